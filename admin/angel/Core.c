@@ -21,6 +21,8 @@
 #include "benc/serialization/standard/BencMessageReader.h"
 #include "benc/serialization/standard/BencMessageWriter.h"
 #include "crypto/AddressCalc.h"
+#include "crypto/AddressCalc_admin.h"
+#include "crypto/CryptoAuth_admin.h"
 #include "crypto/random/Random.h"
 #include "crypto/random/libuv/LibuvEntropyProvider.h"
 #include "subnode/SubnodePathfinder.h"
@@ -56,6 +58,7 @@
 #include "util/events/EventBase.h"
 #include "util/events/libuv/FileNo_admin.h"
 #include "util/events/Pipe.h"
+#include "util/events/ThreadIface.h"
 #include "util/events/Timeout.h"
 #include "util/Hex.h"
 #include "util/log/FileWriterLog.h"
@@ -147,6 +150,7 @@ static void sendResponse(String* error,
 }
 
 static void initTunnel2(String* desiredDeviceName,
+                        bool offload,
                         struct Context* ctx,
                         uint8_t addressPrefix,
                         struct Except* eh)
@@ -157,8 +161,20 @@ static void initTunnel2(String* desiredDeviceName,
     char assignedTunName[TUNInterface_IFNAMSIZ];
     char* desiredName = (desiredDeviceName) ? desiredDeviceName->bytes : NULL;
 
-    struct Iface* tun = TUNInterface_new(
-        desiredName, assignedTunName, 0, ctx->base, ctx->logger, eh, ctx->alloc);
+    struct Iface* tun;
+    #if defined(linux) && !defined(android)
+    if (offload) {
+        tun = TUNInterface_newMultiQueue(
+            desiredName, assignedTunName, 1, ctx->base, ctx->logger, eh, ctx->alloc);
+    } else
+    #endif
+    {
+        if (offload) {
+            Log_info(ctx->logger, "TUN offloads are not supported on this system");
+        }
+        tun = TUNInterface_new(
+            desiredName, assignedTunName, 0, ctx->base, ctx->logger, eh, ctx->alloc);
+    }
 
     Iface_plumb(tun, &ctx->nc->tunAdapt->tunIf);
 
@@ -210,7 +226,9 @@ static void initTunnel(Dict* args, void* vcontext, String* txid, struct Allocato
     struct Jmp jmp;
     Jmp_try(jmp) {
         String* desiredName = Dict_getStringC(args, "desiredTunName");
-        initTunnel2(desiredName, ctx, AddressCalc_ADDRESS_PREFIX_BITS, &jmp.handler);
+        int64_t* offload = Dict_getIntC(args, "offload");
+        initTunnel2(desiredName, (offload && *offload), ctx, AddressCalc_ADDRESS_PREFIX_BITS,
+                    &jmp.handler);
     } Jmp_catch {
         String* error = String_printf(requestAlloc, "Failed to configure tunnel [%s]", jmp.message);
         sendResponse(error, ctx->admin, txid, requestAlloc);
@@ -236,6 +254,20 @@ static void nodeInfo(Dict* args, void* vcontext, String* txid, struct Allocator*
     Admin_sendMessage(out, txid, ctx->admin);
 }
 
+#ifndef SUBNODE
+static void startPathfinder(struct Iface* iface,
+                            struct Allocator* alloc,
+                            struct EventBase* base,
+                            struct Log* log,
+                            struct Random* rand,
+                            void* userData)
+{
+    // Admin belongs to the main loop so the DHT admin functions are left out.
+    struct Pathfinder* pf = Pathfinder_register(alloc, log, base, rand, NULL);
+    Iface_plumb(iface, &pf->eventIf);
+}
+#endif
+
 void Core_init(struct Allocator* alloc,
                struct Log* logger,
                struct EventBase* eventBase,
@@ -244,7 +276,8 @@ void Core_init(struct Allocator* alloc,
                struct Random* rand,
                struct Except* eh,
                struct FakeNetwork* fakeNet,
-               bool noSec)
+               bool noSec,
+               bool pathfinderThread)
 {
     struct Security* sec = NULL;
     if (!noSec) {
@@ -268,10 +301,17 @@ void Core_init(struct Allocator* alloc,
     EventEmitter_regPathfinderIface(nc->ee, &spfAsync->ifB);
 
     #ifndef SUBNODE
-        struct Pathfinder* opf = Pathfinder_register(alloc, logger, eventBase, rand, admin);
-        struct ASynchronizer* opfAsync = ASynchronizer_new(alloc, eventBase, logger);
-        Iface_plumb(&opfAsync->ifA, &opf->eventIf);
-        EventEmitter_regPathfinderIface(nc->ee, &opfAsync->ifB);
+        if (pathfinderThread) {
+            // Messages cross to the other loop so this is already asynchronous.
+            struct ThreadIface* opfThread = ThreadIface_new(
+                startPathfinder, NULL, ALLOCATOR_FAILSAFE, eventBase, logger, alloc);
+            EventEmitter_regPathfinderIface(nc->ee, &opfThread->iface);
+        } else {
+            struct Pathfinder* opf = Pathfinder_register(alloc, logger, eventBase, rand, admin);
+            struct ASynchronizer* opfAsync = ASynchronizer_new(alloc, eventBase, logger);
+            Iface_plumb(&opfAsync->ifA, &opf->eventIf);
+            EventEmitter_regPathfinderIface(nc->ee, &opfAsync->ifB);
+        }
     #endif
 
     SubnodePathfinder_start(spf);
@@ -291,6 +331,8 @@ void Core_init(struct Allocator* alloc,
     ReachabilityCollector_admin_register(spf->rc, admin, alloc);
 
     AuthorizedPasswords_init(admin, nc->ca, alloc);
+    CryptoAuth_admin_register(nc->ca, sec, admin, alloc);
+    AddressCalc_admin_register(admin, alloc);
     Admin_registerFunction("ping", adminPing, admin, false, NULL, admin);
     if (!noSec) {
         Security_admin_register(alloc, logger, sec, admin);
@@ -315,7 +357,8 @@ void Core_init(struct Allocator* alloc,
 
     Admin_registerFunction("Core_initTunnel", initTunnel, ctx, true,
         ((struct Admin_FunctionArg[]) {
-            { .name = "desiredTunName", .required = 0, .type = "String" }
+            { .name = "desiredTunName", .required = 0, .type = "String" },
+            { .name = "offload", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("Core_initTunfd", initTunfd, ctx, true,
@@ -357,6 +400,8 @@ int Core_main(int argc, char** argv)
         InterfaceWaiter_waitForData(&clientPipe->iface, eventBase, tempAlloc, eh);
     Log_debug(logger, "Finished getting pre-configuration from client");
     Dict* config = BencMessageReader_read(preConf, tempAlloc, eh);
+    int64_t* pathfinderThread = Dict_getIntC(config, "pathfinderThread");
+    bool pfThread = pathfinderThread && *pathfinderThread;
 
     String* privateKeyHex = Dict_getStringC(config, "privateKey");
     Dict* adminConf = Dict_getDictC(config, "admin");
@@ -421,7 +466,7 @@ int Core_main(int argc, char** argv)
     Allocator_free(tempAlloc);
 
 
-    Core_init(alloc, logger, eventBase, privateKey, admin, rand, eh, NULL, false);
+    Core_init(alloc, logger, eventBase, privateKey, admin, rand, eh, NULL, false, pfThread);
     EventBase_beginLoop(eventBase);
     return 0;
 }
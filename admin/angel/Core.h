@@ -33,6 +33,12 @@ void Core_initTunnel(String* desiredDeviceName,
                      struct Allocator* alloc,
                      struct Except* eh);
 
+/**
+ * Set up the router.
+ *
+ * @param pathfinderThread if true, the DHT pathfinder runs on its own thread and event loop,
+ *                         its admin functions are not registered.
+ */
 void Core_init(struct Allocator* alloc,
                struct Log* logger,
                struct EventBase* eventBase,
@@ -41,7 +47,8 @@ void Core_init(struct Allocator* alloc,
                struct Random* rand,
                struct Except* eh,
                struct FakeNetwork* fakeNet,
-               bool noSec);
+               bool noSec,
+               bool pathfinderThread);
 
 int Core_main(int argc, char** argv);
 
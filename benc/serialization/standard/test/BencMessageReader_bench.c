@@ -0,0 +1,74 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/standard/BencMessageReader.h"
+#include "benc/serialization/standard/BencMessageWriter.h"
+#include "test/Bench.h"
+#include "util/Assert.h"
+#include "wire/Message.h"
+
+struct Context
+{
+    uint8_t* bytes;
+    int length;
+    struct Allocator* alloc;
+};
+
+static void readDict(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        struct Message* msg = Message_new(ctx->length, 0, alloc);
+        Bits_memcpy(msg->bytes, ctx->bytes, ctx->length);
+        Assert_true(BencMessageReader_read(msg, alloc, NULL));
+        Allocator_free(alloc);
+    }
+}
+
+int main(struct Bench* bench)
+{
+    struct Allocator* alloc = bench->alloc;
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->alloc = alloc;
+
+    // Roughly the shape of an admin reply listing a handful of peers.
+    Dict* reply = Dict_new(alloc);
+    List* peers = List_new(alloc);
+    for (int i = 0; i < 8; i++) {
+        Dict* peer = Dict_new(alloc);
+        Dict_putString(peer, String_CONST("addr"), String_CONST(
+            "v20.0000.0000.0000.0013.0r4xm4zd7h47d1zx1mz7x1pd1qqwnkc3x9h3spmbqrqx1sn2r7b0.k"),
+            alloc);
+        Dict_putString(peer, String_CONST("state"), String_CONST("ESTABLISHED"), alloc);
+        Dict_putInt(peer, String_CONST("bytesIn"), 1234567 * i, alloc);
+        Dict_putInt(peer, String_CONST("bytesOut"), 7654321 * i, alloc);
+        Dict_putInt(peer, String_CONST("last"), 1500000000000ll + i, alloc);
+        List_addDict(peers, peer, alloc);
+    }
+    Dict_putList(reply, String_CONST("peers"), peers, alloc);
+    Dict_putInt(reply, String_CONST("total"), 8, alloc);
+    Dict_putString(reply, String_CONST("txid"), String_CONST("0123456789abcdef"), alloc);
+
+    struct Message* msg = Message_new(0, 4096, alloc);
+    BencMessageWriter_write(reply, msg, NULL);
+    ctx->bytes = msg->bytes;
+    ctx->length = msg->length;
+
+    Bench_run(bench, "read", readDict, ctx);
+    return 0;
+}
@@ -20,6 +20,7 @@
 #include "util/Bits.h"
 #include "util/Endian.h"
 #include "util/Hex.h"
+#include "util/events/Time.h"
 #include "util/events/Timeout.h"
 #include "util/Identity.h"
 #include "wire/Message.h"
@@ -68,9 +69,20 @@ struct Context
     String* password;
     struct Map_OfRequestByHandle outstandingRequests;
     struct Allocator* alloc;
+
+    /**
+     * The last cookie from the node, the node accepts cookies up to 20 seconds old
+     * so it is reused for a while rather than asking for a new one with every call.
+     */
+    String* cookie;
+    uint64_t cookieTime;
+    struct Allocator* cookieAlloc;
+
     Identity
 };
 
+#define COOKIE_REUSE_SECONDS 10
+
 static int calculateAuth(Dict* message,
                          String* password,
                          String* cookieStr,
@@ -104,8 +116,9 @@ static int calculateAuth(Dict* message,
 static void done(struct Request* req, enum AdminClient_Error err)
 {
     req->res.err = err;
-    req->callback(req);
+    // The callback may free the request.
     Allocator_free(req->timeoutAlloc);
+    req->callback(req);
 }
 
 static void timeout(void* vreq)
@@ -238,6 +251,14 @@ static void cookieCallback(struct Request* req)
         return;
     }
 
+    struct Context* ctx = req->ctx;
+    if (ctx->cookieAlloc) {
+        Allocator_free(ctx->cookieAlloc);
+    }
+    ctx->cookieAlloc = Allocator_child(ctx->alloc);
+    ctx->cookie = String_clone(cookie, ctx->cookieAlloc);
+    ctx->cookieTime = Time_currentTimeSeconds(ctx->eventBase);
+
     Dict* message = req->requestMessage;
     sendRaw(message, req->promise, req->ctx, cookie, requestCallback);
     Allocator_free(req->alloc);
@@ -252,6 +273,14 @@ static struct AdminClient_Promise* doCall(Dict* message,
         Allocator_calloc(promiseAlloc, sizeof(struct AdminClient_Promise), 1);
     promise->alloc = promiseAlloc;
 
+    if (ctx->cookie &&
+        Time_currentTimeSeconds(ctx->eventBase) - ctx->cookieTime < COOKIE_REUSE_SECONDS)
+    {
+        Dict* clone = Cloner_cloneDict(message, promiseAlloc);
+        sendRaw(clone, promise, ctx, ctx->cookie, requestCallback);
+        return promise;
+    }
+
     Dict gc = Dict_CONST(String_CONST("q"), String_OBJ(String_CONST("cookie")), NULL);
     struct Request* req = sendRaw(&gc, promise, ctx, NULL, cookieCallback);
 
@@ -40,6 +40,25 @@ struct Context
     struct AdminClient_Result* currentResult;
 
     struct EventBase* base;
+
+    /** Calls made by rpcCallPipelined() which have not returned yet. */
+    uint32_t outstandingCalls;
+
+    /** If non-zero, the event loop ends when outstandingCalls falls below this. */
+    uint32_t waitUntilBelow;
+
+    /** The first pipelined call which failed, it is reported when the pipeline is waited on. */
+    struct AdminClient_Result* failedResult;
+    String* failedFunction;
+};
+
+/** Maximum number of pipelined calls waiting for a response at once. */
+#define PIPELINE_WINDOW 32
+
+struct PipelinedCall
+{
+    String* function;
+    struct Context* ctx;
 };
 
 static void rpcCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
@@ -72,24 +91,13 @@ static void die(struct AdminClient_Result* res, struct Context* ctx, struct Allo
     exit(1);
 }
 
-static int rpcCall0(String* function,
-                    Dict* args,
-                    struct Context* ctx,
-                    struct Allocator* alloc,
-                    Dict** resultP,
-                    bool exitIfError)
+/** @return 0 if the call succeeded or 1 if it returned an error and exitIfError is false. */
+static int checkResult(String* function,
+                       struct AdminClient_Result* res,
+                       bool exitIfError,
+                       struct Context* ctx,
+                       struct Allocator* alloc)
 {
-    ctx->currentReqAlloc = Allocator_child(alloc);
-    ctx->currentResult = NULL;
-    struct AdminClient_Promise* promise = AdminClient_rpcCall(function, args, ctx->client, alloc);
-    promise->callback = rpcCallback;
-    promise->userData = ctx;
-
-    EventBase_beginLoop(ctx->base);
-
-    struct AdminClient_Result* res = ctx->currentResult;
-    Assert_true(res);
-
     if (res->err) {
         Log_critical(ctx->logger,
                       "Failed to make function call [%s], error: [%s]",
@@ -98,7 +106,6 @@ static int rpcCall0(String* function,
         die(res, ctx, alloc);
     }
     String* error = Dict_getStringC(res->responseDict, "error");
-    int ret = 0;
     if (error && !String_equals(error, String_CONST("none"))) {
         if (exitIfError) {
             Log_critical(ctx->logger,
@@ -109,8 +116,82 @@ static int rpcCall0(String* function,
         }
         Log_warn(ctx->logger, "Got error [%s] calling [%s], ignoring.",
                  error->bytes, function->bytes);
-        ret = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void pipelinedCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
+{
+    struct PipelinedCall* call = p->userData;
+    struct Context* ctx = call->ctx;
+    ctx->outstandingCalls--;
+    String* error = (res->err) ? NULL : Dict_getStringC(res->responseDict, "error");
+    bool failed = res->err || (error && !String_equals(error, String_CONST("none")));
+    if (failed && !ctx->failedResult) {
+        // Can't die() from inside of the event loop, keep the result until the loop ends.
+        Allocator_adopt(ctx->alloc, p->alloc);
+        ctx->failedResult = res;
+        ctx->failedFunction = call->function;
+    }
+    if (ctx->waitUntilBelow && (failed || ctx->outstandingCalls < ctx->waitUntilBelow)) {
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+/** Run the event loop until fewer than count pipelined calls are waiting for a response. */
+static void waitForPipeline(uint32_t count, struct Context* ctx)
+{
+    while (ctx->outstandingCalls >= count && !ctx->failedResult) {
+        ctx->waitUntilBelow = count;
+        EventBase_beginLoop(ctx->base);
+        ctx->waitUntilBelow = 0;
     }
+    if (ctx->failedResult) {
+        checkResult(ctx->failedFunction, ctx->failedResult, true, ctx, ctx->alloc);
+    }
+}
+
+/**
+ * Make a call which nothing else depends on without waiting for the response so that
+ * large configurations are not applied one round trip at a time. Any error is fatal,
+ * it is reported when the pipeline is next waited on and every rpcCall0() waits first.
+ */
+static void rpcCallPipelined(String* function, Dict* args, struct Context* ctx)
+{
+    waitForPipeline(PIPELINE_WINDOW, ctx);
+    struct AdminClient_Promise* promise =
+        AdminClient_rpcCall(function, args, ctx->client, ctx->alloc);
+    struct PipelinedCall* call =
+        Allocator_calloc(promise->alloc, sizeof(struct PipelinedCall), 1);
+    call->function = String_clone(function, promise->alloc);
+    call->ctx = ctx;
+    promise->callback = pipelinedCallback;
+    promise->userData = call;
+    ctx->outstandingCalls++;
+}
+
+static int rpcCall0(String* function,
+                    Dict* args,
+                    struct Context* ctx,
+                    struct Allocator* alloc,
+                    Dict** resultP,
+                    bool exitIfError)
+{
+    waitForPipeline(1, ctx);
+
+    ctx->currentReqAlloc = Allocator_child(alloc);
+    ctx->currentResult = NULL;
+    struct AdminClient_Promise* promise = AdminClient_rpcCall(function, args, ctx->client, alloc);
+    promise->callback = rpcCallback;
+    promise->userData = ctx;
+
+    EventBase_beginLoop(ctx->base);
+
+    struct AdminClient_Result* res = ctx->currentResult;
+    Assert_true(res);
+
+    int ret = checkResult(function, res, exitIfError, ctx, alloc);
 
     if (resultP) {
         *resultP = res->responseDict;
@@ -170,7 +251,7 @@ static void authorizedPasswords(List* list, struct Context* ctx)
                 "  This connection password restricted to [%s] only.", ipv6->bytes);
             Dict_putStringC(args, "ipv6", ipv6, child);
         }
-        rpcCall(String_CONST("AuthorizedPasswords_add"), args, ctx, child);
+        rpcCallPipelined(String_CONST("AuthorizedPasswords_add"), args, ctx);
         Allocator_free(child);
     }
 }
@@ -199,6 +280,14 @@ static void udpInterface(Dict* config, struct Context* ctx)
         if (dscp) {
             Dict_putIntC(d, "dscp", *dscp, ctx->alloc);
         }
+        int64_t* batchSize = Dict_getIntC(udp, "batchSize");
+        if (batchSize) {
+            Dict_putIntC(d, "batchSize", *batchSize, ctx->alloc);
+        }
+        int64_t* shards = Dict_getIntC(udp, "shards");
+        if (shards) {
+            Dict_putIntC(d, "shards", *shards, ctx->alloc);
+        }
         Dict* resp = NULL;
         rpcCall0(String_CONST("UDPInterface_new"), d, ctx, ctx->alloc, &resp, true);
         int ifNum = *(Dict_getIntC(resp, "interfaceNumber"));
@@ -237,7 +326,7 @@ static void udpInterface(Dict* config, struct Context* ctx)
                 }
                 Dict_putIntC(value, "interfaceNumber", ifNum, perCallAlloc);
                 Dict_putStringC(value, "address", key, perCallAlloc);
-                rpcCall(String_CONST("UDPInterface_beginConnection"), value, ctx, perCallAlloc);
+                rpcCallPipelined(String_CONST("UDPInterface_beginConnection"), value, ctx);
 
                 // Make a IPTunnel exception for this node
                 Dict* aed = Dict_new(perCallAlloc);
@@ -245,7 +334,7 @@ static void udpInterface(Dict* config, struct Context* ctx)
                 Dict_putStringC(aed, "route", String_new(key->bytes, perCallAlloc),
                     perCallAlloc);
                 *lastColon = ':';
-                rpcCall(String_CONST("RouteGen_addException"), aed, ctx, perCallAlloc);
+                rpcCallPipelined(String_CONST("RouteGen_addException"), aed, ctx);
 
                 entry = entry->next;
             }
@@ -284,6 +373,10 @@ static void tunInterface(Dict* ifaceConf, struct Allocator* tempAlloc, struct Co
         if (device) {
             Dict_putStringC(args, "desiredTunName", device, tempAlloc);
         }
+        int64_t* offload = Dict_getIntC(ifaceConf, "offload");
+        if (offload) {
+            Dict_putIntC(args, "offload", *offload, tempAlloc);
+        }
         rpcCall0(String_CONST("Core_initTunnel"), args, ctx, tempAlloc, NULL, false);
     }
 }
@@ -342,7 +435,7 @@ static void ipTunnel(Dict* ifaceConf, struct Allocator* tempAlloc, struct Contex
             }
 
             Dict_putStringC(d, "publicKeyOfAuthorizedNode", key, tempAlloc);
-            rpcCall0(String_CONST("IpTunnel_allowConnection"), d, ctx, tempAlloc, NULL, true);
+            rpcCallPipelined(String_CONST("IpTunnel_allowConnection"), d, ctx);
         }
     }
 
@@ -353,7 +446,7 @@ static void ipTunnel(Dict* ifaceConf, struct Allocator* tempAlloc, struct Contex
             Log_debug(ctx->logger, "Initiating IpTunnel connection to [%s]", s->bytes);
             Dict requestDict =
                 Dict_CONST(String_CONST("publicKeyOfNodeToConnectTo"), String_OBJ(s), NULL);
-            rpcCall0(String_CONST("IpTunnel_connectTo"), &requestDict, ctx, tempAlloc, NULL, true);
+            rpcCallPipelined(String_CONST("IpTunnel_connectTo"), &requestDict, ctx);
         }
     }
 }
@@ -365,15 +458,26 @@ static void supernodes(List* supernodes, struct Allocator* tempAlloc, struct Con
     for (int i = 0; (s = List_getString(supernodes, i)) != NULL; i++) {
         Log_debug(ctx->logger, "Loading supernode connection to [%s]", s->bytes);
         Dict reqDict = Dict_CONST(String_CONST("key"), String_OBJ(s), NULL);
-        rpcCall0(String_CONST("SupernodeHunter_addSnode"), &reqDict, ctx, tempAlloc, NULL, true);
+        rpcCallPipelined(String_CONST("SupernodeHunter_addSnode"), &reqDict, ctx);
     }
 }
 
+static void cryptoWorkers(int64_t* count, struct Allocator* tempAlloc, struct Context* ctx)
+{
+    if (!count || !*count) { return; }
+    // This must happen before the security section because threads can't be started after
+    // the process is sandboxed.
+    Log_info(ctx->logger, "Starting [%d] crypto worker threads", (int) *count);
+    Dict reqDict = Dict_CONST(String_CONST("count"), Int_OBJ(*count), NULL);
+    rpcCall(String_CONST("CryptoAuth_setWorkers"), &reqDict, ctx, tempAlloc);
+}
+
 static void routerConfig(Dict* routerConf, struct Allocator* tempAlloc, struct Context* ctx)
 {
     tunInterface(Dict_getDictC(routerConf, "interface"), tempAlloc, ctx);
     ipTunnel(Dict_getDictC(routerConf, "ipTunnel"), tempAlloc, ctx);
     supernodes(Dict_getListC(routerConf, "supernodes"), tempAlloc, ctx);
+    cryptoWorkers(Dict_getIntC(routerConf, "cryptoWorkers"), tempAlloc, ctx);
 }
 
 static void ethInterfaceSetBeacon(int ifNum, Dict* eth, struct Context* ctx)
@@ -423,6 +527,8 @@ static void ethInterface(Dict* config, struct Context* ctx)
             // skip loopback...
             if (String_equals(String_CONST("lo"), deviceName)) { continue; }
             Dict_putStringC(d, "bindDevice", deviceName, ctx->alloc);
+            int64_t* ringFrames = Dict_getIntC(eth, "ringFrames");
+            if (ringFrames) { Dict_putIntC(d, "ringFrames", *ringFrames, ctx->alloc); }
             Dict* resp;
             Log_info(ctx->logger, "Creating new ETHInterface [%s]", deviceName->bytes);
             if (rpcCall0(String_CONST("ETHInterface_new"), d, ctx, ctx->alloc, &resp, false)) {
@@ -446,6 +552,11 @@ static void ethInterface(Dict* config, struct Context* ctx)
             Log_info(ctx->logger, "Binding to device [%s].", deviceStr->bytes);
             Dict_putStringC(d, "bindDevice", deviceStr, ctx->alloc);
         }
+        int64_t* ringFrames = Dict_getIntC(eth, "ringFrames");
+        if (ringFrames) {
+            Log_info(ctx->logger, "Using a packet ring of [%d] frames.", (int) *ringFrames);
+            Dict_putIntC(d, "ringFrames", *ringFrames, ctx->alloc);
+        }
         Dict* resp = NULL;
         if (rpcCall0(String_CONST("ETHInterface_new"), d, ctx, ctx->alloc, &resp, false)) {
             Log_warn(ctx->logger, "Failed to create ETHInterface.");
@@ -475,7 +586,7 @@ static void ethInterface(Dict* config, struct Context* ctx)
                 // the arguments,
                 Dict_putStringC(value, "macAddress", key, perCallAlloc);
                 Dict_putIntC(value, "interfaceNumber", ifNum, perCallAlloc);
-                rpcCall(String_CONST("ETHInterface_beginConnection"), value, ctx, perCallAlloc);
+                rpcCallPipelined(String_CONST("ETHInterface_beginConnection"), value, ctx);
                 Allocator_free(perCallAlloc);
 
                 entry = entry->next;
@@ -682,6 +793,7 @@ void Configurator_config(Dict* config,
     List* secList = Dict_getListC(config, "security");
     security(tempAlloc, secList, logger, &ctx);
 
+    waitForPipeline(1, &ctx);
     Log_debug(logger, "Cjdns started in the background");
 
     Allocator_free(tempAlloc);
@@ -163,7 +163,13 @@ static int genconf(struct Random* rand, bool eth)
            "                // Bind to this port.\n"
            "                \"bind\": \"0.0.0.0:%u\",\n", port);
     printf("                // Set the DSCP value for Qos. Default is 0.\n"
-           "                // \"dscp\": 46,\n");
+           "                // \"dscp\": 46,\n"
+           "                // Linux only: read and write up to this many datagrams per\n"
+           "                // system call. Default is 0 (one datagram per call).\n"
+           "                // \"batchSize\": 32,\n"
+           "                // Linux only: spread the socket over this many threads, each with\n"
+           "                // its own SO_REUSEPORT socket. Default is 0 (main thread only).\n"
+           "                // \"shards\": 4,\n");
     printf("\n"
            "                // Nodes to connect to (IPv4 only).\n"
            "                \"connectTo\":\n"
@@ -184,7 +190,13 @@ static int genconf(struct Random* rand, bool eth)
            "                // Bind to this port.\n"
            "                \"bind\": \"[::]:%u\",\n", port);
     printf("                // Set the DSCP value for Qos. Default is 0.\n"
-           "                // \"dscp\": 46,\n");
+           "                // \"dscp\": 46,\n"
+           "                // Linux only: read and write up to this many datagrams per\n"
+           "                // system call. Default is 0 (one datagram per call).\n"
+           "                // \"batchSize\": 32,\n"
+           "                // Linux only: spread the socket over this many threads, each with\n"
+           "                // its own SO_REUSEPORT socket. Default is 0 (main thread only).\n"
+           "                // \"shards\": 4,\n");
     printf("\n"
            "                // Nodes to connect to (IPv6 only).\n"
            "                \"connectTo\":\n"
@@ -224,6 +236,12 @@ static int genconf(struct Random* rand, bool eth)
            "                //\n"
            "                \"beacon\": 2,\n"
            "\n"
+           "                // Linux only: receive frames through a memory mapped ring of this\n"
+           "                // many frames and batch sends, this saves a system call per frame\n"
+           "                // on fast links at the cost of up to 1ms of added latency.\n"
+           "                // Must be a power of two from 32 to 65536.\n"
+           "                // \"ringFrames\": 4096,\n"
+           "\n"
            "                // Node(s) to connect to manually\n"
            "                // Note: does not work with \"all\" pseudo-device-name\n"
            "                \"connectTo\":\n"
@@ -251,6 +269,17 @@ static int genconf(struct Random* rand, bool eth)
            "            //\"6743gf5tw80ExampleExampleExampleExamplevlyb23zfnuzv0.k\",\n"
            "        ],\n"
            "\n"
+           "        // Number of threads to encrypt and decrypt traffic with, 0 does it all in\n"
+           "        // the main thread. Setting this to the number of spare cores can help a busy\n"
+           "        // node on a fast link, handshakes always stay in the main thread.\n"
+           "        \"cryptoWorkers\": 0,\n"
+           "\n"
+           "        // Run the DHT pathfinder on its own thread so that keeping the routing table\n"
+           "        // does not delay forwarding, 0 keeps it on the main thread. When it has its\n"
+           "        // own thread the NodeStore, RouterModule, SearchRunner and Janitor admin\n"
+           "        // functions are not available.\n"
+           "        \"pathfinderThread\": 0,\n"
+           "\n"
            "        // The interface which is used for connecting to the cjdns network.\n"
            "        \"interface\":\n"
            "        {\n"
@@ -259,7 +288,11 @@ static int genconf(struct Random* rand, bool eth)
            "            // The type of tunfd (only \"android\" for now)\n"
            "            // If \"android\" here, the tunDevice should be used as the pipe path\n"
            "            // to transfer the tun file description.\n"
-           "            // \"tunfd\" : \"android\"\n");
+           "            // \"tunfd\" : \"android\"\n"
+           "\n"
+           "            // Linux only, let the kernel hand over and take whole bursts of TCP\n"
+           "            // (TSO/GSO) through the TUN device instead of one packet at a time.\n"
+           "            // \"offload\": 1\n");
 #ifndef __APPLE__
     printf("\n"
            "            // The name of a persistent TUN device to use.\n"
@@ -687,6 +720,12 @@ int main(int argc, char** argv)
     if (logging) {
         Dict_putDictC(preConf, "logging", logging, allocator);
     }
+    // The pathfinder is started with the core so this can not wait for the Configurator.
+    int64_t* pathfinderThread =
+        Dict_getIntC(Dict_getDictC(&config, "router"), "pathfinderThread");
+    if (pathfinderThread) {
+        Dict_putIntC(preConf, "pathfinderThread", *pathfinderThread, allocator);
+    }
 
     struct Message* toCoreMsg = Message_new(0, 1024, allocator);
     BencMessageWriter_write(preConf, toCoreMsg, eh);
@@ -0,0 +1,145 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "client/AdminClient.h"
+#include "interface/addressable/AddrIface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/log/FileWriterLog.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+#define CALLS 100
+
+struct Context
+{
+    struct EventBase* base;
+    uint32_t called;
+    uint32_t returned;
+    struct Admin* admin;
+
+    /** Sits between the admin's UDP socket and the Admin to count the cookie queries. */
+    struct AddrIface adminIface;
+    struct Iface udpIface;
+    uint32_t cookieQueries;
+
+    Identity
+};
+
+static Iface_DEFUN fromUdp(struct Message* msg, struct Iface* udpIface)
+{
+    struct Context* ctx = Identity_containerOf(udpIface, struct Context, udpIface);
+    // {"q":"cookie"} is the only query which the client sends with q set to cookie.
+    const char query[] = "1:q6:cookie";
+    for (int i = 0; i + (int)sizeof(query) - 1 <= msg->length; i++) {
+        if (!Bits_memcmp(&msg->bytes[i], query, sizeof(query) - 1)) {
+            ctx->cookieQueries++;
+            break;
+        }
+    }
+    return Iface_next(&ctx->adminIface.iface, msg);
+}
+
+static Iface_DEFUN fromAdmin(struct Message* msg, struct Iface* adminIface)
+{
+    struct Context* ctx = Identity_containerOf(adminIface, struct Context, adminIface.iface);
+    return Iface_next(&ctx->udpIface, msg);
+}
+
+static void count(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    ctx->called++;
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putStringCC(out, "error", "none", requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void callback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
+{
+    struct Context* ctx = p->userData;
+    Assert_true(!res->err);
+    Assert_true(String_equals(Dict_getStringC(res->responseDict, "error"), String_CONST("none")));
+    if (++ctx->returned == CALLS) {
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+static void fail(void* vNULL)
+{
+    Assert_failure("timed out.");
+}
+
+static void makeCalls(struct Context* ctx, struct AdminClient* client, struct Allocator* alloc)
+{
+    ctx->called = ctx->returned = ctx->cookieQueries = 0;
+    // All of the calls are in flight at once.
+    for (int i = 0; i < CALLS; i++) {
+        struct AdminClient_Promise* p =
+            AdminClient_rpcCall(String_CONST("AdminClient_test"), NULL, client, alloc);
+        p->callback = callback;
+        p->userData = ctx;
+    }
+    struct Allocator* timeoutAlloc = Allocator_child(alloc);
+    Timeout_setTimeout(fail, NULL, 5000, ctx->base, timeoutAlloc);
+    EventBase_beginLoop(ctx->base);
+    Allocator_free(timeoutAlloc);
+    Assert_true(ctx->called == CALLS);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Log* log = FileWriterLog_new(stdout, alloc);
+    String* password = String_CONST("hunter2");
+
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    struct UDPAddrIface* adminUdp = UDPAddrIface_new(base, &ss.addr, alloc, NULL, log);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->base = base;
+    ctx->udpIface.send = fromUdp;
+    Iface_plumb(&ctx->udpIface, &adminUdp->generic.iface);
+    ctx->adminIface.iface.send = fromAdmin;
+    ctx->adminIface.addr = adminUdp->generic.addr;
+    ctx->adminIface.alloc = alloc;
+    ctx->admin = Admin_new(&ctx->adminIface, log, base, password);
+    Admin_registerFunction("AdminClient_test", count, ctx, true, NULL, ctx->admin);
+
+    struct UDPAddrIface* clientUdp = UDPAddrIface_new(base, &ss.addr, alloc, NULL, log);
+    struct AdminClient* client =
+        AdminClient_new(&clientUdp->generic, adminUdp->generic.addr, password, base, log, alloc);
+
+    // None of the calls has a cookie to use yet, each one asks for it.
+    makeCalls(ctx, client, alloc);
+    Assert_true(ctx->cookieQueries == CALLS);
+
+    // Again with the cookie from the first round.
+    makeCalls(ctx, client, alloc);
+    Assert_true(ctx->cookieQueries == 0);
+
+    Allocator_free(alloc);
+    return 0;
+}
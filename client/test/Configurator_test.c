@@ -0,0 +1,205 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "client/Configurator.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Process.h"
+#include "util/events/Timeout.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/log/FileWriterLog.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/CString.h"
+
+#include <stdlib.h>
+
+#define PASSWORDS 100
+
+/** PIPELINE_WINDOW in Configurator.c */
+#define WINDOW 32
+
+struct Context
+{
+    struct Allocator* alloc;
+    struct Admin* admin;
+
+    /** AuthorizedPasswords_add calls which are not answered until the window is full. */
+    String* held[WINDOW];
+    bool heldFails[WINDOW];
+    int heldCount;
+
+    /** AuthorizedPasswords_add calls received. */
+    int added;
+
+    /** The call which gets an error back, or -1. */
+    int failAt;
+
+    bool gotUser;
+    bool coreExited;
+};
+
+static void reply(String* txid, char* error, struct Context* ctx)
+{
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    Dict* out = Dict_new(alloc);
+    Dict_putStringCC(out, "error", error, alloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+    Allocator_free(alloc);
+}
+
+static void ping(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putStringCC(out, "q", "pong", requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+/**
+ * Nothing is answered until the window is full so the configuration only goes on if the
+ * Configurator sends a whole window of calls without waiting.
+ */
+static void addPassword(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    Assert_true(ctx->heldCount < WINDOW);
+    ctx->heldFails[ctx->heldCount] = (ctx->added == ctx->failAt);
+    ctx->held[ctx->heldCount++] = String_clone(txid, ctx->alloc);
+    if (++ctx->added < PASSWORDS && ctx->heldCount < WINDOW) { return; }
+    for (int i = 0; i < ctx->heldCount; i++) {
+        reply(ctx->held[i], (ctx->heldFails[i]) ? "bad password" : "none", ctx);
+    }
+    ctx->heldCount = 0;
+}
+
+static void getUser(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    // Synchronous calls wait until every pipelined call is answered.
+    Assert_true(ctx->added == PASSWORDS && !ctx->heldCount);
+    ctx->gotUser = true;
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putStringCC(out, "error", "none", requestAlloc);
+    Dict_putIntC(out, "uid", 0, requestAlloc);
+    Dict_putIntC(out, "gid", 0, requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void coreExit(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    // No more calls are made once one has failed.
+    Assert_true(ctx->added == WINDOW && !ctx->gotUser);
+    ctx->coreExited = true;
+    reply(txid, "none", ctx);
+}
+
+static void fail(void* vNULL)
+{
+    Assert_failure("timed out.");
+}
+
+/** Configure a fake core, it only has the functions which the configuration below calls. */
+static void configure(struct Context* ctx, struct Allocator* alloc)
+{
+    struct EventBase* base = EventBase_new(alloc);
+    struct Log* log = FileWriterLog_new(stdout, alloc);
+    String* password = String_CONST("hunter2");
+
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    struct UDPAddrIface* adminUdp = UDPAddrIface_new(base, &ss.addr, alloc, NULL, log);
+    ctx->alloc = alloc;
+    ctx->admin = Admin_new(&adminUdp->generic, log, base, password);
+    Admin_registerFunction("ping", ping, ctx, false, NULL, ctx->admin);
+    Admin_registerFunction("AuthorizedPasswords_add", addPassword, ctx, true, NULL, ctx->admin);
+    Admin_registerFunction("Security_getUser", getUser, ctx, true, NULL, ctx->admin);
+    Admin_registerFunction("Core_exit", coreExit, ctx, true, NULL, ctx->admin);
+
+    Dict* config = Dict_new(alloc);
+    List* passwords = List_new(alloc);
+    for (int i = 0; i < PASSWORDS; i++) {
+        Dict* pass = Dict_new(alloc);
+        Dict_putStringC(pass, "password", String_printf(alloc, "password%d", i), alloc);
+        List_addDict(passwords, pass, alloc);
+    }
+    Dict_putListC(config, "authorizedPasswords", passwords, alloc);
+    List* security = List_new(alloc);
+    char* off[] = { "setuser", "seccomp", "noforks", "chroot", "setupComplete" };
+    for (int i = 0; i < (int)(sizeof(off) / sizeof(*off)); i++) {
+        Dict* d = Dict_new(alloc);
+        Dict_putIntC(d, off[i], 0, alloc);
+        List_addDict(security, d, alloc);
+    }
+    Dict_putListC(config, "security", security, alloc);
+
+    Timeout_setTimeout(fail, NULL, 10000, base, alloc);
+    Configurator_config(config, adminUdp->generic.addr, password, base, log, alloc);
+}
+
+static struct Context* gFailing;
+
+static void checkCoreExited(void)
+{
+    Assert_true(gFailing->coreExited);
+}
+
+static int gExitStatus = -1;
+static struct EventBase* gBase;
+
+static void onExit(int64_t exitStatus, int termSignal)
+{
+    gExitStatus = exitStatus;
+    EventBase_endLoop(gBase);
+}
+
+int main(int argc, char** argv)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+
+    if (argc > 2 && !CString_strcmp("Configurator_test", argv[1])
+        && !CString_strcmp("failure", argv[2]))
+    {
+        // Configurator_config() stops the core and exits when a call fails.
+        gFailing = Allocator_calloc(alloc, sizeof(struct Context), 1);
+        gFailing->failAt = 0;
+        atexit(checkCoreExited);
+        configure(gFailing, alloc);
+        Assert_failure("Configurator_config() returned after a failed call");
+    }
+
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->failAt = -1;
+    configure(ctx, Allocator_child(alloc));
+    Assert_true(ctx->added == PASSWORDS && ctx->gotUser && !ctx->coreExited);
+
+    // The failing configuration runs in another process because it calls exit().
+    gBase = EventBase_new(alloc);
+    char* path = Process_getPath(alloc);
+    Assert_true(path);
+    char* args[] = { "Configurator_test", "failure", NULL };
+    Assert_true(!Process_spawn(path, args, gBase, alloc, onExit));
+    Timeout_setTimeout(fail, NULL, 10000, gBase, alloc);
+    EventBase_beginLoop(gBase);
+    Assert_true(gExitStatus == 1);
+
+    Allocator_free(alloc);
+    return 0;
+}
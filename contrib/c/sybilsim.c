@@ -234,7 +234,8 @@ static struct NodeContext* startNode(char* nodeName,
               ctx->rand,
               eh,
               fakeNet,
-              true);
+              true,
+              false);
 
     securitySetupComplete(ctx, node);
     bindUDP(ctx, node);
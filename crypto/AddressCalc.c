@@ -15,6 +15,7 @@
 #include "crypto_hash_sha512.h"
 #include "util/Bits.h"
 #include "util/Endian.h"
+#include "util/MruCache.h"
 #include "crypto/AddressCalc.h"
 
 #include <stdint.h>
@@ -46,14 +47,65 @@ void AddressCalc_makeValidAddress(uint8_t address[16])
     Bits_memcpy (address, &significant_bits, sizeof(uint64_t));
 }
 
-bool AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32])
+struct CacheEntry
+{
+    uint8_t key[32];
+    uint8_t address[16];
+};
+
+/**
+ * Set associative, see util/MruCache.h.
+ * A zero key is never cached so empty entries can not match.
+ * Thread local so a pathfinder on its own thread does not race with the event loop.
+ */
+static __thread struct {
+    struct CacheEntry sets[AddressCalc_CACHE_SETS][AddressCalc_CACHE_WAYS];
+    struct AddressCalc_CacheStats stats;
+} cache;
+
+static void calculate(uint8_t addressOut[16], const uint8_t key[32])
 {
     uint8_t hash[crypto_hash_sha512_BYTES];
     crypto_hash_sha512(hash, key, 32);
     crypto_hash_sha512(hash, hash, crypto_hash_sha512_BYTES);
+    Bits_memcpy(addressOut, hash, 16);
+}
+
+static void lookup(uint8_t addressOut[16], const uint8_t key[32])
+{
+    struct CacheEntry* set = cache.sets[MruCache_setIndex(key, AddressCalc_CACHE_SETS)];
+    int i;
+    for (i = 0; i < AddressCalc_CACHE_WAYS; i++) {
+        if (!Bits_memcmp(set[i].key, key, 32)) { break; }
+    }
+    struct CacheEntry e;
+    if (i < AddressCalc_CACHE_WAYS) {
+        cache.stats.hits++;
+        Bits_memcpy(&e, &set[i], sizeof(struct CacheEntry));
+    } else {
+        cache.stats.misses++;
+        Bits_memcpy(e.key, key, 32);
+        calculate(e.address, key);
+    }
+    MruCache_moveToFront(set, i, AddressCalc_CACHE_WAYS, &e, sizeof(struct CacheEntry));
+    Bits_memcpy(addressOut, e.address, 16);
+}
+
+bool AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32])
+{
+    uint8_t address[16];
+    if (Bits_isZero((uint8_t*) key, 32)) {
+        calculate(address, key);
+    } else {
+        lookup(address, key);
+    }
     if (addressOut) {
-        Bits_memcpy(addressOut, hash, 16);
+        Bits_memcpy(addressOut, address, 16);
     }
-    return AddressCalc_validAddress(addressOut);
+    return AddressCalc_validAddress(address);
 }
 
+void AddressCalc_cacheStats(struct AddressCalc_CacheStats* out)
+{
+    Bits_memcpy(out, &cache.stats, sizeof(struct AddressCalc_CacheStats));
+}
@@ -56,8 +56,15 @@ bool AddressCalc_validAddress(const uint8_t address[16]);
 
 void AddressCalc_makeValidAddress(uint8_t address[16]);
 
+/** Number of keys held in the cache used by AddressCalc_addressForPublicKey(). */
+#define AddressCalc_CACHE_SETS 256
+#define AddressCalc_CACHE_WAYS 4
+
 /**
  * Calculate a cjdns IPv6 address for a public key.
+ * Recently used keys are remembered in a small fixed size table so that the double SHA-512
+ * is skipped when the same keys come back during a burst of handshakes.
+ * Each thread has its own table so this may be called from any thread, see ThreadIface.h.
  *
  * @param addressOut put the address here.
  * @param key the 256 bit curve25519 public key.
@@ -65,4 +72,13 @@ void AddressCalc_makeValidAddress(uint8_t address[16]);
  */
 bool AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32]);
 
+struct AddressCalc_CacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/** Get the hits and misses of the calling thread's table. */
+void AddressCalc_cacheStats(struct AddressCalc_CacheStats* out);
+
 #endif
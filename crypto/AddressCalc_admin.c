@@ -0,0 +1,45 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "crypto/AddressCalc.h"
+#include "crypto/AddressCalc_admin.h"
+#include "util/Identity.h"
+
+struct Context
+{
+    struct Admin* admin;
+    Identity
+};
+
+static void cacheStats(Dict* in, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    struct AddressCalc_CacheStats st;
+    AddressCalc_cacheStats(&st);
+    Dict* d = Dict_new(requestAlloc);
+    Dict_putIntC(d, "hits", st.hits, requestAlloc);
+    Dict_putIntC(d, "misses", st.misses, requestAlloc);
+    Dict_putIntC(d, "size", AddressCalc_CACHE_SETS * AddressCalc_CACHE_WAYS, requestAlloc);
+    Admin_sendMessage(d, txid, ctx->admin);
+}
+
+void AddressCalc_admin_register(struct Admin* admin, struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) { .admin = admin }));
+    Identity_set(ctx);
+    Admin_registerFunction("AddressCalc_cacheStats", cacheStats, ctx, true, NULL, admin);
+}
@@ -0,0 +1,297 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/BoxBatch.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include "crypto_onetimeauth_poly1305.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define BoxBatch_X86 1
+#else
+    #define BoxBatch_X86 0
+#endif
+
+/** One 32 bit word of each lane. */
+typedef uint32_t Vec __attribute__((vector_size(BoxBatch_LANES * 4)));
+
+/** Runs the 20 salsa20 rounds on each lane of in, without the final addition. */
+typedef void (* Kernel)(Vec out[16], const Vec in[16]);
+
+// "expand 32-byte k"
+#define SIGMA0 0x61707865
+#define SIGMA1 0x3320646e
+#define SIGMA2 0x79622d32
+#define SIGMA3 0x6b206574
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+    do {                         \
+        b ^= ROTL(a + d, 7);     \
+        c ^= ROTL(b + a, 9);     \
+        d ^= ROTL(c + b, 13);    \
+        a ^= ROTL(d + c, 18);    \
+    } while (0)
+// CHECKFILES_IGNORE missing ;
+
+static inline __attribute__((always_inline)) void rounds(Vec out[16], const Vec in[16])
+{
+    Vec x0 = in[0], x1 = in[1], x2 = in[2], x3 = in[3];
+    Vec x4 = in[4], x5 = in[5], x6 = in[6], x7 = in[7];
+    Vec x8 = in[8], x9 = in[9], x10 = in[10], x11 = in[11];
+    Vec x12 = in[12], x13 = in[13], x14 = in[14], x15 = in[15];
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x0, x4, x8, x12);
+        QUARTERROUND(x5, x9, x13, x1);
+        QUARTERROUND(x10, x14, x2, x6);
+        QUARTERROUND(x15, x3, x7, x11);
+
+        QUARTERROUND(x0, x1, x2, x3);
+        QUARTERROUND(x5, x6, x7, x4);
+        QUARTERROUND(x10, x11, x8, x9);
+        QUARTERROUND(x15, x12, x13, x14);
+    }
+    out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+    out[4] = x4; out[5] = x5; out[6] = x6; out[7] = x7;
+    out[8] = x8; out[9] = x9; out[10] = x10; out[11] = x11;
+    out[12] = x12; out[13] = x13; out[14] = x14; out[15] = x15;
+}
+
+static void kernelGeneric(Vec out[16], const Vec in[16])
+{
+    rounds(out, in);
+}
+
+#if BoxBatch_X86
+__attribute__((target("avx2"))) static void kernelAvx2(Vec out[16], const Vec in[16])
+{
+    rounds(out, in);
+}
+#endif
+
+static Kernel getKernel(void)
+{
+    // Racing threads all store the same value.
+    static Kernel kernel = NULL;
+    if (!kernel) {
+        Kernel k = kernelGeneric;
+        #if BoxBatch_X86
+            if (__builtin_cpu_supports("avx2")) { k = kernelAvx2; }
+        #endif
+        kernel = k;
+    }
+    return kernel;
+}
+
+const char* BoxBatch_implementation(void)
+{
+    #if BoxBatch_X86
+        if (getKernel() == kernelAvx2) { return "avx2"; }
+    #endif
+    return "generic";
+}
+
+static inline uint32_t load32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** A salsa20 keystream to be xor'd over data. */
+struct Stream
+{
+    uint8_t* data;
+    uint32_t length;
+    uint32_t key[8];
+    uint32_t nonce[2];
+};
+
+/** Which stream and block each lane of a kernel run belongs to. */
+struct Lane
+{
+    struct Stream* stream;
+    uint32_t block;
+};
+
+static void xorLanes(Kernel kernel, Vec in[16], struct Lane* lanes, int count)
+{
+    Vec out[16];
+    kernel(out, in);
+    for (int l = 0; l < count; l++) {
+        uint8_t keystream[64];
+        for (int w = 0; w < 16; w++) {
+            uint32_t v = out[w][l] + in[w][l];
+            keystream[w * 4] = v;
+            keystream[w * 4 + 1] = v >> 8;
+            keystream[w * 4 + 2] = v >> 16;
+            keystream[w * 4 + 3] = v >> 24;
+        }
+        struct Stream* s = lanes[l].stream;
+        uint32_t offset = lanes[l].block * 64;
+        uint32_t len = s->length - offset;
+        if (len > 64) { len = 64; }
+        uint8_t* data = &s->data[offset];
+        for (uint32_t i = 0; i < len; i++) {
+            data[i] ^= keystream[i];
+        }
+    }
+}
+
+/** Xor the salsa20 keystream over each stream, blocks of all streams are packed into lanes. */
+static void xorStreams(Kernel kernel, struct Stream* streams, int count)
+{
+    Vec in[16];
+    struct Lane lanes[BoxBatch_LANES];
+    int l = 0;
+    for (int i = 0; i < count; i++) {
+        struct Stream* s = &streams[i];
+        for (uint32_t block = 0; block * 64 < s->length; block++) {
+            in[0][l] = SIGMA0;
+            in[1][l] = s->key[0];
+            in[2][l] = s->key[1];
+            in[3][l] = s->key[2];
+            in[4][l] = s->key[3];
+            in[5][l] = SIGMA1;
+            in[6][l] = s->nonce[0];
+            in[7][l] = s->nonce[1];
+            in[8][l] = block;
+            in[9][l] = 0;
+            in[10][l] = SIGMA2;
+            in[11][l] = s->key[4];
+            in[12][l] = s->key[5];
+            in[13][l] = s->key[6];
+            in[14][l] = s->key[7];
+            in[15][l] = SIGMA3;
+            lanes[l].stream = s;
+            lanes[l].block = block;
+            if (++l == BoxBatch_LANES) {
+                xorLanes(kernel, in, lanes, l);
+                l = 0;
+            }
+        }
+    }
+    if (l) {
+        xorLanes(kernel, in, lanes, l);
+    }
+}
+
+/**
+ * Set up a stream for each item, the xsalsa20 subkeys (hsalsa20 of the secret and the first
+ * 16 bytes of the nonce) of all items are computed in one kernel run.
+ */
+static void setupStreams(Kernel kernel,
+                         struct Stream streams[BoxBatch_LANES],
+                         struct BoxBatch_Item* items,
+                         int count)
+{
+    Assert_true(count <= BoxBatch_LANES);
+    Vec in[16];
+    Vec out[16];
+    Bits_memset(in, 0, sizeof in);
+    for (int l = 0; l < count; l++) {
+        const uint8_t* k = items[l].secret;
+        const uint8_t* n = items[l].nonce;
+        in[0][l] = SIGMA0;
+        in[1][l] = load32(&k[0]);
+        in[2][l] = load32(&k[4]);
+        in[3][l] = load32(&k[8]);
+        in[4][l] = load32(&k[12]);
+        in[5][l] = SIGMA1;
+        in[6][l] = load32(&n[0]);
+        in[7][l] = load32(&n[4]);
+        in[8][l] = load32(&n[8]);
+        in[9][l] = load32(&n[12]);
+        in[10][l] = SIGMA2;
+        in[11][l] = load32(&k[16]);
+        in[12][l] = load32(&k[20]);
+        in[13][l] = load32(&k[24]);
+        in[14][l] = load32(&k[28]);
+        in[15][l] = SIGMA3;
+    }
+    kernel(out, in);
+    for (int l = 0; l < count; l++) {
+        struct Stream* s = &streams[l];
+        s->data = items[l].data;
+        s->length = items[l].length;
+        s->key[0] = out[0][l];
+        s->key[1] = out[5][l];
+        s->key[2] = out[10][l];
+        s->key[3] = out[15][l];
+        s->key[4] = out[6][l];
+        s->key[5] = out[7][l];
+        s->key[6] = out[8][l];
+        s->key[7] = out[9][l];
+        s->nonce[0] = load32(&items[l].nonce[16]);
+        s->nonce[1] = load32(&items[l].nonce[20]);
+    }
+}
+
+void BoxBatch_seal(struct BoxBatch_Item* items, int count)
+{
+    Kernel kernel = getKernel();
+    for (int i = 0; i < count; i += BoxBatch_LANES) {
+        int n = (count - i < BoxBatch_LANES) ? count - i : BoxBatch_LANES;
+        struct Stream streams[BoxBatch_LANES];
+        setupStreams(kernel, streams, &items[i], n);
+        xorStreams(kernel, streams, n);
+        for (int j = i; j < i + n; j++) {
+            uint8_t* c = items[j].data;
+            Assert_true(items[j].length >= 32);
+            // The first 32 bytes of keystream are the poly1305 key.
+            crypto_onetimeauth_poly1305(&c[16], &c[32], items[j].length - 32, c);
+            Bits_memset(c, 0, 16);
+        }
+    }
+}
+
+int BoxBatch_open(struct BoxBatch_Item* items, int count, int* results)
+{
+    Kernel kernel = getKernel();
+    int failed = 0;
+    for (int i = 0; i < count; i += BoxBatch_LANES) {
+        int n = (count - i < BoxBatch_LANES) ? count - i : BoxBatch_LANES;
+        struct Stream streams[BoxBatch_LANES];
+        setupStreams(kernel, streams, &items[i], n);
+
+        // Get the poly1305 keys first so nothing is touched unless it is authentic.
+        uint8_t polyKeys[BoxBatch_LANES][32];
+        struct Stream keyStreams[BoxBatch_LANES];
+        Bits_memset(polyKeys, 0, sizeof polyKeys);
+        for (int l = 0; l < n; l++) {
+            keyStreams[l] = streams[l];
+            keyStreams[l].data = polyKeys[l];
+            keyStreams[l].length = 32;
+        }
+        xorStreams(kernel, keyStreams, n);
+
+        int authentic = 0;
+        for (int l = 0; l < n; l++) {
+            struct BoxBatch_Item* item = &items[i + l];
+            if (item->length < 32 || crypto_onetimeauth_poly1305_verify(
+                    &item->data[16], &item->data[32], item->length - 32, polyKeys[l]))
+            {
+                results[i + l] = -1;
+                failed++;
+                continue;
+            }
+            results[i + l] = 0;
+            streams[authentic++] = streams[l];
+        }
+        xorStreams(kernel, streams, authentic);
+        for (int l = 0; l < authentic; l++) {
+            Bits_memset(streams[l].data, 0, 32);
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BoxBatch_H
+#define BoxBatch_H
+
+#include "util/Linker.h"
+Linker_require("crypto/BoxBatch.c");
+
+#include <stdint.h>
+
+/**
+ * Multi-packet xsalsa20/poly1305 (crypto_box_afternm / crypto_box_open_afternm).
+ *
+ * The salsa20 blocks of every message in a batch are run through one 8 lane vectorized
+ * kernel so short packets fill the vector as well as long ones do. On x86 an AVX2 build of
+ * the kernel is used if the CPU supports it, otherwise the same kernel runs on SSE2 or
+ * whatever the compiler makes of it. Poly1305 is done by cnacl's selected implementation.
+ */
+
+/** How many salsa20 blocks are computed at once. */
+#define BoxBatch_LANES 8
+
+struct BoxBatch_Item
+{
+    /**
+     * The message, laid out as for crypto_box_afternm(). For sealing it begins with 32 zero
+     * bytes followed by the content, for opening it begins with 16 zero bytes followed by the
+     * authenticator and the encrypted content. Processed in place.
+     */
+    uint8_t* data;
+
+    /** Length of data including the leading 32 bytes, must be at least 32. */
+    uint32_t length;
+
+    /** 24 byte nonce. */
+    const uint8_t* nonce;
+
+    /** 32 byte shared secret as produced by crypto_box_beforenm(). */
+    const uint8_t* secret;
+};
+
+/**
+ * Encrypt and authenticate each of the items, same as crypto_box_afternm().
+ * Items may share a secret and may point to the same secret.
+ */
+void BoxBatch_seal(struct BoxBatch_Item* items, int count);
+
+/**
+ * Authenticate and decrypt each of the items, same as crypto_box_open_afternm().
+ * An item which fails authentication is left untouched.
+ *
+ * @param results set to 0 for each item which is authentic and -1 for each which is not.
+ * @return the number of items which failed authentication.
+ */
+int BoxBatch_open(struct BoxBatch_Item* items, int count, int* results);
+
+/** @return the name of the salsa20 kernel which is in use, "avx2" or "generic". */
+const char* BoxBatch_implementation(void);
+
+#endif
@@ -14,6 +14,7 @@
  */
 #include "crypto/CryptoAuth_pvt.h"
 #include "crypto/AddressCalc.h"
+#include "crypto/BoxBatch.h"
 #include "crypto/ReplayProtector.h"
 #include "crypto/random/Random.h"
 #include "benc/Dict.h"
@@ -27,7 +28,9 @@
 #include "util/Defined.h"
 #include "util/Endian.h"
 #include "util/Hex.h"
+#include "util/MruCache.h"
 #include "util/events/Time.h"
+#include "util/events/Work.h"
 #include "wire/Error.h"
 #include "wire/Headers.h"
 #include "wire/Message.h"
@@ -119,6 +122,73 @@ static inline void getSharedSecret(uint8_t outputSecret[32],
     }
 }
 
+/** Zero memory in a way which the compiler will not optimize out. */
+static void wipe(void* memory, int length)
+{
+    volatile uint8_t* m = memory;
+    while (length--) { *m++ = 0; }
+}
+
+static int wipeSecretCache(struct Allocator_OnFreeJob* job)
+{
+    struct CryptoAuth_pvt* ca = Identity_check((struct CryptoAuth_pvt*) job->userData);
+    if (ca->secretCache) {
+        wipe(ca->secretCache, sizeof(struct CryptoAuth_SecretCache));
+    }
+    return 0;
+}
+
+/**
+ * Get the shared secret between our permanent key and her permanent key, from the cache if
+ * it has been computed before. A secret which is evicted is overwritten in place.
+ */
+static void getPermanentSharedSecret(uint8_t outputSecret[32],
+                                     struct CryptoAuth_pvt* ca,
+                                     uint8_t herPublicKey[32],
+                                     uint8_t passwordHash[32])
+{
+    if (Bits_isZero(herPublicKey, 32)) {
+        getSharedSecret(outputSecret, ca->privateKey, herPublicKey, passwordHash, ca->logger);
+        return;
+    }
+    if (!ca->secretCache) {
+        ca->secretCache =
+            Allocator_calloc(ca->allocator, sizeof(struct CryptoAuth_SecretCache), 1);
+        Allocator_onFree(ca->allocator, wipeSecretCache, ca);
+    }
+    struct CryptoAuth_SecretCache* cache = ca->secretCache;
+    struct CryptoAuth_CachedSecret* set =
+        cache->sets[MruCache_setIndex(herPublicKey, CryptoAuth_SECRET_CACHE_SETS)];
+    int i;
+    for (i = 0; i < CryptoAuth_SECRET_CACHE_WAYS; i++) {
+        if (set[i].hasPassword == (passwordHash != NULL) &&
+            !Bits_memcmp(set[i].herPublicKey, herPublicKey, 32) &&
+            (!passwordHash || !Bits_memcmp(set[i].passwordHash, passwordHash, 32)))
+        {
+            break;
+        }
+    }
+    struct CryptoAuth_CachedSecret e;
+    if (i < CryptoAuth_SECRET_CACHE_WAYS) {
+        cache->hits++;
+        Bits_memcpy(&e, &set[i], sizeof(struct CryptoAuth_CachedSecret));
+    } else {
+        cache->misses++;
+        Bits_memset(&e, 0, sizeof(struct CryptoAuth_CachedSecret));
+        Bits_memcpy(e.herPublicKey, herPublicKey, 32);
+        if (passwordHash) {
+            Bits_memcpy(e.passwordHash, passwordHash, 32);
+            e.hasPassword = true;
+        }
+        getSharedSecret(e.secret, ca->privateKey, herPublicKey, passwordHash, ca->logger);
+    }
+    // Moving the set down overwrites the least recently used entry if it is being evicted.
+    MruCache_moveToFront(set, i, CryptoAuth_SECRET_CACHE_WAYS, &e,
+                         sizeof(struct CryptoAuth_CachedSecret));
+    Bits_memcpy(outputSecret, e.secret, 32);
+    wipe(&e, sizeof(struct CryptoAuth_CachedSecret));
+}
+
 static inline void hashPassword(uint8_t secretOut[32],
                                 struct CryptoHeader_Challenge* challengeOut,
                                 const String* login,
@@ -140,6 +210,83 @@ static inline void hashPassword(uint8_t secretOut[32],
     challengeOut->additional = 0;
 }
 
+struct ChallengeKey
+{
+    uint8_t hash[CryptoHeader_Challenge_KEYSIZE];
+    uint32_t authType;
+};
+
+#define Map_USE_HASHTABLE
+#define Map_USE_COMPARATOR
+#define Map_NAME OfUsersByChallenge
+#define Map_KEY_TYPE struct ChallengeKey
+#define Map_VALUE_TYPE struct CryptoAuth_User*
+#include "util/Map.h"
+
+/** Constant time so that a lookup does not reveal how much of a challenge was correct. */
+static inline int Map_OfUsersByChallenge_compare(struct ChallengeKey* keyA,
+                                                 struct ChallengeKey* keyB)
+{
+    uint8_t* a = (uint8_t*) keyA;
+    uint8_t* b = (uint8_t*) keyB;
+    int diff = 0;
+    for (int i = 0; i < (int)sizeof(struct ChallengeKey); i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff;
+}
+
+static inline void challengeKeyForUser(struct ChallengeKey* key,
+                                       struct CryptoAuth_User* user,
+                                       int authType)
+{
+    key->authType = authType;
+    Bits_memcpy(key->hash,
+                (authType == 1) ? user->passwordHash : user->userNameHash,
+                CryptoHeader_Challenge_KEYSIZE);
+}
+
+static void indexUser(struct CryptoAuth_User* user, struct CryptoAuth_pvt* ca)
+{
+    for (int authType = 1; authType <= 2; authType++) {
+        struct ChallengeKey key;
+        challengeKeyForUser(&key, user, authType);
+        user->nextWithChallenge[authType - 1] = NULL;
+        int index = Map_OfUsersByChallenge_indexForKey(&key, ca->usersByChallenge);
+        if (index < 0) {
+            Map_OfUsersByChallenge_put(&key, &user, ca->usersByChallenge);
+            continue;
+        }
+        // The first user added wins so the new one goes to the end.
+        struct CryptoAuth_User* u = ca->usersByChallenge->values[index];
+        while (u->nextWithChallenge[authType - 1]) { u = u->nextWithChallenge[authType - 1]; }
+        u->nextWithChallenge[authType - 1] = user;
+    }
+}
+
+static void reindexUsers(struct CryptoAuth_pvt* ca)
+{
+    if (ca->userIndexAlloc) {
+        Allocator_free(ca->userIndexAlloc);
+    }
+    ca->userIndexAlloc = Allocator_child(ca->allocator);
+    ca->usersByChallenge = Map_OfUsersByChallenge_new(ca->userIndexAlloc);
+    for (struct CryptoAuth_User* u = ca->users; u; u = u->next) {
+        indexUser(u, ca);
+    }
+}
+
+/** The first of the users with this challenge, the rest follow by nextWithChallenge. */
+static inline struct CryptoAuth_User* usersForChallenge(uint8_t* hash,
+                                                        int authType,
+                                                        struct CryptoAuth_pvt* ca)
+{
+    struct ChallengeKey key = { .authType = authType };
+    Bits_memcpy(key.hash, hash, CryptoHeader_Challenge_KEYSIZE);
+    int index = Map_OfUsersByChallenge_indexForKey(&key, ca->usersByChallenge);
+    return (index < 0) ? NULL : ca->usersByChallenge->values[index];
+}
+
 /**
  * Search the authorized passwords for one matching this auth header.
  *
@@ -153,20 +300,13 @@ static inline struct CryptoAuth_User* getAuth(struct CryptoHeader_Challenge* aut
     if (auth->type == 0) {
         return NULL;
     }
-    int count = 0;
-    for (struct CryptoAuth_User* u = ca->users; u; u = u->next) {
-        count++;
-        if (auth->type == 1 &&
-            !Bits_memcmp(auth, u->passwordHash, CryptoHeader_Challenge_KEYSIZE))
-        {
-            return u;
-        } else if (auth->type == 2 &&
-            !Bits_memcmp(auth, u->userNameHash, CryptoHeader_Challenge_KEYSIZE))
-        {
+    if (auth->type == 1 || auth->type == 2) {
+        struct CryptoAuth_User* u = usersForChallenge((uint8_t*) auth, auth->type, ca);
+        if (u) {
             return u;
         }
     }
-    Log_debug(ca->logger, "Got unrecognized auth, password count = [%d]", count);
+    Log_debug(ca->logger, "Got unrecognized auth, password count = [%d]", ca->userCount);
     return NULL;
 }
 
@@ -410,11 +550,10 @@ static void encryptHandshake(struct Message* message,
 
     uint8_t sharedSecret[32];
     if (session->nextNonce < CryptoAuth_State_RECEIVED_HELLO) {
-        getSharedSecret(sharedSecret,
-                        session->context->privateKey,
-                        session->pub.herPublicKey,
-                        passwordHash,
-                        session->context->logger);
+        getPermanentSharedSecret(sharedSecret,
+                                 session->context,
+                                 session->pub.herPublicKey,
+                                 passwordHash);
 
         session->isInitiator = true;
 
@@ -528,6 +667,80 @@ static inline void updateTime(struct CryptoAuth_Session_pvt* session, struct Mes
     session->timeOfLastPacket = Time_currentTimeSeconds(session->context->eventBase);
 }
 
+/** A run message waiting in CryptoAuth_encryptBatch(). */
+struct BatchEntry
+{
+    struct Message* msg;
+    uint32_t nonce;
+    uint8_t nonceBytes[24];
+    uint8_t secret[32];
+    uint8_t paddingSpace[16];
+};
+
+static void flushBatch(struct BatchEntry* entries, int count)
+{
+    struct BoxBatch_Item items[BoxBatch_LANES];
+    for (int i = 0; i < count; i++) {
+        items[i].data = entries[i].msg->bytes - 32;
+        items[i].length = entries[i].msg->length + 32;
+        items[i].nonce = entries[i].nonceBytes;
+        items[i].secret = entries[i].secret;
+    }
+    if (!Defined(NSA_APPROVED)) {
+        BoxBatch_seal(items, count);
+    }
+    for (int i = 0; i < count; i++) {
+        struct Message* msg = entries[i].msg;
+        Bits_memcpy(msg->bytes - 32, entries[i].paddingSpace, 16);
+        Message_shift(msg, 16, NULL);
+        Message_push32(msg, entries[i].nonce, NULL);
+    }
+}
+
+void CryptoAuth_encryptBatch(struct CryptoAuth_Session** sessions,
+                             struct Message** msgs,
+                             int count)
+{
+    struct BatchEntry entries[BoxBatch_LANES];
+    int queued = 0;
+    for (int i = 0; i < count; i++) {
+        struct CryptoAuth_Session_pvt* session =
+            Identity_check((struct CryptoAuth_Session_pvt*) sessions[i]);
+        struct Message* msg = msgs[i];
+        // Otherwise this message would get a nonce and go out ahead of messages queued before it.
+        Assert_true(!session->jobs || !"encryptBatch with async jobs pending");
+        resetIfTimeout(session);
+        if (session->nextNonce >= 0xfffffff0 ||
+            session->nextNonce <= CryptoAuth_State_RECEIVED_KEY)
+        {
+            // Handshake or nonce wrap, messages which are already queued have their own
+            // copy of the secret so they are not affected.
+            Assert_true(!CryptoAuth_encrypt(sessions[i], msg));
+            continue;
+        }
+        Assert_true(!((uintptr_t)msg->bytes % 4) || !"alignment fault");
+        Assert_true(msg->length > 0);
+        Assert_true(msg->padding >= 36 || !"not enough padding");
+
+        struct BatchEntry* e = &entries[queued++];
+        e->msg = msg;
+        e->nonce = session->nextNonce++;
+        Bits_memset(e->nonceBytes, 0, 24);
+        uint32_t nonceLE = Endian_hostToLittleEndian32(e->nonce);
+        Bits_memcpy(&e->nonceBytes[session->isInitiator ? 4 : 0], &nonceLE, 4);
+        Bits_memcpy(e->secret, session->sharedSecret, 32);
+        Bits_memcpy(e->paddingSpace, msg->bytes - 32, 16);
+        Bits_memset(msg->bytes - 32, 0, 32);
+        if (queued == BoxBatch_LANES) {
+            flushBatch(entries, queued);
+            queued = 0;
+        }
+    }
+    if (queued) {
+        flushBatch(entries, queued);
+    }
+}
+
 static inline enum CryptoAuth_DecryptErr decryptMessage(struct CryptoAuth_Session_pvt* session,
                                                         uint32_t nonce,
                                                         struct Message* content,
@@ -614,11 +827,10 @@ static enum CryptoAuth_DecryptErr decryptHandshake(struct CryptoAuth_Session_pvt
             cryptoAuthDebug0(session, "Received a repeat hello packet");
         }
 
-        getSharedSecret(sharedSecret,
-                        session->context->privateKey,
-                        session->pub.herPublicKey,
-                        passwordHash,
-                        session->context->logger);
+        getPermanentSharedSecret(sharedSecret,
+                                 session->context,
+                                 session->pub.herPublicKey,
+                                 passwordHash);
         nextNonce = CryptoAuth_State_RECEIVED_HELLO;
     } else {
         if (nonce == Nonce_KEY) {
@@ -910,6 +1122,247 @@ enum CryptoAuth_DecryptErr CryptoAuth_decrypt(struct CryptoAuth_Session* session
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+struct CryptoAuth_Job
+{
+    /** The next job for the same session. */
+    struct CryptoAuth_Job* next;
+
+    struct CryptoAuth_Session_pvt* session;
+    struct Message* msg;
+
+    /** Child of the session allocator which has adopted the message. */
+    struct Allocator* alloc;
+
+    CryptoAuth_Callback callback;
+    void* userData;
+
+    /** Copied from the session so that the worker does not race a reset. */
+    uint8_t secret[32];
+    uint32_t nonce;
+    bool isInitiator;
+
+    bool isEncrypt;
+
+    /**
+     * If false, the message is only waiting its turn, it will be handled by
+     * CryptoAuth_encrypt() or CryptoAuth_decrypt() when it reaches the head of the queue.
+     */
+    bool offloaded;
+
+    /** True once the worker thread has finished. */
+    bool done;
+
+    /** Written by the worker thread. */
+    int decryptRet;
+
+    Identity
+};
+
+/** Runs on a worker thread, nothing but the job may be touched here. */
+static void jobWork(void* vjob)
+{
+    struct CryptoAuth_Job* job = (struct CryptoAuth_Job*) vjob;
+    if (job->isEncrypt) {
+        encrypt(job->nonce, job->msg, job->secret, job->isInitiator);
+    } else {
+        job->decryptRet = decrypt(job->nonce, job->msg, job->secret, job->isInitiator);
+    }
+}
+
+/** The part of encrypt/decrypt which must happen on the event loop, in order. */
+static int finishJob(struct CryptoAuth_Job* job)
+{
+    struct CryptoAuth_Session_pvt* session = job->session;
+    if (!job->offloaded) {
+        if (job->isEncrypt) {
+            Assert_true(!CryptoAuth_encrypt(&session->pub, job->msg));
+            return 0;
+        }
+        return CryptoAuth_decrypt(&session->pub, job->msg);
+    }
+    if (job->isEncrypt) {
+        Message_push32(job->msg, job->nonce, NULL);
+        return 0;
+    }
+    if (job->decryptRet) {
+        cryptoAuthDebug0(session, "DROP authenticated decryption failed");
+        return CryptoAuth_DecryptErr_DECRYPT;
+    }
+    if (!session->established || Bits_memcmp(job->secret, session->sharedSecret, 32)) {
+        // Something which was ahead in the queue has reset the session.
+        cryptoAuthDebug0(session, "DROP session was reset while decrypting");
+        return CryptoAuth_DecryptErr_DECRYPT;
+    }
+    if (!ReplayProtector_checkNonce(job->nonce, &session->pub.replayProtector)) {
+        cryptoAuthDebug(session, "DROP nonce checking failed nonce=[%u]", job->nonce);
+        return CryptoAuth_DecryptErr_REPLAY;
+    }
+    updateTime(session, job->msg);
+    return 0;
+}
+
+/** Deliver everything at the head of the queue which is ready. */
+static void deliverJobs(struct CryptoAuth_Session_pvt* session)
+{
+    bool freed = false;
+    session->freedFlag = &freed;
+    while (session->jobs && (session->jobs->done || !session->jobs->offloaded)) {
+        struct CryptoAuth_Job* job = session->jobs;
+        session->jobs = job->next;
+        if (!session->jobs) {
+            session->lastJob = NULL;
+        }
+        int ret = finishJob(job);
+        job->callback(job->msg, ret, job->userData);
+        if (freed) {
+            // The job went with the session.
+            return;
+        }
+        Allocator_free(job->alloc);
+    }
+    session->freedFlag = NULL;
+}
+
+static void jobComplete(void* vjob)
+{
+    struct CryptoAuth_Job* job = Identity_check((struct CryptoAuth_Job*) vjob);
+    job->done = true;
+    deliverJobs(job->session);
+}
+
+static int sessionOnFree(struct Allocator_OnFreeJob* onFree)
+{
+    struct CryptoAuth_Session_pvt* session =
+        Identity_check((struct CryptoAuth_Session_pvt*) onFree->userData);
+    if (session->freedFlag) {
+        *session->freedFlag = true;
+    }
+    return 0;
+}
+
+static struct CryptoAuth_Job* queueJob(struct CryptoAuth_Session_pvt* session,
+                                       struct Message* msg,
+                                       bool isEncrypt,
+                                       bool offloaded,
+                                       CryptoAuth_Callback callback,
+                                       void* userData)
+{
+    // Allocated under the session so that freeing the session drops the queue, a job which is
+    // still on a worker thread holds up the free until the worker is done with it.
+    struct Allocator* alloc = Allocator_child(session->alloc);
+    Allocator_adopt(alloc, msg->alloc);
+    struct CryptoAuth_Job* job = Allocator_calloc(alloc, sizeof(struct CryptoAuth_Job), 1);
+    Identity_set(job);
+    job->session = session;
+    job->msg = msg;
+    job->alloc = alloc;
+    job->callback = callback;
+    job->userData = userData;
+    job->isEncrypt = isEncrypt;
+    job->offloaded = offloaded;
+    if (session->lastJob) {
+        session->lastJob->next = job;
+    } else {
+        session->jobs = job;
+    }
+    session->lastJob = job;
+    if (offloaded) {
+        Bits_memcpy(job->secret, session->sharedSecret, 32);
+        job->isInitiator = session->isInitiator;
+    }
+    return job;
+}
+
+int CryptoAuth_encryptAsync(struct CryptoAuth_Session* sessionPub,
+                            struct Message* msg,
+                            CryptoAuth_Callback callback,
+                            void* userData)
+{
+    struct CryptoAuth_Session_pvt* session =
+        Identity_check((struct CryptoAuth_Session_pvt*) sessionPub);
+
+    if (!session->jobs) {
+        if (!session->context->useWorkers) { return -1; }
+        resetIfTimeout(session);
+    }
+
+    // Anything which might change the state of the session is left to CryptoAuth_encrypt().
+    bool offload = session->context->useWorkers &&
+        session->nextNonce > CryptoAuth_State_RECEIVED_KEY &&
+        session->nextNonce < 0xfffffff0;
+
+    if (!offload) {
+        if (!session->jobs) { return -1; }
+        queueJob(session, msg, true, false, callback, userData);
+        return 0;
+    }
+
+    Assert_true(!((uintptr_t)msg->bytes % 4) || !"alignment fault");
+    Assert_true(msg->length > 0 && "Empty packet during handshake");
+    Assert_true(msg->padding >= 36 || !"not enough padding");
+
+    struct CryptoAuth_Job* job = queueJob(session, msg, true, true, callback, userData);
+    job->nonce = session->nextNonce++;
+    Work_queue(jobWork, jobComplete, job, session->context->eventBase, job->alloc);
+    return 0;
+}
+
+int CryptoAuth_decryptAsync(struct CryptoAuth_Session* sessionPub,
+                            struct Message* msg,
+                            CryptoAuth_Callback callback,
+                            void* userData)
+{
+    struct CryptoAuth_Session_pvt* session =
+        Identity_check((struct CryptoAuth_Session_pvt*) sessionPub);
+
+    if (!session->jobs && !session->context->useWorkers) {
+        return -1;
+    }
+
+    // Only run messages of an established session go to a worker, handshakes, runts and
+    // everything else are left to CryptoAuth_decrypt().
+    bool offload = session->context->useWorkers &&
+        session->established &&
+        msg->length >= 20 &&
+        Endian_bigEndianToHost32(((uint32_t*)msg->bytes)[0]) >= Nonce_FIRST_TRAFFIC_PACKET;
+
+    if (!offload) {
+        if (!session->jobs) { return -1; }
+        queueJob(session, msg, false, false, callback, userData);
+        return 0;
+    }
+
+    Assert_true(msg->padding >= 12 || "need at least 12 bytes of padding in incoming message");
+    Assert_true(!((uintptr_t)msg->bytes % 4) || !"alignment fault");
+    Assert_true(!(msg->capacity % 4) || !"length fault");
+    Assert_ifParanoid(!Bits_isZero(session->sharedSecret, 32));
+
+    uint32_t nonce = Message_pop32(msg, NULL);
+    struct CryptoAuth_Job* job = queueJob(session, msg, false, true, callback, userData);
+    job->nonce = nonce;
+    Work_queue(jobWork, jobComplete, job, session->context->eventBase, job->alloc);
+    return 0;
+}
+
+bool CryptoAuth_isAsync(struct CryptoAuth_Session* sessionPub)
+{
+    struct CryptoAuth_Session_pvt* session =
+        Identity_check((struct CryptoAuth_Session_pvt*) sessionPub);
+    return session->context->useWorkers || session->jobs;
+}
+
+int CryptoAuth_setWorkers(struct CryptoAuth* ca, uint32_t count)
+{
+    struct CryptoAuth_pvt* context = Identity_check((struct CryptoAuth_pvt*) ca);
+    context->useWorkers = (count > 0);
+    if (!count) {
+        return 0;
+    }
+    return Work_startThreads(count, context->eventBase);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
 struct CryptoAuth* CryptoAuth_new(struct Allocator* allocator,
                                   const uint8_t* privateKey,
                                   struct EventBase* eventBase,
@@ -929,6 +1382,8 @@ struct CryptoAuth* CryptoAuth_new(struct Allocator* allocator,
         Random_bytes(rand, ca->privateKey, 32);
     }
     crypto_scalarmult_curve25519_base(ca->pub.publicKey, ca->privateKey);
+    ca->usersEnd = &ca->users;
+    reindexUsers(ca);
 
     if (Defined(Log_KEYS)) {
         uint8_t publicKeyHex[65];
@@ -957,9 +1412,7 @@ int CryptoAuth_addUser_ipv6(String* password,
     Identity_set(user);
 
     if (!login) {
-        int i = 0;
-        for (struct CryptoAuth_User* u = ca->users; u; u = u->next) { i++; }
-        user->login = login = String_printf(alloc, "Anon #%d", i);
+        user->login = login = String_printf(alloc, "Anon #%d", ca->userCount);
     } else {
         user->login = String_clone(login, alloc);
     }
@@ -971,7 +1424,11 @@ int CryptoAuth_addUser_ipv6(String* password,
     hashPassword(user->secret, &ac, NULL, password, 1);
     Bits_memcpy(user->passwordHash, &ac, CryptoHeader_Challenge_KEYSIZE);
 
-    for (struct CryptoAuth_User* u = ca->users; u; u = u->next) {
+    // Users with the same secret have the same passwordHash.
+    for (struct CryptoAuth_User* u = usersForChallenge(user->passwordHash, 1, ca);
+         u;
+         u = u->nextWithChallenge[0])
+    {
         if (Bits_memcmp(user->secret, u->secret, 32)) {
         } else if (!login) {
         } else if (String_equals(login, u->login)) {
@@ -985,12 +1442,10 @@ int CryptoAuth_addUser_ipv6(String* password,
     }
 
     // Add the user to the *end* of the list
-    for (struct CryptoAuth_User** up = &ca->users; ; up = &(*up)->next) {
-        if (!*up) {
-            *up = user;
-            break;
-        }
-    }
+    *ca->usersEnd = user;
+    ca->usersEnd = &user->next;
+    ca->userCount++;
+    indexUser(user, ca);
 
     return 0;
 }
@@ -1011,6 +1466,11 @@ int CryptoAuth_removeUsers(struct CryptoAuth* context, String* login)
             up = &u->next;
         }
     }
+    ca->usersEnd = up;
+    ca->userCount -= count;
+    if (count) {
+        reindexUsers(ca);
+    }
 
     if (!login) {
         Log_debug(ca->logger, "Flushing [%d] users", count);
@@ -1058,6 +1518,8 @@ struct CryptoAuth_Session* CryptoAuth_newSession(struct CryptoAuth* ca,
     AddressCalc_addressForPublicKey(calculatedIp6, herPublicKey);
     Bits_memcpy(session->pub.herIp6, calculatedIp6, 16);
 
+    Allocator_onFree(alloc, sessionOnFree, session);
+
     return &session->pub;
 }
 
@@ -148,6 +148,22 @@ struct CryptoAuth_Session* CryptoAuth_newSession(struct CryptoAuth* ca,
 /** @return 0 on success, -1 otherwise. */
 int CryptoAuth_encrypt(struct CryptoAuth_Session* session, struct Message* msg);
 
+/**
+ * Encrypt a number of messages as if by calling CryptoAuth_encrypt() on each in turn.
+ * Run messages of established sessions have their salsa20/poly1305 done together,
+ * see BoxBatch.h, anything else goes through CryptoAuth_encrypt().
+ * The same session may appear more than once.
+ * This bypasses the ordering of CryptoAuth_encryptAsync() and CryptoAuth_decryptAsync() so it
+ * must not be used on a session which has any of their messages still pending.
+ *
+ * @param sessions the session to encrypt each message with.
+ * @param msgs the messages, encrypted in place.
+ * @param count the number of messages.
+ */
+void CryptoAuth_encryptBatch(struct CryptoAuth_Session** sessions,
+                             struct Message** msgs,
+                             int count);
+
 enum CryptoAuth_DecryptErr {
     CryptoAuth_DecryptErr_NONE = 0,
 
@@ -199,6 +215,63 @@ enum CryptoAuth_DecryptErr {
 // If there is an error, the content of the message MIGHT already be decrypted !
 enum CryptoAuth_DecryptErr CryptoAuth_decrypt(struct CryptoAuth_Session* sess, struct Message* msg);
 
+/**
+ * Called from the event loop when a message given to CryptoAuth_encryptAsync() or
+ * CryptoAuth_decryptAsync() is complete.
+ *
+ * @param msg the message, encrypted or decrypted as if by CryptoAuth_encrypt() or
+ *            CryptoAuth_decrypt().
+ * @param err 0 or a CryptoAuth_DecryptErr, always 0 for encryption.
+ * @param userData the pointer which was passed with the message.
+ */
+typedef void (* CryptoAuth_Callback)(struct Message* msg, int err, void* userData);
+
+/**
+ * Encrypt a message, using a worker thread if workers are enabled (see CryptoAuth_setWorkers()).
+ * Data packets are encrypted on a worker thread, handshake packets which must wait behind them
+ * are encrypted on the event loop when their turn comes. Messages for the same session are
+ * completed in the order which they were given and if the session is freed before that, they
+ * are dropped without the callback being called.
+ *
+ * @return 0 if the message was taken and the callback will be called with it later,
+ *         -1 if there is no reason to wait, in which case use CryptoAuth_encrypt().
+ */
+int CryptoAuth_encryptAsync(struct CryptoAuth_Session* session,
+                            struct Message* msg,
+                            CryptoAuth_Callback callback,
+                            void* userData);
+
+/**
+ * Decrypt a message, using a worker thread if workers are enabled.
+ * The replay check is made on the event loop when the message is completed so it is always
+ * done in order. See CryptoAuth_encryptAsync().
+ *
+ * @return 0 if the message was taken and the callback will be called with it later,
+ *         -1 if there is no reason to wait, in which case use CryptoAuth_decrypt().
+ */
+int CryptoAuth_decryptAsync(struct CryptoAuth_Session* session,
+                            struct Message* msg,
+                            CryptoAuth_Callback callback,
+                            void* userData);
+
+/**
+ * @return true if CryptoAuth_encryptAsync() or CryptoAuth_decryptAsync() might take a message
+ *         for this session, false if they would certainly return -1.
+ */
+bool CryptoAuth_isAsync(struct CryptoAuth_Session* session);
+
+/**
+ * Enable or disable encrypting and decrypting data packets on worker threads.
+ * The thread pool is process wide and it can only be sized once, it should be started before
+ * the process is sandboxed.
+ *
+ * @param ca the CryptoAuth.
+ * @param count the number of threads, 0 to do everything on the event loop (the default).
+ * @return 0 on success, -1 if the pool was already running with a different number of threads,
+ *         workers are still enabled in that case.
+ */
+int CryptoAuth_setWorkers(struct CryptoAuth* ca, uint32_t count);
+
 /**
  * Choose the authentication credentials to use.
  * WARNING: Even if the remote end begins the connection, these credentials will be presented which
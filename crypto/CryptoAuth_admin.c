@@ -0,0 +1,66 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/String.h"
+#include "benc/Dict.h"
+#include "crypto/CryptoAuth.h"
+#include "crypto/CryptoAuth_admin.h"
+#include "memory/Allocator.h"
+#include "util/events/Work.h"
+#include "util/Identity.h"
+#include "util/Security.h"
+
+struct CryptoAuth_admin_pvt
+{
+    struct CryptoAuth* ca;
+    struct Admin* admin;
+    struct Security* sec;
+    Identity
+};
+
+static void setWorkers(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct CryptoAuth_admin_pvt* ctx = Identity_check((struct CryptoAuth_admin_pvt*)vcontext);
+    int64_t* count = Dict_getIntC(args, "count");
+    char* err = "none";
+    if (*count < 0 || *count > 128) {
+        err = "count must be between 0 and 128";
+    } else if (*count && !Work_threadCount() && ctx->sec && ctx->sec->setupComplete) {
+        // Starting the pool would create threads inside of the sandbox, which kills the process.
+        err = "the thread pool can not be started after Security_setupComplete()";
+    } else if (CryptoAuth_setWorkers(ctx->ca, *count)) {
+        err = "thread pool already started with a different size, workers enabled anyway";
+    }
+    Dict* d = Dict_new(requestAlloc);
+    Dict_putStringCC(d, "error", err, requestAlloc);
+    Admin_sendMessage(d, txid, ctx->admin);
+}
+
+void CryptoAuth_admin_register(struct CryptoAuth* ca,
+                               struct Security* sec,
+                               struct Admin* admin,
+                               struct Allocator* alloc)
+{
+    struct CryptoAuth_admin_pvt* ctx = Allocator_clone(alloc, (&(struct CryptoAuth_admin_pvt) {
+        .ca = ca,
+        .admin = admin,
+        .sec = sec
+    }));
+    Identity_set(ctx);
+    Admin_registerFunction("CryptoAuth_setWorkers", setWorkers, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "count", .required = 1, .type = "Int" }
+        }), admin);
+}
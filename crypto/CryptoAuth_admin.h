@@ -0,0 +1,34 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CryptoAuth_admin_H
+#define CryptoAuth_admin_H
+
+#include "admin/Admin.h"
+#include "crypto/CryptoAuth.h"
+#include "memory/Allocator.h"
+#include "util/Security.h"
+#include "util/Linker.h"
+Linker_require("crypto/CryptoAuth_admin.c");
+
+/**
+ * @param sec once its setup is complete the thread pool may no longer be started,
+ *            NULL if the process is not sandboxed.
+ */
+void CryptoAuth_admin_register(struct CryptoAuth* ca,
+                               struct Security* sec,
+                               struct Admin* admin,
+                               struct Allocator* alloc);
+
+#endif
@@ -42,11 +42,42 @@ struct CryptoAuth_User {
 
     struct CryptoAuth_User* next;
 
+    /**
+     * Next user with the same passwordHash ([0]) or userNameHash ([1]),
+     * in the order they were added, see CryptoAuth_pvt.usersByChallenge.
+     */
+    struct CryptoAuth_User* nextWithChallenge[2];
+
     struct Allocator* alloc;
 
     Identity
 };
 
+#define CryptoAuth_SECRET_CACHE_SETS 64
+#define CryptoAuth_SECRET_CACHE_WAYS 4
+
+/** A shared secret between our permanent key and her permanent key (and password). */
+struct CryptoAuth_CachedSecret
+{
+    uint8_t herPublicKey[32];
+    uint8_t passwordHash[32];
+    uint8_t secret[32];
+    bool hasPassword;
+};
+
+/**
+ * Hello packets in both directions need the curve25519 secret between the permanent keys,
+ * this keeps them so that repeated handshakes with the same peer cost one scalar
+ * multiplication. Set associative, see util/MruCache.h.
+ */
+struct CryptoAuth_SecretCache
+{
+    struct CryptoAuth_CachedSecret
+        sets[CryptoAuth_SECRET_CACHE_SETS][CryptoAuth_SECRET_CACHE_WAYS];
+    uint64_t hits;
+    uint64_t misses;
+};
+
 struct CryptoAuth_pvt
 {
     struct CryptoAuth pub;
@@ -55,12 +86,26 @@ struct CryptoAuth_pvt
 
     struct CryptoAuth_User* users;
 
+    /** The next pointer of the last user, where the next one will be added. */
+    struct CryptoAuth_User** usersEnd;
+    uint32_t userCount;
+
+    /** The first user for each auth type and challenge key, so hellos need not scan users. */
+    struct Map_OfUsersByChallenge* usersByChallenge;
+    struct Allocator* userIndexAlloc;
+
     struct Log* logger;
     struct EventBase* eventBase;
 
     struct Allocator* allocator;
     struct Random* rand;
 
+    /** If true, data packets given to the async functions are processed on worker threads. */
+    bool useWorkers;
+
+    /** Allocated when the first handshake is done, wiped when the CryptoAuth is freed. */
+    struct CryptoAuth_SecretCache* secretCache;
+
     Identity
 };
 
@@ -106,6 +151,13 @@ struct CryptoAuth_Session_pvt
     /** A pointer back to the main cryptoauth context. */
     struct CryptoAuth_pvt* context;
 
+    /** Messages given to the async functions which have not been completed, oldest first. */
+    struct CryptoAuth_Job* jobs;
+    struct CryptoAuth_Job* lastJob;
+
+    /** Set to true if the session is freed while completed jobs are being delivered. */
+    bool* freedFlag;
+
     Identity
 };
 
@@ -0,0 +1,79 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto_hash_sha512.h"
+#include "crypto/AddressCalc.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+static void reference(uint8_t addressOut[16], const uint8_t key[32])
+{
+    uint8_t hash[crypto_hash_sha512_BYTES];
+    crypto_hash_sha512(hash, key, 32);
+    crypto_hash_sha512(hash, hash, crypto_hash_sha512_BYTES);
+    Bits_memcpy(addressOut, hash, 16);
+}
+
+/** Keys which all land in the same set. */
+static void mkKey(uint8_t key[32], int n)
+{
+    Bits_memset(key, 0x55, 32);
+    key[31] = n;
+}
+
+static void check(int n, int expectHits, int expectMisses)
+{
+    struct AddressCalc_CacheStats before;
+    struct AddressCalc_CacheStats after;
+    uint8_t key[32];
+    uint8_t expected[16];
+    uint8_t address[16];
+    mkKey(key, n);
+    reference(expected, key);
+
+    AddressCalc_cacheStats(&before);
+    bool valid = AddressCalc_addressForPublicKey(address, key);
+    AddressCalc_cacheStats(&after);
+
+    Assert_true(!Bits_memcmp(address, expected, 16));
+    Assert_true(valid == AddressCalc_validAddress(expected));
+    Assert_true(after.hits - before.hits == (uint64_t) expectHits);
+    Assert_true(after.misses - before.misses == (uint64_t) expectMisses);
+}
+
+int main()
+{
+    for (int i = 0; i < AddressCalc_CACHE_WAYS; i++) {
+        check(i, 0, 1);
+    }
+    for (int i = 0; i < AddressCalc_CACHE_WAYS; i++) {
+        check(i, 1, 0);
+    }
+
+    // Key 0 is the least recently used so it is the one which gets evicted.
+    check(AddressCalc_CACHE_WAYS, 0, 1);
+    check(0, 0, 1);
+    check(AddressCalc_CACHE_WAYS, 1, 0);
+
+    // The all zero key is never cached.
+    uint8_t zero[32] = {0};
+    uint8_t address[16];
+    struct AddressCalc_CacheStats before;
+    struct AddressCalc_CacheStats after;
+    AddressCalc_cacheStats(&before);
+    AddressCalc_addressForPublicKey(address, zero);
+    AddressCalc_cacheStats(&after);
+    Assert_true(after.hits == before.hits && after.misses == before.misses);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto_box_curve25519xsalsa20poly1305.h"
+#include "crypto/BoxBatch.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#define COUNT 21
+#define MAX_LEN 300
+
+struct Buffers
+{
+    uint8_t plain[COUNT][MAX_LEN];
+    uint8_t expected[COUNT][MAX_LEN];
+    uint8_t data[COUNT][MAX_LEN];
+    uint8_t nonces[COUNT][24];
+    uint8_t secrets[3][32];
+    struct BoxBatch_Item items[COUNT];
+    int results[COUNT];
+};
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct Buffers* b = Allocator_calloc(alloc, sizeof(struct Buffers), 1);
+
+    Random_bytes(rand, (uint8_t*) b->secrets, sizeof b->secrets);
+    for (int i = 0; i < COUNT; i++) {
+        // Lengths from a bare authenticator through several blocks and partial blocks.
+        uint32_t len = 32 + (i * 13) % (MAX_LEN - 32);
+        Random_bytes(rand, b->nonces[i], 24);
+        Random_bytes(rand, b->plain[i], len);
+        Bits_memset(b->plain[i], 0, 32);
+        Bits_memcpy(b->data[i], b->plain[i], len);
+        b->items[i] = (struct BoxBatch_Item) {
+            .data = b->data[i],
+            .length = len,
+            .nonce = b->nonces[i],
+            .secret = b->secrets[i % 3]
+        };
+        crypto_box_curve25519xsalsa20poly1305_afternm(
+            b->expected[i], b->plain[i], len, b->nonces[i], b->secrets[i % 3]);
+    }
+
+    // Every batch size from 1 up so partly filled lanes are covered.
+    for (int count = 1; count <= COUNT; count++) {
+        for (int i = 0; i < count; i++) {
+            Bits_memcpy(b->data[i], b->plain[i], b->items[i].length);
+        }
+        BoxBatch_seal(b->items, count);
+        for (int i = 0; i < count; i++) {
+            Assert_true(!Bits_memcmp(b->data[i], b->expected[i], b->items[i].length));
+        }
+        Assert_true(!BoxBatch_open(b->items, count, b->results));
+        for (int i = 0; i < count; i++) {
+            Assert_true(!b->results[i]);
+            Assert_true(!Bits_memcmp(b->data[i], b->plain[i], b->items[i].length));
+        }
+    }
+
+    // Damaged messages are reported and left alone, the rest are opened.
+    BoxBatch_seal(b->items, COUNT);
+    b->data[3][40] ^= 1;
+    b->data[10][20] ^= 0x80;
+    Assert_true(BoxBatch_open(b->items, COUNT, b->results) == 2);
+    for (int i = 0; i < COUNT; i++) {
+        if (i == 3 || i == 10) {
+            Assert_true(b->results[i] == -1);
+            b->data[i][i == 3 ? 40 : 20] ^= (i == 3) ? 1 : 0x80;
+            Assert_true(!Bits_memcmp(b->data[i], b->expected[i], b->items[i].length));
+        } else {
+            Assert_true(!b->results[i]);
+            Assert_true(!Bits_memcmp(b->data[i], b->plain[i], b->items[i].length));
+        }
+    }
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,190 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "crypto/CryptoAuth.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/events/Work.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/log/FileWriterLog.h"
+#include "wire/CryptoHeader.h"
+#include "wire/Message.h"
+
+#define PRIVATEKEY_A \
+    Constant_stringForHex("53ff22b2eb94ce8c5f1852c0f557eb901f067e5273d541e0a21e143c20dff9da")
+#define PUBLICKEY_A \
+    Constant_stringForHex("e3ff75af6e4414494df22f200ffeaa56e7976d991d33cc87f52427e27f83235d")
+
+#define PRIVATEKEY_B \
+    Constant_stringForHex("b71c4f43e3d4b1879b5065d44a1cb43eaf07ddba96de6a72ca761c4ef4bd2988")
+#define PUBLICKEY_B \
+    Constant_stringForHex("27c303cdc1f96e4b28d51c75130aff6cad52098f2d752615b7b6509ed6a89477")
+
+#define MESSAGES 256
+#define MSG_SIZE 1024
+
+struct Context
+{
+    struct CryptoAuth* ca1;
+    struct CryptoAuth_Session* sess1;
+    struct Allocator* sessAlloc1;
+
+    struct CryptoAuth* ca2;
+    struct CryptoAuth_Session* sess2;
+
+    struct Allocator* alloc;
+    struct EventBase* base;
+
+    int encrypted;
+    int decrypted;
+    int replays;
+};
+
+static struct Message* newMsg(struct Context* ctx, uint32_t num)
+{
+    struct Message* msg = Message_new(MSG_SIZE, CryptoHeader_SIZE, Allocator_child(ctx->alloc));
+    Bits_memset(msg->bytes, num & 0xff, MSG_SIZE);
+    Bits_memcpy(msg->bytes, &num, 4);
+    return msg;
+}
+
+static void sync(struct Context* ctx,
+                 struct CryptoAuth_Session* from,
+                 struct CryptoAuth_Session* to)
+{
+    struct Message* msg = newMsg(ctx, 0);
+    Assert_true(!CryptoAuth_encrypt(from, msg));
+    Assert_true(!CryptoAuth_decrypt(to, msg));
+    Allocator_free(msg->alloc);
+}
+
+static void decrypted(struct Message* msg, int err, void* vctx)
+{
+    struct Context* ctx = vctx;
+    if (err) {
+        Assert_true(err == CryptoAuth_DecryptErr_REPLAY);
+        ctx->replays++;
+        return;
+    }
+    uint32_t num;
+    Bits_memcpy(&num, msg->bytes, 4);
+    Assert_true(num == (uint32_t) ctx->decrypted);
+    Assert_true(msg->length == MSG_SIZE);
+    Assert_true(msg->bytes[MSG_SIZE - 1] == (num & 0xff));
+    if (++ctx->decrypted == MESSAGES) {
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+static void encrypted(struct Message* msg, int err, void* vctx)
+{
+    struct Context* ctx = vctx;
+    Assert_true(!err);
+    Assert_true(msg->length == MSG_SIZE + 20);
+    ctx->encrypted++;
+
+    // Send the first message twice, the copy must fail the replay check.
+    struct Message* dupe = NULL;
+    if (ctx->encrypted == 1) {
+        dupe = Message_clone(msg, Allocator_child(ctx->alloc));
+    }
+    if (CryptoAuth_decryptAsync(ctx->sess2, msg, decrypted, ctx)) {
+        Assert_failure("expected the message to be taken");
+    }
+    if (dupe) {
+        Assert_true(!CryptoAuth_decryptAsync(ctx->sess2, dupe, decrypted, ctx));
+        Allocator_free(dupe->alloc);
+    }
+}
+
+static void inOrder(struct Context* ctx)
+{
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        struct Message* msg = newMsg(ctx, i);
+        Assert_true(!CryptoAuth_encryptAsync(ctx->sess1, msg, encrypted, ctx));
+        // The job has adopted the message.
+        Allocator_free(msg->alloc);
+    }
+    Assert_true(!ctx->encrypted);
+    EventBase_beginLoop(ctx->base);
+    Assert_true(ctx->encrypted == MESSAGES);
+    Assert_true(ctx->decrypted == MESSAGES);
+    Assert_true(ctx->replays == 1);
+}
+
+static void neverCalled(struct Message* msg, int err, void* vctx)
+{
+    Assert_failure("callback after the session was freed");
+}
+
+static void endLoop(void* vctx)
+{
+    struct Context* ctx = vctx;
+    EventBase_endLoop(ctx->base);
+}
+
+static void freedWhileWorking(struct Context* ctx)
+{
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        struct Message* msg = newMsg(ctx, i);
+        Assert_true(!CryptoAuth_encryptAsync(ctx->sess1, msg, neverCalled, ctx));
+        Allocator_free(msg->alloc);
+    }
+    Allocator_free(ctx->sessAlloc1);
+    Timeout_setTimeout(endLoop, ctx, 100, ctx->base, ctx->alloc);
+    EventBase_beginLoop(ctx->base);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<24);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->alloc = alloc;
+    struct Log* logger = FileWriterLog_new(stdout, alloc);
+    struct Random* rand = Random_new(alloc, logger, NULL);
+    ctx->base = EventBase_new(alloc);
+
+    ctx->ca1 = CryptoAuth_new(alloc, PRIVATEKEY_A, ctx->base, logger, rand);
+    ctx->sessAlloc1 = Allocator_child(alloc);
+    ctx->sess1 = CryptoAuth_newSession(ctx->ca1, ctx->sessAlloc1, PUBLICKEY_B, false, "cif1");
+    ctx->ca2 = CryptoAuth_new(alloc, PRIVATEKEY_B, ctx->base, logger, rand);
+    ctx->sess2 = CryptoAuth_newSession(ctx->ca2, alloc, PUBLICKEY_A, false, "cif2");
+
+    // Nothing is deferred until workers are enabled.
+    Assert_true(!CryptoAuth_isAsync(ctx->sess1));
+    struct Message* msg = newMsg(ctx, 0);
+    Assert_true(CryptoAuth_encryptAsync(ctx->sess1, msg, neverCalled, ctx));
+    Allocator_free(msg->alloc);
+
+    // Handshake.
+    sync(ctx, ctx->sess1, ctx->sess2);
+    sync(ctx, ctx->sess2, ctx->sess1);
+    sync(ctx, ctx->sess1, ctx->sess2);
+    Assert_true(CryptoAuth_getState(ctx->sess2) == CryptoAuth_State_ESTABLISHED);
+
+    Assert_true(!CryptoAuth_setWorkers(ctx->ca1, 2));
+    Assert_true(!CryptoAuth_setWorkers(ctx->ca2, 2));
+    Assert_true(CryptoAuth_setWorkers(ctx->ca2, 3));
+    // The pool keeps the size it was started with.
+    Assert_true(Work_threadCount() == 2);
+
+    inOrder(ctx);
+    freedWhileWorking(ctx);
+
+    Allocator_free(alloc);
+    return 0;
+}
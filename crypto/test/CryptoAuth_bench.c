@@ -0,0 +1,86 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/CryptoAuth.h"
+#include "test/Bench.h"
+#include "util/Assert.h"
+#include "wire/CryptoHeader.h"
+#include "wire/Message.h"
+
+#define PAYLOAD_SIZE 1024
+
+struct Context
+{
+    struct CryptoAuth* ca1;
+    struct CryptoAuth* ca2;
+    struct CryptoAuth_Session* sess1;
+    struct CryptoAuth_Session* sess2;
+    struct Allocator* alloc;
+};
+
+static void sendMsg(struct CryptoAuth_Session* from,
+                    struct CryptoAuth_Session* to,
+                    struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(PAYLOAD_SIZE, CryptoHeader_SIZE, alloc);
+    Bits_memset(msg->bytes, 0, PAYLOAD_SIZE);
+    Assert_true(!CryptoAuth_encrypt(from, msg));
+    Assert_true(!CryptoAuth_decrypt(to, msg));
+    Assert_true(msg->length == PAYLOAD_SIZE);
+}
+
+static void handshake(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        struct CryptoAuth_Session* sess1 =
+            CryptoAuth_newSession(ctx->ca1, alloc, ctx->ca2->publicKey, false, "bench1");
+        struct CryptoAuth_Session* sess2 =
+            CryptoAuth_newSession(ctx->ca2, alloc, ctx->ca1->publicKey, false, "bench2");
+        // hello, key, then the first data packet which completes the handshake.
+        sendMsg(sess1, sess2, alloc);
+        sendMsg(sess2, sess1, alloc);
+        sendMsg(sess1, sess2, alloc);
+        Allocator_free(alloc);
+    }
+}
+
+static void established(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        sendMsg(ctx->sess1, ctx->sess2, alloc);
+        Allocator_free(alloc);
+    }
+}
+
+int main(struct Bench* bench)
+{
+    struct Context* ctx = Allocator_calloc(bench->alloc, sizeof(struct Context), 1);
+    ctx->alloc = bench->alloc;
+    ctx->ca1 = CryptoAuth_new(bench->alloc, NULL, bench->base, NULL, bench->rand);
+    ctx->ca2 = CryptoAuth_new(bench->alloc, NULL, bench->base, NULL, bench->rand);
+
+    Bench_run(bench, "handshake", handshake, ctx);
+
+    ctx->sess1 = CryptoAuth_newSession(ctx->ca1, bench->alloc, ctx->ca2->publicKey, false, "b1");
+    ctx->sess2 = CryptoAuth_newSession(ctx->ca2, bench->alloc, ctx->ca1->publicKey, false, "b2");
+    sendMsg(ctx->sess1, ctx->sess2, bench->alloc);
+    sendMsg(ctx->sess2, ctx->sess1, bench->alloc);
+    sendMsg(ctx->sess1, ctx->sess2, bench->alloc);
+    Bench_run(bench, "established", established, ctx);
+    return 0;
+}
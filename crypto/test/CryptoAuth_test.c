@@ -13,7 +13,7 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "crypto/random/Random.h"
-#include "crypto/CryptoAuth.h"
+#include "crypto/CryptoAuth_pvt.h"
 #include "benc/String.h"
 #include "memory/MallocAllocator.h"
 #include "util/events/EventBase.h"
@@ -24,6 +24,8 @@
 #include "util/log/FileWriterLog.h"
 #include "wire/CryptoHeader.h"
 
+#include <stdio.h>
+
 #define PRIVATEKEY_A \
     Constant_stringForHex("53ff22b2eb94ce8c5f1852c0f557eb901f067e5273d541e0a21e143c20dff9da")
 #define PUBLICKEY_A \
@@ -191,6 +193,52 @@ static void auth()
     Allocator_free(ctx->alloc);
 }
 
+static void newSessions(struct Context* ctx, String* password, String* login)
+{
+    ctx->sess1 = CryptoAuth_newSession(ctx->ca1, ctx->alloc, PUBLICKEY_B, false, "cif1");
+    ctx->sess2 = CryptoAuth_newSession(ctx->ca2, ctx->alloc, PUBLICKEY_A, false, "cif2");
+    CryptoAuth_setAuth(password, login, ctx->sess1);
+}
+
+static void helloRejected(struct Context* ctx)
+{
+    struct Message* msg = encryptMsg(ctx, ctx->sess1, "hello world");
+    Assert_true(CryptoAuth_decrypt(ctx->sess2, msg) == CryptoAuth_DecryptErr_UNRECOGNIZED_AUTH);
+    Allocator_free(msg->alloc);
+}
+
+static void manyUsers()
+{
+    struct Context* ctx = simpleInit();
+    for (int i = 0; i < 1000; i++) {
+        // Pairs of users share a password.
+        String* password = String_printf(ctx->alloc, "pass%d", i / 2);
+        String* login = String_printf(ctx->alloc, "user%d", i);
+        Assert_true(!CryptoAuth_addUser(password, login, ctx->ca2));
+    }
+    Assert_true(CryptoAuth_addUser_DUPLICATE ==
+        CryptoAuth_addUser(String_CONST("pass300"), String_CONST("user601"), ctx->ca2));
+
+    newSessions(ctx, String_CONST("pass300"), String_CONST("user601"));
+    sendToIf2(ctx, "hello world");
+    sendToIf1(ctx, "hello cjdns");
+
+    Assert_true(CryptoAuth_removeUsers(ctx->ca2, String_CONST("user601")) == 1);
+    newSessions(ctx, String_CONST("pass300"), String_CONST("user601"));
+    helloRejected(ctx);
+
+    // The other user with the same password still matches by password alone.
+    newSessions(ctx, String_CONST("pass300"), NULL);
+    sendToIf2(ctx, "hello world");
+    sendToIf1(ctx, "hello cjdns");
+
+    Assert_true(CryptoAuth_removeUsers(ctx->ca2, NULL) == 999);
+    newSessions(ctx, String_CONST("pass300"), NULL);
+    helloRejected(ctx);
+
+    Allocator_free(ctx->alloc);
+}
+
 static void replayKeyPacket(int scenario)
 {
     struct Context* ctx = simpleInit();
@@ -303,6 +351,74 @@ static void twoKeyPackets(int scenario)
     Allocator_free(ctx->alloc);
 }
 
+static void cachedSecrets()
+{
+    struct Context* ctx = simpleInit();
+    struct CryptoAuth_pvt* ca1 = (struct CryptoAuth_pvt*) ctx->ca1;
+    struct CryptoAuth_pvt* ca2 = (struct CryptoAuth_pvt*) ctx->ca2;
+    sendToIf2(ctx, "hello world");
+    sendToIf1(ctx, "hello cjdns");
+    Assert_true(ca1->secretCache->misses == 1 && ca1->secretCache->hits == 0);
+    Assert_true(ca2->secretCache->misses == 1 && ca2->secretCache->hits == 0);
+
+    // Handshaking again with the same keys does not recompute the permanent secret.
+    for (int i = 0; i < 3; i++) {
+        CryptoAuth_reset(ctx->sess1);
+        CryptoAuth_reset(ctx->sess2);
+        sendToIf2(ctx, "hello again");
+        sendToIf1(ctx, "ok works");
+    }
+    Assert_true(ca1->secretCache->misses == 1 && ca1->secretCache->hits == 3);
+    Assert_true(ca2->secretCache->misses == 1 && ca2->secretCache->hits == 3);
+    Allocator_free(ctx->alloc);
+
+    // With a password the secret is different, and a wrong password must not get it.
+    ctx = init(PRIVATEKEY_A, PUBLICKEY_A, "password", PRIVATEKEY_B, PUBLICKEY_B);
+    sendToIf2(ctx, "hello world");
+    sendToIf1(ctx, "hello cjdns");
+    CryptoAuth_reset(ctx->sess1);
+    CryptoAuth_reset(ctx->sess2);
+    CryptoAuth_setAuth(String_CONST("wrong"), NULL, ctx->sess1);
+    decryptMsg(ctx, encryptMsg(ctx, ctx->sess1, "hello"), ctx->sess2, NULL);
+    Allocator_free(ctx->alloc);
+}
+
+static void batch()
+{
+    struct Context* ctx = simpleInit();
+    sendToIf2(ctx, "hello world");
+    sendToIf1(ctx, "hello cjdns");
+
+    // Both directions interleaved, longer than one batch so it is flushed part way through.
+    #define BATCH_COUNT 19
+    struct Message* msgs[BATCH_COUNT];
+    struct CryptoAuth_Session* sessions[BATCH_COUNT];
+    char text[BATCH_COUNT][48];
+    for (int i = 0; i < BATCH_COUNT; i++) {
+        snprintf(text[i], 48, "batched message %d%s", i, (i % 4) ? "" : " with more text");
+        sessions[i] = (i % 3) ? ctx->sess1 : ctx->sess2;
+        int len = CString_strlen(text[i]);
+        msgs[i] = Message_new(((len / 8) + 1) * 8, CryptoHeader_SIZE, ctx->alloc);
+        Bits_memcpy(msgs[i]->bytes, text[i], len);
+        msgs[i]->length = len;
+    }
+    CryptoAuth_encryptBatch(sessions, msgs, BATCH_COUNT);
+    for (int i = 0; i < BATCH_COUNT; i++) {
+        decryptMsg(ctx, msgs[i], (i % 3) ? ctx->sess2 : ctx->sess1, text[i]);
+    }
+
+    // A session which is not set up yet gets its handshake done the normal way.
+    struct CryptoAuth_Session* fresh =
+        CryptoAuth_newSession(ctx->ca1, ctx->alloc, PUBLICKEY_B, false, "fresh");
+    struct Message* hello = Message_new(8, CryptoHeader_SIZE, ctx->alloc);
+    Bits_memcpy(hello->bytes, "hello", 5);
+    hello->length = 5;
+    CryptoAuth_encryptBatch(&fresh, &hello, 1);
+    Assert_true(hello->length >= CryptoHeader_SIZE + 5);
+    Assert_true(CryptoAuth_getState(fresh) == CryptoAuth_State_SENT_HELLO);
+    Allocator_free(ctx->alloc);
+}
+
 int main()
 {
     normal();
@@ -318,5 +434,8 @@ int main()
     twoKeyPackets(1);
     twoKeyPackets(2);
     twoKeyPackets(3);
+    batch();
+    cachedSecrets();
+    manyUsers();
     return 0;
 }
@@ -230,7 +230,7 @@ static Iface_DEFUN connected(struct Pathfinder_pvt* pf, struct Message* msg)
 
     // Now the admin stuff...
     if (pf->admin) {
-        NodeStore_admin_register(pf->nodeStore, pf->admin, pf->alloc);
+        NodeStore_admin_register(pf->nodeStore, pf->admin, pf->base, pf->alloc);
         RouterModule_admin_register(routerModule, pf->router, pf->admin, pf->alloc);
         SearchRunner_admin_register(pf->searchRunner, pf->admin, pf->alloc);
         Janitor_admin_register(pf->janitor, pf->admin, pf->alloc);
@@ -70,6 +70,10 @@ struct Node_Two
         int rbe_color;
     } nodeTree;
 
+    /** Used by nodeStore's list of nodes which fall in the same keyspace bucket. */
+    struct Node_Two* nextInBucket;
+    struct Node_Two* prevInBucket;
+
     struct Allocator* alloc;
 
     Identity
@@ -43,6 +43,12 @@ struct NodeStore_pvt
         struct Node_Two* rbh_root;
     } nodeTree;
 
+    /**
+     * Every node in the tree, grouped by NodeStore_bucketForAddr() so that finding the nodes
+     * which protect a bucket doesn't require walking the whole tree.
+     */
+    struct Node_Two* buckets[NodeStore_bucketNumber];
+
     struct Allocator* alloc;
 
     /**
@@ -107,6 +113,32 @@ static int compareNodes(const struct Node_Two* na, const struct Node_Two* nb)
 
 RB_GENERATE_STATIC(NodeRBTree, Node_Two, nodeTree, compareNodes)
 
+static void bucketInsert(struct Node_Two* node, struct NodeStore_pvt* store)
+{
+    uint16_t bucket = NodeStore_bucketForAddr(&store->pub.selfNode->address, &node->address);
+    node->prevInBucket = NULL;
+    node->nextInBucket = store->buckets[bucket];
+    if (node->nextInBucket) {
+        node->nextInBucket->prevInBucket = node;
+    }
+    store->buckets[bucket] = node;
+}
+
+static void bucketRemove(struct Node_Two* node, struct NodeStore_pvt* store)
+{
+    if (node->nextInBucket) {
+        node->nextInBucket->prevInBucket = node->prevInBucket;
+    }
+    if (node->prevInBucket) {
+        node->prevInBucket->nextInBucket = node->nextInBucket;
+    } else {
+        uint16_t bucket = NodeStore_bucketForAddr(&store->pub.selfNode->address, &node->address);
+        Assert_true(store->buckets[bucket] == node);
+        store->buckets[bucket] = node->nextInBucket;
+    }
+    node->nextInBucket = node->prevInBucket = NULL;
+}
+
 static void freeLink(struct Node_Link* link, struct NodeStore_pvt* store)
 {
     Allocator_realloc(store->alloc, link, 0);
@@ -644,6 +676,7 @@ static struct Node_Link* linkNodes(struct Node_Two* parent,
             store->pub.linkedNodes++;
         }
         RB_INSERT(NodeRBTree, &store->nodeTree, child);
+        bucketInsert(child, store);
         store->pub.nodeCount++;
     }
 
@@ -1107,6 +1140,44 @@ static struct Node_Two* whichIsWorse(struct Node_Two* one,
     return one;
 }
 
+/**
+ * Fill nodes with the (at most) count best nodes in the bucket, best first.
+ * @return the number of nodes found.
+ */
+static uint32_t bestNodesForBucket(struct NodeStore_pvt* store,
+                                   uint16_t bucket,
+                                   struct Node_Two** nodes,
+                                   const uint32_t count)
+{
+    uint32_t size = 0;
+    for (struct Node_Two* nn = store->buckets[bucket]; nn; nn = nn->nextInBucket) {
+        Assert_ifParanoid(NodeStore_bucketForAddr(store->pub.selfAddress, &nn->address) == bucket);
+        if (Node_getCost(nn) == UINT64_MAX) { continue; }
+        struct Node_Two* newNode = nn;
+        struct Node_Two* tempNode = NULL;
+        for (uint32_t i = 0 ; i < count ; i++) {
+            if (size < i+1) {
+                // The list isn't full yet, so insert at the end.
+                size = i+1;
+                nodes[i] = newNode;
+                break;
+            }
+            if ( (newNode->marked && !nodes[i]->marked) ||
+                  whichIsWorse(nodes[i], newNode, store) == nodes[i] ) {
+                // If we've already marked nodes because they're a bestParent,
+                // lets give them priority in the bucket since we need to keep
+                // them either way.
+                // Otherwise, decide based on whichIsWorse().
+                // Insertion sorted list.
+                tempNode = nodes[i];
+                nodes[i] = newNode;
+                newNode = tempNode;
+            }
+        }
+    }
+    return size;
+}
+
 struct NodeList* NodeStore_getNodesForBucket(struct NodeStore* nodeStore,
                                              struct Allocator* allocator,
                                              uint16_t bucket,
@@ -1115,65 +1186,22 @@ struct NodeList* NodeStore_getNodesForBucket(struct NodeStore* nodeStore,
     struct NodeStore_pvt* store = Identity_check((struct NodeStore_pvt*)nodeStore);
     struct NodeList* nodeList = Allocator_malloc(allocator, sizeof(struct NodeList));
     nodeList->nodes = Allocator_calloc(allocator, count, sizeof(char*));
-    nodeList->size = 0;
-    struct Node_Two* nn = NULL;
-    RB_FOREACH(nn, NodeRBTree, &store->nodeTree) {
-        if (Node_getCost(nn) == UINT64_MAX) { continue; }
-        if (NodeStore_bucketForAddr(store->pub.selfAddress, &nn->address) == bucket) {
-            struct Node_Two* newNode = nn;
-            struct Node_Two* tempNode = NULL;
-            for (uint32_t i = 0 ; i < count ; i++) {
-                if (nodeList->size < i+1) {
-                    // The list isn't full yet, so insert at the end.
-                    nodeList->size = i+1;
-                    nodeList->nodes[i] = newNode;
-                    break;
-                }
-                if ( (newNode->marked && !nodeList->nodes[i]->marked) ||
-                      whichIsWorse(nodeList->nodes[i], newNode, store) == nodeList->nodes[i] ) {
-                    // If we've already marked nodes because they're a bestParent,
-                    // lets give them priority in the bucket since we need to keep
-                    // them either way.
-                    // Otherwise, decide based on whichIsWorse().
-                    // Insertion sorted list.
-                    tempNode = nodeList->nodes[i];
-                    nodeList->nodes[i] = newNode;
-                    newNode = tempNode;
-                }
-            }
-        }
-    }
+    nodeList->size = bestNodesForBucket(store, bucket, nodeList->nodes, count);
     return nodeList;
 }
 
-static bool markNodesForBucket(struct NodeStore_pvt* store,
-                               uint16_t bucket,
-                               const uint32_t count)
-{
-    struct Allocator* nodeListAlloc = Allocator_child(store->alloc);
-    struct NodeList* nodeList = NodeStore_getNodesForBucket(&store->pub,
-                                                            nodeListAlloc,
-                                                            bucket,
-                                                            count);
-    bool retVal = false;
-    if (nodeList->size > 0) { retVal = true; }
-
-    for (uint32_t i = 0; i < nodeList->size; i++) {
-        // Now mark the nodes in the list to protect them.
-        Identity_check(nodeList->nodes[i]);
-        nodeList->nodes[i]->marked = 1;
-    }
-
-    // Cleanup
-    Allocator_free(nodeListAlloc);
-
-    return retVal;
-}
-
+/**
+ * Mark the best nodes in each bucket to protect them.
+ * This only visits each node once because nodes are kept grouped by bucket.
+ */
 static void markKeyspaceNodes(struct NodeStore_pvt* store)
 {
+    struct Node_Two* nodes[NodeStore_bucketSize];
     for (uint16_t bucket = 0; bucket < NodeStore_bucketNumber ; bucket++) {
-        markNodesForBucket(store, bucket, NodeStore_bucketSize);
+        uint32_t size = bestNodesForBucket(store, bucket, nodes, NodeStore_bucketSize);
+        for (uint32_t i = 0; i < size; i++) {
+            Identity_check(nodes[i])->marked = 1;
+        }
     }
 }
 
@@ -1269,6 +1297,7 @@ static void destroyNode(struct Node_Two* node, struct NodeStore_pvt* store)
 
     Assert_ifParanoid(node == RB_FIND(NodeRBTree, &store->nodeTree, node));
     RB_REMOVE(NodeRBTree, &store->nodeTree, node);
+    bucketRemove(node, store);
     store->pub.nodeCount--;
 
     Allocator_free(node->alloc);
@@ -1695,6 +1724,18 @@ struct Node_Two* NodeStore_getNextNode(struct NodeStore* nodeStore, struct Node_
     return Identity_ncheck(NodeRBTree_RB_NEXT(lastNode));
 }
 
+struct Node_Two* NodeStore_getNodeAfter(struct NodeStore* nodeStore, uint8_t ip6[16])
+{
+    struct NodeStore_pvt* store = Identity_check((struct NodeStore_pvt*)nodeStore);
+    struct Node_Two dummy;
+    Bits_memcpy(dummy.address.ip6.bytes, ip6, 16);
+    struct Node_Two* nn = Identity_ncheck(RB_NFIND(NodeRBTree, &store->nodeTree, &dummy));
+    if (nn && !compareNodes(&dummy, nn)) {
+        nn = Identity_ncheck(NodeRBTree_RB_NEXT(nn));
+    }
+    return nn;
+}
+
 static struct Node_Two* getBestCycleB(struct Node_Two* node,
                                       uint8_t target[16],
                                       struct NodeStore_pvt* store)
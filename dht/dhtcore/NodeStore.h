@@ -219,6 +219,13 @@ void NodeStore_brokenLink(struct NodeStore* nodeStore, uint64_t path, uint64_t p
 void NodeStore_disconnectedPeer(struct NodeStore* nodeStore, uint64_t path);
 
 struct Node_Two* NodeStore_getNextNode(struct NodeStore* nodeStore, struct Node_Two* lastNode);
+
+/**
+ * Get the first node (in the same order as NodeStore_getNextNode()) whose address comes after
+ * ip6. The node for ip6 needn't exist anymore, this allows resuming a walk of the table
+ * without holding a pointer to a node which might have been freed in the meantime.
+ */
+struct Node_Two* NodeStore_getNodeAfter(struct NodeStore* nodeStore, uint8_t ip6[16]);
 struct Node_Link* NodeStore_getNextLink(struct NodeStore* nodeStore, struct Node_Link* last);
 
 uint64_t NodeStore_timeSinceLastPing(struct NodeStore* nodeStore, struct Node_Two* node);
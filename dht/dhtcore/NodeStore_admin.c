@@ -23,62 +23,93 @@
 #include "memory/Allocator.h"
 #include "switch/EncodingScheme.h"
 #include "util/AddrTools.h"
+#include "util/Bits.h"
+#include "util/Hex.h"
+#include "util/events/Timeout.h"
 #include "util/version/Version.h"
 
 struct Context {
     struct Admin* admin;
     struct Allocator* alloc;
     struct NodeStore* store;
+    struct EventBase* base;
+
     Identity
 };
 
-
-#define ENTRIES_PER_PAGE 4
-static void dumpTable(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+static Dict* nodeDict(struct Context* ctx, struct Node_Two* nn, struct Allocator* requestAlloc)
 {
-    struct Context* ctx = Identity_check((struct Context*) vcontext);
-    int64_t* page = Dict_getIntC(args, "page");
-    int ctr = (page) ? *page * ENTRIES_PER_PAGE : 0;
+    Dict* nodeDict = Dict_new(requestAlloc);
 
-    Dict* out = Dict_new(requestAlloc);
-    List* table = List_new(requestAlloc);
-    struct Node_Two* nn = NULL;
-    for (int i = 0; i < ctr+ENTRIES_PER_PAGE; i++) {
-        nn = NodeStore_getNextNode(ctx->store, nn);
-        if (!nn) { break; }
-        if (i < ctr) { continue; }
-        Dict* nodeDict = Dict_new(requestAlloc);
+    String* ip = String_newBinary(NULL, 39, requestAlloc);
+    Address_printIp(ip->bytes, &nn->address);
+    Dict_putStringC(nodeDict, "ip", ip, requestAlloc);
 
-        String* ip = String_newBinary(NULL, 39, requestAlloc);
-        Address_printIp(ip->bytes, &nn->address);
-        Dict_putStringC(nodeDict, "ip", ip, requestAlloc);
+    String* addr = Address_toString(&nn->address, requestAlloc);
+    Dict_putStringC(nodeDict, "addr", addr, requestAlloc);
 
-        String* addr = Address_toString(&nn->address, requestAlloc);
-        Dict_putStringC(nodeDict, "addr", addr, requestAlloc);
+    String* path = String_newBinary(NULL, 19, requestAlloc);
+    AddrTools_printPath(path->bytes, nn->address.path);
+    Dict_putStringC(nodeDict, "path", path, requestAlloc);
 
-        String* path = String_newBinary(NULL, 19, requestAlloc);
-        AddrTools_printPath(path->bytes, nn->address.path);
-        Dict_putStringC(nodeDict, "path", path, requestAlloc);
+    Dict_putIntC(nodeDict, "link", Node_getCost(nn), requestAlloc);
+    Dict_putIntC(nodeDict, "version", nn->address.protocolVersion, requestAlloc);
 
-        Dict_putIntC(nodeDict, "link", Node_getCost(nn), requestAlloc);
-        Dict_putIntC(nodeDict, "version", nn->address.protocolVersion, requestAlloc);
+    Dict_putIntC(nodeDict,
+                "time",
+                NodeStore_timeSinceLastPing(ctx->store, nn),
+                requestAlloc);
 
-        Dict_putIntC(nodeDict,
-                    "time",
-                    NodeStore_timeSinceLastPing(ctx->store, nn),
-                    requestAlloc);
+    Dict_putIntC(nodeDict,
+                "bucket",
+                NodeStore_bucketForAddr(ctx->store->selfAddress, &nn->address),
+                requestAlloc);
 
-        Dict_putIntC(nodeDict,
-                    "bucket",
-                    NodeStore_bucketForAddr(ctx->store->selfAddress, &nn->address),
-                    requestAlloc);
+    return nodeDict;
+}
 
-        List_addDict(table, nodeDict, requestAlloc);
+#define ENTRIES_PER_PAGE 4
+static void dumpTable(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    int64_t* pagePtr = Dict_getIntC(args, "page");
+    int64_t page = (pagePtr) ? *pagePtr : 0;
+    String* cursor = Dict_getStringC(args, "cursor");
+
+    // The cursor is the last node of the previous page so that a full dump doesn't walk the
+    // table from the start for every page, it is kept by the caller so callers can't mix up
+    // each other's walks.
+    uint8_t lastIp[16];
+    struct Node_Two* nn;
+    if (cursor) {
+        if (cursor->len != 32 || Hex_decode(lastIp, 16, cursor->bytes, 32) != 16) {
+            Dict* out = Dict_new(requestAlloc);
+            Dict_putStringCC(out, "error", "invalid cursor", requestAlloc);
+            Admin_sendMessage(out, txid, ctx->admin);
+            return;
+        }
+        nn = NodeStore_getNodeAfter(ctx->store, lastIp);
+    } else {
+        nn = NodeStore_getNextNode(ctx->store, NULL);
+        for (int64_t i = 0; nn && i < page * ENTRIES_PER_PAGE; i++) {
+            nn = NodeStore_getNextNode(ctx->store, nn);
+        }
+    }
+
+    Dict* out = Dict_new(requestAlloc);
+    List* table = List_new(requestAlloc);
+    for (int i = 0; nn && i < ENTRIES_PER_PAGE; i++) {
+        List_addDict(table, nodeDict(ctx, nn, requestAlloc), requestAlloc);
+        Bits_memcpy(lastIp, nn->address.ip6.bytes, 16);
+        nn = NodeStore_getNextNode(ctx->store, nn);
     }
     Dict_putListC(out, "routingTable", table, requestAlloc);
 
     if (nn) {
         Dict_putIntC(out, "more", 1, requestAlloc);
+        String* next = String_newBinary(NULL, 32, requestAlloc);
+        Hex_encode(next->bytes, 33, lastIp, 16);
+        Dict_putStringC(out, "cursor", next, requestAlloc);
     }
     Dict_putIntC(out, "count", ctx->store->nodeCount, requestAlloc);
     Dict_putIntC(out, "peers", ctx->store->peerCount, requestAlloc);
@@ -89,6 +120,72 @@ static void dumpTable(Dict* args, void* vcontext, String* txid, struct Allocator
     Admin_sendMessage(out, txid, ctx->admin);
 }
 
+#define ENTRIES_PER_STREAM_MESSAGE 64
+struct DumpStream
+{
+    struct Context* ctx;
+    struct Allocator* alloc;
+    String* txid;
+    struct Timeout* next;
+    uint8_t lastIp[16];
+    bool started;
+    Identity
+};
+
+/** Send one message worth of nodes then yield to the event loop so switching isn't blocked. */
+static void dumpStreamNext(void* vstream)
+{
+    struct DumpStream* stream = Identity_check((struct DumpStream*) vstream);
+    struct Context* ctx = stream->ctx;
+    struct Allocator* alloc = Allocator_child(stream->alloc);
+
+    struct Node_Two* nn = (stream->started)
+        ? NodeStore_getNodeAfter(ctx->store, stream->lastIp)
+        : NodeStore_getNextNode(ctx->store, NULL);
+    stream->started = true;
+
+    Dict* out = Dict_new(alloc);
+    List* table = List_new(alloc);
+    for (int i = 0; nn && i < ENTRIES_PER_STREAM_MESSAGE; i++) {
+        List_addDict(table, nodeDict(ctx, nn, alloc), alloc);
+        Bits_memcpy(stream->lastIp, nn->address.ip6.bytes, 16);
+        nn = NodeStore_getNextNode(ctx->store, nn);
+    }
+    Dict_putListC(out, "routingTable", table, alloc);
+    if (nn) {
+        Dict_putIntC(out, "more", 1, alloc);
+    }
+    Dict_putIntC(out, "count", ctx->store->nodeCount, alloc);
+    Dict_putIntC(out, "peers", ctx->store->peerCount, alloc);
+    Dict_putStringCC(out, "error", "none", alloc);
+
+    int ret = Admin_sendMessage(out, stream->txid, ctx->admin);
+    Allocator_free(alloc);
+
+    if (nn && !ret) {
+        Timeout_resetTimeout(stream->next, 0);
+    } else {
+        Allocator_free(stream->alloc);
+    }
+}
+
+static void dumpTableStream(Dict* args,
+                            void* vcontext,
+                            String* txid,
+                            struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct DumpStream* stream = Allocator_calloc(alloc, sizeof(struct DumpStream), 1);
+    Identity_set(stream);
+    stream->ctx = ctx;
+    stream->alloc = alloc;
+    stream->txid = String_clone(txid, alloc);
+    stream->next = Timeout_setTimeout(dumpStreamNext, stream, 0, ctx->base, alloc);
+    Timeout_clearTimeout(stream->next);
+    dumpStreamNext(stream);
+}
+
 static int linkCount(struct Node_Two* parent)
 {
     struct Node_Link* link = NULL;
@@ -320,19 +417,23 @@ static void setFullVerify(Dict* args, void* vcontext, String* txid, struct Alloc
 
 void NodeStore_admin_register(struct NodeStore* nodeStore,
                               struct Admin* admin,
+                              struct EventBase* base,
                               struct Allocator* alloc)
 {
     struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
         .admin = admin,
         .alloc = alloc,
-        .store = nodeStore
+        .store = nodeStore,
+        .base = base
     }));
     Identity_set(ctx);
 
     Admin_registerFunction("NodeStore_dumpTable", dumpTable, ctx, false,
         ((struct Admin_FunctionArg[]) {
             { .name = "page", .required = true, .type = "Int" },
+            { .name = "cursor", .required = false, .type = "String" },
         }), admin);
+    Admin_registerFunction("NodeStore_dumpTableStream", dumpTableStream, ctx, false, NULL, admin);
 
     Admin_registerFunction("NodeStore_getLink", getLink, ctx, false,
         ((struct Admin_FunctionArg[]) {
@@ -22,11 +22,13 @@
 #include "admin/Admin.h"
 #include "dht/dhtcore/NodeStore.h"
 #include "memory/Allocator.h"
+#include "util/events/EventBase.h"
 #include "util/Linker.h"
 Linker_require("dht/dhtcore/NodeStore_admin.c");
 
 void NodeStore_admin_register(struct NodeStore* module,
                               struct Admin* admin,
+                              struct EventBase* base,
                               struct Allocator* alloc);
 
 #endif
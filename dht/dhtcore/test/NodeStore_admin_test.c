@@ -0,0 +1,199 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/standard/BencMessageReader.h"
+#include "benc/serialization/standard/BencMessageWriter.h"
+#include "crypto/random/Random.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/NodeStore_admin.h"
+#include "interface/addressable/AddrIface.h"
+#include "memory/MallocAllocator.h"
+#include "switch/NumberCompress.h"
+#include "util/Assert.h"
+#include "util/events/EventBase.h"
+#include "util/Identity.h"
+#include "util/platform/Sockaddr.h"
+#include "util/version/Version.h"
+
+#define NODES 30
+
+struct Context
+{
+    /** Stands in for the admin socket, requests are sent in and responses come out. */
+    struct AddrIface ai;
+
+    Dict* response;
+    struct Allocator* responseAlloc;
+
+    Identity
+};
+
+/** A client of the admin interface walking the table. */
+struct Walker
+{
+    struct Sockaddr_storage addr;
+    int64_t page;
+    String* cursor;
+    int count;
+    String* ips[NODES + 1];
+};
+
+static Iface_DEFUN receiveResponse(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_check((struct Context*) iface);
+    Message_pop(msg, NULL, ctx->ai.addr->addrLen, NULL);
+    ctx->response = BencMessageReader_read(msg, ctx->responseAlloc, NULL);
+    return NULL;
+}
+
+static Dict* dumpTable(struct Context* ctx,
+                       struct Sockaddr* from,
+                       int64_t page,
+                       String* cursor,
+                       struct Allocator* alloc)
+{
+    Dict* args = Dict_new(alloc);
+    Dict_putIntC(args, "page", page, alloc);
+    if (cursor) { Dict_putStringC(args, "cursor", cursor, alloc); }
+    Dict* req = Dict_new(alloc);
+    Dict_putStringCC(req, "q", "NodeStore_dumpTable", alloc);
+    Dict_putDictC(req, "args", args, alloc);
+    Dict_putStringCC(req, "txid", "walk", alloc);
+
+    struct Message* msg = Message_new(0, 1024, alloc);
+    BencMessageWriter_write(req, msg, NULL);
+    Message_push(msg, from, from->addrLen, NULL);
+
+    ctx->response = NULL;
+    ctx->responseAlloc = alloc;
+    Iface_send(&ctx->ai.iface, msg);
+    Assert_true(ctx->response);
+    return ctx->response;
+}
+
+/** Ask for the walker's next page, return false once the walk is finished. */
+static bool nextPage(struct Context* ctx, struct Walker* w, struct Allocator* alloc)
+{
+    Dict* resp = dumpTable(ctx, &w->addr.addr, w->page, w->cursor, alloc);
+    List* table = Dict_getListC(resp, "routingTable");
+    Assert_true(table);
+    for (int i = 0; i < List_size(table); i++) {
+        Assert_true(w->count < NODES + 1);
+        w->ips[w->count++] = Dict_getStringC(List_getDict(table, i), "ip");
+    }
+    w->page++;
+    w->cursor = Dict_getStringC(resp, "cursor");
+    Assert_true(!w->cursor == !Dict_getIntC(resp, "more"));
+    return w->cursor != NULL;
+}
+
+static void checkWalk(struct Walker* w, String** expected, int count)
+{
+    Assert_true(w->count == count);
+    for (int i = 0; i < count; i++) {
+        Assert_true(String_equals(w->ips[i], expected[i]));
+    }
+}
+
+static void randomAddress(struct Address* addr, uint64_t path, struct Random* rand)
+{
+    addr->protocolVersion = Version_CURRENT_PROTOCOL;
+    Random_bytes(rand, addr->key, Address_KEY_SIZE);
+    Random_bytes(rand, addr->ip6.bytes, 16);
+    addr->ip6.bytes[0] = 0xfc;
+    addr->path = path;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+
+    struct Address myAddr = { .path = 1 };
+    randomAddress(&myAddr, 1, rand);
+    struct NodeStore* store = NodeStore_new(&myAddr, alloc, base, NULL, NULL);
+    struct EncodingScheme* scheme = NumberCompress_v3x5x8_defineScheme(alloc);
+    for (uint32_t i = 2; i < NODES + 1; i++) {
+        uint32_t bits = NumberCompress_v3x5x8_bitsUsedForNumber(i);
+        uint64_t label = (((uint64_t)1) << bits) | NumberCompress_v3x5x8_getCompressed(i, bits);
+        struct Address addr = { .path = 0 };
+        randomAddress(&addr, label, rand);
+        Assert_true(NodeStore_discoverNode(store, &addr, scheme, 0, 100));
+    }
+
+    // The order which every walk should see.
+    String* expected[NODES + 1];
+    int count = 0;
+    for (struct Node_Two* nn = NodeStore_getNextNode(store, NULL);
+        nn;
+        nn = NodeStore_getNextNode(store, nn))
+    {
+        Assert_true(count < NODES + 1);
+        expected[count] = String_newBinary(NULL, 39, alloc);
+        Address_printIp(expected[count++]->bytes, &nn->address);
+    }
+    Assert_true(count == NODES);
+
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    struct Sockaddr_storage adminAddr;
+    Assert_true(!Sockaddr_parse("127.0.0.1:1", &adminAddr));
+    ctx->ai.addr = &adminAddr.addr;
+    ctx->ai.alloc = alloc;
+    ctx->ai.iface.send = receiveResponse;
+    struct Admin* admin = Admin_new(&ctx->ai, NULL, base, String_CONST("x"));
+    NodeStore_admin_register(store, admin, base, alloc);
+
+    // Two clients paging at the same time, one with the cursor and one by page number only,
+    // the walks are interleaved unevenly and must not disturb each other.
+    struct Allocator* walkAlloc = Allocator_child(alloc);
+    struct Walker* a = Allocator_calloc(walkAlloc, sizeof(struct Walker), 1);
+    struct Walker* b = Allocator_calloc(walkAlloc, sizeof(struct Walker), 1);
+    Assert_true(!Sockaddr_parse("127.0.0.1:2", &a->addr));
+    Assert_true(!Sockaddr_parse("127.0.0.1:3", &b->addr));
+    bool aMore = true;
+    bool bMore = true;
+    for (int i = 0; aMore || bMore; i++) {
+        if (aMore) { aMore = nextPage(ctx, a, walkAlloc); }
+        if (bMore && (i % 3)) {
+            // b drops the cursor and asks by page number.
+            b->cursor = NULL;
+            bMore = nextPage(ctx, b, walkAlloc);
+        }
+    }
+    checkWalk(a, expected, count);
+    checkWalk(b, expected, count);
+
+    // A page past the end is empty and leaves nothing behind for the next caller.
+    Dict* resp = dumpTable(ctx, &a->addr.addr, 1000, NULL, walkAlloc);
+    Assert_true(!List_size(Dict_getListC(resp, "routingTable")));
+    Assert_true(!Dict_getIntC(resp, "more"));
+    Assert_true(!Dict_getStringC(resp, "cursor"));
+    resp = dumpTable(ctx, &a->addr.addr, 1, NULL, walkAlloc);
+    List* table = Dict_getListC(resp, "routingTable");
+    Assert_true(List_size(table) == 4);
+    Assert_true(String_equals(Dict_getStringC(List_getDict(table, 0), "ip"), expected[4]));
+
+    resp = dumpTable(ctx, &a->addr.addr, 0, String_CONST("nothex"), walkAlloc);
+    Assert_true(String_equals(Dict_getStringC(resp, "error"), String_CONST("invalid cursor")));
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "dht/Address.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "switch/NumberCompress.h"
+#include "test/Bench.h"
+#include "util/Assert.h"
+#include "util/version/Version.h"
+
+#define PEERS 256
+#define TARGETS 1024
+
+struct Context
+{
+    struct NodeStore* store;
+    uint8_t known[16];
+    uint8_t targets[TARGETS][16];
+};
+
+static void randomAddress(struct Address* addr, uint64_t path, struct Random* rand)
+{
+    // The key is not checked against the address so skip the slow Key_gen().
+    addr->protocolVersion = Version_CURRENT_PROTOCOL;
+    Random_bytes(rand, addr->key, Address_KEY_SIZE);
+    Random_bytes(rand, addr->ip6.bytes, 16);
+    addr->ip6.bytes[0] = 0xfc;
+    addr->path = path;
+}
+
+static void getBestKnown(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        Assert_true(NodeStore_getBest(ctx->store, ctx->known));
+    }
+}
+
+static void getBestRandom(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        NodeStore_getBest(ctx->store, ctx->targets[i % TARGETS]);
+    }
+}
+
+int main(struct Bench* bench)
+{
+    struct Context* ctx = Allocator_calloc(bench->alloc, sizeof(struct Context), 1);
+    struct EncodingScheme* scheme = NumberCompress_v3x5x8_defineScheme(bench->alloc);
+
+    struct Address myAddr = { .path = 1 };
+    randomAddress(&myAddr, 1, bench->rand);
+    ctx->store = NodeStore_new(&myAddr, bench->alloc, bench->base, NULL, NULL);
+
+    for (uint32_t i = 2; i < PEERS; i++) {
+        uint32_t bits = NumberCompress_v3x5x8_bitsUsedForNumber(i);
+        uint64_t label = (((uint64_t)1) << bits) | NumberCompress_v3x5x8_getCompressed(i, bits);
+        struct Address addr = { .path = 0 };
+        randomAddress(&addr, label, bench->rand);
+        Assert_true(NodeStore_discoverNode(ctx->store, &addr, scheme, 0, 100));
+        if (i == PEERS / 2) { Bits_memcpy(ctx->known, addr.ip6.bytes, 16); }
+    }
+    for (int i = 0; i < TARGETS; i++) {
+        Random_bytes(bench->rand, ctx->targets[i], 16);
+        ctx->targets[i][0] = 0xfc;
+    }
+
+    Bench_run(bench, "getBestKnown", getBestKnown, ctx);
+    Bench_run(bench, "getBestRandom", getBestRandom, ctx);
+    return 0;
+}
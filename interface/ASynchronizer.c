@@ -16,12 +16,11 @@
 #include "interface/ASynchronizer.h"
 #include "memory/Allocator.h"
 #include "util/Identity.h"
-#include "util/events/Timeout.h"
+#include "util/events/Defer.h"
 #include "util/log/Log.h"
 #include "util/Hex.h"
 
-#define MAX_DRY_CYCLES 16
-
+#include <stdbool.h>
 
 #define ArrayList_TYPE struct Message
 #define ArrayList_NAME Messages
@@ -38,24 +37,21 @@ struct ASynchronizer_pvt
     struct ArrayList_Messages* msgsToA;
     struct ArrayList_Messages* msgsToB;
 
-    struct Allocator* timeoutAlloc;
-    int dryCycles;
+    /**
+     * Delivers the messages on the next turn of the event loop, after I/O has been handled.
+     * It is only scheduled while there are messages waiting so an idle ASynchronizer never wakes.
+     */
+    struct Defer* flush;
 
     Identity
 };
 
-static void timeoutTrigger(void* vASynchronizer)
+static void flush(void* vASynchronizer)
 {
     struct ASynchronizer_pvt* as = Identity_check((struct ASynchronizer_pvt*) vASynchronizer);
+    if (!as->cycleAlloc) { return; }
 
-    if (!as->cycleAlloc) {
-        if (as->dryCycles++ < MAX_DRY_CYCLES || !as->timeoutAlloc) { return; }
-        Allocator_free(as->timeoutAlloc);
-        as->timeoutAlloc = NULL;
-        as->dryCycles = 0;
-        return;
-    }
-
+    // Messages sent while these are delivered go in a new cycle and wait for the next turn.
     struct ArrayList_Messages* msgsToA = as->msgsToA;
     struct ArrayList_Messages* msgsToB = as->msgsToB;
     struct Allocator* cycleAlloc = as->cycleAlloc;
@@ -78,32 +74,28 @@ static void timeoutTrigger(void* vASynchronizer)
     Allocator_free(cycleAlloc);
 }
 
-static void checkTimeout(struct ASynchronizer_pvt* as)
-{
-    if (as->timeoutAlloc) { return; }
-    as->timeoutAlloc = Allocator_child(as->alloc);
-    Timeout_setInterval(timeoutTrigger, as, 1, as->base, as->timeoutAlloc);
-}
-
 static Iface_DEFUN fromA(struct Message* msg, struct Iface* ifA)
 {
     struct ASynchronizer_pvt* as = Identity_containerOf(ifA, struct ASynchronizer_pvt, pub.ifA);
+    // Sent by an onFree job, nothing would be left to deliver it to.
+    if (as->alloc->isFreeing) { return NULL; }
     if (!as->cycleAlloc) { as->cycleAlloc = Allocator_child(as->alloc); }
     if (!as->msgsToB) { as->msgsToB = ArrayList_Messages_new(as->cycleAlloc); }
     Allocator_adopt(as->cycleAlloc, msg->alloc);
     ArrayList_Messages_add(as->msgsToB, msg);
-    checkTimeout(as);
+    Defer_schedule(as->flush);
     return NULL;
 }
 
 static Iface_DEFUN fromB(struct Message* msg, struct Iface* ifB)
 {
     struct ASynchronizer_pvt* as = Identity_containerOf(ifB, struct ASynchronizer_pvt, pub.ifB);
+    if (as->alloc->isFreeing) { return NULL; }
     if (!as->cycleAlloc) { as->cycleAlloc = Allocator_child(as->alloc); }
     if (!as->msgsToA) { as->msgsToA = ArrayList_Messages_new(as->cycleAlloc); }
     Allocator_adopt(as->cycleAlloc, msg->alloc);
     ArrayList_Messages_add(as->msgsToA, msg);
-    checkTimeout(as);
+    Defer_schedule(as->flush);
     return NULL;
 }
 
@@ -118,5 +110,6 @@ struct ASynchronizer* ASynchronizer_new(struct Allocator* alloc,
     ctx->log = log;
     ctx->pub.ifA.send = fromA;
     ctx->pub.ifB.send = fromB;
+    ctx->flush = Defer_new(flush, ctx, base, alloc);
     return &ctx->pub;
 }
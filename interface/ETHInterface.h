@@ -65,8 +65,32 @@ struct ETHInterface
     struct AddrIface generic;
 };
 
+/** The receive ring is made of blocks of this many frames. */
+#define ETHInterface_RING_BLOCK_FRAMES 32
+
+/** Largest allowed receive ring, 128MB of memory. */
+#define ETHInterface_RING_MAX_FRAMES (1<<16)
+
+/**
+ * @return non-zero if ringFrames is a power of two which is a whole number of blocks and not
+ *         more than ETHInterface_RING_MAX_FRAMES, zero is not a valid ring size.
+ */
+static inline int ETHInterface_isValidRingFrames(int64_t ringFrames)
+{
+    return ringFrames >= ETHInterface_RING_BLOCK_FRAMES
+        && ringFrames <= ETHInterface_RING_MAX_FRAMES
+        && !(ringFrames & (ringFrames - 1));
+}
+
+/**
+ * @param ringFrames if non-zero then (on Linux) frames are received through a memory mapped
+ *                   ring of this many frames and sends are batched once per event loop turn,
+ *                   it must pass ETHInterface_isValidRingFrames().
+ *                   If zero then each frame costs one system call.
+ */
 struct ETHInterface* ETHInterface_new(struct EventBase* eventBase,
                                       const char* bindDevice,
+                                      uint32_t ringFrames,
                                       struct Allocator* alloc,
                                       struct Except* exHandler,
                                       struct Log* logger);
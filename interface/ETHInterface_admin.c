@@ -85,13 +85,23 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
 {
     struct Context* const ctx = Identity_check((struct Context*) vcontext);
     String* const bindDevice = Dict_getStringC(args, "bindDevice");
+    int64_t* ringFramesP = Dict_getIntC(args, "ringFrames");
+    if (ringFramesP && *ringFramesP && !ETHInterface_isValidRingFrames(*ringFramesP)) {
+        Dict* out = Dict_new(requestAlloc);
+        Dict_putStringC(out, "error", String_printf(requestAlloc,
+            "invalid ringFrames, must be a power of two from [%d] to [%d]",
+            ETHInterface_RING_BLOCK_FRAMES, ETHInterface_RING_MAX_FRAMES), requestAlloc);
+        Admin_sendMessage(out, txid, ctx->admin);
+        return;
+    }
+    uint32_t ringFrames = (ringFramesP) ? ((uint32_t) *ringFramesP) : 0;
     struct Allocator* const alloc = Allocator_child(ctx->alloc);
 
     struct ETHInterface* ethIf = NULL;
     struct Jmp jmp;
     Jmp_try(jmp) {
         ethIf = ETHInterface_new(
-            ctx->eventBase, bindDevice->bytes, alloc, &jmp.handler, ctx->logger);
+            ctx->eventBase, bindDevice->bytes, ringFrames, alloc, &jmp.handler, ctx->logger);
     } Jmp_catch {
         Dict* out = Dict_new(requestAlloc);
         Dict_putStringCC(out, "error", jmp.message, requestAlloc);
@@ -189,7 +199,8 @@ void ETHInterface_admin_register(struct EventBase* base,
 
     Admin_registerFunction("ETHInterface_new", newInterface, ctx, true,
         ((struct Admin_FunctionArg[]) {
-            { .name = "bindDevice", .required = 1, .type = "String" }
+            { .name = "bindDevice", .required = 1, .type = "String" },
+            { .name = "ringFrames", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("ETHInterface_beginConnection",
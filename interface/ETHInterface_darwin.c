@@ -262,10 +262,15 @@ static void macaddr(const char* ifname, uint8_t addrOut[6], struct Except* eh)
 
 struct ETHInterface* ETHInterface_new(struct EventBase* eventBase,
                                       const char* bindDevice,
+                                      uint32_t ringFrames,
                                       struct Allocator* alloc,
                                       struct Except* exHandler,
                                       struct Log* logger)
 {
+    if (ringFrames) {
+        Except_throw(exHandler, "ringFrames is only supported on Linux");
+    }
+
     struct ETHInterface_pvt* ctx = Allocator_calloc(alloc, sizeof(struct ETHInterface_pvt), 1);
     Identity_set(ctx);
     ctx->pub.generic.iface.send = sendMessage;
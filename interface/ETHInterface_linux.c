@@ -12,9 +12,11 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "interface/ETHInterface.h"
 #include "exception/Except.h"
 #include "memory/Allocator.h"
+#include "memory/MessagePool.h"
 #include "net/InterfaceController.h"
 #include "wire/Headers.h"
 #include "wire/Message.h"
@@ -35,6 +37,7 @@
 #include <linux/if_arp.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -50,6 +53,24 @@
 // 2 last 0x00 of .sll_addr are removed from original size (20)
 #define SOCKADDR_LL_LEN 18
 
+/** Ring mode block and frame sizes, blocks must be a multiple of the page size. */
+#define RING_BLOCK_SIZE (1<<16)
+#define RING_FRAME_SIZE 2048
+Assert_compileTime(RING_BLOCK_SIZE / RING_FRAME_SIZE == ETHInterface_RING_BLOCK_FRAMES);
+
+/**
+ * Number of milliseconds before the kernel hands over a block which is not full,
+ * this is the worst case added latency when traffic is light.
+ */
+#define RING_BLOCK_TIMEOUT_MILLISECONDS 1
+
+/** Maximum number of frames which are queued for a single sendmmsg() call. */
+#define TX_BATCH_MAX 64
+#define TX_FRAME_MAX (MAX_PACKET_SIZE + ETHInterface_Header_SIZE)
+
+/** Maximum number of frames from the ring which are passed up with a single Iface_sendBatch(). */
+#define RX_BATCH_MAX 64
+
 struct ETHInterface_pvt
 {
     struct ETHInterface pub;
@@ -65,9 +86,45 @@ struct ETHInterface_pvt
 
     String* ifName;
 
+    struct EventBase* eventBase;
+
+    /** Incoming frames are copied into buffers from this pool. */
+    struct MessagePool* pool;
+
+    /** TPACKET_V3 receive ring, NULL unless ring mode was requested. */
+    uint8_t* ring;
+    uint32_t ringBlockCount;
+    uint32_t nextBlock;
+
+    /**
+     * Frames which are waiting to be flushed by flushTx(), only used in ring mode.
+     * The arrays hold TX_BATCH_MAX entries and are allocated by setupRing().
+     */
+    struct Timeout* txFlush;
+    int txFlushPending;
+    int txCount;
+    uint8_t* txBuffers;
+    struct iovec* txIov;
+    struct sockaddr_ll* txAddrs;
+    struct mmsghdr* txMsgs;
+
     Identity
 };
 
+static void logSendError(struct ETHInterface_pvt* context)
+{
+    switch (errno) {
+        default:;
+            Log_info(context->logger, "[%s] Got error sending to socket [%s]",
+                     context->ifName->bytes, strerror(errno));
+
+        case EMSGSIZE:
+        case ENOBUFS:
+        case EAGAIN:;
+            // todo: care
+    }
+}
+
 static void sendMessageInternal(struct Message* message,
                                 struct sockaddr_ll* addr,
                                 struct ETHInterface_pvt* context)
@@ -85,20 +142,54 @@ static void sendMessageInternal(struct Message* message,
                (struct sockaddr*) addr,
                sizeof(struct sockaddr_ll)) < 0)
     {
-        switch (errno) {
-            default:;
-                Log_info(context->logger, "[%s] Got error sending to socket [%s]",
-                         context->ifName->bytes, strerror(errno));
-
-            case EMSGSIZE:
-            case ENOBUFS:
-            case EAGAIN:;
-                // todo: care
-        }
+        logSendError(context);
     }
     return;
 }
 
+static void flushTx(void* vcontext)
+{
+    struct ETHInterface_pvt* ctx = Identity_check((struct ETHInterface_pvt*) vcontext);
+    ctx->txFlushPending = 0;
+    for (int sent = 0; sent < ctx->txCount;) {
+        int rc = sendmmsg(ctx->socket, &ctx->txMsgs[sent], ctx->txCount - sent, 0);
+        if (rc > 0) {
+            sent += rc;
+            continue;
+        }
+        logSendError(ctx);
+        if (errno != EMSGSIZE) { break; }
+        // Only this one frame is bad, carry on with the rest.
+        sent++;
+    }
+    ctx->txCount = 0;
+}
+
+/**
+ * Copy the frame into the tx batch, it is sent at the end of the current event loop turn
+ * (or sooner if the batch fills up) so that a burst costs one syscall rather than one per frame.
+ */
+static void queueMessage(struct Message* message,
+                         struct sockaddr_ll* addr,
+                         struct ETHInterface_pvt* ctx)
+{
+    if (message->length > TX_FRAME_MAX) {
+        Log_debug(ctx->logger, "DROP oversize frame [%d]", message->length);
+        return;
+    }
+    int i = ctx->txCount++;
+    Bits_memcpy(&ctx->txBuffers[i * TX_FRAME_MAX], message->bytes, message->length);
+    Bits_memcpy(&ctx->txAddrs[i], addr, sizeof(struct sockaddr_ll));
+    ctx->txIov[i].iov_len = message->length;
+
+    if (ctx->txCount == TX_BATCH_MAX) {
+        flushTx(ctx);
+    } else if (!ctx->txFlushPending) {
+        ctx->txFlushPending = 1;
+        Timeout_resetTimeout(ctx->txFlush, 0);
+    }
+}
+
 static Iface_DEFUN sendMessage(struct Message* msg, struct Iface* iface)
 {
     struct ETHInterface_pvt* ctx =
@@ -127,37 +218,47 @@ static Iface_DEFUN sendMessage(struct Message* msg, struct Iface* iface)
         .fc00_be = Endian_hostToBigEndian16(0xfc00)
     };
     Message_push(msg, &hdr, ETHInterface_Header_SIZE, NULL);
-    sendMessageInternal(msg, &addr, ctx);
+    if (ctx->ring) {
+        queueMessage(msg, &addr, ctx);
+    } else {
+        sendMessageInternal(msg, &addr, ctx);
+    }
     return NULL;
 }
 
-static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* messageAlloc)
+static void sendMessageBatch(struct Message** msgs, int count, struct Iface* iface)
 {
-    struct Message* msg = Message_new(MAX_PACKET_SIZE, PADDING, messageAlloc);
+    struct ETHInterface_pvt* ctx =
+        Identity_containerOf(iface, struct ETHInterface_pvt, pub.generic.iface);
+    for (int i = 0; i < count; i++) {
+        Iface_CALL(sendMessage, msgs[i], iface);
+    }
+    if (ctx->txFlushPending) {
+        Timeout_clearTimeout(ctx->txFlush);
+        flushTx(ctx);
+    }
+}
 
-    struct sockaddr_ll addr;
-    uint32_t addrLen = sizeof(struct sockaddr_ll);
+static struct Message* newFrameMessage(struct Allocator* messageAlloc)
+{
+    struct Message* msg = Message_new(MAX_PACKET_SIZE, PADDING, messageAlloc);
 
     // Knock it out of alignment by 2 bytes so that it will be
     // aligned when the idAndPadding is shifted off.
     Message_shift(msg, 2, NULL);
+    return msg;
+}
 
-    int rc = recvfrom(context->socket,
-                      msg->bytes,
-                      msg->length,
-                      0,
-                      (struct sockaddr*) &addr,
-                      &addrLen);
-
-    if (rc < ETHInterface_Header_SIZE) {
-        Log_debug(context->logger, "Failed to receive eth frame");
-        return;
-    }
-
-    Assert_true(msg->length >= rc);
-    msg->length = rc;
-
-    //Assert_true(addrLen == SOCKADDR_LL_LEN);
+/**
+ * Check the header of a received frame and replace it with the sender's address.
+ * @return 0 if the message should be passed up, -1 if it should be dropped.
+ */
+static int parseFrame(struct ETHInterface_pvt* context,
+                      struct Message* msg,
+                      struct sockaddr_ll* frameAddr)
+{
+    struct sockaddr_ll addr;
+    Bits_memcpy(&addr, frameAddr, sizeof(struct sockaddr_ll));
 
     struct ETHInterface_Header hdr;
     Message_pop(msg, &hdr, ETHInterface_Header_SIZE, NULL);
@@ -165,7 +266,7 @@ static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* mes
     // here we could put a switch statement to handle different versions differently.
     if (hdr.version != ETHInterface_CURRENT_VERSION) {
         Log_debug(context->logger, "DROP unknown version");
-        return;
+        return -1;
     }
 
     uint16_t reportedLength = Endian_bigEndianToHost16(hdr.length_be);
@@ -173,13 +274,13 @@ static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* mes
     if (msg->length != reportedLength) {
         if (msg->length < reportedLength) {
             Log_debug(context->logger, "DROP size field is larger than frame");
-            return;
+            return -1;
         }
         msg->length = reportedLength;
     }
     if (hdr.fc00_be != Endian_hostToBigEndian16(0xfc00)) {
         Log_debug(context->logger, "DROP bad magic");
-        return;
+        return -1;
     }
 
     struct ETHInterface_Sockaddr  sockaddr = { .zero = 0 };
@@ -192,14 +293,107 @@ static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* mes
     Message_push(msg, &sockaddr, ETHInterface_Sockaddr_SIZE, NULL);
 
     Assert_true(!((uintptr_t)msg->bytes % 4) && "Alignment fault");
+    return 0;
+}
+
+static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* messageAlloc)
+{
+    struct Message* msg = newFrameMessage(messageAlloc);
+
+    struct sockaddr_ll addr;
+    uint32_t addrLen = sizeof(struct sockaddr_ll);
+
+    int rc = recvfrom(context->socket,
+                      msg->bytes,
+                      msg->length,
+                      0,
+                      (struct sockaddr*) &addr,
+                      &addrLen);
+
+    if (rc < ETHInterface_Header_SIZE) {
+        Log_debug(context->logger, "Failed to receive eth frame");
+        return;
+    }
+
+    Assert_true(msg->length >= rc);
+    msg->length = rc;
+
+    //Assert_true(addrLen == SOCKADDR_LL_LEN);
+
+    if (!parseFrame(context, msg, &addr)) {
+        Iface_send(&context->pub.generic.iface, msg);
+    }
+}
+
+static void flushRx(struct ETHInterface_pvt* context,
+                    struct Message** msgs,
+                    struct Allocator** allocs,
+                    int count)
+{
+    if (!count) { return; }
+    Iface_sendBatch(&context->pub.generic.iface, msgs, count);
+    for (int i = 0; i < count; i++) {
+        Allocator_free(allocs[i]);
+    }
+}
 
-    Iface_send(&context->pub.generic.iface, msg);
+/**
+ * Drain every block which the kernel has handed over, passing the frames up in bursts.
+ * Frames are copied out of the ring because a message may be held on to after Iface_send()
+ * returns (e.g. buffered while a session is set up) and the kernel fills blocks strictly
+ * in order, a single pinned block would stall the whole ring.
+ */
+static void handleRingEvent(void* vcontext)
+{
+    struct ETHInterface_pvt* context = Identity_check((struct ETHInterface_pvt*) vcontext);
+    struct Message* msgs[RX_BATCH_MAX];
+    struct Allocator* allocs[RX_BATCH_MAX];
+    int count = 0;
+    for (;;) {
+        struct tpacket_block_desc* block =
+            (struct tpacket_block_desc*) &context->ring[context->nextBlock * RING_BLOCK_SIZE];
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) { break; }
+
+        uint8_t* frame = ((uint8_t*) block) + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            struct tpacket3_hdr* th = (struct tpacket3_hdr*) frame;
+            struct sockaddr_ll* addr =
+                (struct sockaddr_ll*) &frame[TPACKET_ALIGN(sizeof(struct tpacket3_hdr))];
+
+            struct Allocator* messageAlloc =
+                MessagePool_child(context->pool, context->pub.generic.alloc);
+            struct Message* msg = newFrameMessage(messageAlloc);
+            uint8_t* data = &frame[th->tp_net];
+            frame += th->tp_next_offset;
+            if (th->tp_snaplen < ETHInterface_Header_SIZE || (int)th->tp_snaplen > msg->length) {
+                Log_debug(context->logger, "DROP eth frame with length [%u]", th->tp_snaplen);
+                Allocator_free(messageAlloc);
+                continue;
+            }
+            Bits_memcpy(msg->bytes, data, th->tp_snaplen);
+            msg->length = th->tp_snaplen;
+            if (parseFrame(context, msg, addr)) {
+                Allocator_free(messageAlloc);
+                continue;
+            }
+            msgs[count] = msg;
+            allocs[count++] = messageAlloc;
+            if (count == RX_BATCH_MAX) {
+                flushRx(context, msgs, allocs, count);
+                count = 0;
+            }
+        }
+
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        context->nextBlock = (context->nextBlock + 1) % context->ringBlockCount;
+    }
+    flushRx(context, msgs, allocs, count);
 }
 
 static void handleEvent(void* vcontext)
 {
     struct ETHInterface_pvt* context = Identity_check((struct ETHInterface_pvt*) vcontext);
-    struct Allocator* messageAlloc = Allocator_child(context->pub.generic.alloc);
+    struct Allocator* messageAlloc = MessagePool_child(context->pool, context->pub.generic.alloc);
     handleEvent2(context, messageAlloc);
     Allocator_free(messageAlloc);
 }
@@ -225,12 +419,65 @@ List* ETHInterface_listDevices(struct Allocator* alloc, struct Except* eh)
 static int closeSocket(struct Allocator_OnFreeJob* j)
 {
     struct ETHInterface_pvt* ctx = Identity_check((struct ETHInterface_pvt*) j->userData);
+    if (ctx->ring) {
+        munmap(ctx->ring, ctx->ringBlockCount * RING_BLOCK_SIZE);
+    }
     close(ctx->socket);
     return 0;
 }
 
+static void setupRing(struct ETHInterface_pvt* ctx, uint32_t ringFrames, struct Except* eh)
+{
+    if (!ETHInterface_isValidRingFrames(ringFrames)) {
+        Except_throw(eh, "ringFrames must be a power of two between [%d] and [%d]",
+                     ETHInterface_RING_BLOCK_FRAMES, ETHInterface_RING_MAX_FRAMES);
+    }
+    int version = TPACKET_V3;
+    if (setsockopt(ctx->socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(int))) {
+        Except_throw(eh, "setsockopt(PACKET_VERSION) [%s]", strerror(errno));
+    }
+
+    uint32_t blockCount = ringFrames / ETHInterface_RING_BLOCK_FRAMES;
+    struct tpacket_req3 req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr = blockCount,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = ringFrames,
+        .tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MILLISECONDS
+    };
+    if (setsockopt(ctx->socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        Except_throw(eh, "setsockopt(PACKET_RX_RING) [%s]", strerror(errno));
+    }
+
+    void* ring = mmap(NULL, blockCount * RING_BLOCK_SIZE,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, ctx->socket, 0);
+    if (ring == MAP_FAILED) {
+        Except_throw(eh, "mmap() of packet ring failed [%s]", strerror(errno));
+    }
+    ctx->ring = ring;
+    ctx->ringBlockCount = blockCount;
+
+    struct Allocator* alloc = ctx->pub.generic.alloc;
+    ctx->txBuffers = Allocator_malloc(alloc, TX_BATCH_MAX * TX_FRAME_MAX);
+    ctx->txIov = Allocator_calloc(alloc, sizeof(struct iovec), TX_BATCH_MAX);
+    ctx->txAddrs = Allocator_calloc(alloc, sizeof(struct sockaddr_ll), TX_BATCH_MAX);
+    ctx->txMsgs = Allocator_calloc(alloc, sizeof(struct mmsghdr), TX_BATCH_MAX);
+    for (int i = 0; i < TX_BATCH_MAX; i++) {
+        ctx->txIov[i].iov_base = &ctx->txBuffers[i * TX_FRAME_MAX];
+        ctx->txMsgs[i].msg_hdr = (struct msghdr) {
+            .msg_name = &ctx->txAddrs[i],
+            .msg_namelen = sizeof(struct sockaddr_ll),
+            .msg_iov = &ctx->txIov[i],
+            .msg_iovlen = 1
+        };
+    }
+    ctx->txFlush = Timeout_setTimeout(flushTx, ctx, 0, ctx->eventBase, alloc);
+    Timeout_clearTimeout(ctx->txFlush);
+}
+
 struct ETHInterface* ETHInterface_new(struct EventBase* eventBase,
                                       const char* bindDevice,
+                                      uint32_t ringFrames,
                                       struct Allocator* alloc,
                                       struct Except* exHandler,
                                       struct Log* logger)
@@ -238,8 +485,11 @@ struct ETHInterface* ETHInterface_new(struct EventBase* eventBase,
     struct ETHInterface_pvt* ctx = Allocator_calloc(alloc, sizeof(struct ETHInterface_pvt), 1);
     Identity_set(ctx);
     ctx->pub.generic.iface.send = sendMessage;
+    ctx->pub.generic.iface.sendBatch = sendMessageBatch;
     ctx->pub.generic.alloc = alloc;
     ctx->logger = logger;
+    ctx->eventBase = eventBase;
+    ctx->pool = MessagePool_new(alloc, MAX_PACKET_SIZE + PADDING);
 
     struct ifreq ifr = { .ifr_ifindex = 0 };
 
@@ -283,7 +533,12 @@ struct ETHInterface* ETHInterface_new(struct EventBase* eventBase,
 
     Socket_makeNonBlocking(ctx->socket);
 
-    Event_socketRead(handleEvent, ctx, ctx->socket, eventBase, alloc, exHandler);
+    if (ringFrames) {
+        setupRing(ctx, ringFrames, exHandler);
+        Event_socketRead(handleRingEvent, ctx, ctx->socket, eventBase, alloc, exHandler);
+    } else {
+        Event_socketRead(handleEvent, ctx, ctx->socket, eventBase, alloc, exHandler);
+    }
 
     return &ctx->pub;
 }
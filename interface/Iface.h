@@ -30,11 +30,25 @@ typedef struct Iface* (* Iface_Callback)(struct Message* message, struct Iface*
 
 #define Iface_DEFUN __attribute__ ((warn_unused_result)) struct Iface*
 
+/**
+ * @param msgs the messages, the array itself is only valid for the duration of the call but
+ *             the messages are the same as if each one had been passed to Iface_Callback.
+ * @param count the number of messages.
+ * @param thisInterface the interface which contains the sendBatch function pointer.
+ */
+typedef void (* Iface_BatchCallback)(struct Message** msgs, int count, struct Iface* thisInterface);
+
 struct Iface
 {
     /** Send a message through this interface. */
     Iface_Callback send;
 
+    /**
+     * Optional, send a burst of messages through this interface at once.
+     * If this is NULL then Iface_sendBatch() passes the messages to send one at a time.
+     */
+    Iface_BatchCallback sendBatch;
+
     #ifdef PARANOIA
         /** This is for checking currentMsg Iface_next() has not been called incorrectly. */
         struct Message* currentMsg;
@@ -79,6 +93,37 @@ static inline void Iface_send(struct Iface* iface, struct Message* msg)
     } while (iface);
 }
 
+/**
+ * Send a burst of messages to an Iface.
+ * If the interface which is plumbed to this one has a sendBatch function then the messages are
+ * all handed to it in one call so that the cost of passing through each layer is paid once per
+ * burst, otherwise they are sent one by one with Iface_send().
+ * A burst is complete when it is handed over so an interface which holds messages back to
+ * send them together at the end of the event loop turn should send them right away instead.
+ * Like Iface_send(), this must not be used for forwarding a message which has been passed to
+ * an Iface_Callback function.
+ */
+static inline void Iface_sendBatch(struct Iface* iface, struct Message** msgs, int count)
+{
+    struct Iface* conn = iface->connectedIf;
+
+    #ifdef PARANOIA
+        Assert_true(conn);
+        for (int i = 0; i < count; i++) {
+            Assert_true(msgs[i]);
+            Assert_true(!msgs[i]->currentIface);
+        }
+    #endif
+
+    if (conn->sendBatch) {
+        conn->sendBatch(msgs, count, conn);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        Iface_send(iface, msgs[i]);
+    }
+}
+
 /**
  * Forward a message from inside of an Iface_Callback function.
  * This function must be a tail-call, you must return the value returned to you.
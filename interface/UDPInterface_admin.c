@@ -18,6 +18,7 @@
 #include "memory/Allocator.h"
 #include "net/InterfaceController.h"
 #include "util/events/UDPAddrIface.h"
+#include "util/events/UDPShards.h"
 #include "util/events/EventBase.h"
 #include "util/events/FakeNetwork.h"
 #include "util/platform/Sockaddr.h"
@@ -122,6 +123,7 @@ static void beginConnection(Dict* args,
 static struct AddrIface* setupLibuvUDP(struct Context* ctx,
                                        struct Sockaddr* addr,
                                        uint8_t dscp,
+                                       uint32_t batchSize,
                                        String* txid,
                                        struct Allocator* alloc)
 {
@@ -134,6 +136,11 @@ static struct AddrIface* setupLibuvUDP(struct Context* ctx,
                 Log_warn(ctx->logger, "Set DSCP failed");
             }
         }
+        if (batchSize) {
+            if (UDPAddrIface_setBatchSize(udpIf, batchSize)) {
+                Log_warn(ctx->logger, "Set batchSize failed, batching is only supported on Linux");
+            }
+        }
     } Jmp_catch {
         String* errStr = String_CONST(jmp.message);
         Dict out = Dict_CONST(String_CONST("error"), String_OBJ(errStr), NULL);
@@ -144,6 +151,29 @@ static struct AddrIface* setupLibuvUDP(struct Context* ctx,
     return &udpIf->generic;
 }
 
+static struct AddrIface* setupUDPShards(struct Context* ctx,
+                                        struct Sockaddr* addr,
+                                        uint8_t dscp,
+                                        uint32_t batchSize,
+                                        uint32_t shards,
+                                        String* txid,
+                                        struct Allocator* alloc)
+{
+    struct UDPShards* us = NULL;
+    struct Jmp jmp;
+    Jmp_try(jmp) {
+        us = UDPShards_new(
+            ctx->eventBase, addr, shards, batchSize, dscp, alloc, &jmp.handler, ctx->logger);
+    } Jmp_catch {
+        String* errStr = String_CONST(jmp.message);
+        Dict out = Dict_CONST(String_CONST("error"), String_OBJ(errStr), NULL);
+        Admin_sendMessage(&out, txid, ctx->admin);
+        Allocator_free(alloc);
+        return NULL;
+    }
+    return &us->generic;
+}
+
 static struct AddrIface* setupFakeUDP(struct FakeNetwork* fakeNet,
                                       struct Sockaddr* addr,
                                       struct Allocator* alloc)
@@ -155,6 +185,8 @@ static struct AddrIface* setupFakeUDP(struct FakeNetwork* fakeNet,
 static void newInterface2(struct Context* ctx,
                           struct Sockaddr* addr,
                           uint8_t dscp,
+                          uint32_t batchSize,
+                          uint32_t shards,
                           String* txid,
                           struct Allocator* requestAlloc)
 {
@@ -162,8 +194,10 @@ static void newInterface2(struct Context* ctx,
     struct AddrIface* ai;
     if (ctx->fakeNet) {
         ai = setupFakeUDP(ctx->fakeNet, addr, alloc);
+    } else if (shards) {
+        ai = setupUDPShards(ctx, addr, dscp, batchSize, shards, txid, alloc);
     } else {
-        ai = setupLibuvUDP(ctx, addr, dscp, txid, alloc);
+        ai = setupLibuvUDP(ctx, addr, dscp, batchSize, txid, alloc);
     }
     if (!ai) { return; }
     ctx->udpIf = ai;
@@ -189,6 +223,19 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
     String* bindAddress = Dict_getStringC(args, "bindAddress");
     int64_t* dscpValue = Dict_getIntC(args, "dscp");
     uint8_t dscp = dscpValue ? ((uint8_t) *dscpValue) : 0;
+    int64_t* batchSizeValue = Dict_getIntC(args, "batchSize");
+    if (batchSizeValue &&
+        (*batchSizeValue < 0 || *batchSizeValue > UDPAddrIface_MAX_BATCH_SIZE))
+    {
+        Dict out = Dict_CONST(
+            String_CONST("error"), String_OBJ(String_CONST("Invalid batchSize")), NULL
+        );
+        Admin_sendMessage(&out, txid, ctx->admin);
+        return;
+    }
+    uint32_t batchSize = batchSizeValue ? ((uint32_t) *batchSizeValue) : 0;
+    int64_t* shardsValue = Dict_getIntC(args, "shards");
+    uint32_t shards = shardsValue ? ((uint32_t) *shardsValue) : 0;
     struct Sockaddr_storage addr;
     if (Sockaddr_parse((bindAddress) ? bindAddress->bytes : "0.0.0.0", &addr)) {
         Dict out = Dict_CONST(
@@ -197,7 +244,7 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
         Admin_sendMessage(&out, txid, ctx->admin);
         return;
     }
-    newInterface2(ctx, &addr.addr, dscp, txid, requestAlloc);
+    newInterface2(ctx, &addr.addr, dscp, batchSize, shards, txid, requestAlloc);
 }
 
 void UDPInterface_admin_register(struct EventBase* base,
@@ -219,7 +266,9 @@ void UDPInterface_admin_register(struct EventBase* base,
     Admin_registerFunction("UDPInterface_new", newInterface, ctx, true,
         ((struct Admin_FunctionArg[]) {
             { .name = "bindAddress", .required = 0, .type = "String" },
-            { .name = "dscp", .required = 0, .type = "Int" }
+            { .name = "dscp", .required = 0, .type = "Int" },
+            { .name = "batchSize", .required = 0, .type = "Int" },
+            { .name = "shards", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("UDPInterface_beginConnection", beginConnection, ctx, true,
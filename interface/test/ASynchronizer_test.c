@@ -0,0 +1,160 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "interface/ASynchronizer.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+struct Context
+{
+    struct Iface ifA;
+    struct Iface ifB;
+    struct Allocator* alloc;
+    int receivedA;
+    int receivedB;
+    Identity
+};
+
+static Iface_DEFUN receiveA(struct Message* msg, struct Iface* ifA)
+{
+    struct Context* ctx = Identity_containerOf(ifA, struct Context, ifA);
+    ctx->receivedA++;
+    return NULL;
+}
+
+static Iface_DEFUN receiveB(struct Message* msg, struct Iface* ifB)
+{
+    struct Context* ctx = Identity_containerOf(ifB, struct Context, ifB);
+    ctx->receivedB++;
+    if (ctx->receivedB == 2) {
+        // A reply sent from inside the delivery is not delivered until a later turn.
+        Iface_send(&ctx->ifB, Message_new(0, 0, ctx->alloc));
+        Assert_true(!ctx->receivedA);
+    }
+    return NULL;
+}
+
+struct PingPong
+{
+    struct Iface ifA;
+    struct Iface ifB;
+    struct Iface udp;
+    struct Allocator* alloc;
+    struct EventBase* base;
+    int bounces;
+    int bouncesAtIo;
+    Identity
+};
+
+/** Each side sends a message back as soon as it gets one so there is always one waiting. */
+static Iface_DEFUN bounceA(struct Message* msg, struct Iface* ifA)
+{
+    struct PingPong* pp = Identity_containerOf(ifA, struct PingPong, ifA);
+    pp->bounces++;
+    if (!pp->bouncesAtIo) {
+        Iface_send(&pp->ifA, Message_new(0, 0, pp->alloc));
+    }
+    return NULL;
+}
+
+static Iface_DEFUN bounceB(struct Message* msg, struct Iface* ifB)
+{
+    struct PingPong* pp = Identity_containerOf(ifB, struct PingPong, ifB);
+    pp->bounces++;
+    if (!pp->bouncesAtIo) {
+        Iface_send(&pp->ifB, Message_new(0, 0, pp->alloc));
+    }
+    return NULL;
+}
+
+static Iface_DEFUN udpReceived(struct Message* msg, struct Iface* udp)
+{
+    struct PingPong* pp = Identity_containerOf(udp, struct PingPong, udp);
+    pp->bouncesAtIo = pp->bounces;
+    EventBase_endLoop(pp->base);
+    return NULL;
+}
+
+static void fail(void* vNULL)
+{
+    Assert_failure("timed out.");
+}
+
+/** Two sides which keep sending to each other must not keep I/O from being handled. */
+static void pingPong(struct Allocator* alloc)
+{
+    struct EventBase* base = EventBase_new(alloc);
+    struct ASynchronizer* as = ASynchronizer_new(alloc, base, NULL);
+    struct PingPong* pp = Allocator_calloc(alloc, sizeof(struct PingPong), 1);
+    Identity_set(pp);
+    pp->alloc = alloc;
+    pp->base = base;
+    pp->ifA.send = bounceA;
+    pp->ifB.send = bounceB;
+    Iface_plumb(&pp->ifA, &as->ifA);
+    Iface_plumb(&pp->ifB, &as->ifB);
+
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    struct UDPAddrIface* udp = UDPAddrIface_new(base, &ss.addr, alloc, NULL, NULL);
+    pp->udp.send = udpReceived;
+    Iface_plumb(&pp->udp, &udp->generic.iface);
+
+    // A datagram to ourselves, it is sent and received by the event loop.
+    struct Message* msg = Message_new(0, 512, alloc);
+    Message_push32(msg, 0, NULL);
+    Message_push(msg, udp->generic.addr, udp->generic.addr->addrLen, NULL);
+    Iface_send(&pp->udp, msg);
+
+    Iface_send(&pp->ifA, Message_new(0, 0, alloc));
+    Timeout_setTimeout(fail, NULL, 2000, base, alloc);
+    EventBase_beginLoop(base);
+
+    // Sending and receiving takes a turn or two, not waiting for the bouncing to stop.
+    Assert_true(pp->bouncesAtIo > 0 && pp->bouncesAtIo < 10);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct ASynchronizer* as = ASynchronizer_new(alloc, base, NULL);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->alloc = alloc;
+    ctx->ifA.send = receiveA;
+    ctx->ifB.send = receiveB;
+    Iface_plumb(&ctx->ifA, &as->ifA);
+    Iface_plumb(&ctx->ifB, &as->ifB);
+
+    Iface_send(&ctx->ifA, Message_new(0, 0, alloc));
+    Iface_send(&ctx->ifA, Message_new(0, 0, alloc));
+    Assert_true(!ctx->receivedB);
+
+    // Nothing keeps the loop running once everything is delivered.
+    EventBase_beginLoop(base);
+    Assert_true(ctx->receivedB == 2);
+    Assert_true(ctx->receivedA == 1);
+
+    pingPong(Allocator_child(alloc));
+
+    Allocator_free(alloc);
+    return 0;
+}
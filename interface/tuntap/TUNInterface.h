@@ -53,4 +53,28 @@ struct Iface* TUNInterface_new(const char* interfaceName,
                                    struct Log* logger,
                                    struct Except* eh,
                                    struct Allocator* alloc);
+
+#if defined(linux) && !defined(android)
+/** The most queues which TUNInterface_newMultiQueue() will open. */
+#define TUNInterface_MAX_QUEUES 16
+
+/**
+ * Create a TUN device with IFF_MULTI_QUEUE and IFF_VNET_HDR so the kernel can hand over and
+ * accept TCP super-packets (TSO/GSO) and partial checksums.
+ * Every queue is read from the event loop, packets are written through the first queue.
+ * If the kernel does not support these flags, a plain TUN device is created as with
+ * TUNInterface_new().
+ * This is opt-in (see Core_initTunnel offload), TUNInterface_new() always creates a plain device.
+ *
+ * @param queueCount the number of file descriptors to attach to the device.
+ * See TUNInterface_new() for the other parameters.
+ */
+struct Iface* TUNInterface_newMultiQueue(const char* interfaceName,
+                                         char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+                                         int queueCount,
+                                         struct EventBase* base,
+                                         struct Log* logger,
+                                         struct Except* eh,
+                                         struct Allocator* alloc);
+#endif
 #endif
@@ -13,14 +13,25 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "interface/tuntap/TUNInterface.h"
+#include "interface/tuntap/TUNMessageType.h"
+#include "interface/tuntap/TUNOffload.h"
 #include "exception/Except.h"
 #include "memory/Allocator.h"
+#include "memory/MessagePool.h"
 #include "util/events/EventBase.h"
+#include "util/events/Event.h"
 #include "util/events/Pipe.h"
+#include "util/events/Timeout.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "wire/Ethernet.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
 
 #include <errno.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -40,13 +51,14 @@
   #define DEVICE_PATH "/dev/net/tun"
 #endif
 
-struct Iface* TUNInterface_new(const char* interfaceName,
-                                   char assignedInterfaceName[TUNInterface_IFNAMSIZ],
-                                   int isTapMode,
-                                   struct EventBase* base,
-                                   struct Log* logger,
-                                   struct Except* eh,
-                                   struct Allocator* alloc)
+/** The plain tun/tap device with packet info and no offloads, read and written through a Pipe. */
+static struct Iface* newPipeInterface(const char* interfaceName,
+                                      char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+                                      int isTapMode,
+                                      struct EventBase* base,
+                                      struct Log* logger,
+                                      struct Except* eh,
+                                      struct Allocator* alloc)
 {
     uint32_t maxNameSize = (IFNAMSIZ < TUNInterface_IFNAMSIZ) ? IFNAMSIZ : TUNInterface_IFNAMSIZ;
     Log_info(logger, "Initializing tun device [%s]", ((interfaceName) ? interfaceName : "auto"));
@@ -77,3 +89,343 @@ struct Iface* TUNInterface_new(const char* interfaceName,
 
     return &p->iface;
 }
+
+#if !defined(android)
+
+/** Same as Pipe, the largest packet which is not a super-packet. */
+#define BUFFER_CAP Pipe_BUFFER_CAP
+#define PADDING Pipe_PADDING_AMOUNT
+
+/** Packets to read from one queue each time it becomes readable. */
+#define RX_BURST 32
+
+struct TUNInterface_Queue
+{
+    struct TUNInterface_pvt* ctx;
+    int fd;
+    Identity
+};
+
+struct TUNInterface_pvt
+{
+    struct Iface pub;
+
+    struct TUNInterface_Queue queues[TUNInterface_MAX_QUEUES];
+    int queueCount;
+
+    /** True if the kernel accepted TUNSETOFFLOAD so super-packets may be read and written. */
+    bool offload;
+
+    struct MessagePool* pool;
+    struct Allocator* alloc;
+    struct Log* logger;
+
+    /** Where a super-packet is put back together after it spills out of the message buffer. */
+    uint8_t* rxScratch;
+
+    struct TUNOffload_Coalescer coalescer;
+
+    /** Flush the coalescer at the end of the event loop turn. */
+    struct Timeout* txFlush;
+    bool txFlushPending;
+
+    Identity
+};
+
+struct RxBatch
+{
+    struct Message* msgs[RX_BURST];
+    struct Allocator* allocs[RX_BURST];
+    int count;
+};
+
+static void writePacket(struct TUNInterface_pvt* ctx,
+                        struct TUNOffload_Header* hdr,
+                        uint8_t* bytes,
+                        uint32_t length)
+{
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = TUNOffload_Header_SIZE },
+        { .iov_base = bytes, .iov_len = length }
+    };
+    if (writev(ctx->queues[0].fd, iov, 2) < 0) {
+        // EAGAIN means the tun queue is full, the packet is lost just like on a congested link.
+        Log_debug(ctx->logger, "DROP write to tun failed [%s]", strerror(errno));
+    }
+}
+
+static void flushTx(void* vcontext)
+{
+    struct TUNInterface_pvt* ctx = Identity_check((struct TUNInterface_pvt*) vcontext);
+    ctx->txFlushPending = false;
+    struct TUNOffload_Header hdr;
+    uint32_t length = TUNOffload_finish(&ctx->coalescer, &hdr);
+    if (length) {
+        writePacket(ctx, &hdr, ctx->coalescer.buffer, length);
+    }
+}
+
+/**
+ * Consecutive TCP segments of the same flow are merged into a super-packet which is written
+ * at the end of the event loop turn, everything else is written immediately.
+ */
+static Iface_DEFUN sendMessage(struct Message* msg, struct Iface* iface)
+{
+    struct TUNInterface_pvt* ctx = Identity_containerOf(iface, struct TUNInterface_pvt, pub);
+    TUNMessageType_pop(msg, NULL);
+
+    int ret = TUNOffload_append_UNSUITABLE;
+    if (ctx->offload) {
+        ret = TUNOffload_append(&ctx->coalescer, msg->bytes, msg->length);
+        if (ret == TUNOffload_append_FLUSH) {
+            flushTx(ctx);
+            ret = TUNOffload_append(&ctx->coalescer, msg->bytes, msg->length);
+        }
+    }
+    if (ret == TUNOffload_append_UNSUITABLE) {
+        // Keep the packets in order.
+        flushTx(ctx);
+        struct TUNOffload_Header hdr = { .gsoType = TUNOffload_Header_GSO_NONE };
+        writePacket(ctx, &hdr, msg->bytes, msg->length);
+    } else if (!ctx->txFlushPending) {
+        ctx->txFlushPending = true;
+        Timeout_resetTimeout(ctx->txFlush, 0);
+    }
+    return NULL;
+}
+
+static void sendMessageBatch(struct Message** msgs, int count, struct Iface* iface)
+{
+    struct TUNInterface_pvt* ctx = Identity_containerOf(iface, struct TUNInterface_pvt, pub);
+    for (int i = 0; i < count; i++) {
+        Iface_CALL(sendMessage, msgs[i], iface);
+    }
+    if (ctx->txFlushPending) {
+        Timeout_clearTimeout(ctx->txFlush);
+        flushTx(ctx);
+    }
+}
+
+static void flushRx(struct TUNInterface_pvt* ctx, struct RxBatch* batch)
+{
+    if (!batch->count) { return; }
+    Iface_sendBatch(&ctx->pub, batch->msgs, batch->count);
+    for (int i = 0; i < batch->count; i++) {
+        Allocator_free(batch->allocs[i]);
+    }
+    batch->count = 0;
+}
+
+static void addToBatch(struct TUNInterface_pvt* ctx,
+                       struct RxBatch* batch,
+                       struct Message* msg,
+                       struct Allocator* alloc)
+{
+    int version = Headers_getIpVersion(msg->bytes);
+    if (version != 4 && version != 6) {
+        Log_debug(ctx->logger, "DROP packet with unknown IP version [%d]", version);
+        Allocator_free(alloc);
+        return;
+    }
+    TUNMessageType_push(msg, (version == 6) ? Ethernet_TYPE_IP6 : Ethernet_TYPE_IP4, NULL);
+    batch->msgs[batch->count] = msg;
+    batch->allocs[batch->count++] = alloc;
+    if (batch->count == RX_BURST) {
+        flushRx(ctx, batch);
+    }
+}
+
+/**
+ * Cut a TCP super-packet into MTU sized segments.
+ * Anything else which did not fit in a message is too big to forward and is dropped.
+ */
+static void segmentSuperPacket(struct TUNInterface_pvt* ctx,
+                               struct RxBatch* batch,
+                               uint32_t length,
+                               struct TUNOffload_Header* hdr)
+{
+    int segments = TUNOffload_segmentCount(ctx->rxScratch, length, hdr, BUFFER_CAP);
+    if (segments < 1) {
+        Log_debug(ctx->logger, "DROP oversize packet, gsoType [%d] length [%u] gsoSize [%d]",
+                  hdr->gsoType, length, hdr->gsoSize);
+        return;
+    }
+    for (int i = 0; i < segments; i++) {
+        struct Allocator* alloc = MessagePool_child(ctx->pool, ctx->alloc);
+        struct Message* msg = Message_new(BUFFER_CAP, PADDING, alloc);
+        msg->length = TUNOffload_segment(ctx->rxScratch, length, hdr, i, msg->bytes);
+        addToBatch(ctx, batch, msg, alloc);
+    }
+}
+
+/**
+ * Read a burst of packets from one queue. Each is read straight into a pooled message unless
+ * it is too large, in which case the rest spills into the scratch buffer and it is segmented.
+ */
+static void readQueue(void* vqueue)
+{
+    struct TUNInterface_Queue* q = Identity_check((struct TUNInterface_Queue*) vqueue);
+    struct TUNInterface_pvt* ctx = Identity_check(q->ctx);
+    struct RxBatch batch = { .count = 0 };
+
+    for (int i = 0; i < RX_BURST; i++) {
+        struct Allocator* alloc = MessagePool_child(ctx->pool, ctx->alloc);
+        struct Message* msg = Message_new(BUFFER_CAP, PADDING, alloc);
+        struct TUNOffload_Header hdr;
+        struct iovec iov[3] = {
+            { .iov_base = &hdr, .iov_len = TUNOffload_Header_SIZE },
+            { .iov_base = msg->bytes, .iov_len = msg->length },
+            {
+                .iov_base = &ctx->rxScratch[msg->length],
+                .iov_len = TUNOffload_MAX_PACKET - msg->length
+            }
+        };
+        ssize_t rc = readv(q->fd, iov, 3);
+        if (rc <= TUNOffload_Header_SIZE) {
+            if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_info(ctx->logger, "Error reading from tun [%s]", strerror(errno));
+            }
+            Allocator_free(alloc);
+            break;
+        }
+        uint32_t length = rc - TUNOffload_Header_SIZE;
+
+        if ((hdr.gsoType & ~TUNOffload_Header_GSO_ECN) == TUNOffload_Header_GSO_NONE
+            && length <= (uint32_t) msg->length)
+        {
+            msg->length = length;
+            if (TUNOffload_completeChecksum(msg->bytes, length, &hdr)) {
+                Log_debug(ctx->logger, "DROP packet with bad checksum offset");
+                Allocator_free(alloc);
+                continue;
+            }
+            addToBatch(ctx, &batch, msg, alloc);
+            continue;
+        }
+
+        // Put the part which landed in the message back in front of the rest.
+        Bits_memcpy(ctx->rxScratch, msg->bytes, (length < (uint32_t) msg->length)
+                                                 ? length : (uint32_t) msg->length);
+        Allocator_free(alloc);
+        segmentSuperPacket(ctx, &batch, length, &hdr);
+    }
+    flushRx(ctx, &batch);
+}
+
+static int closeQueues(struct Allocator_OnFreeJob* j)
+{
+    struct TUNInterface_pvt* ctx = Identity_check((struct TUNInterface_pvt*) j->userData);
+    for (int i = 0; i < ctx->queueCount; i++) {
+        close(ctx->queues[i].fd);
+    }
+    return 0;
+}
+
+/**
+ * Attach another queue to the device.
+ * @return the file descriptor or -1 with errno set.
+ */
+static int openQueue(struct ifreq* ifRequest)
+{
+    int fd = open(DEVICE_PATH, O_RDWR | O_NONBLOCK);
+    if (fd < 0) { return -1; }
+    if (ioctl(fd, TUNSETIFF, ifRequest) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+struct Iface* TUNInterface_newMultiQueue(const char* interfaceName,
+                                         char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+                                         int queueCount,
+                                         struct EventBase* base,
+                                         struct Log* logger,
+                                         struct Except* eh,
+                                         struct Allocator* alloc)
+{
+    uint32_t maxNameSize = (IFNAMSIZ < TUNInterface_IFNAMSIZ) ? IFNAMSIZ : TUNInterface_IFNAMSIZ;
+    if (queueCount < 1 || queueCount > TUNInterface_MAX_QUEUES) {
+        Except_throw(eh, "queueCount must be between 1 and [%d]", TUNInterface_MAX_QUEUES);
+    }
+    if (interfaceName && strlen(interfaceName) > maxNameSize) {
+        Except_throw(eh, "tunnel name too big, limit is [%d] characters", maxNameSize);
+    }
+    Log_info(logger, "Initializing tun device [%s] with [%d] queues",
+             ((interfaceName) ? interfaceName : "auto"), queueCount);
+
+    struct ifreq ifRequest = {
+        .ifr_flags = IFF_TUN | IFF_NO_PI | IFF_VNET_HDR | IFF_MULTI_QUEUE
+    };
+    if (interfaceName) {
+        strncpy(ifRequest.ifr_name, interfaceName, maxNameSize);
+    }
+    int fd = openQueue(&ifRequest);
+    if (fd < 0) {
+        if (errno != EINVAL) {
+            Except_throw(eh, "open tun device [%s]", strerror(errno));
+        }
+        // Kernels older than 3.8 do not know about IFF_MULTI_QUEUE.
+        Log_info(logger, "tun offloads not supported, falling back to a plain tun device");
+        return newPipeInterface(interfaceName, assignedInterfaceName, 0, base, logger, eh, alloc);
+    }
+
+    struct TUNInterface_pvt* ctx = Allocator_calloc(alloc, sizeof(struct TUNInterface_pvt), 1);
+    Identity_set(ctx);
+    ctx->pub.send = sendMessage;
+    ctx->pub.sendBatch = sendMessageBatch;
+    ctx->alloc = alloc;
+    ctx->logger = logger;
+    ctx->queues[0].fd = fd;
+    ctx->queueCount = 1;
+    Allocator_onFree(alloc, closeQueues, ctx);
+
+    // Later queues attach to the device by the name it was given.
+    for (; ctx->queueCount < queueCount; ctx->queueCount++) {
+        int qfd = openQueue(&ifRequest);
+        if (qfd < 0) {
+            Except_throw(eh, "ioctl(TUNSETIFF) queue [%d] [%s]", ctx->queueCount, strerror(errno));
+        }
+        ctx->queues[ctx->queueCount].fd = qfd;
+    }
+
+    unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+    if (ioctl(fd, TUNSETOFFLOAD, offloads) < 0) {
+        Log_info(logger, "ioctl(TUNSETOFFLOAD) [%s], running without offloads", strerror(errno));
+    } else {
+        ctx->offload = true;
+    }
+
+    ctx->pool = MessagePool_new(alloc, BUFFER_CAP + PADDING);
+    ctx->rxScratch = Allocator_malloc(alloc, TUNOffload_MAX_PACKET);
+    ctx->coalescer.buffer = Allocator_malloc(alloc, TUNOffload_MAX_PACKET);
+    ctx->txFlush = Timeout_setTimeout(flushTx, ctx, 0, base, alloc);
+    Timeout_clearTimeout(ctx->txFlush);
+
+    for (int i = 0; i < ctx->queueCount; i++) {
+        ctx->queues[i].ctx = ctx;
+        Identity_set(&ctx->queues[i]);
+        Event_socketRead(readQueue, &ctx->queues[i], ctx->queues[i].fd, base, alloc, eh);
+    }
+
+    if (assignedInterfaceName) {
+        strncpy(assignedInterfaceName, ifRequest.ifr_name, maxNameSize);
+    }
+    return &ctx->pub;
+}
+
+#endif
+
+struct Iface* TUNInterface_new(const char* interfaceName,
+                               char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+                               int isTapMode,
+                               struct EventBase* base,
+                               struct Log* logger,
+                               struct Except* eh,
+                               struct Allocator* alloc)
+{
+    return newPipeInterface(interfaceName, assignedInterfaceName, isTapMode,
+                            base, logger, eh, alloc);
+}
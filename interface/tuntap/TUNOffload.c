@@ -0,0 +1,298 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "interface/tuntap/TUNOffload.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "wire/Headers.h"
+
+#define PROTO_TCP 6
+
+struct Layout
+{
+    int version;
+
+    /** Offset of the TCP header. */
+    uint32_t l4Offset;
+
+    /** IP and TCP headers including options. */
+    uint32_t headerLength;
+};
+
+/**
+ * Find the TCP header in an IPv4 or IPv6 packet.
+ * The IP length fields are not checked because they are rewritten on every path.
+ */
+static int parseTcp(const uint8_t* packet, uint32_t length, struct Layout* out)
+{
+    if (length < Headers_IP4Header_SIZE) { return -1; }
+    out->version = Headers_getIpVersion((void*) packet);
+    if (out->version == 6) {
+        struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) packet;
+        if (length < Headers_IP6Header_SIZE || ip6->nextHeader != PROTO_TCP) { return -1; }
+        out->l4Offset = Headers_IP6Header_SIZE;
+    } else if (out->version == 4) {
+        struct Headers_IP4Header* ip4 = (struct Headers_IP4Header*) packet;
+        // No IP options and no fragments.
+        if ((packet[0] & 0x0f) != 5 || ip4->protocol != PROTO_TCP) { return -1; }
+        if (ip4->flagsAndFragmentOffset & Endian_hostToBigEndian16(0x3fff)) { return -1; }
+        out->l4Offset = Headers_IP4Header_SIZE;
+    } else {
+        return -1;
+    }
+    if (length < out->l4Offset + Headers_TCPHeader_SIZE) { return -1; }
+    struct Headers_TCPHeader* tcp = (struct Headers_TCPHeader*) &packet[out->l4Offset];
+    uint32_t tcpLength = (tcp->dataOffset >> 4) * 4;
+    if (tcpLength < Headers_TCPHeader_SIZE || length < out->l4Offset + tcpLength) { return -1; }
+    out->headerLength = out->l4Offset + tcpLength;
+    return 0;
+}
+
+static uint32_t pseudoHeaderSum(const uint8_t* packet, int version, uint32_t l4Length)
+{
+    if (version == 6) {
+        // source and destination addresses are the last 32 bytes of the header.
+        uint32_t sum = Checksum_step(&packet[8], 32, 0);
+        sum = Checksum_step32(Endian_hostToBigEndian32(l4Length), sum);
+        return Checksum_step32(Endian_hostToBigEndian32(PROTO_TCP), sum);
+    }
+    uint32_t sum = Checksum_step(&packet[12], 8, 0);
+    return Checksum_step32(Endian_hostToBigEndian32((PROTO_TCP << 16) | l4Length), sum);
+}
+
+static void setIpLength(uint8_t* packet, int version, uint32_t length)
+{
+    if (version == 6) {
+        struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) packet;
+        ip6->payloadLength_be = Endian_hostToBigEndian16(length - Headers_IP6Header_SIZE);
+        return;
+    }
+    struct Headers_IP4Header* ip4 = (struct Headers_IP4Header*) packet;
+    ip4->totalLength_be = Endian_hostToBigEndian16(length);
+    ip4->checksum_be = 0;
+    ip4->checksum_be = Checksum_engine(packet, Headers_IP4Header_SIZE);
+}
+
+int TUNOffload_completeChecksum(uint8_t* packet, uint32_t length, struct TUNOffload_Header* hdr)
+{
+    if (!(hdr->flags & TUNOffload_Header_F_NEEDS_CSUM)) { return 0; }
+    uint32_t start = hdr->csumStart;
+    uint32_t offset = start + hdr->csumOffset;
+    if (offset + 2 > length || (start & 1) || length - start > 0xffff) { return -1; }
+
+    // The checksum field already holds the sum of the pseudo-header.
+    uint16_t sum = Checksum_complete(Checksum_step(&packet[start], length - start, 0));
+    // UDP uses 0 to mean "no checksum".
+    if (!sum && hdr->csumOffset == 6) { sum = 0xffff; }
+    Bits_memcpy(&packet[offset], &sum, 2);
+    hdr->flags &= ~TUNOffload_Header_F_NEEDS_CSUM;
+    return 0;
+}
+
+int TUNOffload_segmentCount(const uint8_t* packet,
+                            uint32_t length,
+                            const struct TUNOffload_Header* hdr,
+                            uint32_t maxSegment)
+{
+    int type = hdr->gsoType & ~TUNOffload_Header_GSO_ECN;
+    if (type == TUNOffload_Header_GSO_NONE) {
+        return (length <= maxSegment) ? 1 : -1;
+    }
+    struct Layout l;
+    if (parseTcp(packet, length, &l)) { return -1; }
+    if ((type == TUNOffload_Header_GSO_TCPV4) != (l.version == 4)) { return -1; }
+    if (type != TUNOffload_Header_GSO_TCPV4 && type != TUNOffload_Header_GSO_TCPV6) {
+        return -1;
+    }
+    uint32_t payload = length - l.headerLength;
+    if (!hdr->gsoSize || !payload || l.headerLength + hdr->gsoSize > maxSegment) { return -1; }
+    return (payload + hdr->gsoSize - 1) / hdr->gsoSize;
+}
+
+uint32_t TUNOffload_segment(const uint8_t* packet,
+                            uint32_t length,
+                            const struct TUNOffload_Header* hdr,
+                            int index,
+                            uint8_t* out)
+{
+    struct Layout l;
+    Assert_true(!parseTcp(packet, length, &l));
+    uint32_t payload = length - l.headerLength;
+    uint32_t first = index * hdr->gsoSize;
+    Assert_true(first < payload);
+    uint32_t segPayload = (payload - first < hdr->gsoSize) ? payload - first : hdr->gsoSize;
+    bool last = (first + segPayload == payload);
+
+    Bits_memcpy(out, packet, l.headerLength);
+    Bits_memcpy(&out[l.headerLength], &packet[l.headerLength + first], segPayload);
+    uint32_t segLength = l.headerLength + segPayload;
+
+    if (l.version == 4) {
+        struct Headers_IP4Header* ip4 = (struct Headers_IP4Header*) out;
+        uint16_t id = Endian_bigEndianToHost16(ip4->identification_be) + index;
+        ip4->identification_be = Endian_hostToBigEndian16(id);
+    }
+    setIpLength(out, l.version, segLength);
+
+    // Edit a copy, the checksum reads 16 bits at a time and must not be reordered before the edits.
+    struct Headers_TCPHeader tcp;
+    Bits_memcpy(&tcp, &out[l.l4Offset], Headers_TCPHeader_SIZE);
+    tcp.seq_be = Endian_hostToBigEndian32(Endian_bigEndianToHost32(tcp.seq_be) + first);
+    if (!last) {
+        tcp.flags &= ~(Headers_TCPHeader_FIN | Headers_TCPHeader_PSH);
+    }
+    if (index) {
+        tcp.flags &= ~Headers_TCPHeader_CWR;
+    }
+    tcp.checksum_be = 0;
+    Bits_memcpy(&out[l.l4Offset], &tcp, Headers_TCPHeader_SIZE);
+
+    uint32_t l4Length = segLength - l.l4Offset;
+    uint32_t sum = pseudoHeaderSum(out, l.version, l4Length);
+    uint16_t checksum = Checksum_complete(Checksum_step(&out[l.l4Offset], l4Length, sum));
+    Bits_memcpy(&out[l.l4Offset + 16], &checksum, 2);
+    return segLength;
+}
+
+/** @return true if the packet may begin or join a super-packet. */
+static bool suitable(const uint8_t* packet, uint32_t length, struct Layout* l)
+{
+    if (length > TUNOffload_MAX_PACKET || parseTcp(packet, length, l)) { return false; }
+    if (l->version == 6) {
+        struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) packet;
+        uint32_t payloadLength = Endian_bigEndianToHost16(ip6->payloadLength_be);
+        if (payloadLength + Headers_IP6Header_SIZE != length) { return false; }
+    } else {
+        struct Headers_IP4Header* ip4 = (struct Headers_IP4Header*) packet;
+        if (Endian_bigEndianToHost16(ip4->totalLength_be) != length) { return false; }
+    }
+    struct Headers_TCPHeader* tcp = (struct Headers_TCPHeader*) &packet[l->l4Offset];
+    if ((tcp->flags & ~Headers_TCPHeader_PSH) != Headers_TCPHeader_ACK || tcp->urgentPointer_be) {
+        return false;
+    }
+    if (length == l->headerLength) { return false; }
+
+    // The kernel trusts the checksum of a super-packet so a corrupt segment must not get in.
+    uint32_t l4Length = length - l->l4Offset;
+    uint32_t sum = pseudoHeaderSum(packet, l->version, l4Length);
+    return !Checksum_complete(Checksum_step(&packet[l->l4Offset], l4Length, sum));
+}
+
+/** @return true if the packet is the next segment of the same flow as the super-packet. */
+static bool follows(struct TUNOffload_Coalescer* c, const uint8_t* packet, struct Layout* l)
+{
+    const uint8_t* head = c->buffer;
+    if (l->headerLength != c->headerLength || Headers_getIpVersion((void*) head) != l->version) {
+        return false;
+    }
+    if (l->version == 6) {
+        // Everything but the payload length.
+        if (Bits_memcmp(head, packet, 4) || Bits_memcmp(&head[6], &packet[6], 34)) {
+            return false;
+        }
+    } else {
+        struct Headers_IP4Header* a = (struct Headers_IP4Header*) head;
+        struct Headers_IP4Header* b = (struct Headers_IP4Header*) packet;
+        uint16_t nextId = Endian_bigEndianToHost16(a->identification_be) + c->segmentCount;
+        if (a->differentiatedServices != b->differentiatedServices
+            || a->flagsAndFragmentOffset != b->flagsAndFragmentOffset
+            || a->ttl != b->ttl
+            || Bits_memcmp(a->sourceAddr, b->sourceAddr, 8)
+            || Endian_bigEndianToHost16(b->identification_be) != nextId)
+        {
+            return false;
+        }
+    }
+    struct Headers_TCPHeader* a = (struct Headers_TCPHeader*) &head[l->l4Offset];
+    struct Headers_TCPHeader* b = (struct Headers_TCPHeader*) &packet[l->l4Offset];
+    uint32_t nextSeq = Endian_bigEndianToHost32(a->seq_be) + c->length - c->headerLength;
+    if (a->srcPort_be != b->srcPort_be
+        || a->destPort_be != b->destPort_be
+        || a->ack_be != b->ack_be
+        || a->window_be != b->window_be
+        || Endian_bigEndianToHost32(b->seq_be) != nextSeq)
+    {
+        return false;
+    }
+    // Options, including timestamps, must match exactly.
+    uint32_t optionsOffset = l->l4Offset + Headers_TCPHeader_SIZE;
+    return !Bits_memcmp(&head[optionsOffset],
+                        &packet[optionsOffset],
+                        l->headerLength - optionsOffset);
+}
+
+int TUNOffload_append(struct TUNOffload_Coalescer* c, const uint8_t* packet, uint32_t length)
+{
+    struct Layout l;
+    if (!suitable(packet, length, &l)) { return TUNOffload_append_UNSUITABLE; }
+    struct Headers_TCPHeader* tcp = (struct Headers_TCPHeader*) &packet[l.l4Offset];
+    uint32_t payload = length - l.headerLength;
+
+    if (!c->length) {
+        Bits_memcpy(c->buffer, packet, length);
+        c->length = length;
+        c->headerLength = l.headerLength;
+        c->segmentSize = payload;
+        c->segmentCount = 1;
+        c->closed = (tcp->flags & Headers_TCPHeader_PSH);
+        return TUNOffload_append_OK;
+    }
+
+    if (c->closed
+        || payload > c->segmentSize
+        || c->length + payload > TUNOffload_MAX_PACKET
+        || !follows(c, packet, &l))
+    {
+        return TUNOffload_append_FLUSH;
+    }
+
+    Bits_memcpy(&c->buffer[c->length], &packet[l.headerLength], payload);
+    c->length += payload;
+    c->segmentCount++;
+    if (tcp->flags & Headers_TCPHeader_PSH) {
+        struct Headers_TCPHeader* headTcp = (struct Headers_TCPHeader*) &c->buffer[l.l4Offset];
+        headTcp->flags |= Headers_TCPHeader_PSH;
+        c->closed = true;
+    }
+    if (payload < c->segmentSize) {
+        c->closed = true;
+    }
+    return TUNOffload_append_OK;
+}
+
+uint32_t TUNOffload_finish(struct TUNOffload_Coalescer* c, struct TUNOffload_Header* hdr)
+{
+    Bits_memset(hdr, 0, TUNOffload_Header_SIZE);
+    uint32_t length = c->length;
+    c->length = 0;
+    if (!length || c->segmentCount == 1) { return length; }
+
+    struct Layout l;
+    Assert_true(!parseTcp(c->buffer, length, &l));
+    setIpLength(c->buffer, l.version, length);
+
+    // Partial checksum, only the pseudo-header, the kernel does the rest for each segment.
+    struct Headers_TCPHeader* tcp = (struct Headers_TCPHeader*) &c->buffer[l.l4Offset];
+    uint32_t sum = pseudoHeaderSum(c->buffer, l.version, length - l.l4Offset);
+    tcp->checksum_be = ~Checksum_complete(sum);
+
+    hdr->flags = TUNOffload_Header_F_NEEDS_CSUM;
+    hdr->gsoType = (l.version == 4) ? TUNOffload_Header_GSO_TCPV4 : TUNOffload_Header_GSO_TCPV6;
+    hdr->hdrLen = l.headerLength;
+    hdr->gsoSize = c->segmentSize;
+    hdr->csumStart = l.l4Offset;
+    hdr->csumOffset = 16;
+    return length;
+}
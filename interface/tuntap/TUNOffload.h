@@ -0,0 +1,133 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TUNOffload_H
+#define TUNOffload_H
+
+#include "util/Assert.h"
+#include "util/Linker.h"
+Linker_require("interface/tuntap/TUNOffload.c");
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Segmentation and checksum offload for TUN devices which prefix each packet with a
+ * virtio_net_hdr (Linux IFF_VNET_HDR).
+ * Packets read from such a device may be TCP "super-packets" of up to 64k which must be cut into
+ * MTU sized segments and may have only a partial checksum. When writing, runs of consecutive TCP
+ * segments of the same flow can be merged back into a super-packet so the kernel takes a whole
+ * burst in one write.
+ */
+
+/** Same layout as struct virtio_net_hdr, in host byte order. */
+struct TUNOffload_Header
+{
+    uint8_t flags;
+    uint8_t gsoType;
+    uint16_t hdrLen;
+    uint16_t gsoSize;
+    uint16_t csumStart;
+    uint16_t csumOffset;
+};
+#define TUNOffload_Header_SIZE 10
+Assert_compileTime(sizeof(struct TUNOffload_Header) == TUNOffload_Header_SIZE);
+
+#define TUNOffload_Header_F_NEEDS_CSUM 1
+#define TUNOffload_Header_GSO_NONE     0
+#define TUNOffload_Header_GSO_TCPV4    1
+#define TUNOffload_Header_GSO_TCPV6    4
+#define TUNOffload_Header_GSO_ECN      0x80
+
+/** The largest super-packet, including the IP header. */
+#define TUNOffload_MAX_PACKET 65535
+
+/**
+ * If the packet has only a partial checksum (TUNOffload_Header_F_NEEDS_CSUM), fill it in.
+ *
+ * @return 0 on success, -1 if the checksum location is out of bounds.
+ */
+int TUNOffload_completeChecksum(uint8_t* packet, uint32_t length, struct TUNOffload_Header* hdr);
+
+/**
+ * @param maxSegment the largest packet, including headers, which the caller can take.
+ * @return the number of segments which the packet must be cut into, 1 if it is not a
+ *         super-packet or -1 if the packet cannot be handled, including a packet which is not
+ *         a super-packet but is bigger than maxSegment or a super-packet whose segments are.
+ */
+int TUNOffload_segmentCount(const uint8_t* packet,
+                            uint32_t length,
+                            const struct TUNOffload_Header* hdr,
+                            uint32_t maxSegment);
+
+/**
+ * Write one segment of a TCP super-packet with headers and a complete checksum.
+ *
+ * @param packet the super-packet, TUNOffload_segmentCount() must have returned more than 1.
+ * @param index the number of the segment, less than TUNOffload_segmentCount().
+ * @param out a buffer with space for the maxSegment which was given to
+ *            TUNOffload_segmentCount().
+ * @return the length of the segment.
+ */
+uint32_t TUNOffload_segment(const uint8_t* packet,
+                            uint32_t length,
+                            const struct TUNOffload_Header* hdr,
+                            int index,
+                            uint8_t* out);
+
+struct TUNOffload_Coalescer
+{
+    /** Where the super-packet is built, TUNOffload_MAX_PACKET bytes, set by the user. */
+    uint8_t* buffer;
+
+    /** Length of the super-packet so far, 0 if none is being built. */
+    uint32_t length;
+
+    uint32_t headerLength;
+    uint32_t segmentSize;
+    uint32_t segmentCount;
+
+    /** Set when nothing more can be added because the last segment was short or had PSH. */
+    bool closed;
+};
+
+/** The packet was copied into the super-packet, possibly as the first segment of a new one. */
+#define TUNOffload_append_OK 0
+
+/** The packet does not follow the super-packet, call TUNOffload_finish() and try again. */
+#define TUNOffload_append_FLUSH -1
+
+/**
+ * The packet is not a TCP segment which can be merged, call TUNOffload_finish() on whatever
+ * is pending and then send it by itself.
+ */
+#define TUNOffload_append_UNSUITABLE -2
+
+/**
+ * Add a packet (without any virtio_net_hdr) to the super-packet being built.
+ * Only segments with a correct checksum are merged because the kernel will trust the checksum
+ * of the super-packet.
+ */
+int TUNOffload_append(struct TUNOffload_Coalescer* c, const uint8_t* packet, uint32_t length);
+
+/**
+ * Fix up the lengths and checksum of the pending super-packet and describe it in hdr.
+ * If only one packet was added, it is unchanged and hdr says it is a normal packet.
+ * The super-packet is in c->buffer until the next call to TUNOffload_append().
+ *
+ * @return the length of the super-packet, 0 if none was pending.
+ */
+uint32_t TUNOffload_finish(struct TUNOffload_Coalescer* c, struct TUNOffload_Header* hdr);
+
+#endif
@@ -0,0 +1,217 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "interface/tuntap/TUNOffload.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "wire/Headers.h"
+
+#define SEGMENTS 10
+#define SEGMENT_SIZE 1000
+#define LAST_SEGMENT_SIZE 500
+#define FIRST_SEQ 0xfffff000
+
+struct Packet
+{
+    uint8_t bytes[Headers_IP6Header_SIZE + Headers_TCPHeader_SIZE + SEGMENT_SIZE];
+    uint32_t length;
+};
+
+static uint32_t pseudoHeaderSum(const uint8_t* packet, int version, uint32_t l4Length)
+{
+    if (version == 6) {
+        uint32_t sum = Checksum_step(&packet[8], 32, 0);
+        sum = Checksum_step32(Endian_hostToBigEndian32(l4Length), sum);
+        return Checksum_step32(Endian_hostToBigEndian32(6), sum);
+    }
+    uint32_t sum = Checksum_step(&packet[12], 8, 0);
+    return Checksum_step32(Endian_hostToBigEndian32((6 << 16) | l4Length), sum);
+}
+
+static bool checksumValid(const uint8_t* packet, uint32_t length, int version)
+{
+    uint32_t l4Offset = (version == 6) ? Headers_IP6Header_SIZE : Headers_IP4Header_SIZE;
+    uint32_t sum = pseudoHeaderSum(packet, version, length - l4Offset);
+    return !Checksum_complete(Checksum_step(&packet[l4Offset], length - l4Offset, sum));
+}
+
+/**
+ * Headers are built in structs and copied in because the checksum reads the packet 16 bits
+ * at a time and that must not be reordered before the stores.
+ */
+static void mkSegment(struct Packet* p, int version, int index)
+{
+    Bits_memset(p, 0, sizeof(struct Packet));
+    uint32_t payload = (index == SEGMENTS - 1) ? LAST_SEGMENT_SIZE : SEGMENT_SIZE;
+    uint32_t l4Offset;
+    if (version == 6) {
+        struct Headers_IP6Header ip6 = {
+            .payloadLength_be = Endian_hostToBigEndian16(Headers_TCPHeader_SIZE + payload),
+            .nextHeader = 6,
+            .hopLimit = 64
+        };
+        Headers_setIpVersion(&ip6);
+        Bits_memset(ip6.sourceAddr, 0xfc, 16);
+        Bits_memset(ip6.destinationAddr, 0xfd, 16);
+        Bits_memcpy(p->bytes, &ip6, Headers_IP6Header_SIZE);
+        l4Offset = Headers_IP6Header_SIZE;
+    } else {
+        struct Headers_IP4Header ip4 = {
+            .versionAndHeaderLength = 0x45,
+            .totalLength_be = Endian_hostToBigEndian16(
+                Headers_IP4Header_SIZE + Headers_TCPHeader_SIZE + payload),
+            .identification_be = Endian_hostToBigEndian16(0xfffe + index),
+            .ttl = 64,
+            .protocol = 6
+        };
+        Bits_memset(ip4.sourceAddr, 10, 4);
+        Bits_memset(ip4.destAddr, 11, 4);
+        Bits_memcpy(p->bytes, &ip4, Headers_IP4Header_SIZE);
+        uint16_t checksum = Checksum_engine(p->bytes, Headers_IP4Header_SIZE);
+        Bits_memcpy(&p->bytes[10], &checksum, 2);
+        l4Offset = Headers_IP4Header_SIZE;
+    }
+    struct Headers_TCPHeader tcp = {
+        .srcPort_be = Endian_hostToBigEndian16(5000),
+        .destPort_be = Endian_hostToBigEndian16(80),
+        .seq_be = Endian_hostToBigEndian32(FIRST_SEQ + index * SEGMENT_SIZE),
+        .ack_be = Endian_hostToBigEndian32(12345),
+        .dataOffset = (Headers_TCPHeader_SIZE / 4) << 4,
+        .flags = Headers_TCPHeader_ACK,
+        .window_be = Endian_hostToBigEndian16(1024)
+    };
+    if (index == SEGMENTS - 1) {
+        tcp.flags |= Headers_TCPHeader_PSH;
+    }
+    Bits_memcpy(&p->bytes[l4Offset], &tcp, Headers_TCPHeader_SIZE);
+    uint8_t* data = &p->bytes[l4Offset + Headers_TCPHeader_SIZE];
+    for (uint32_t i = 0; i < payload; i++) {
+        data[i] = (index * SEGMENT_SIZE + i) * 7;
+    }
+    p->length = l4Offset + Headers_TCPHeader_SIZE + payload;
+    uint32_t sum = pseudoHeaderSum(p->bytes, version, p->length - l4Offset);
+    uint16_t checksum =
+        Checksum_complete(Checksum_step(&p->bytes[l4Offset], p->length - l4Offset, sum));
+    Bits_memcpy(&p->bytes[l4Offset + 16], &checksum, 2);
+    Assert_true(checksumValid(p->bytes, p->length, version));
+}
+
+static void roundTrip(int version, struct Allocator* alloc)
+{
+    struct Packet* segs = Allocator_calloc(alloc, sizeof(struct Packet), SEGMENTS);
+    for (int i = 0; i < SEGMENTS; i++) {
+        mkSegment(&segs[i], version, i);
+    }
+
+    struct TUNOffload_Coalescer c = { .buffer = Allocator_malloc(alloc, TUNOffload_MAX_PACKET) };
+    for (int i = 0; i < SEGMENTS; i++) {
+        Assert_true(TUNOffload_append(&c, segs[i].bytes, segs[i].length) == TUNOffload_append_OK);
+    }
+    // PSH closed the super-packet.
+    Assert_true(TUNOffload_append(&c, segs[0].bytes, segs[0].length) == TUNOffload_append_FLUSH);
+
+    struct TUNOffload_Header hdr;
+    uint32_t length = TUNOffload_finish(&c, &hdr);
+    uint32_t l4Offset = (version == 6) ? Headers_IP6Header_SIZE : Headers_IP4Header_SIZE;
+    Assert_true(length == l4Offset + Headers_TCPHeader_SIZE
+        + (SEGMENTS - 1) * SEGMENT_SIZE + LAST_SEGMENT_SIZE);
+    Assert_true(hdr.flags == TUNOffload_Header_F_NEEDS_CSUM);
+    Assert_true(hdr.gsoType == ((version == 6)
+        ? TUNOffload_Header_GSO_TCPV6 : TUNOffload_Header_GSO_TCPV4));
+    Assert_true(hdr.gsoSize == SEGMENT_SIZE);
+    Assert_true(hdr.hdrLen == l4Offset + Headers_TCPHeader_SIZE);
+    struct Packet out;
+    Assert_true(TUNOffload_segmentCount(c.buffer, length, &hdr, sizeof out.bytes) == SEGMENTS);
+
+    // The caller could not take a whole segment.
+    Assert_true(TUNOffload_segmentCount(c.buffer, length, &hdr, hdr.hdrLen + SEGMENT_SIZE - 1) < 0);
+
+    // Cutting it up again gives back exactly what went in.
+    for (int i = 0; i < SEGMENTS; i++) {
+        out.length = TUNOffload_segment(c.buffer, length, &hdr, i, out.bytes);
+        Assert_true(out.length == segs[i].length);
+        Assert_true(!Bits_memcmp(out.bytes, segs[i].bytes, out.length));
+    }
+
+    // What the kernel would do if it could not segment the packet.
+    Assert_true(!checksumValid(c.buffer, length, version));
+    Assert_true(!TUNOffload_completeChecksum(c.buffer, length, &hdr));
+    Assert_true(!(hdr.flags & TUNOffload_Header_F_NEEDS_CSUM));
+    Assert_true(checksumValid(c.buffer, length, version));
+}
+
+static void unsuitable(struct Allocator* alloc)
+{
+    struct TUNOffload_Coalescer c = { .buffer = Allocator_malloc(alloc, TUNOffload_MAX_PACKET) };
+    struct Packet p;
+    struct TUNOffload_Header hdr;
+
+    // A single segment goes out as it is.
+    mkSegment(&p, 6, 0);
+    Assert_true(TUNOffload_append(&c, p.bytes, p.length) == TUNOffload_append_OK);
+    Assert_true(TUNOffload_finish(&c, &hdr) == p.length);
+    Assert_true(hdr.gsoType == TUNOffload_Header_GSO_NONE && !hdr.flags);
+    Assert_true(!Bits_memcmp(c.buffer, p.bytes, p.length));
+
+    // Out of sequence.
+    Assert_true(TUNOffload_append(&c, p.bytes, p.length) == TUNOffload_append_OK);
+    mkSegment(&p, 6, 2);
+    Assert_true(TUNOffload_append(&c, p.bytes, p.length) == TUNOffload_append_FLUSH);
+    TUNOffload_finish(&c, &hdr);
+
+    // Bad checksum.
+    p.bytes[p.length - 1] ^= 1;
+    Assert_true(TUNOffload_append(&c, p.bytes, p.length) == TUNOffload_append_UNSUITABLE);
+
+    // Not TCP.
+    mkSegment(&p, 6, 0);
+    p.bytes[6] = 17;
+    Assert_true(TUNOffload_append(&c, p.bytes, p.length) == TUNOffload_append_UNSUITABLE);
+    Assert_true(!c.length);
+}
+
+/** A packet which is not a super-packet but is too big for the caller must not be segmented. */
+static void oversize(struct Allocator* alloc)
+{
+    uint8_t* big = Allocator_calloc(alloc, TUNOffload_MAX_PACKET, 1);
+    struct TUNOffload_Header hdr = { .gsoType = TUNOffload_Header_GSO_NONE };
+    struct Packet p;
+
+    // UDP, nothing which segmenting could make sense of.
+    mkSegment(&p, 6, 0);
+    p.bytes[6] = 17;
+    Bits_memcpy(big, p.bytes, p.length);
+    Assert_true(TUNOffload_segmentCount(big, p.length, &hdr, p.length) == 1);
+    Assert_true(TUNOffload_segmentCount(big, TUNOffload_MAX_PACKET, &hdr, p.length) < 0);
+
+    // A TCP packet which the kernel did not mark as a super-packet.
+    mkSegment(&p, 4, 0);
+    Bits_memcpy(big, p.bytes, p.length);
+    Assert_true(TUNOffload_segmentCount(big, p.length, &hdr, p.length - 1) < 0);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    roundTrip(6, alloc);
+    roundTrip(4, alloc);
+    unsuitable(alloc);
+    oversize(alloc);
+    Allocator_free(alloc);
+    return 0;
+}
@@ -15,6 +15,7 @@
 
 #include "memory/Allocator.h"
 #include "memory/Allocator_pvt.h"
+#include "memory/MessagePool.h"
 #include "util/Bits.h"
 #include "util/Defined.h"
 
@@ -158,6 +159,141 @@ static inline void checkCanaries(struct Allocator_Allocation_pvt* alloc,
     #endif
 }
 
+/** Buffers are aligned so that the memory handed to the user starts on a cache line. */
+#define CACHE_LINE 64
+
+/** Allocators, Message structures, onFree jobs and other small things. */
+#define SMALL_SIZE 256
+
+/** Amount of memory to ask the provider for each time a free list runs dry. */
+#define SLAB_SIZE (1<<16)
+
+/** Room for the allocation header and canaries on top of what the user asked for. */
+#define OVERHEAD (sizeof(struct Allocator_Allocation_pvt) + 2 * sizeof(long))
+
+#define ROUND_UP(x, align) (((x) + (align) - 1) & ~((unsigned long)(align) - 1))
+
+struct MessagePool_Slab;
+struct MessagePool_Slab {
+    struct MessagePool_Slab* next;
+};
+
+struct MessagePool_FreeBlock;
+struct MessagePool_FreeBlock {
+    struct MessagePool_FreeBlock* next;
+};
+
+struct MessagePool_Class
+{
+    /** Largest allocation (including header) which fits in this class. */
+    unsigned long capacity;
+
+    /** Distance between buffers, a multiple of the cache line size. */
+    unsigned long stride;
+
+    /** Buffers per slab. */
+    unsigned long count;
+
+    struct MessagePool_FreeBlock* freeList;
+};
+
+struct MessagePool_pvt
+{
+    struct MessagePool pub;
+
+    struct MessagePool_Class classes[2];
+
+    /** Every slab which was taken from the provider, released when refs drops to zero. */
+    struct MessagePool_Slab* slabs;
+
+    /** The owner plus every allocator which is drawing from the pool. */
+    unsigned long refs;
+
+    Allocator_Provider provider;
+    Allocator_Provider_CONTEXT_TYPE* providerContext;
+    struct Allocator_FirstCtx* rootAlloc;
+
+    Identity
+};
+
+static struct MessagePool_Class* classFor(struct MessagePool_pvt* pool, unsigned long size)
+{
+    for (int i = 0; i < 2; i++) {
+        if (size <= pool->classes[i].capacity) {
+            return &pool->classes[i];
+        }
+    }
+    return NULL;
+}
+
+static void grow(struct MessagePool_pvt* pool, struct MessagePool_Class* cls)
+{
+    unsigned long size = sizeof(struct MessagePool_Slab) + CACHE_LINE + cls->count * cls->stride;
+    struct MessagePool_Slab* slab = pool->provider(pool->providerContext, NULL, size, NULL);
+    Assert_true(slab);
+    pool->rootAlloc->mallocs++;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    // Line up the first buffer so that the memory after the allocation header is aligned.
+    uintptr_t first = (uintptr_t) &slab[1] + sizeof(struct Allocator_Allocation_pvt);
+    first = ROUND_UP(first, CACHE_LINE) - sizeof(struct Allocator_Allocation_pvt);
+    for (unsigned long i = 0; i < cls->count; i++) {
+        struct MessagePool_FreeBlock* block =
+            (struct MessagePool_FreeBlock*) (first + i * cls->stride);
+        block->next = cls->freeList;
+        cls->freeList = block;
+    }
+}
+
+static void* poolTake(struct MessagePool_pvt* pool, unsigned long size)
+{
+    struct MessagePool_Class* cls = classFor(Identity_check(pool), size);
+    if (!cls) {
+        return NULL;
+    }
+    if (!cls->freeList) {
+        grow(pool, cls);
+    }
+    struct MessagePool_FreeBlock* block = cls->freeList;
+    cls->freeList = block->next;
+    return block;
+}
+
+static int poolGive(struct MessagePool_pvt* pool, void* vblock, unsigned long size)
+{
+    struct MessagePool_Class* cls = classFor(Identity_check(pool), size);
+    if (!cls) {
+        return -1;
+    }
+    struct MessagePool_FreeBlock* block = vblock;
+    block->next = cls->freeList;
+    cls->freeList = block;
+    return 0;
+}
+
+static void poolRef(struct MessagePool_pvt* pool)
+{
+    Identity_check(pool)->refs++;
+}
+
+static void poolUnref(struct MessagePool_pvt* pool)
+{
+    Identity_check(pool);
+    Assert_true(pool->refs > 0);
+    if (--pool->refs) {
+        return;
+    }
+    Allocator_Provider provider = pool->provider;
+    Allocator_Provider_CONTEXT_TYPE* providerContext = pool->providerContext;
+    for (struct MessagePool_Slab* slab = pool->slabs; slab;) {
+        struct MessagePool_Slab* next = slab->next;
+        provider(providerContext, (struct Allocator_Allocation*) slab, 0, NULL);
+        slab = next;
+    }
+    provider(providerContext, (struct Allocator_Allocation*) pool, 0, NULL);
+}
+
 Gcc_ALLOC_SIZE(2)
 static inline void* newAllocation(struct Allocator_pvt* context,
                                   unsigned long size,
@@ -174,11 +310,19 @@ static inline void* newAllocation(struct Allocator_pvt* context,
     rootAlloc->spaceAvailable -= realSize;
     context->allocatedHere += realSize;
 
-    struct Allocator_Allocation_pvt* alloc =
-        rootAlloc->provider(rootAlloc->providerContext,
-                            NULL,
-                            realSize,
-                            &context->pub);
+    struct Allocator_Allocation_pvt* alloc = NULL;
+    if (context->pool) {
+        alloc = poolTake(context->pool, realSize);
+    }
+    if (alloc) {
+        rootAlloc->pooled++;
+    } else {
+        rootAlloc->mallocs++;
+        alloc = rootAlloc->provider(rootAlloc->providerContext,
+                                    NULL,
+                                    realSize,
+                                    &context->pub);
+    }
     if (alloc == NULL) {
         failure(context, "Out of memory, malloc() returned NULL", fileName, lineNum);
     }
@@ -223,6 +367,7 @@ static int removeJob(struct Allocator_OnFreeJob_pvt* job)
     struct Allocator_pvt* context = Identity_check(job->alloc);
     struct Allocator_OnFreeJob_pvt* j = context->onFree;
     struct Allocator_OnFreeJob_pvt** jP = &context->onFree;
+    context->onFreeTail = NULL;
     while (j && j != job) {
         jP = &j->next;
         j = j->next;
@@ -238,6 +383,7 @@ static int removeJob(struct Allocator_OnFreeJob_pvt* job)
 
 static void releaseAllocation(struct Allocator_pvt* context,
                               struct Allocator_Allocation_pvt* allocation,
+                              struct MessagePool_pvt* pool,
                               Allocator_Provider provider,
                               Allocator_Provider_CONTEXT_TYPE* providerCtx)
 {
@@ -248,6 +394,9 @@ static void releaseAllocation(struct Allocator_pvt* context,
                 0xee,
                 allocation->pub.size - sizeof(struct Allocator_Allocation));
 
+    if (pool && !poolGive(pool, allocation, allocation->pub.size)) {
+        return;
+    }
     provider(providerCtx,
              &allocation->pub,
              0,
@@ -265,6 +414,9 @@ static void releaseMemory(struct Allocator_pvt* context,
 
     Identity_check(context->rootAlloc)->spaceAvailable += context->allocatedHere;
 
+    // The allocator itself is the last allocation to go, don't read it after that.
+    struct MessagePool_pvt* pool = context->pool;
+
     struct Allocator_Allocation_pvt* loc = context->allocations;
     while (loc != NULL) {
         #ifdef PARANOIA
@@ -272,9 +424,12 @@ static void releaseMemory(struct Allocator_pvt* context,
         #endif
 
         struct Allocator_Allocation_pvt* nextLoc = loc->next;
-        releaseAllocation(context, loc, provider, providerCtx);
+        releaseAllocation(context, loc, pool, provider, providerCtx);
         loc = nextLoc;
     }
+    if (pool) {
+        poolUnref(pool);
+    }
     #ifdef PARANOIA
         Assert_true(allocatedHere == 0);
     #endif
@@ -422,6 +577,8 @@ static void marshalOnFreeJobs(struct Allocator_pvt* context, struct Allocator_pv
         }
         *jobP = child->onFree;
         child->onFree = NULL;
+        child->onFreeTail = NULL;
+        rootToFree->onFreeTail = NULL;
 
         while (*jobP != NULL) {
             struct Allocator_OnFreeJob_pvt* job = *jobP;
@@ -457,10 +614,13 @@ static void doOnFreeJobs(struct Allocator_pvt* context)
     }
 }
 
-static void freeAllocator(struct Allocator_pvt* context)
+/**
+ * @param isTop true if this is the allocator which Allocator_free() was called on rather than
+ *              one of its children, it is disconnected from its parent.
+ */
+static void freeAllocator(struct Allocator_pvt* context, int isTop)
 {
     Assert_true(context->pub.isFreeing);
-    int isTop = !context->parent->pub.isFreeing;
     if (isTop) {
         check(context);
         disconnect(context);
@@ -468,7 +628,7 @@ static void freeAllocator(struct Allocator_pvt* context)
     struct Allocator_pvt* child = context->firstChild;
     while (child) {
         struct Allocator_pvt* nextChild = child->nextSibling;
-        freeAllocator(child);
+        freeAllocator(child, 0);
         child = nextChild;
     }
 
@@ -494,7 +654,7 @@ void Allocator_onFreeComplete(struct Allocator_OnFreeJob* onFreeJob)
 
     if (!context->onFree) {
         // There are no more jobs, release the memory.
-        freeAllocator(context);
+        freeAllocator(context, !context->parent->pub.isFreeing);
     }
 }
 
@@ -523,7 +683,9 @@ void Allocator__free(struct Allocator* alloc, const char* file, int line)
     doOnFreeJobs(context);
     check(context);
     if (!context->onFree) {
-        freeAllocator(context);
+        // The parent may be freeing too if this was made by one of the parent's onFree jobs,
+        // it is still in the parent's list of children and must be taken out.
+        freeAllocator(context, context->parent != context);
     }
 }
 
@@ -589,12 +751,30 @@ void* Allocator__realloc(struct Allocator* allocator,
         context->allocatedHere -= origLoc->pub.size;
         releaseAllocation(context,
                           origLoc,
+                          context->pool,
                           context->rootAlloc->provider,
                           context->rootAlloc->providerContext);
         check(context);
         return NULL;
     }
 
+    if (context->pool) {
+        // Pooled memory can't be handed to the provider's realloc(), move it instead.
+        *locPtr = nextLoc;
+        context->rootAlloc->spaceAvailable += origLoc->pub.size;
+        context->allocatedHere -= origLoc->pub.size;
+        void* out = newAllocation(context, size, fileName, lineNum);
+        unsigned long origSize = origLoc->pub.size - getRealSize(0);
+        Bits_memcpy(out, original, (origSize < size) ? origSize : size);
+        releaseAllocation(context,
+                          origLoc,
+                          context->pool,
+                          context->rootAlloc->provider,
+                          context->rootAlloc->providerContext);
+        check(context);
+        return out;
+    }
+
     size_t realSize = getRealSize(size);
     if (context->rootAlloc->spaceAvailable + origLoc->pub.size < realSize) {
         failure(context, "Out of memory, limit exceeded.", fileName, lineNum);
@@ -603,6 +783,7 @@ void* Allocator__realloc(struct Allocator* allocator,
     context->rootAlloc->spaceAvailable -= realSize;
     context->allocatedHere -= origLoc->pub.size;
     context->allocatedHere += realSize;
+    context->rootAlloc->mallocs++;
 
     struct Allocator_Allocation_pvt* alloc =
         context->rootAlloc->provider(context->rootAlloc->providerContext,
@@ -634,7 +815,10 @@ void* Allocator__clone(struct Allocator* allocator,
     return pointer;
 }
 
-struct Allocator* Allocator__child(struct Allocator* allocator, const char* file, int line)
+static struct Allocator* pooledChild(struct Allocator* allocator,
+                                     struct MessagePool_pvt* pool,
+                                     const char* file,
+                                     int line)
 {
     struct Allocator_pvt* parent = Identity_check((struct Allocator_pvt*) allocator);
     check(parent);
@@ -644,8 +828,12 @@ struct Allocator* Allocator__child(struct Allocator* allocator, const char* file
             .fileName = file,
             .lineNum = line,
         },
-        .rootAlloc = parent->rootAlloc
+        .rootAlloc = parent->rootAlloc,
+        .pool = pool
     };
+    if (pool) {
+        poolRef(pool);
+    }
     Identity_set(&stackChild);
     #ifdef Allocator_USE_CANARIES
         stackChild.nextCanary = stackChild.canary = parent->nextCanary;
@@ -662,11 +850,18 @@ struct Allocator* Allocator__child(struct Allocator* allocator, const char* file
     return &child->pub;
 }
 
+struct Allocator* Allocator__child(struct Allocator* allocator, const char* file, int line)
+{
+    struct Allocator_pvt* parent = Identity_check((struct Allocator_pvt*) allocator);
+    return pooledChild(allocator, parent->pool, file, line);
+}
+
 int Allocator_cancelOnFree(struct Allocator_OnFreeJob* toRemove)
 {
     struct Allocator_OnFreeJob_pvt* job = (struct Allocator_OnFreeJob_pvt*) toRemove;
     struct Allocator_pvt* context = Identity_check(job->alloc);
     struct Allocator_OnFreeJob_pvt** jobPtr = &(context->onFree);
+    context->onFreeTail = NULL;
     while (*jobPtr != NULL) {
         if (*jobPtr == job) {
             *jobPtr = (*jobPtr)->next;
@@ -786,15 +981,14 @@ struct Allocator_OnFreeJob* Allocator__onFree(struct Allocator* alloc,
         }));
     Identity_set(newJob);
 
-    struct Allocator_OnFreeJob_pvt* job = context->onFree;
-    if (job == NULL) {
-        context->onFree = newJob;
-    } else {
-        while (job->next != NULL) {
-            job = job->next;
+    if (!context->onFreeTail) {
+        context->onFreeTail = &context->onFree;
+        while (*context->onFreeTail) {
+            context->onFreeTail = &(*context->onFreeTail)->next;
         }
-        job->next = newJob;
     }
+    *context->onFreeTail = newJob;
+    context->onFreeTail = &newJob->next;
     return &newJob->pub;
 }
 
@@ -851,6 +1045,14 @@ unsigned long Allocator_bytesAllocated(struct Allocator* allocator)
     return bytesAllocated(context);
 }
 
+void Allocator_getStats(struct Allocator* allocator, struct Allocator_Stats* out)
+{
+    struct Allocator_pvt* context = Identity_check((struct Allocator_pvt*) allocator);
+    struct Allocator_FirstCtx* rootAlloc = Identity_check(context->rootAlloc);
+    out->mallocs = rootAlloc->mallocs;
+    out->pooled = rootAlloc->pooled;
+}
+
 void Allocator_setCanary(struct Allocator* alloc, unsigned long value)
 {
     #ifdef Allocator_USE_CANARIES
@@ -858,3 +1060,52 @@ void Allocator_setCanary(struct Allocator* alloc, unsigned long value)
         context->nextCanary ^= value;
     #endif
 }
+
+static int ownerFreed(struct Allocator_OnFreeJob* job)
+{
+    poolUnref(Identity_check((struct MessagePool_pvt*) job->userData));
+    return 0;
+}
+
+static void initClass(struct MessagePool_Class* cls, unsigned long capacity)
+{
+    cls->capacity = capacity;
+    cls->stride = ROUND_UP(capacity, CACHE_LINE);
+    cls->count = (SLAB_SIZE > cls->stride) ? SLAB_SIZE / cls->stride : 1;
+}
+
+struct MessagePool* MessagePool_new(struct Allocator* alloc, uint32_t bufferSize)
+{
+    struct Allocator_pvt* context = Identity_check((struct Allocator_pvt*) alloc);
+    struct Allocator_FirstCtx* rootAlloc = Identity_check(context->rootAlloc);
+
+    // The pool is not part of the allocator tree because it may outlive alloc.
+    struct MessagePool_pvt* pool =
+        rootAlloc->provider(rootAlloc->providerContext, NULL, sizeof(struct MessagePool_pvt), NULL);
+    Assert_true(pool);
+    rootAlloc->mallocs++;
+    Bits_memcpy(pool, (&(struct MessagePool_pvt) {
+        .pub = { .bufferSize = bufferSize },
+        .refs = 1,
+        .provider = rootAlloc->provider,
+        .providerContext = rootAlloc->providerContext,
+        .rootAlloc = rootAlloc
+    }), sizeof(struct MessagePool_pvt));
+    Identity_set(pool);
+
+    unsigned long large = ROUND_UP(bufferSize, sizeof(char*)) + OVERHEAD;
+    initClass(&pool->classes[0], (large < SMALL_SIZE) ? large : SMALL_SIZE);
+    initClass(&pool->classes[1], large);
+
+    Allocator_onFree(alloc, ownerFreed, pool);
+    return &pool->pub;
+}
+
+struct Allocator* MessagePool__child(struct MessagePool* pool,
+                                     struct Allocator* parent,
+                                     const char* fileName,
+                                     int lineNum)
+{
+    struct MessagePool_pvt* p = Identity_check((struct MessagePool_pvt*) pool);
+    return pooledChild(parent, p, fileName, lineNum);
+}
@@ -20,6 +20,8 @@
 #include "util/Linker.h"
 Linker_require("memory/Allocator.c");
 
+#include <stdint.h>
+
 /**
  * A handle which is provided in response to calls to Allocator_onFree().
  * This handle is sutable for use with Allocator_notOnFree() to cancel a job.
@@ -331,6 +333,20 @@ void Allocator_setCanary(struct Allocator* alloc, unsigned long value);
  */
 unsigned long Allocator_bytesAllocated(struct Allocator* allocator);
 
+struct Allocator_Stats
+{
+    /** Number of times the provider (e.g. malloc()) was asked for memory. */
+    uint64_t mallocs;
+
+    /** Number of allocations which were served from a MessagePool free list. */
+    uint64_t pooled;
+};
+
+/**
+ * Get the allocation counters for the whole tree which this allocator belongs to.
+ */
+void Allocator_getStats(struct Allocator* allocator, struct Allocator_Stats* out);
+
 /**
  * Dump a memory snapshot to stderr.
  *
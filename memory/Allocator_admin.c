@@ -43,6 +43,17 @@ static void bytesAllocated(Dict* in, void* vcontext, String* txid, struct Alloca
     Admin_sendMessage(d, txid, ctx->admin);
 }
 
+static void stats(Dict* in, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Allocator_admin_pvt* ctx = Identity_check((struct Allocator_admin_pvt*)vcontext);
+    struct Allocator_Stats st;
+    Allocator_getStats(ctx->alloc, &st);
+    Dict* d = Dict_new(requestAlloc);
+    Dict_putIntC(d, "mallocs", st.mallocs, requestAlloc);
+    Dict_putIntC(d, "pooled", st.pooled, requestAlloc);
+    Admin_sendMessage(d, txid, ctx->admin);
+}
+
 void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin)
 {
     struct Allocator_admin_pvt* ctx = Allocator_clone(alloc, (&(struct Allocator_admin_pvt) {
@@ -55,4 +66,5 @@ void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin)
             { .name = "includeAllocations", .required = 0, .type = "Int" }
         }), admin);
     Admin_registerFunction("Allocator_bytesAllocated", bytesAllocated, ctx, true, NULL, admin);
+    Admin_registerFunction("Allocator_stats", stats, ctx, true, NULL, admin);
 }
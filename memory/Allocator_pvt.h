@@ -74,6 +74,12 @@ struct Allocator_pvt
     /** A linked list of jobs which must be done when this allocator is freed. */
     struct Allocator_OnFreeJob_pvt* onFree;
 
+    /**
+     * The next pointer of the last job in onFree so jobs can be appended in constant time,
+     * NULL if it is not known and must be found by walking the list.
+     */
+    struct Allocator_OnFreeJob_pvt** onFreeTail;
+
     /** The parent of this allocator, self-pointer if this is a root allocator. */
     struct Allocator_pvt* parent;
 
@@ -102,6 +108,9 @@ struct Allocator_pvt
      */
     struct Allocator_Adoptions* adoptions;
 
+    /** If non-NULL, allocations which fit are taken from this pool, inherited by children. */
+    struct MessagePool_pvt* pool;
+
     #ifdef Allocator_USE_CANARIES
         /** The canary for allocations made with this allocator constant to allow varification. */
         unsigned long canary;
@@ -130,6 +139,12 @@ struct Allocator_FirstCtx
     /** The number of bytes which can be allocated total. */
     int64_t maxSpace;
 
+    /** The number of times the provider has been asked for new memory. */
+    uint64_t mallocs;
+
+    /** The number of allocations which were served from a MessagePool instead. */
+    uint64_t pooled;
+
     Identity
 };
 
@@ -0,0 +1,63 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef MessagePool_H
+#define MessagePool_H
+
+#include "memory/Allocator.h"
+#include "util/Gcc.h"
+
+#include <stdint.h>
+
+/**
+ * A pool of fixed size, cache line aligned buffers which are recycled through a free list.
+ *
+ * Allocators created with MessagePool_child() (and their children) take their memory from
+ * the pool whenever it fits and give it back to the pool when they are freed, so the usual
+ * per packet pattern of child allocator + Message_new() + Allocator_free() does not touch
+ * malloc() once the pool has grown to the size of the working set.
+ * Large allocations which do not fit in a buffer fall back to the normal provider.
+ *
+ * The pool lives until the allocator it was created with is freed *and* every allocator which
+ * is drawing from it has been freed, so messages may safely be adopted and held.
+ * Pool memory is never returned to the provider before then.
+ *
+ * Implemented in Allocator.c because it works on the allocator internals.
+ */
+struct MessagePool
+{
+    /** The largest single allocation which is served from the pool. */
+    const uint32_t bufferSize;
+};
+
+/**
+ * @param alloc the allocator which owns the pool.
+ * @param bufferSize the size of the largest allocation which should come from the pool,
+ *                   normally the message length plus padding.
+ */
+struct MessagePool* MessagePool_new(struct Allocator* alloc, uint32_t bufferSize);
+
+/**
+ * Spawn a child of parent which allocates from the pool.
+ *
+ * @param pool the pool to draw from.
+ * @param parent the allocator to make a child of, see Allocator_child().
+ */
+struct Allocator* MessagePool__child(struct MessagePool* pool,
+                                     struct Allocator* parent,
+                                     const char* fileName,
+                                     int lineNum);
+#define MessagePool_child(p, a) MessagePool__child((p),(a),Gcc_SHORT_FILE,Gcc_LINE)
+
+#endif
@@ -0,0 +1,92 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "memory/MessagePool.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "wire/Message.h"
+
+#define BUFFER_SIZE 2048
+#define PADDING 512
+
+static void steadyState(struct Allocator* alloc)
+{
+    struct Allocator* owner = Allocator_child(alloc);
+    struct MessagePool* pool = MessagePool_new(owner, BUFFER_SIZE);
+
+    // Warm up the free lists.
+    for (int i = 0; i < 16; i++) {
+        struct Allocator* child = MessagePool_child(pool, owner);
+        Message_new(BUFFER_SIZE - PADDING, PADDING, child);
+        Allocator_free(child);
+    }
+
+    struct Allocator_Stats before;
+    Allocator_getStats(alloc, &before);
+    for (int i = 0; i < 10000; i++) {
+        struct Allocator* child = MessagePool_child(pool, owner);
+        struct Message* msg = Message_new(BUFFER_SIZE - PADDING, PADDING, child);
+        Assert_true(!(((uintptr_t) (msg->bytes - msg->padding)) % 64));
+        Bits_memset(msg->bytes, 0xab, msg->length);
+        Allocator_free(child);
+    }
+    struct Allocator_Stats after;
+    Allocator_getStats(alloc, &after);
+    Assert_true(after.mallocs == before.mallocs);
+    Assert_true(after.pooled == before.pooled + 10000 * 3);
+
+    // Too big for the pool, falls through to the provider.
+    struct Allocator* child = MessagePool_child(pool, owner);
+    Allocator_malloc(child, BUFFER_SIZE * 2);
+    Allocator_getStats(alloc, &before);
+    Assert_true(before.mallocs == after.mallocs + 1);
+    Allocator_free(child);
+
+    Allocator_free(owner);
+}
+
+static void outliveOwner(struct Allocator* alloc)
+{
+    struct Allocator* owner = Allocator_child(alloc);
+    struct Allocator* holder = Allocator_child(alloc);
+    struct MessagePool* pool = MessagePool_new(owner, BUFFER_SIZE);
+
+    struct Allocator* child = MessagePool_child(pool, owner);
+    struct Message* msg = Message_new(64, PADDING, child);
+    Bits_memset(msg->bytes, 0xcd, msg->length);
+    Allocator_adopt(holder, child);
+    Allocator_free(child);
+
+    // The pool must stay alive while the message is being held.
+    Allocator_free(owner);
+    char* grown = Allocator_realloc(msg->alloc, msg->bytes - msg->padding, BUFFER_SIZE);
+    Assert_true(grown[PADDING] == (char)0xcd && grown[PADDING + 63] == (char)0xcd);
+    struct Allocator* grandchild = Allocator_child(msg->alloc);
+    Allocator_malloc(grandchild, 16);
+
+    Allocator_free(holder);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    unsigned long bytes = Allocator_bytesAllocated(alloc);
+    steadyState(alloc);
+    outliveOwner(alloc);
+    Assert_true(Allocator_bytesAllocated(alloc) == bytes);
+    Allocator_free(alloc);
+    return 0;
+}
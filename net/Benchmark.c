@@ -17,12 +17,18 @@
 #include "memory/Allocator.h"
 #include "crypto/random/Random.h"
 #include "crypto/Key.h"
+#include "crypto/BoxBatch.h"
 #include "interface/Iface.h"
 #include "util/log/FileWriterLog.h"
 #include "util/events/Time.h"
 #include "util/events/Timeout.h"
 #include "net/NetCore.h"
+#include "switch/SwitchCore.h"
 #include "util/Checksum.h"
+#include "util/events/ThreadIface.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/events/UDPShards.h"
+#include "exception/Jmp.h"
 
 struct Context
 {
@@ -98,11 +104,85 @@ static void cryptoAuth(struct Context* ctx)
         Assert_true(!CryptoAuth_decrypt(sess2, msg));
     }
     done(ctx);
+
+    // Encryption alone, one message at a time and then BoxBatch_LANES at a time.
+    // The message is put back to its original size after each round.
+    begin(ctx, "salsa20/poly1305 encrypt", (count * size * 8) / 1024, "kilobits");
+    for (int i = 0; i < count; i++) {
+        Assert_true(!CryptoAuth_encrypt(sess1, msg));
+        Message_shift(msg, -20, NULL);
+    }
+    done(ctx);
+
+    struct Message* msgs[BoxBatch_LANES];
+    struct CryptoAuth_Session* sessions[BoxBatch_LANES];
+    for (int i = 0; i < BoxBatch_LANES; i++) {
+        msgs[i] = Message_new(size, 256, alloc);
+        Random_bytes(ctx->rand, msgs[i]->bytes, msgs[i]->length);
+        sessions[i] = (i & 1) ? sess2 : sess1;
+    }
+    Log_info(ctx->log, "Batched salsa20 kernel is [%s]", BoxBatch_implementation());
+    begin(ctx, "salsa20/poly1305 encrypt batched", (count * size * 8) / 1024, "kilobits");
+    for (int i = 0; i < count; i += BoxBatch_LANES) {
+        CryptoAuth_encryptBatch(sessions, msgs, BoxBatch_LANES);
+        for (int j = 0; j < BoxBatch_LANES; j++) {
+            Message_shift(msgs[j], -20, NULL);
+        }
+    }
+    done(ctx);
     Allocator_free(alloc);
 }
 
 
 
+struct SwitchCoreContext
+{
+    struct Iface aliceIf;
+    struct Iface bobIf;
+    int msgCount;
+    Identity
+};
+
+static Iface_DEFUN switchCoreBobRecv(struct Message* msg, struct Iface* bobIf)
+{
+    struct SwitchCoreContext* sc = Identity_containerOf(bobIf, struct SwitchCoreContext, bobIf);
+    sc->msgCount++;
+    return NULL;
+}
+
+/** Only the forwarding path of the switch, no crypto or session lookups. */
+static void switchCore(struct Context* ctx)
+{
+    Log_info(ctx->log, "Setting up SwitchCore benchmark (forwarding only)");
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct SwitchCoreContext* sc = Allocator_calloc(alloc, sizeof(struct SwitchCoreContext), 1);
+    Identity_set(sc);
+    sc->bobIf.send = switchCoreBobRecv;
+
+    struct SwitchCore* core = SwitchCore_new(ctx->log, alloc, ctx->base);
+    uint64_t aliceLabel;
+    uint64_t bobLabel;
+    Assert_true(!SwitchCore_addInterface(core, &sc->aliceIf, alloc, &aliceLabel));
+    Assert_true(!SwitchCore_addInterface(core, &sc->bobIf, alloc, &bobLabel));
+
+    int size = 1024;
+    int count = 2000000;
+    struct Message* msg = Message_new(size, 256, alloc);
+    Bits_memset(msg->bytes, 0, size);
+    struct SwitchHeader* sh = (struct SwitchHeader*) msg->bytes;
+
+    begin(ctx, "SwitchCore", count, "packets");
+    for (int i = 0; i < count; i++) {
+        sh->label_be = Endian_hostToBigEndian64(bobLabel);
+        SwitchHeader_setLabelShift(sh, 0);
+        Iface_send(&sc->aliceIf, msg);
+    }
+    done(ctx);
+    Assert_true(sc->msgCount == count);
+
+    Allocator_free(alloc);
+}
+
 struct SwitchingContext
 {
     struct Iface aliceIf;
@@ -217,6 +297,161 @@ static void switching(struct Context* ctx)
     Allocator_free(alloc);
 }
 
+static void neverCalled(void* vNULL)
+{
+    Assert_failure("timeout should have been cleared");
+}
+
+/** Create and clear 1M timeouts, TIMEOUT_ROUND at a time so that many are outstanding. */
+#define TIMEOUT_COUNT 1000000
+#define TIMEOUT_ROUND 100000
+static void timeouts(struct Context* ctx)
+{
+    struct Allocator* bigAlloc = MallocAllocator_new(1<<28);
+    struct Timeout** outstanding =
+        Allocator_malloc(bigAlloc, sizeof(struct Timeout*) * TIMEOUT_ROUND);
+    begin(ctx, "Timeout", TIMEOUT_COUNT, "timeouts");
+    for (int round = 0; round < TIMEOUT_COUNT / TIMEOUT_ROUND; round++) {
+        struct Allocator* alloc = Allocator_child(bigAlloc);
+        for (int i = 0; i < TIMEOUT_ROUND; i++) {
+            // Spread over the first hour so every level of the wheel is used.
+            uint64_t ms = 1 + ((uint64_t)i * 7919) % 3600000;
+            outstanding[i] = Timeout_setTimeout(neverCalled, NULL, ms, ctx->base, alloc);
+        }
+        for (int i = 0; i < TIMEOUT_ROUND; i++) {
+            Timeout_clearTimeout(outstanding[i]);
+        }
+        Allocator_free(alloc);
+    }
+    done(ctx);
+    Allocator_free(bigAlloc);
+}
+
+/** Sockets per sender thread, each has its own port so the kernel can spread them. */
+#define BLASTER_SOCKETS 4
+#define BLASTER_THREADS 4
+#define BLASTER_BURST 256
+#define BLASTER_BATCH 64
+#define UDP_SHARDS_PACKETS 200000
+
+struct Blaster
+{
+    /** Plumbed to one socket each, nothing comes back. */
+    struct Iface ifaces[BLASTER_SOCKETS];
+    struct Sockaddr* dest;
+    struct Allocator* alloc;
+    Identity
+};
+
+/**
+ * Runs on a sender thread every millisecond until the thread is stopped, a zero timeout would
+ * be run again and again by libuv without ever getting back to the loop.
+ */
+static void blast(void* vBlaster)
+{
+    struct Blaster* b = Identity_check((struct Blaster*) vBlaster);
+    for (int i = 0; i < BLASTER_BURST; i++) {
+        struct Allocator* msgAlloc = Allocator_child(b->alloc);
+        struct Message* msg = Message_new(64, 512, msgAlloc);
+        Bits_memset(msg->bytes, 0, 64);
+        Message_push(msg, b->dest, b->dest->addrLen, NULL);
+        Iface_send(&b->ifaces[i % BLASTER_SOCKETS], msg);
+        Allocator_free(msgAlloc);
+    }
+}
+
+static void startBlaster(struct Iface* iface,
+                         struct Allocator* alloc,
+                         struct EventBase* base,
+                         struct Log* log,
+                         struct Random* rand,
+                         void* vDest)
+{
+    struct Blaster* b = Allocator_calloc(alloc, sizeof(struct Blaster), 1);
+    Identity_set(b);
+    b->dest = Sockaddr_clone(vDest, alloc);
+    b->alloc = alloc;
+    struct Sockaddr* bindAddr = Sockaddr_clone(vDest, alloc);
+    Sockaddr_setPort(bindAddr, 0);
+    for (int i = 0; i < BLASTER_SOCKETS; i++) {
+        struct UDPAddrIface* udp = UDPAddrIface_new(base, bindAddr, alloc, NULL, log);
+        UDPAddrIface_setBatchSize(udp, BLASTER_BATCH);
+        Iface_plumb(&b->ifaces[i], &udp->generic.iface);
+    }
+    Timeout_setInterval(blast, b, 1, base, alloc);
+}
+
+struct UDPShardsContext
+{
+    struct Iface shardsIf;
+    struct Context* benchmarkCtx;
+    uint32_t received;
+    Identity
+};
+
+static Iface_DEFUN udpShardsRecv(struct Message* msg, struct Iface* shardsIf)
+{
+    struct UDPShardsContext* usc =
+        Identity_containerOf(shardsIf, struct UDPShardsContext, shardsIf);
+    if (++usc->received == UDP_SHARDS_PACKETS) {
+        EventBase_endLoop(usc->benchmarkCtx->base);
+    }
+    return NULL;
+}
+
+static void udpShardsTooSlow(void* vctx)
+{
+    struct UDPShardsContext* usc = Identity_check((struct UDPShardsContext*) vctx);
+    Log_warn(usc->benchmarkCtx->log, "Gave up after [%u] packets", usc->received);
+    EventBase_endLoop(usc->benchmarkCtx->base);
+}
+
+/**
+ * Packets delivered to the main loop by UDPShards with a growing number of shards while
+ * BLASTER_THREADS other threads send to it as fast as they can over the loopback.
+ */
+static void udpShards(struct Context* ctx)
+{
+    static char* names[] = { "UDPShards x1", "UDPShards x2", "UDPShards x4", "UDPShards x8" };
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    for (int n = 0; n < 4; n++) {
+        // Each thread has two rings of ThreadIface_RING_SIZE.
+        struct Allocator* alloc = MallocAllocator_new(1<<24);
+        struct UDPShardsContext* usc =
+            Allocator_calloc(alloc, sizeof(struct UDPShardsContext), 1);
+        Identity_set(usc);
+        usc->benchmarkCtx = ctx;
+        usc->shardsIf.send = udpShardsRecv;
+
+        struct UDPShards* shards;
+        struct Jmp jmp;
+        Jmp_try(jmp) {
+            shards = UDPShards_new(ctx->base, &ss.addr, 1 << n, BLASTER_BATCH, 0,
+                                   alloc, &jmp.handler, ctx->log);
+        } Jmp_catch {
+            Log_info(ctx->log, "Skipping UDPShards benchmark [%s]", jmp.message);
+            Allocator_free(alloc);
+            return;
+        }
+        Iface_plumb(&usc->shardsIf, &shards->generic.iface);
+
+        for (int i = 0; i < BLASTER_THREADS; i++) {
+            ThreadIface_new(startBlaster, shards->generic.addr, UDPShards_THREAD_MEMORY,
+                            ctx->base, ctx->log, alloc);
+        }
+        // Keeps the loop running, the shards and senders do not.
+        Timeout_setTimeout(udpShardsTooSlow, usc, 30000, ctx->base, alloc);
+
+        begin(ctx, names[n], UDP_SHARDS_PACKETS, "packets");
+        EventBase_beginLoop(ctx->base);
+        done(ctx);
+
+        // Stops and joins all of the threads.
+        Allocator_free(alloc);
+    }
+}
+
 /** Check if nodes A and C can communicate via B without A knowing that C exists. */
 void Benchmark_runAll(void)
 {
@@ -229,5 +464,8 @@ void Benchmark_runAll(void)
     ctx->rand = Random_new(alloc, log, NULL);
 
     cryptoAuth(ctx);
+    switchCore(ctx);
     switching(ctx);
+    timeouts(ctx);
+    udpShards(ctx);
 }
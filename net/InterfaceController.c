@@ -67,6 +67,7 @@
 #define Map_VALUE_TYPE struct Peer*
 #define Map_USE_HASH
 #define Map_USE_COMPARATOR
+#define Map_USE_HASHTABLE
 #include "util/Map.h"
 static inline uint32_t Map_EndpointsBySockaddr_hash(struct Sockaddr** key)
 {
@@ -146,6 +147,23 @@ struct Peer
     Identity
 };
 
+/** The largest number of messages which are passed on together from a burst. */
+#define BATCH_MAX 64
+
+/** Messages which are collected while handling a burst so that they can be passed on together. */
+struct Batch
+{
+    /** The interface which the messages are from (rx) or are going out of (tx). */
+    struct InterfaceController_Iface_pvt* ici;
+
+    int count;
+
+    struct Message* msgs[BATCH_MAX];
+
+    /** For messages headed to the switch, the handle of the peer which each came from. */
+    uint32_t handles[BATCH_MAX];
+};
+
 struct InterfaceController_pvt
 {
     /** Public functions and fields for this ifcontroller. */
@@ -198,6 +216,12 @@ struct InterfaceController_pvt
 
     struct Headers_Beacon beacon;
 
+    /** Non-null while a burst from the wire is being handled, collects messages for the switch. */
+    struct Batch* rxBatch;
+
+    /** Non-null while a burst from the switch is being handled, collects messages for the wire. */
+    struct Batch* txBatch;
+
     Identity
 };
 
@@ -471,39 +495,106 @@ static Iface_DEFUN receivedPostCryptoAuth(struct Message* msg,
 
     Identity_check(ep);
     Assert_true(!(msg->capacity % 4));
+
+    struct Batch* batch = ic->rxBatch;
+    if (batch && batch->ici == ep->ici && batch->count < BATCH_MAX) {
+        batch->handles[batch->count] = ep->handle;
+        batch->msgs[batch->count++] = msg;
+        return NULL;
+    }
     return Iface_next(&ep->switchIf, msg);
 }
 
-// This is directly called from SwitchCore, message is not encrypted.
-static Iface_DEFUN sendFromSwitch(struct Message* msg, struct Iface* switchIf)
+/** Put on the lladdr and write out a message which has been encrypted. */
+static void sendToWire(struct Message* msg, struct Peer* ep)
 {
-    struct Peer* ep = Identity_check((struct Peer*) switchIf);
+    Assert_true(!(((uintptr_t)msg->bytes) % 4) && "alignment fault");
 
-    ep->bytesOut += msg->length;
+    // push the lladdr...
+    Message_push(msg, ep->lladdr, ep->lladdr->addrLen, NULL);
+
+    // very noisy
+    if (Defined(Log_DEBUG) && false) {
+        char* printedAddr =
+            Hex_print(&ep->lladdr[1], ep->lladdr->addrLen - Sockaddr_OVERHEAD, msg->alloc);
+        Log_debug(ep->ici->ic->logger, "Outgoing message to [%s]", printedAddr);
+    }
+
+    struct Batch* batch = ep->ici->ic->txBatch;
+    if (batch && batch->ici == ep->ici && batch->count < BATCH_MAX) {
+        batch->msgs[batch->count++] = msg;
+        return;
+    }
+    Iface_send(&ep->ici->pub.addrIf, msg);
+}
 
-    int msgs = PeerLink_send(msg, ep->peerLink);
+static void encryptedAsync(struct Message* msg, int err, void* vpeer)
+{
+    sendToWire(msg, Identity_check((struct Peer*) vpeer));
+}
 
-    for (int i = 0; i < msgs; i++) {
-        msg = PeerLink_poll(ep->peerLink);
+/**
+ * Encrypt and send whatever the PeerLink is willing to release now.
+ * @param alloc an allocator which lives until the messages have been sent.
+ */
+static void drainPeerLink(struct Peer* ep, struct Allocator* alloc)
+{
+    struct Message* msg;
+    while ((msg = PeerLink_poll(ep->peerLink, alloc))) {
+        if (!CryptoAuth_encryptAsync(ep->caSession, msg, encryptedAsync, ep)) {
+            continue;
+        }
         Assert_true(!CryptoAuth_encrypt(ep->caSession, msg));
+        sendToWire(msg, ep);
+    }
+}
 
-        Assert_true(!(((uintptr_t)msg->bytes) % 4) && "alignment fault");
+/** The PeerLink's pacer allows more to be sent after having held messages back. */
+static void peerLinkReady(struct PeerLink* pl, void* vpeer)
+{
+    struct Peer* ep = Identity_check((struct Peer*) vpeer);
+    struct Allocator* alloc = Allocator_child(ep->alloc);
+    drainPeerLink(ep, alloc);
+    Allocator_free(alloc);
+}
 
-        // push the lladdr...
-        Message_push(msg, ep->lladdr, ep->lladdr->addrLen, NULL);
+// This is directly called from SwitchCore, message is not encrypted.
+static Iface_DEFUN sendFromSwitch(struct Message* msg, struct Iface* switchIf)
+{
+    struct Peer* ep = Identity_check((struct Peer*) switchIf);
 
-        // very noisy
-        if (Defined(Log_DEBUG) && false) {
-            char* printedAddr =
-                Hex_print(&ep->lladdr[1], ep->lladdr->addrLen - Sockaddr_OVERHEAD, msg->alloc);
-            Log_debug(ep->ici->ic->logger, "Outgoing message to [%s]", printedAddr);
-        }
+    ep->bytesOut += msg->length;
 
-        Iface_send(&ep->ici->pub.addrIf, msg);
+    // Messages which were waiting in the queue are adopted by this one's allocator,
+    // it outlives the send because it is freed by whoever sent to the switch.
+    if (PeerLink_send(msg, ep->peerLink)) {
+        drainPeerLink(ep, msg->alloc);
     }
     return NULL;
 }
 
+/** A burst from the switch, encrypt them all and then write them out with one sendBatch. */
+static void sendBatchFromSwitch(struct Message** msgs, int count, struct Iface* switchIf)
+{
+    struct Peer* ep = Identity_check((struct Peer*) switchIf);
+    struct InterfaceController_Iface_pvt* ici = ep->ici;
+    struct InterfaceController_pvt* ic = ici->ic;
+    struct Batch* outerBatch = ic->txBatch;
+    struct Batch batch = { .ici = ici };
+    for (int base = 0; base < count; base += BATCH_MAX) {
+        int n = (count - base < BATCH_MAX) ? count - base : BATCH_MAX;
+        batch.count = 0;
+        ic->txBatch = &batch;
+        for (int i = 0; i < n; i++) {
+            Iface_CALL(sendFromSwitch, msgs[base + i], switchIf);
+        }
+        ic->txBatch = outerBatch;
+        if (batch.count) {
+            Iface_sendBatch(&ici->pub.addrIf, batch.msgs, batch.count);
+        }
+    }
+}
+
 static int closeInterface(struct Allocator_OnFreeJob* job)
 {
     struct Peer* toClose = Identity_check((struct Peer*) job->userData);
@@ -600,11 +691,12 @@ static Iface_DEFUN handleBeacon(struct Message* msg, struct InterfaceController_
     Identity_set(ep);
     Allocator_onFree(epAlloc, closeInterface, ep);
 
-    ep->peerLink = PeerLink_new(ic->eventBase, epAlloc);
+    ep->peerLink = PeerLink_new(ic->eventBase, peerLinkReady, ep, epAlloc);
     ep->caSession = CryptoAuth_newSession(ic->ca, epAlloc, beacon.publicKey, false, "outer");
     CryptoAuth_setAuth(beaconPass, NULL, ep->caSession);
 
     ep->switchIf.send = sendFromSwitch;
+    ep->switchIf.sendBatch = sendBatchFromSwitch;
 
     if (SwitchCore_addInterface(ic->switchCore, &ep->switchIf, epAlloc, &ep->addr.path)) {
         Log_debug(ic->logger, "handleBeacon() SwitchCore out of space");
@@ -652,7 +744,7 @@ static Iface_DEFUN handleUnexpectedIncoming(struct Message* msg,
     ep->ici = ici;
     ep->lladdr = lladdr;
     ep->alloc = epAlloc;
-    ep->peerLink = PeerLink_new(ic->eventBase, epAlloc);
+    ep->peerLink = PeerLink_new(ic->eventBase, peerLinkReady, ep, epAlloc);
     struct CryptoHeader* ch = (struct CryptoHeader*) msg->bytes;
     ep->caSession = CryptoAuth_newSession(ic->ca, epAlloc, ch->publicKey, true, "outer");
     if (CryptoAuth_decrypt(ep->caSession, msg)) {
@@ -670,6 +762,7 @@ static Iface_DEFUN handleUnexpectedIncoming(struct Message* msg,
     ep->state = InterfaceController_PeerState_UNAUTHENTICATED;
     ep->isIncomingConnection = true;
     ep->switchIf.send = sendFromSwitch;
+    ep->switchIf.sendBatch = sendBatchFromSwitch;
 
     if (SwitchCore_addInterface(ic->switchCore, &ep->switchIf, epAlloc, &ep->addr.path)) {
         Log_debug(ic->logger, "handleUnexpectedIncoming() SwitchCore out of space");
@@ -691,6 +784,25 @@ static Iface_DEFUN handleUnexpectedIncoming(struct Message* msg,
     return receivedPostCryptoAuth(msg, ep, ic);
 }
 
+static Iface_DEFUN receivedDecrypted(struct Message* msg, struct Peer* ep)
+{
+    PeerLink_recv(msg, ep->peerLink);
+    if (ep->state == InterfaceController_PeerState_ESTABLISHED &&
+        CryptoAuth_getState(ep->caSession) != CryptoAuth_State_ESTABLISHED) {
+        sendPeer(0xffffffff, PFChan_Core_PEER_GONE, ep);
+    }
+    return receivedPostCryptoAuth(msg, ep, ep->ici->ic);
+}
+
+static void decryptedAsync(struct Message* msg, int err, void* vpeer)
+{
+    struct Peer* ep = Identity_check((struct Peer*) vpeer);
+    if (err) {
+        return;
+    }
+    Iface_CALL(receivedDecrypted, msg, ep);
+}
+
 static Iface_DEFUN handleIncomingFromWire(struct Message* msg, struct Iface* addrIf)
 {
     struct InterfaceController_Iface_pvt* ici =
@@ -723,15 +835,46 @@ static Iface_DEFUN handleIncomingFromWire(struct Message* msg, struct Iface* add
     struct Peer* ep = Identity_check((struct Peer*) ici->peerMap.values[epIndex]);
     Message_shift(msg, -lladdr->addrLen, NULL);
     CryptoAuth_resetIfTimeout(ep->caSession);
+    if (!CryptoAuth_decryptAsync(ep->caSession, msg, decryptedAsync, ep)) {
+        return NULL;
+    }
     if (CryptoAuth_decrypt(ep->caSession, msg)) {
         return NULL;
     }
-    PeerLink_recv(msg, ep->peerLink);
-    if (ep->state == InterfaceController_PeerState_ESTABLISHED &&
-        CryptoAuth_getState(ep->caSession) != CryptoAuth_State_ESTABLISHED) {
-        sendPeer(0xffffffff, PFChan_Core_PEER_GONE, ep);
+    return receivedDecrypted(msg, ep);
+}
+
+/**
+ * A burst from the wire, decrypt them all and then pass them to the switch with one sendBatch
+ * for each run of messages from the same peer.
+ */
+static void handleIncomingBatchFromWire(struct Message** msgs, int count, struct Iface* addrIf)
+{
+    struct InterfaceController_Iface_pvt* ici =
+        Identity_containerOf(addrIf, struct InterfaceController_Iface_pvt, pub.addrIf);
+    struct InterfaceController_pvt* ic = ici->ic;
+    struct Batch* outerBatch = ic->rxBatch;
+    struct Batch batch = { .ici = ici };
+    for (int base = 0; base < count; base += BATCH_MAX) {
+        int n = (count - base < BATCH_MAX) ? count - base : BATCH_MAX;
+        batch.count = 0;
+        ic->rxBatch = &batch;
+        for (int i = 0; i < n; i++) {
+            Iface_CALL(handleIncomingFromWire, msgs[base + i], addrIf);
+        }
+        ic->rxBatch = outerBatch;
+        for (int i = 0; i < batch.count;) {
+            int j = i + 1;
+            while (j < batch.count && batch.handles[j] == batch.handles[i]) { j++; }
+            // Look the peer up again, it might have been removed by a message in this burst.
+            int index = Map_EndpointsBySockaddr_indexForHandle(batch.handles[i], &ici->peerMap);
+            if (index > -1) {
+                struct Peer* ep = Identity_check((struct Peer*) ici->peerMap.values[index]);
+                Iface_sendBatch(&ep->switchIf, &batch.msgs[i], j - i);
+            }
+            i = j;
+        }
     }
-    return receivedPostCryptoAuth(msg, ep, ici->ic);
 }
 
 struct InterfaceController_Iface* InterfaceController_newIface(struct InterfaceController* ifc,
@@ -747,6 +890,7 @@ struct InterfaceController_Iface* InterfaceController_newIface(struct InterfaceC
     ici->ic = ic;
     ici->alloc = alloc;
     ici->pub.addrIf.send = handleIncomingFromWire;
+    ici->pub.addrIf.sendBatch = handleIncomingBatchFromWire;
     ici->pub.ifNum = ArrayList_OfIfaces_add(ic->icis, ici);
 
     Identity_set(ici);
@@ -881,7 +1025,7 @@ int InterfaceController_bootstrapPeer(struct InterfaceController* ifc,
     Allocator_onFree(epAlloc, closeInterface, ep);
     Allocator_onFree(alloc, freeAlloc, epAlloc);
 
-    ep->peerLink = PeerLink_new(ic->eventBase, epAlloc);
+    ep->peerLink = PeerLink_new(ic->eventBase, peerLinkReady, ep, epAlloc);
     ep->caSession = CryptoAuth_newSession(ic->ca, epAlloc, herPublicKey, false, "outer");
     CryptoAuth_setAuth(password, login, ep->caSession);
     if (user) {
@@ -889,6 +1033,7 @@ int InterfaceController_bootstrapPeer(struct InterfaceController* ifc,
     }
 
     ep->switchIf.send = sendFromSwitch;
+    ep->switchIf.sendBatch = sendBatchFromSwitch;
 
     if (SwitchCore_addInterface(ic->switchCore, &ep->switchIf, epAlloc, &ep->addr.path)) {
         Log_debug(ic->logger, "bootstrapPeer() SwitchCore out of space");
@@ -959,6 +1104,12 @@ int InterfaceController_getPeerStats(struct InterfaceController* ifController,
             PeerLink_kbps(peer->peerLink, &kbps);
             s->sendKbps = kbps.sendKbps;
             s->recvKbps = kbps.recvKbps;
+
+            struct PeerLink_QueueStats qs;
+            PeerLink_queueStats(peer->peerLink, &qs);
+            s->queueLength = qs.queueLength;
+            s->sojournMicroseconds = qs.sojournMicroseconds;
+            s->queueDrops = qs.drops;
         }
     }
 
@@ -1004,6 +1155,27 @@ int InterfaceController_disconnectPeer(struct InterfaceController* ifController,
     return InterfaceController_disconnectPeer_NOTFOUND;
 }
 
+int InterfaceController_setPeerMaxKbps(struct InterfaceController* ifController,
+                                       uint8_t herPublicKey[32],
+                                       uint32_t kbps)
+{
+    struct InterfaceController_pvt* ic =
+        Identity_check((struct InterfaceController_pvt*) ifController);
+
+    int ret = InterfaceController_setPeerMaxKbps_NOTFOUND;
+    for (int j = 0; j < ic->icis->length; j++) {
+        struct InterfaceController_Iface_pvt* ici = ArrayList_OfIfaces_get(ic->icis, j);
+        for (int i = 0; i < (int)ici->peerMap.count; i++) {
+            struct Peer* peer = Identity_check((struct Peer*) ici->peerMap.values[i]);
+            if (!Bits_memcmp(herPublicKey, peer->caSession->herPublicKey, 32)) {
+                PeerLink_setMaxKbps(peer->peerLink, kbps);
+                ret = 0;
+            }
+        }
+    }
+    return ret;
+}
+
 static Iface_DEFUN incomingFromEventEmitterIf(struct Message* msg, struct Iface* eventEmitterIf)
 {
     struct InterfaceController_pvt* ic =
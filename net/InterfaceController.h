@@ -93,6 +93,11 @@ struct InterfaceController_PeerStats
 
     uint32_t sendKbps;
     uint32_t recvKbps;
+
+    /** Egress queue statistics. see: PeerLink */
+    uint32_t queueLength;
+    uint32_t sojournMicroseconds;
+    uint64_t queueDrops;
 };
 
 struct InterfaceController
@@ -187,6 +192,22 @@ void InterfaceController_resetPeering(struct InterfaceController* ifController,
 #define InterfaceController_disconnectPeer_NOTFOUND -1
 int InterfaceController_disconnectPeer(struct InterfaceController* ifc, uint8_t herPublicKey[32]);
 
+/**
+ * Limit the rate at which messages are sent to a peer, messages in excess of the rate wait in
+ * the peer's queue and are dropped if they wait too long.
+ * The limit applies to the current session with the peer, it is not remembered if they reconnect.
+ *
+ * @param ic the if controller
+ * @param herPublicKey the public key of the foreign node
+ * @param kbps the maximum rate in kilobits per second, 0 for unlimited.
+ * @return 0 if all goes well.
+ *         InterfaceController_setPeerMaxKbps_NOTFOUND if no peer with herPublicKey is found.
+ */
+#define InterfaceController_setPeerMaxKbps_NOTFOUND -1
+int InterfaceController_setPeerMaxKbps(struct InterfaceController* ifc,
+                                       uint8_t herPublicKey[32],
+                                       uint32_t kbps);
+
 /**
  * Get stats for the connected peers.
  *
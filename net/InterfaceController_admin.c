@@ -82,6 +82,10 @@ static void adminPeerStats(Dict* args, void* vcontext, String* txid, struct Allo
         Dict_putIntC(d, "lostPackets", stats[i].lostPackets, alloc);
         Dict_putIntC(d, "receivedOutOfRange", stats[i].receivedOutOfRange, alloc);
 
+        Dict_putIntC(d, "queueLength", stats[i].queueLength, alloc);
+        Dict_putIntC(d, "sojournMicroseconds", stats[i].sojournMicroseconds, alloc);
+        Dict_putIntC(d, "queueDrops", stats[i].queueDrops, alloc);
+
         if (stats[i].user) {
             Dict_putStringC(d, "user", stats[i].user, alloc);
         }
@@ -133,6 +137,31 @@ static void adminDisconnectPeer(Dict* args,
     Admin_sendMessage(response, txid, context->admin);
 }
 
+static void adminSetPeerMaxKbps(Dict* args,
+                                void* vcontext,
+                                String* txid,
+                                struct Allocator* requestAlloc)
+{
+    struct Context* context = Identity_check((struct Context*)vcontext);
+    String* pubkeyString = Dict_getStringC(args, "pubkey");
+    int64_t* kbps = Dict_getIntC(args, "kbps");
+
+    uint8_t pubkey[32];
+    uint8_t addr[16];
+    char* errorMsg = NULL;
+    if (Key_parse(pubkeyString, pubkey, addr)) {
+        errorMsg = "bad key";
+    } else if (*kbps < 0 || *kbps > UINT32_MAX) {
+        errorMsg = "kbps out of range";
+    } else if (InterfaceController_setPeerMaxKbps(context->ic, pubkey, *kbps)) {
+        errorMsg = "no peer found for that key";
+    }
+
+    Dict* response = Dict_new(requestAlloc);
+    Dict_putStringCC(response, "error", errorMsg ? errorMsg : "none", requestAlloc);
+    Admin_sendMessage(response, txid, context->admin);
+}
+
 static void adminResetPeering(Dict* args,
                               void* vcontext,
                               String* txid,
@@ -226,4 +255,10 @@ void InterfaceController_admin_register(struct InterfaceController* ic,
         ((struct Admin_FunctionArg[]) {
             { .name = "pubkey", .required = 1, .type = "String" }
         }), admin);
+
+    Admin_registerFunction("InterfaceController_setPeerMaxKbps", adminSetPeerMaxKbps, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "pubkey", .required = 1, .type = "String" },
+            { .name = "kbps", .required = 1, .type = "Int" }
+        }), admin);
 }
@@ -18,28 +18,222 @@
 #include "util/Kbps.h"
 #include "wire/SwitchHeader.h"
 #include "util/events/Time.h"
+#include "util/events/Timeout.h"
 
-#define ArrayList_TYPE struct Message
-#define ArrayList_NAME Messages
-#include "util/ArrayList.h"
+/** Queue length in bytes at or below which CoDel will never drop. */
+#define MAX_PACKET 1500
+
+/** The pacer may send this far ahead of the rate, in microseconds worth of bytes. */
+#define BURST_MICROSECONDS 10000
+
+struct PeerLink_Entry
+{
+    struct Message* msg;
+    uint64_t enqueueTime;
+};
 
 struct PeerLink_pvt
 {
     struct PeerLink pub;
     struct Allocator* alloc;
     struct EventBase* base;
-    struct ArrayList_Messages* queue;
+
+    /** Ring of waiting messages, first is the index of the oldest. */
+    struct PeerLink_Entry queue[PeerLink_MAX_QUEUE];
+    uint32_t first;
+    uint32_t queueBytes;
+
+    /** CoDel state, times are microseconds from the clock. */
+    uint64_t firstAboveTime;
+    uint64_t dropNext;
+    uint32_t count;
+    uint32_t lastCount;
+    bool dropping;
+
+    /** Pacer, 0 maxKbps means unlimited. */
+    uint32_t maxKbps;
+    int64_t tokens;
+    uint64_t lastRefill;
+    struct Timeout* readyTimeout;
+    PeerLink_ReadyCallback onReady;
+    void* userData;
+
+    uint32_t sojournMicroseconds;
+    uint64_t drops;
+
+    PeerLink_Clock clock;
+    void* clockContext;
+
     struct Kbps sendBw;
     struct Kbps recvBw;
     Identity
 };
 
-struct Message* PeerLink_poll(struct PeerLink* peerLink)
+static uint64_t hrtimeMicroseconds(void* vNULL)
+{
+    return Time_hrtime() / 1000;
+}
+
+static inline uint64_t nowMicroseconds(struct PeerLink_pvt* pl)
+{
+    return pl->clock(pl->clockContext);
+}
+
+static uint32_t isqrt(uint64_t x)
+{
+    uint64_t r = x;
+    uint64_t y = (r + 1) / 2;
+    while (y < r) {
+        r = y;
+        y = (r + x / r) / 2;
+    }
+    return r;
+}
+
+/** Next drop time, the interval shrinks with the square root of the number of drops. */
+static uint64_t controlLaw(uint64_t t, uint32_t count)
+{
+    return t + ((uint64_t)PeerLink_INTERVAL_MICROSECONDS << 10) / isqrt((uint64_t)count << 20);
+}
+
+static struct PeerLink_Entry* shift(struct PeerLink_pvt* pl)
+{
+    if (!pl->pub.queueLength) { return NULL; }
+    struct PeerLink_Entry* e = &pl->queue[pl->first];
+    pl->first = (pl->first + 1) % PeerLink_MAX_QUEUE;
+    pl->pub.queueLength--;
+    pl->queueBytes -= e->msg->length;
+    return e;
+}
+
+static void drop(struct PeerLink_pvt* pl, struct Message* msg)
+{
+    pl->drops++;
+    Allocator_disown(pl->alloc, msg->alloc);
+}
+
+/** Take the oldest message and decide whether it has been in the queue too long. */
+static struct Message* doDequeue(struct PeerLink_pvt* pl, uint64_t t, bool* okToDrop)
+{
+    *okToDrop = false;
+    struct PeerLink_Entry* e = shift(pl);
+    if (!e) {
+        pl->firstAboveTime = 0;
+        return NULL;
+    }
+    uint64_t sojourn = t - e->enqueueTime;
+    pl->sojournMicroseconds = (sojourn > UINT32_MAX) ? UINT32_MAX : sojourn;
+    if (sojourn < PeerLink_TARGET_MICROSECONDS || pl->queueBytes <= MAX_PACKET) {
+        pl->firstAboveTime = 0;
+    } else if (!pl->firstAboveTime) {
+        pl->firstAboveTime = t + PeerLink_INTERVAL_MICROSECONDS;
+    } else if (t >= pl->firstAboveTime) {
+        *okToDrop = true;
+    }
+    return e->msg;
+}
+
+/** CoDel dequeue, see RFC 8289. */
+static struct Message* dequeue(struct PeerLink_pvt* pl, uint64_t t)
+{
+    bool okToDrop;
+    struct Message* msg = doDequeue(pl, t, &okToDrop);
+    if (pl->dropping) {
+        if (!okToDrop) {
+            pl->dropping = false;
+        }
+        while (pl->dropping && t >= pl->dropNext) {
+            drop(pl, msg);
+            pl->count++;
+            msg = doDequeue(pl, t, &okToDrop);
+            if (!okToDrop) {
+                pl->dropping = false;
+            } else {
+                pl->dropNext = controlLaw(pl->dropNext, pl->count);
+            }
+        }
+    } else if (okToDrop) {
+        drop(pl, msg);
+        msg = doDequeue(pl, t, &okToDrop);
+        pl->dropping = true;
+        uint32_t delta = pl->count - pl->lastCount;
+        pl->count = (delta > 1 && t - pl->dropNext < 16 * PeerLink_INTERVAL_MICROSECONDS)
+            ? delta : 1;
+        pl->dropNext = controlLaw(t, pl->count);
+        pl->lastCount = pl->count;
+    }
+    return msg;
+}
+
+static int64_t burstBytes(struct PeerLink_pvt* pl)
+{
+    // kbps * 1000 / 8 bytes per second, / 1000000 for bytes per microsecond.
+    int64_t burst = (int64_t)pl->maxKbps * BURST_MICROSECONDS / 8000;
+    return (burst < MAX_PACKET) ? MAX_PACKET : burst;
+}
+
+static void refill(struct PeerLink_pvt* pl, uint64_t t)
+{
+    int64_t burst = burstBytes(pl);
+    // More than a second is always enough to fill the burst, capping it prevents overflow.
+    uint64_t elapsed = t - pl->lastRefill;
+    if (elapsed > 1000000) { elapsed = 1000000; }
+    int64_t add = elapsed * pl->maxKbps / 8000;
+    pl->tokens += add;
+    if (pl->tokens >= burst) {
+        pl->tokens = burst;
+        pl->lastRefill = t;
+    } else {
+        // Only account for the time which became whole bytes so that nothing is lost to rounding.
+        pl->lastRefill += add * 8000 / pl->maxKbps;
+    }
+}
+
+static void ready(void* vPeerLink)
+{
+    struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) vPeerLink);
+    if (pl->pub.queueLength) {
+        pl->onReady(&pl->pub, pl->userData);
+    }
+}
+
+/**
+ * Bytes which must be available before the oldest message may be sent, a message which is bigger
+ * than the whole burst only needs a full bucket or it would never go out.
+ */
+static int64_t neededTokens(struct PeerLink_pvt* pl)
+{
+    int64_t need = pl->queue[pl->first].msg->length;
+    int64_t burst = burstBytes(pl);
+    return (need < burst) ? need : burst;
+}
+
+/** @return true if the pacer allows sending now, otherwise schedule a call to onReady. */
+static bool mayPoll(struct PeerLink_pvt* pl, uint64_t t)
+{
+    if (!pl->maxKbps) { return true; }
+    refill(pl, t);
+    int64_t need = neededTokens(pl);
+    if (pl->tokens >= need) { return true; }
+    uint64_t waitMicroseconds = (uint64_t)(need - pl->tokens) * 8000 / pl->maxKbps;
+    Timeout_resetTimeout(pl->readyTimeout, waitMicroseconds / 1000 + 1);
+    return false;
+}
+
+struct Message* PeerLink_poll(struct PeerLink* peerLink, struct Allocator* alloc)
 {
     struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) peerLink);
-    struct Message* out = ArrayList_Messages_shift(pl->queue);
+    uint64_t t = nowMicroseconds(pl);
+    if (!pl->pub.queueLength || !mayPoll(pl, t)) { return NULL; }
+    struct Message* out = dequeue(pl, t);
     if (!out) { return NULL; }
+    if (out->alloc != alloc) {
+        Allocator_adopt(alloc, out->alloc);
+    }
     Allocator_disown(pl->alloc, out->alloc);
+    if (pl->maxKbps) {
+        pl->tokens -= out->length;
+    }
     Kbps_accumulate(&pl->sendBw, Time_currentTimeMilliseconds(pl->base), out->length);
     return out;
 }
@@ -47,9 +241,20 @@ struct Message* PeerLink_poll(struct PeerLink* peerLink)
 int PeerLink_send(struct Message* msg, struct PeerLink* peerLink)
 {
     struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) peerLink);
+    if (pl->pub.queueLength == PeerLink_MAX_QUEUE) {
+        // Drop from the head, the oldest message is the least useful.
+        drop(pl, shift(pl)->msg);
+    }
     Allocator_adopt(pl->alloc, msg->alloc);
-    ArrayList_Messages_add(pl->queue, msg);
-    return pl->queue->length;
+    uint32_t i = (pl->first + pl->pub.queueLength) % PeerLink_MAX_QUEUE;
+    pl->queue[i].msg = msg;
+    pl->queue[i].enqueueTime = nowMicroseconds(pl);
+    pl->pub.queueLength++;
+    pl->queueBytes += msg->length;
+
+    if (!pl->maxKbps) { return pl->pub.queueLength; }
+    refill(pl, pl->queue[i].enqueueTime);
+    return (pl->tokens >= neededTokens(pl)) ? pl->pub.queueLength : 0;
 }
 
 void PeerLink_recv(struct Message* msg, struct PeerLink* peerLink)
@@ -66,13 +271,44 @@ void PeerLink_kbps(struct PeerLink* peerLink, struct PeerLink_Kbps* output)
     output->sendKbps = Kbps_accumulate(&pl->sendBw, now, Kbps_accumulate_NO_PACKET);
 }
 
-struct PeerLink* PeerLink_new(struct EventBase* base, struct Allocator* allocator)
+void PeerLink_queueStats(struct PeerLink* peerLink, struct PeerLink_QueueStats* output)
+{
+    struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) peerLink);
+    output->queueLength = pl->pub.queueLength;
+    output->sojournMicroseconds = pl->sojournMicroseconds;
+    output->drops = pl->drops;
+}
+
+void PeerLink_setMaxKbps(struct PeerLink* peerLink, uint32_t kbps)
+{
+    struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) peerLink);
+    pl->maxKbps = kbps;
+    pl->tokens = burstBytes(pl);
+    pl->lastRefill = nowMicroseconds(pl);
+}
+
+void PeerLink_setClock(struct PeerLink* peerLink, PeerLink_Clock clock, void* context)
+{
+    struct PeerLink_pvt* pl = Identity_check((struct PeerLink_pvt*) peerLink);
+    pl->clock = clock;
+    pl->clockContext = context;
+    pl->lastRefill = nowMicroseconds(pl);
+}
+
+struct PeerLink* PeerLink_new(struct EventBase* base,
+                              PeerLink_ReadyCallback onReady,
+                              void* userData,
+                              struct Allocator* allocator)
 {
     struct Allocator* alloc = Allocator_child(allocator);
     struct PeerLink_pvt* pl = Allocator_calloc(alloc, sizeof(struct PeerLink_pvt), 1);
     Identity_set(pl);
     pl->base = base;
     pl->alloc = alloc;
-    pl->queue = ArrayList_Messages_new(alloc);
+    pl->onReady = onReady;
+    pl->userData = userData;
+    pl->clock = hrtimeMicroseconds;
+    pl->readyTimeout = Timeout_setTimeout(ready, pl, 0, base, alloc);
+    Timeout_clearTimeout(pl->readyTimeout);
     return &pl->pub;
 }
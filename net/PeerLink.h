@@ -23,6 +23,13 @@ Linker_require("net/PeerLink.c");
 
 #include <stdbool.h>
 
+/** Maximum number of messages which may be waiting in the queue, the oldest is dropped. */
+#define PeerLink_MAX_QUEUE 256
+
+/** CoDel target, drop if the queue has not been drained below this delay for an interval. */
+#define PeerLink_TARGET_MICROSECONDS 5000
+#define PeerLink_INTERVAL_MICROSECONDS 100000
+
 /**
  * The PeerLink adds a PeerHeader to outgoing messages and removes it from incoming messages while
  * checking clock skew to detect latency and react by sending congestion notifications to the peer.
@@ -43,11 +50,34 @@ struct PeerLink_Kbps
     uint32_t recvKbps;
 };
 
+struct PeerLink_QueueStats
+{
+    /** Number of messages waiting to be sent. */
+    uint32_t queueLength;
+
+    /** How long the most recently sent message spent in the queue. */
+    uint32_t sojournMicroseconds;
+
+    /** Messages dropped by CoDel or because the queue was full. */
+    uint64_t drops;
+};
+
+/**
+ * Called when the pacer will allow more messages to be sent after PeerLink_poll() returned NULL
+ * while there were still messages in the queue.
+ */
+typedef void (* PeerLink_ReadyCallback)(struct PeerLink* pl, void* userData);
+
 /**
  * Attempt to get a message from the peerlink to send, if it is time to send one.
  * If there are no messages in the queue or the link is already at capacity, NULL will be returned.
+ * Messages which have been waiting too long will be dropped here (see: CoDel).
+ *
+ * @param pl the peerlink
+ * @param alloc the message will be adopted by this allocator, it must live at least as long as
+ *              the message is needed.
  */
-struct Message* PeerLink_poll(struct PeerLink* pl);
+struct Message* PeerLink_poll(struct PeerLink* pl, struct Allocator* alloc);
 
 /**
  * Enqueue a message to be sent.
@@ -65,7 +95,27 @@ void PeerLink_recv(struct Message* msg, struct PeerLink* pl);
 
 void PeerLink_kbps(struct PeerLink* peerLink, struct PeerLink_Kbps* output);
 
+void PeerLink_queueStats(struct PeerLink* peerLink, struct PeerLink_QueueStats* output);
+
+/**
+ * Limit the rate at which messages are released from the queue.
+ * @param kbps the maximum send rate in kilobits per second, 0 for no limit.
+ */
+void PeerLink_setMaxKbps(struct PeerLink* peerLink, uint32_t kbps);
+
+/** A source of monotonic time in microseconds. */
+typedef uint64_t (* PeerLink_Clock)(void* context);
+
+/**
+ * Replace the clock which is used for queue delay and pacing, the default is Time_hrtime().
+ * This exists so that tests can control time, the ready callback is still scheduled on the
+ * event base so a test which sets a clock must poll by itself after advancing it.
+ */
+void PeerLink_setClock(struct PeerLink* peerLink, PeerLink_Clock clock, void* context);
 
-struct PeerLink* PeerLink_new(struct EventBase* base, struct Allocator* alloc);
+struct PeerLink* PeerLink_new(struct EventBase* base,
+                              PeerLink_ReadyCallback onReady,
+                              void* userData,
+                              struct Allocator* alloc);
 
 #endif
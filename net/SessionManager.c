@@ -23,12 +23,36 @@
 #include "wire/RouteHeader.h"
 #include "util/events/Timeout.h"
 #include "util/Checksum.h"
+#define NumberCompress_OLD_CODE
+#include "switch/NumberCompress.h"
 
 /** Handle numbers 0-3 are reserved for CryptoAuth nonces. */
 #define MIN_FIRST_HANDLE 4
 
 #define MAX_FIRST_HANDLE 100000
 
+/** Size of each generation of the filter of handshakes which were dropped for retry. */
+#define RETRY_FILTER_BITS (1 << 16)
+
+/** Bits set for each entry, each is 16 bits of the hash. */
+#define RETRY_FILTER_HASHES 3
+
+/**
+ * A generation which is more than a quarter full would let in more than 1 in 64 forged hellos
+ * so it is not trusted, nothing is admitted on retry until it is rotated out.
+ */
+#define RETRY_FILTER_MAX_SET (RETRY_FILTER_BITS / 4)
+
+/** Buckets hold up to this many seconds worth of tokens. */
+#define BURST_SECONDS 4
+
+/** A token bucket, counted in thousandths of a token so it can be refilled every ms. */
+struct TokenBucket
+{
+    int64_t lastRefill;
+    uint64_t milliTokens;
+};
+
 struct BufferedMessage
 {
     struct Message* msg;
@@ -48,6 +72,7 @@ struct Ip6 {
 #define Map_VALUE_TYPE struct SessionManager_Session_pvt*
 #define Map_NAME OfSessionsByIp6
 #define Map_ENABLE_HANDLES
+#define Map_USE_HASHTABLE
 #include "util/Map.h"
 
 struct SessionManager_pvt
@@ -61,6 +86,30 @@ struct SessionManager_pvt
     struct CryptoAuth* cryptoAuth;
     struct EventBase* eventBase;
     uint32_t firstHandle;
+
+    /** Admission of handshakes from nodes with no session, see SessionManager_AdmissionStats. */
+    struct TokenBucket newSessionBucket;
+
+    /** Handshakes admitted on retry, so a sender which sends everything twice is still capped. */
+    struct TokenBucket retrySessionBucket;
+
+    /**
+     * One bucket for each of our switch interfaces, by the first hop of the source label.
+     * The sender can choose the rest of the label but not which of our peers it came through.
+     */
+    struct TokenBucket peerBuckets[NumberCompress_INTERFACES];
+
+    /**
+     * Bloom filters of (label, key) of handshakes which were dropped to be retried, the current
+     * generation and the previous one. Swapped each time periodically() runs.
+     */
+    uint64_t retryFilter[2][RETRY_FILTER_BITS / 64];
+    uint32_t retryFilterSet[2];
+    int retryGeneration;
+
+    /** Random, so that which bits a handshake sets in the retry filter is not known. */
+    uint64_t hashSeed;
+
     Identity
 };
 
@@ -152,6 +201,117 @@ static inline void check(struct SessionManager_pvt* sm, int mapIndex)
     }
 }
 
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t admissionHash(struct SessionManager_pvt* sm, uint64_t label, uint8_t* key)
+{
+    uint64_t h = mix64(sm->hashSeed ^ label);
+    for (int i = 0; i < 32; i += 8) {
+        uint64_t word;
+        Bits_memcpy(&word, &key[i], 8);
+        h = mix64(h ^ word);
+    }
+    return h;
+}
+
+static bool takeToken(struct TokenBucket* b, int perSecond, int64_t now)
+{
+    uint64_t max = (uint64_t) perSecond * BURST_SECONDS * 1000;
+    uint64_t tokens = b->milliTokens;
+    if (now > b->lastRefill) {
+        tokens += (uint64_t) (now - b->lastRefill) * perSecond;
+    }
+    b->lastRefill = now;
+    if (tokens > max) { tokens = max; }
+    if (tokens < 1000) {
+        b->milliTokens = tokens;
+        return false;
+    }
+    b->milliTokens = tokens - 1000;
+    return true;
+}
+
+/** @return the number of our switch interface which the label leads back through. */
+static uint32_t firstHop(uint64_t label)
+{
+    uint32_t hop = NumberCompress_getDecompressed(label, NumberCompress_bitsUsedForLabel(label));
+    Assert_true(hop < NumberCompress_INTERFACES);
+    return hop;
+}
+
+static uint32_t retryFilterBit(uint64_t hash, int i)
+{
+    Assert_compileTime(RETRY_FILTER_BITS == (1 << 16) && RETRY_FILTER_HASHES * 16 <= 64);
+    return (hash >> (i * 16)) & 0xffff;
+}
+
+static bool retryFilterHas(struct SessionManager_pvt* sm, uint64_t hash)
+{
+    for (int g = 0; g < 2; g++) {
+        if (sm->retryFilterSet[g] > RETRY_FILTER_MAX_SET) { continue; }
+        int i;
+        for (i = 0; i < RETRY_FILTER_HASHES; i++) {
+            uint32_t bit = retryFilterBit(hash, i);
+            if (!((sm->retryFilter[g][bit / 64] >> (bit % 64)) & 1)) { break; }
+        }
+        if (i == RETRY_FILTER_HASHES) { return true; }
+    }
+    return false;
+}
+
+static void retryFilterAdd(struct SessionManager_pvt* sm, uint64_t hash)
+{
+    int g = sm->retryGeneration;
+    for (int i = 0; i < RETRY_FILTER_HASHES; i++) {
+        uint32_t bit = retryFilterBit(hash, i);
+        uint64_t mask = 1ull << (bit % 64);
+        if (!(sm->retryFilter[g][bit / 64] & mask)) {
+            sm->retryFilter[g][bit / 64] |= mask;
+            sm->retryFilterSet[g]++;
+        }
+    }
+}
+
+/**
+ * Decide whether a handshake from a node we have no session with may go on to create a session
+ * and do the curve25519 to check it.
+ */
+static bool admitHandshake(struct SessionManager_pvt* sm, uint64_t label, uint8_t* key)
+{
+    int64_t now = Time_currentTimeMilliseconds(sm->eventBase);
+
+    struct TokenBucket* peer = &sm->peerBuckets[firstHop(label)];
+    if (!takeToken(peer, sm->pub.newSessionsPerPeerPerSecond, now)) {
+        sm->pub.admission.rejectedRate++;
+        return false;
+    }
+
+    if (takeToken(&sm->newSessionBucket, sm->pub.newSessionsPerSecond, now)) {
+        return true;
+    }
+
+    // Over the limit, only let in handshakes which are being tried again.
+    uint64_t h = admissionHash(sm, label, key);
+    if (retryFilterHas(sm, h)) {
+        if (takeToken(&sm->retrySessionBucket, sm->pub.newSessionsPerSecond, now)) {
+            return true;
+        }
+        sm->pub.admission.rejectedRate++;
+        return false;
+    }
+    retryFilterAdd(sm, h);
+    sm->pub.admission.rejectedRetry++;
+    return false;
+}
+
 static inline struct SessionManager_Session_pvt* sessionForHandle(uint32_t handle,
                                                                   struct SessionManager_pvt* sm)
 {
@@ -303,6 +463,120 @@ static Iface_DEFUN failedDecrypt(struct Message* msg,
     return Iface_next(&sm->pub.switchIf, msg);
 }
 
+static Iface_DEFUN incomingDecrypted(struct Message* msg,
+                                     struct SessionManager_Session_pvt* session,
+                                     struct SwitchHeader* switchHeader,
+                                     enum CryptoAuth_DecryptErr ret,
+                                     uint32_t nonceOrHandle,
+                                     uint32_t length0,
+                                     uint8_t firstSixteen[16],
+                                     bool newSession)
+{
+    struct SessionManager_pvt* sm = Identity_check(session->sessionManager);
+    bool currentMessageSetup = (nonceOrHandle <= 3);
+
+    if (ret) {
+        debugHandlesAndLabel(sm->log, session,
+                             Endian_bigEndianToHost64(switchHeader->label_be),
+                             "DROP Failed decrypting message NoH[%d] state[%s]",
+                             nonceOrHandle,
+                             CryptoAuth_stateString(CryptoAuth_getState(session->pub.caSession)));
+        Message_shift(msg, length0 - msg->length - 24, NULL);
+        msg->length = 0;
+        Message_push32(msg, CryptoAuth_getState(session->pub.caSession), NULL);
+        Message_push32(msg, ret, NULL);
+        Message_push(msg, firstSixteen, 16, NULL);
+        Message_shift(msg, SwitchHeader_SIZE, NULL);
+        Assert_true(msg->bytes == (uint8_t*)switchHeader);
+        uint64_t label_be = switchHeader->label_be;
+        switchHeader->label_be = Bits_bitReverse64(switchHeader->label_be);
+        if (newSession) {
+            // Nothing is kept for a handshake which does not authenticate.
+            sm->pub.admission.unauthenticated++;
+            int index = Map_OfSessionsByIp6_indexForKey(
+                (struct Ip6*)session->pub.caSession->herIp6, &sm->ifaceMap);
+            Assert_true(index > -1);
+            sendSession(session, session->pub.sendSwitchLabel, 0xffffffff,
+                        PFChan_Core_SESSION_ENDED);
+            Map_OfSessionsByIp6_remove(index, &sm->ifaceMap);
+            Allocator_free(session->alloc);
+        }
+        return failedDecrypt(msg, label_be, sm);
+    }
+
+    if (newSession) {
+        sm->pub.admission.admitted++;
+    }
+
+    if (currentMessageSetup) {
+        session->pub.sendHandle = Message_pop32(msg, NULL);
+    }
+
+    Message_shift(msg, RouteHeader_SIZE, NULL);
+    struct RouteHeader* header = (struct RouteHeader*) msg->bytes;
+
+    Assert_true(msg->length >= DataHeader_SIZE);
+    struct DataHeader* dh = (struct DataHeader*) &header[1];
+    if (DataHeader_getContentType(dh) != ContentType_CJDHT) {
+        session->pub.timeOfLastIn = Time_currentTimeMilliseconds(sm->eventBase);
+    }
+    session->pub.bytesIn += msg->length;
+    session->pub.timeOfKeepAliveIn = Time_currentTimeMilliseconds(sm->eventBase);
+
+    if (currentMessageSetup) {
+        Bits_memcpy(&header->sh, switchHeader, SwitchHeader_SIZE);
+        debugHandlesAndLabel0(sm->log,
+                              session,
+                              Endian_bigEndianToHost64(switchHeader->label_be),
+                              "received start message");
+    } else {
+        // RouteHeader is laid out such that no copy of switch header should be needed.
+        Assert_true(&header->sh == switchHeader);
+        if (0) { // noisey
+        debugHandlesAndLabel0(sm->log,
+                              session,
+                              Endian_bigEndianToHost64(switchHeader->label_be),
+                              "received run message");
+        }
+    }
+
+    header->version_be = Endian_hostToBigEndian32(session->pub.version);
+    Bits_memcpy(header->ip6, session->pub.caSession->herIp6, 16);
+    Bits_memcpy(header->publicKey, session->pub.caSession->herPublicKey, 32);
+
+    header->unused = 0;
+    header->flags = RouteHeader_flags_INCOMING;
+
+    uint64_t path = Endian_bigEndianToHost64(switchHeader->label_be);
+    if (!session->pub.sendSwitchLabel) {
+        session->pub.sendSwitchLabel = path;
+    }
+    if (path != session->pub.recvSwitchLabel) {
+        session->pub.recvSwitchLabel = path;
+        sendSession(session, path, 0xffffffff, PFChan_Core_DISCOVERED_PATH);
+    }
+
+    return Iface_next(&sm->pub.insideIf, msg);
+}
+
+/** Kept with a message while CryptoAuth decrypts it on a worker thread. */
+struct PendingDecrypt
+{
+    struct SessionManager_Session_pvt* session;
+    struct SwitchHeader* switchHeader;
+    uint32_t nonceOrHandle;
+    uint32_t length0;
+    uint8_t firstSixteen[16];
+    Identity
+};
+
+static void decryptedAsync(struct Message* msg, int err, void* vpd)
+{
+    struct PendingDecrypt* pd = Identity_check((struct PendingDecrypt*) vpd);
+    Iface_CALL(incomingDecrypted, msg, pd->session, pd->switchHeader, err,
+               pd->nonceOrHandle, pd->length0, pd->firstSixteen, false);
+}
+
 static Iface_DEFUN incomingFromSwitchIf(struct Message* msg, struct Iface* iface)
 {
     struct SessionManager_pvt* sm =
@@ -338,6 +612,7 @@ static Iface_DEFUN incomingFromSwitchIf(struct Message* msg, struct Iface* iface
     // This is for handling error situations and being able to send back some kind of a message.
     uint8_t firstSixteen[16];
     uint32_t length0 = msg->length;
+    bool newSession = false;
     Assert_true(msg->length >= 16);
     Bits_memcpy(firstSixteen, msg->bytes, 16);
 
@@ -375,81 +650,32 @@ static Iface_DEFUN incomingFromSwitchIf(struct Message* msg, struct Iface* iface
         }
 
         uint64_t label = Endian_bigEndianToHost64(switchHeader->label_be);
+        newSession = !sessionForIp6(ip6, sm);
+        if (newSession && !admitHandshake(sm, label, caHeader->publicKey)) {
+            Log_debug(sm->log, "DROP Handshake not admitted");
+            return NULL;
+        }
         session = getSession(sm, ip6, caHeader->publicKey, 0, label, 0xfffff000);
         CryptoAuth_resetIfTimeout(session->pub.caSession);
         debugHandlesAndLabel(sm->log, session, label, "new session nonce[%d]", nonceOrHandle);
     }
 
-    bool currentMessageSetup = (nonceOrHandle <= 3);
-
-    enum CryptoAuth_DecryptErr ret = CryptoAuth_decrypt(session->pub.caSession, msg);
-    if (ret) {
-        debugHandlesAndLabel(sm->log, session,
-                             Endian_bigEndianToHost64(switchHeader->label_be),
-                             "DROP Failed decrypting message NoH[%d] state[%s]",
-                             nonceOrHandle,
-                             CryptoAuth_stateString(CryptoAuth_getState(session->pub.caSession)));
-        Message_shift(msg, length0 - msg->length - 24, NULL);
-        msg->length = 0;
-        Message_push32(msg, CryptoAuth_getState(session->pub.caSession), NULL);
-        Message_push32(msg, ret, NULL);
-        Message_push(msg, firstSixteen, 16, NULL);
-        Message_shift(msg, SwitchHeader_SIZE, NULL);
-        Assert_true(msg->bytes == (uint8_t*)switchHeader);
-        uint64_t label_be = switchHeader->label_be;
-        switchHeader->label_be = Bits_bitReverse64(switchHeader->label_be);
-        return failedDecrypt(msg, label_be, sm);
-    }
-
-    if (currentMessageSetup) {
-        session->pub.sendHandle = Message_pop32(msg, NULL);
-    }
-
-    Message_shift(msg, RouteHeader_SIZE, NULL);
-    struct RouteHeader* header = (struct RouteHeader*) msg->bytes;
-
-    Assert_true(msg->length >= DataHeader_SIZE);
-    struct DataHeader* dh = (struct DataHeader*) &header[1];
-    if (DataHeader_getContentType(dh) != ContentType_CJDHT) {
-        session->pub.timeOfLastIn = Time_currentTimeMilliseconds(sm->eventBase);
-    }
-    session->pub.bytesIn += msg->length;
-    session->pub.timeOfKeepAliveIn = Time_currentTimeMilliseconds(sm->eventBase);
-
-    if (currentMessageSetup) {
-        Bits_memcpy(&header->sh, switchHeader, SwitchHeader_SIZE);
-        debugHandlesAndLabel0(sm->log,
-                              session,
-                              Endian_bigEndianToHost64(switchHeader->label_be),
-                              "received start message");
-    } else {
-        // RouteHeader is laid out such that no copy of switch header should be needed.
-        Assert_true(&header->sh == switchHeader);
-        if (0) { // noisey
-        debugHandlesAndLabel0(sm->log,
-                              session,
-                              Endian_bigEndianToHost64(switchHeader->label_be),
-                              "received run message");
+    if (nonceOrHandle > 3 && CryptoAuth_isAsync(session->pub.caSession)) {
+        struct PendingDecrypt* pd = Allocator_calloc(msg->alloc, sizeof(struct PendingDecrypt), 1);
+        Identity_set(pd);
+        pd->session = session;
+        pd->switchHeader = switchHeader;
+        pd->nonceOrHandle = nonceOrHandle;
+        pd->length0 = length0;
+        Bits_memcpy(pd->firstSixteen, firstSixteen, 16);
+        if (!CryptoAuth_decryptAsync(session->pub.caSession, msg, decryptedAsync, pd)) {
+            return NULL;
         }
     }
 
-    header->version_be = Endian_hostToBigEndian32(session->pub.version);
-    Bits_memcpy(header->ip6, session->pub.caSession->herIp6, 16);
-    Bits_memcpy(header->publicKey, session->pub.caSession->herPublicKey, 32);
-
-    header->unused = 0;
-    header->flags = RouteHeader_flags_INCOMING;
-
-    uint64_t path = Endian_bigEndianToHost64(switchHeader->label_be);
-    if (!session->pub.sendSwitchLabel) {
-        session->pub.sendSwitchLabel = path;
-    }
-    if (path != session->pub.recvSwitchLabel) {
-        session->pub.recvSwitchLabel = path;
-        sendSession(session, path, 0xffffffff, PFChan_Core_DISCOVERED_PATH);
-    }
-
-    return Iface_next(&sm->pub.insideIf, msg);
+    enum CryptoAuth_DecryptErr ret = CryptoAuth_decrypt(session->pub.caSession, msg);
+    return incomingDecrypted(msg, session, switchHeader, ret, nonceOrHandle, length0,
+                             firstSixteen, newSession);
 }
 
 static void checkTimedOutBuffers(struct SessionManager_pvt* sm)
@@ -535,6 +761,9 @@ static void periodically(void* vSessionManager)
     struct SessionManager_pvt* sm = Identity_check((struct SessionManager_pvt*) vSessionManager);
     checkTimedOutSessions(sm);
     checkTimedOutBuffers(sm);
+    sm->retryGeneration ^= 1;
+    Bits_memset(sm->retryFilter[sm->retryGeneration], 0, RETRY_FILTER_BITS / 8);
+    sm->retryFilterSet[sm->retryGeneration] = 0;
 }
 
 static void needsLookup(struct SessionManager_pvt* sm, struct Message* msg, bool setupSession)
@@ -578,6 +807,55 @@ static void needsLookup(struct SessionManager_pvt* sm, struct Message* msg, bool
     triggerSearch(sm, header->ip6, Endian_hostToBigEndian32(header->version_be));
 }
 
+/** Put on the handle and the SwitchHeader once the message has been encrypted. */
+static Iface_DEFUN sendEncrypted(struct Message* msg, struct SessionManager_Session_pvt* sess)
+{
+    struct SessionManager_pvt* sm = Identity_check(sess->sessionManager);
+
+    // Same as the receive side, a nonce greater than 3 means this is a run message.
+    bool isSetup = (Endian_bigEndianToHost32(((uint32_t*)msg->bytes)[0]) <= 3);
+    if (!isSetup) {
+        Message_push32(msg, sess->pub.sendHandle, NULL);
+    }
+
+    // The SwitchHeader should have been moved to the correct location.
+    Message_shift(msg, SwitchHeader_SIZE, NULL);
+    struct SwitchHeader* sh = (struct SwitchHeader*) msg->bytes;
+
+    if (isSetup) {
+        debugHandlesAndLabel0(sm->log,
+                              sess,
+                              Endian_bigEndianToHost64(sh->label_be),
+                              "sending start message");
+    } else if (0) { // Noisy
+        debugHandlesAndLabel0(sm->log,
+                              sess,
+                              Endian_bigEndianToHost64(sh->label_be),
+                              "sending run message");
+    }
+
+    if (!sh->label_be) {
+        Bits_memset(sh, 0, SwitchHeader_SIZE);
+        sh->label_be = Endian_hostToBigEndian64(sess->pub.sendSwitchLabel);
+        SwitchHeader_setVersion(sh, SwitchHeader_CURRENT_VERSION);
+    }
+
+    return Iface_next(&sm->pub.switchIf, msg);
+}
+
+static void encryptedAsync(struct Message* msg, int err, void* vsess)
+{
+    struct SessionManager_Session_pvt* sess =
+        Identity_check((struct SessionManager_Session_pvt*) vsess);
+    if (Endian_bigEndianToHost32(((uint32_t*)msg->bytes)[0]) <= 3) {
+        // The session was reset while this was waiting behind other messages and it was
+        // encrypted as a handshake, but it was laid out as a run message.
+        Log_debug(sess->sessionManager->log, "DROP run message encrypted after session reset");
+        return;
+    }
+    Iface_CALL(sendEncrypted, msg, sess);
+}
+
 static Iface_DEFUN readyToSend(struct Message* msg,
                                struct SessionManager_pvt* sm,
                                struct SessionManager_Session_pvt* sess)
@@ -588,19 +866,16 @@ static Iface_DEFUN readyToSend(struct Message* msg,
         sess->pub.timeOfLastOut = Time_currentTimeMilliseconds(sm->eventBase);
     }
     Message_shift(msg, -RouteHeader_SIZE, NULL);
-    struct SwitchHeader* sh;
     CryptoAuth_resetIfTimeout(sess->pub.caSession);
-    if (CryptoAuth_getState(sess->pub.caSession) < CryptoAuth_State_RECEIVED_KEY) {
+    bool isSetup = (CryptoAuth_getState(sess->pub.caSession) < CryptoAuth_State_RECEIVED_KEY);
+    if (isSetup) {
         // Put the handle into the message so that it's authenticated.
         Message_push32(msg, sess->pub.receiveHandle, NULL);
 
         // Copy back the SwitchHeader so it is not clobbered.
         Message_shift(msg, (CryptoHeader_SIZE + SwitchHeader_SIZE), NULL);
         Bits_memcpy(msg->bytes, &header->sh, SwitchHeader_SIZE);
-        sh = (struct SwitchHeader*) msg->bytes;
         Message_shift(msg, -(CryptoHeader_SIZE + SwitchHeader_SIZE), NULL);
-    } else {
-        sh = &header->sh;
     }
 
     // This pointer ceases to be useful.
@@ -608,34 +883,14 @@ static Iface_DEFUN readyToSend(struct Message* msg,
 
     sess->pub.bytesOut += msg->length;
 
-    Assert_true(!CryptoAuth_encrypt(sess->pub.caSession, msg));
-
-    if (CryptoAuth_getState(sess->pub.caSession) >= CryptoAuth_State_RECEIVED_KEY) {
-        if (0) { // Noisy
-            debugHandlesAndLabel0(sm->log,
-                                  sess,
-                                  Endian_bigEndianToHost64(sh->label_be),
-                                  "sending run message");
-        }
-        Message_push32(msg, sess->pub.sendHandle, NULL);
-    } else {
-        debugHandlesAndLabel0(sm->log,
-                              sess,
-                              Endian_bigEndianToHost64(sh->label_be),
-                              "sending start message");
+    // Only run messages may wait for a worker thread, handshakes are laid out differently.
+    if (!isSetup && !CryptoAuth_encryptAsync(sess->pub.caSession, msg, encryptedAsync, sess)) {
+        return NULL;
     }
 
-    // The SwitchHeader should have been moved to the correct location.
-    Message_shift(msg, SwitchHeader_SIZE, NULL);
-    Assert_true((uint8_t*)sh == msg->bytes);
-
-    if (!sh->label_be) {
-        Bits_memset(sh, 0, SwitchHeader_SIZE);
-        sh->label_be = Endian_hostToBigEndian64(sess->pub.sendSwitchLabel);
-        SwitchHeader_setVersion(sh, SwitchHeader_CURRENT_VERSION);
-    }
+    Assert_true(!CryptoAuth_encrypt(sess->pub.caSession, msg));
 
-    return Iface_next(&sm->pub.switchIf, msg);
+    return sendEncrypted(msg, sess);
 }
 
 static Iface_DEFUN outgoingCtrlFrame(struct Message* msg, struct SessionManager_pvt* sm)
@@ -788,6 +1043,14 @@ struct SessionManager* SessionManager_new(struct Allocator* allocator,
     sm->pub.maxBufferedMessages = SessionManager_MAX_BUFFERED_MESSAGES_DEFAULT;
     sm->pub.sessionSearchAfterMilliseconds =
         SessionManager_SESSION_SEARCH_AFTER_MILLISECONDS_DEFAULT;
+    sm->pub.newSessionsPerPeerPerSecond = SessionManager_NEW_SESSIONS_PER_PEER_PER_SECOND_DEFAULT;
+    sm->pub.newSessionsPerSecond = SessionManager_NEW_SESSIONS_PER_SECOND_DEFAULT;
+    // Buckets start full, peerBuckets fill the first time they are used since lastRefill is 0.
+    sm->newSessionBucket.lastRefill = Time_currentTimeMilliseconds(eventBase);
+    sm->newSessionBucket.milliTokens =
+        (uint64_t) SessionManager_NEW_SESSIONS_PER_SECOND_DEFAULT * BURST_SECONDS * 1000;
+    sm->retrySessionBucket = sm->newSessionBucket;
+    Random_bytes(rand, (uint8_t*) &sm->hashSeed, 8);
 
     sm->eventIf.send = incomingFromEventIf;
     EventEmitter_regCore(ee, &sm->eventIf, PFChan_Pathfinder_NODE);
@@ -67,6 +67,46 @@ struct SessionManager
      */
     #define SessionManager_SESSION_SEARCH_AFTER_MILLISECONDS_DEFAULT 30000
     int64_t sessionSearchAfterMilliseconds;
+
+    /**
+     * Handshakes from nodes we have no session with are admitted at up to this many per second
+     * through any one of our peers (the first hop of the source label), with bursts of up to
+     * 4 times as many.
+     */
+    #define SessionManager_NEW_SESSIONS_PER_PEER_PER_SECOND_DEFAULT 16
+    int newSessionsPerPeerPerSecond;
+
+    /**
+     * Above this many per second in total (again with bursts of 4 times as many), a handshake
+     * from a node we have no session with is dropped the first time it is seen and only
+     * admitted when the node sends it again, see SessionManager_AdmissionStats.
+     * Handshakes admitted on retry are limited to the same rate again.
+     */
+    #define SessionManager_NEW_SESSIONS_PER_SECOND_DEFAULT 128
+    int newSessionsPerSecond;
+
+    /** Counters of what became of handshakes from nodes we have no session with. */
+    struct SessionManager_AdmissionStats {
+        /** Handshakes which passed admission and authenticated, creating a session. */
+        uint64_t admitted;
+
+        /**
+         * Dropped because the peer it came through was over newSessionsPerPeerPerSecond, or it
+         * was a retry and retries were over newSessionsPerSecond.
+         */
+        uint64_t rejectedRate;
+
+        /**
+         * Dropped because the node was over newSessionsPerSecond and this was the first time
+         * the handshake was seen from that label and key. Nodes resend hellos until answered
+         * so a real node gets in on its next try, a flood of one-off forged hellos does not.
+         * While a flood has filled the record of what was seen, retries are not recognized.
+         */
+        uint64_t rejectedRetry;
+
+        /** Handshakes which passed admission but failed to authenticate, no session is kept. */
+        uint64_t unauthenticated;
+    } admission;
 };
 
 struct SessionManager_Session
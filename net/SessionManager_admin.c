@@ -168,6 +168,18 @@ static void resetCA(Dict* args,
     Admin_sendMessage(r, txid, context->admin);
 }
 
+static void admissionStats(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = Identity_check((struct Context*) vcontext);
+    struct SessionManager_AdmissionStats* stats = &context->sm->admission;
+    Dict* r = Dict_new(alloc);
+    Dict_putIntC(r, "admitted", stats->admitted, alloc);
+    Dict_putIntC(r, "rejectedRate", stats->rejectedRate, alloc);
+    Dict_putIntC(r, "rejectedRetry", stats->rejectedRetry, alloc);
+    Dict_putIntC(r, "unauthenticated", stats->unauthenticated, alloc);
+    Admin_sendMessage(r, txid, context->admin);
+}
+
 void SessionManager_admin_register(struct SessionManager* sm,
                                    struct Admin* admin,
                                    struct Allocator* alloc)
@@ -198,4 +210,6 @@ void SessionManager_admin_register(struct SessionManager* sm,
         ((struct Admin_FunctionArg[]) {
             { .name = "ip6", .required = 1, .type = "String" }
         }), admin);
+
+    Admin_registerFunction("SessionManager_admissionStats", admissionStats, ctx, true, NULL, admin);
 }
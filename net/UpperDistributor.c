@@ -34,6 +34,7 @@ struct UpperDistributor_Handler_pvt
 #define Map_KEY_TYPE int
 #define Map_VALUE_TYPE struct UpperDistributor_Handler_pvt*
 #define Map_NAME OfHandlers
+#define Map_USE_HASHTABLE
 #include "util/Map.h"
 
 struct UpperDistributor_pvt
@@ -0,0 +1,189 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "net/PeerLink.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+#define PACED_COUNT 20
+#define PACED_SIZE 500
+
+/** 100 bytes per millisecond. */
+#define PACED_KBPS 800
+
+/** Time for one PACED_SIZE message to be allowed through. */
+#define PACED_MICROSECONDS 5000
+
+struct Context
+{
+    struct PeerLink* pl;
+    struct Allocator* alloc;
+    struct EventBase* base;
+    uint64_t now;
+    int received;
+    Identity
+};
+
+static uint64_t fakeClock(void* vctx)
+{
+    struct Context* ctx = Identity_check((struct Context*) vctx);
+    return ctx->now;
+}
+
+static struct Context* newContext(PeerLink_ReadyCallback onReady,
+                                  struct Allocator* alloc,
+                                  struct EventBase* base)
+{
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->alloc = alloc;
+    ctx->base = base;
+    ctx->now = 1000000;
+    ctx->pl = PeerLink_new(base, onReady, ctx, alloc);
+    PeerLink_setClock(ctx->pl, fakeClock, ctx);
+    return ctx;
+}
+
+static void sendMessage(struct PeerLink* pl, int length, struct Allocator* alloc)
+{
+    // The message is adopted by the PeerLink, the sender frees their allocator right away.
+    struct Allocator* msgAlloc = Allocator_child(alloc);
+    struct Message* msg = Message_new(length, 512, msgAlloc);
+    PeerLink_send(msg, pl);
+    Allocator_free(msgAlloc);
+}
+
+static int drain(struct Context* ctx)
+{
+    struct Allocator* pollAlloc = Allocator_child(ctx->alloc);
+    int count = 0;
+    struct Message* msg;
+    while ((msg = PeerLink_poll(ctx->pl, pollAlloc))) {
+        Assert_true(msg->length == PACED_SIZE);
+        count++;
+    }
+    Allocator_free(pollAlloc);
+    ctx->received += count;
+    return count;
+}
+
+static void ready(struct PeerLink* pl, void* vctx)
+{
+    struct Context* ctx = Identity_check((struct Context*) vctx);
+    drain(ctx);
+    if (ctx->received == PACED_COUNT) {
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+static void fail(void* vNULL)
+{
+    Assert_failure("timed out.");
+}
+
+static void neverReady(struct PeerLink* pl, void* vctx)
+{
+    Assert_failure("not paced, should never be waiting");
+}
+
+static void paced(struct Allocator* alloc, struct EventBase* base)
+{
+    struct Context* ctx = newContext(ready, alloc, base);
+    PeerLink_setMaxKbps(ctx->pl, PACED_KBPS);
+
+    for (int i = 0; i < PACED_COUNT; i++) {
+        sendMessage(ctx->pl, PACED_SIZE, alloc);
+    }
+
+    // Only the initial burst (1500 bytes) gets out right away.
+    Assert_true(drain(ctx) == 3);
+
+    // After that one message per 5ms, never a moment sooner.
+    while (ctx->received < PACED_COUNT - 1) {
+        ctx->now += PACED_MICROSECONDS - 1;
+        Assert_true(drain(ctx) == 0);
+        ctx->now += 1;
+        Assert_true(drain(ctx) == 1);
+    }
+
+    // The last one is picked up by the ready callback.
+    ctx->now += PACED_MICROSECONDS - 1;
+    Assert_true(drain(ctx) == 0);
+    ctx->now += 1;
+    Timeout_setTimeout(fail, NULL, 5000, base, alloc);
+    EventBase_beginLoop(base);
+    Assert_true(ctx->received == PACED_COUNT);
+
+    struct PeerLink_QueueStats qs;
+    PeerLink_queueStats(ctx->pl, &qs);
+    Assert_true(qs.queueLength == 0);
+    Assert_true(qs.drops == 0);
+}
+
+static void overflow(struct Allocator* alloc, struct EventBase* base)
+{
+    struct PeerLink* pl = PeerLink_new(base, neverReady, NULL, alloc);
+    for (int i = 0; i < PeerLink_MAX_QUEUE + 10; i++) {
+        sendMessage(pl, PACED_SIZE, alloc);
+    }
+    struct PeerLink_QueueStats qs;
+    PeerLink_queueStats(pl, &qs);
+    Assert_true(qs.queueLength == PeerLink_MAX_QUEUE);
+    Assert_true(qs.drops == 10);
+}
+
+static void codel(struct Allocator* alloc, struct EventBase* base)
+{
+    struct Context* ctx = newContext(neverReady, alloc, base);
+    struct PeerLink* pl = ctx->pl;
+    for (int i = 0; i < 50; i++) {
+        sendMessage(pl, 1000, alloc);
+    }
+    struct Allocator* pollAlloc = Allocator_child(alloc);
+
+    // Above target but not yet for a whole interval, nothing is dropped.
+    ctx->now += PeerLink_TARGET_MICROSECONDS * 2;
+    Assert_true(PeerLink_poll(pl, pollAlloc));
+    struct PeerLink_QueueStats qs;
+    PeerLink_queueStats(pl, &qs);
+    Assert_true(qs.drops == 0);
+    Assert_true(qs.sojournMicroseconds == PeerLink_TARGET_MICROSECONDS * 2);
+
+    // Still above target after the interval, now it begins to drop.
+    ctx->now += PeerLink_INTERVAL_MICROSECONDS;
+    Assert_true(PeerLink_poll(pl, pollAlloc));
+    PeerLink_queueStats(pl, &qs);
+    Assert_true(qs.drops == 1);
+    Assert_true(qs.queueLength == 47);
+
+    Allocator_free(pollAlloc);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+
+    overflow(alloc, base);
+    codel(alloc, base);
+    paced(alloc, base);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,264 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/CryptoAuth.h"
+#include "crypto/Key.h"
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "net/EventEmitter.h"
+#include "net/SessionManager.h"
+#include "util/events/EventBase.h"
+#include "util/log/FileWriterLog.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "wire/DataHeader.h"
+#include "wire/SwitchHeader.h"
+#define NumberCompress_OLD_CODE
+#include "switch/NumberCompress.h"
+
+struct Context
+{
+    struct Iface switchIf;
+    struct Iface insideIf;
+    struct SessionManager* sm;
+    struct CryptoAuth* ca;
+    struct Allocator* alloc;
+    struct EventBase* base;
+    struct Random* rand;
+    struct Log* log;
+    int received;
+    Identity
+};
+
+static Iface_DEFUN fromSwitchIf(struct Message* msg, struct Iface* iface)
+{
+    // Errors sent back for handshakes which failed.
+    return NULL;
+}
+
+static Iface_DEFUN fromInsideIf(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, insideIf);
+    ctx->received++;
+    return NULL;
+}
+
+/** A return path which came in through our interface number hop, anything may follow it. */
+static uint64_t mkLabel(uint32_t hop, uint64_t rest)
+{
+    uint32_t bits = NumberCompress_bitsUsedForNumber(hop);
+    return NumberCompress_getCompressed(hop, bits) | (rest << bits);
+}
+
+/** The switch hands the return path over bit reversed. */
+static void setLabel(struct Message* msg, uint64_t label)
+{
+    struct SwitchHeader* sh = (struct SwitchHeader*) msg->bytes;
+    sh->label_be = Bits_bitReverse64(Endian_hostToBigEndian64(label));
+}
+
+/** A hello from a new node, ip6Out is set to its address. */
+static struct Message* mkHello(struct Context* ctx, uint64_t label, uint8_t ip6Out[16])
+{
+    uint8_t publicKey[32];
+    uint8_t privateKey[32];
+    Key_gen(ip6Out, publicKey, privateKey, ctx->rand);
+    struct CryptoAuth* ca = CryptoAuth_new(ctx->alloc, privateKey, ctx->base, NULL, ctx->rand);
+    struct CryptoAuth_Session* sess =
+        CryptoAuth_newSession(ca, ctx->alloc, ctx->ca->publicKey, false, "test");
+
+    // Send handle then the DataHeader.
+    struct Message* msg = Message_new(8, 512, ctx->alloc);
+    Bits_memset(msg->bytes, 0, 8);
+    msg->bytes[3] = 0x10;
+    Assert_true(!CryptoAuth_encrypt(sess, msg));
+
+    struct SwitchHeader sh;
+    Bits_memset(&sh, 0, SwitchHeader_SIZE);
+    Message_push(msg, &sh, SwitchHeader_SIZE, NULL);
+    setLabel(msg, label);
+    return msg;
+}
+
+static struct Message* copy(struct Message* msg, struct Allocator* alloc)
+{
+    struct Message* out = Message_new(msg->length, 512, alloc);
+    Bits_memcpy(out->bytes, msg->bytes, msg->length);
+    return out;
+}
+
+static struct Context* init(struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->alloc = alloc;
+    ctx->log = FileWriterLog_new(stdout, alloc);
+    ctx->rand = Random_new(alloc, ctx->log, NULL);
+    ctx->base = EventBase_new(alloc);
+    ctx->ca = CryptoAuth_new(alloc, NULL, ctx->base, ctx->log, ctx->rand);
+    struct EventEmitter* ee = EventEmitter_new(alloc, ctx->log, ctx->ca->publicKey);
+    ctx->sm = SessionManager_new(alloc, ctx->base, ctx->ca, ctx->rand, ctx->log, ee);
+    ctx->switchIf.send = fromSwitchIf;
+    ctx->insideIf.send = fromInsideIf;
+    Iface_plumb(&ctx->switchIf, &ctx->sm->switchIf);
+    Iface_plumb(&ctx->insideIf, &ctx->sm->insideIf);
+    return ctx;
+}
+
+static void perPeer(struct Allocator* alloc)
+{
+    struct Context* ctx = init(alloc);
+    ctx->sm->newSessionsPerPeerPerSecond = 1;
+    uint8_t ip6[16];
+
+    // A burst of 4 through one peer gets in, the rest do not.
+    for (int i = 0; i < 6; i++) {
+        Iface_send(&ctx->switchIf, mkHello(ctx, mkLabel(3, 1), ip6));
+        Assert_true((SessionManager_sessionForIp6(ip6, ctx->sm) != NULL) == (i < 4));
+    }
+    Assert_true(ctx->received == 4);
+    Assert_true(ctx->sm->admission.admitted == 4);
+    Assert_true(ctx->sm->admission.rejectedRate == 2);
+
+    // Another peer has its own bucket.
+    Iface_send(&ctx->switchIf, mkHello(ctx, mkLabel(5, 1), ip6));
+    Assert_true(ctx->sm->admission.admitted == 5);
+}
+
+/** Changing the rest of the label must not get a flood a fresh bucket. */
+static void varyingLabels(struct Allocator* alloc)
+{
+    struct Context* ctx = init(alloc);
+    ctx->sm->newSessionsPerPeerPerSecond = 1;
+    uint8_t ip6[16];
+
+    for (int i = 0; i < 4; i++) {
+        Iface_send(&ctx->switchIf, mkHello(ctx, mkLabel(3, i + 1), ip6));
+    }
+    Assert_true(ctx->sm->admission.admitted == 4);
+
+    struct Message* hello = mkHello(ctx, 0, ip6);
+    for (int i = 0; i < 500; i++) {
+        struct Allocator* msgAlloc = Allocator_child(alloc);
+        struct Message* msg = copy(hello, msgAlloc);
+        setLabel(msg, mkLabel(3, 0x1000 + i));
+        Iface_send(&ctx->switchIf, msg);
+        Allocator_free(msgAlloc);
+    }
+    Assert_true(ctx->sm->admission.admitted == 4);
+    Assert_true(ctx->sm->admission.rejectedRate == 500);
+    Assert_true(!SessionManager_sessionForIp6(ip6, ctx->sm));
+
+    // Through another peer it still gets in.
+    setLabel(hello, mkLabel(5, 1));
+    Iface_send(&ctx->switchIf, hello);
+    Assert_true(ctx->sm->admission.admitted == 5);
+    Assert_true(SessionManager_sessionForIp6(ip6, ctx->sm));
+}
+
+static void unauthenticated(struct Allocator* alloc)
+{
+    struct Context* ctx = init(alloc);
+    uint8_t ip6[16];
+    struct Message* msg = mkHello(ctx, 0x13, ip6);
+    msg->bytes[msg->length - 1] ^= 1;
+    Iface_send(&ctx->switchIf, msg);
+    Assert_true(!ctx->received);
+    Assert_true(ctx->sm->admission.unauthenticated == 1);
+    Assert_true(!SessionManager_sessionForIp6(ip6, ctx->sm));
+}
+
+static void retry(struct Allocator* alloc)
+{
+    struct Context* ctx = init(alloc);
+    ctx->sm->newSessionsPerSecond = 1;
+    uint8_t ip6[16];
+
+    // Use up the burst.
+    for (int i = 0; i < 4; i++) {
+        Iface_send(&ctx->switchIf, mkHello(ctx, mkLabel(i + 2, 1), ip6));
+    }
+    Assert_true(ctx->sm->admission.admitted == 4);
+
+    // Now a new node is turned away the first time and gets in when it tries again.
+    struct Message* msg = mkHello(ctx, mkLabel(7, 1), ip6);
+    struct Message* again = copy(msg, ctx->alloc);
+    Iface_send(&ctx->switchIf, msg);
+    Assert_true(ctx->sm->admission.rejectedRetry == 1);
+    Assert_true(!SessionManager_sessionForIp6(ip6, ctx->sm));
+    Iface_send(&ctx->switchIf, again);
+    Assert_true(ctx->sm->admission.admitted == 5);
+    Assert_true(SessionManager_sessionForIp6(ip6, ctx->sm));
+
+    // Sending everything twice only gets the burst of retries in.
+    for (int i = 0; i < 4; i++) {
+        msg = mkHello(ctx, mkLabel(8 + i, 1), ip6);
+        again = copy(msg, ctx->alloc);
+        Iface_send(&ctx->switchIf, msg);
+        Iface_send(&ctx->switchIf, again);
+    }
+    Assert_true(ctx->sm->admission.admitted == 8);
+    Assert_true(ctx->sm->admission.rejectedRate == 1);
+}
+
+/** A flood of one-off hellos which fills the retry filter must not make it let everything in. */
+#define FLOOD_COUNT 20000
+static void retrySaturated(struct Allocator* alloc)
+{
+    struct Context* ctx = init(alloc);
+    ctx->sm->newSessionsPerSecond = 1;
+    ctx->sm->newSessionsPerPeerPerSecond = 1000000;
+    uint8_t ip6[16];
+    for (int i = 0; i < 4; i++) {
+        Iface_send(&ctx->switchIf, mkHello(ctx, mkLabel(i + 2, 1), ip6));
+    }
+
+    // Forged, so one which gets through as a false positive is dropped and does not stay.
+    struct Message* forged = mkHello(ctx, 0, ip6);
+    forged->bytes[forged->length - 1] ^= 1;
+    for (int i = 0; i < FLOOD_COUNT; i++) {
+        struct Allocator* msgAlloc = Allocator_child(alloc);
+        struct Message* msg = copy(forged, msgAlloc);
+        setLabel(msg, mkLabel(3, 0x1000 + i));
+        Iface_send(&ctx->switchIf, msg);
+        Allocator_free(msgAlloc);
+    }
+    struct SessionManager_AdmissionStats* as = &ctx->sm->admission;
+    Assert_true(as->admitted == 4);
+    // Time does not move without the event loop so only the burst of retries can get in.
+    Assert_true(as->unauthenticated <= 4);
+    Assert_true(as->rejectedRetry + as->rejectedRate + as->unauthenticated == FLOOD_COUNT);
+
+    // Even a real retry is not recognized now.
+    struct Message* hello = mkHello(ctx, mkLabel(3, 1), ip6);
+    Iface_send(&ctx->switchIf, copy(hello, ctx->alloc));
+    Iface_send(&ctx->switchIf, hello);
+    Assert_true(as->admitted == 4);
+    Assert_true(!SessionManager_sessionForIp6(ip6, ctx->sm));
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    perPeer(Allocator_child(alloc));
+    varyingLabels(Allocator_child(alloc));
+    unauthenticated(Allocator_child(alloc));
+    retry(Allocator_child(alloc));
+    retrySaturated(Allocator_child(alloc));
+    Allocator_free(alloc);
+    return 0;
+}
@@ -39,6 +39,9 @@ struct Penalty_pvt
     struct Log* log;
     int lastReplaced;
     uint32_t entries[ENTRY_COUNT];
+
+    /** Sum of CONTRIBUTION() of every entry, kept up to date as entries are replaced. */
+    uint64_t contributionSum;
     Identity
 };
 
@@ -46,6 +49,15 @@ struct Penalty_pvt
 
 #define PENALTY_TIME(penaltyEntry) ((penaltyEntry) << 21 >> 21)
 
+#define CONTRIBUTION(penaltyEntry) ((uint32_t)((penaltyEntry) << 16) >> 11)
+
+static void setEntry(struct Penalty_pvt* p, int i, uint32_t penaltyEntry)
+{
+    p->contributionSum -= CONTRIBUTION(p->entries[i]);
+    p->entries[i] = penaltyEntry;
+    p->contributionSum += CONTRIBUTION(penaltyEntry);
+}
+
 static uint16_t handlePacket(struct Penalty_pvt* p,
                              uint32_t currentPackedPenalty,
                              int messageLength)
@@ -60,14 +72,14 @@ static uint16_t handlePacket(struct Penalty_pvt* p,
     // normalize currentPackedPenalty
     currentPackedPenalty = newPenaltyEntry >> 16;
 
-    for (int i = 0; i < ENTRY_COUNT; i++) {
-        // Non-branching comparison: 30% - 60% better perf for whole switching process (no crypto)
-        uint32_t e = p->entries[i];
-        //if (e > newPenaltyEntry) { unpackedPenalty += (e << 16 >> 11); }
-        unpackedPenalty += ( ((((e - newPenaltyEntry - 1) >> 31) << 31) - 1) & (e << 16 >> 11) );
-    }
+    // This used to be a scan of every entry using a non-branching comparison:
+    //     unpackedPenalty += ( ((((e - newPenaltyEntry - 1) >> 31) << 31) - 1) & (e << 16 >> 11) )
+    // but the mask is either 0xffffffff or 0x7fffffff and the contribution is never more than
+    // 21 bits so every entry was always added, the running sum gives the same result in O(1).
+    unpackedPenalty += p->contributionSum;
+
     p->lastReplaced = (p->lastReplaced + 1) % ENTRY_COUNT;
-    p->entries[p->lastReplaced] = newPenaltyEntry;
+    setEntry(p, p->lastReplaced, newPenaltyEntry);
 
     uint16_t newPackedPenalty = PenaltyFloat_pack(unpackedPenalty);
     if (newPackedPenalty > currentPackedPenalty) {
@@ -98,7 +110,7 @@ static void maintanence(void* vPenalty)
     for (int i = 0; i < ENTRY_COUNT; i++) {
         if (PENALTY_TIME(p->entries[i]) < tooOld) {
             // set to max penalty.
-            p->entries[i] = (PenaltyFloat_MAX << 16) | now;
+            setEntry(p, i, (PenaltyFloat_MAX << 16) | now);
         }
     }
 }
@@ -112,7 +124,7 @@ struct Penalty* Penalty_new(struct Allocator* alloc, struct EventBase* base, str
     Identity_set(p);
     uint32_t now = Time_currentTimeMilliseconds(p->eventBase);
     for (int i = 0; i < ENTRY_COUNT; i++) {
-        p->entries[i] = (PenaltyFloat_MAX << 16) | now;
+        setEntry(p, i, (PenaltyFloat_MAX << 16) | now);
     }
     return &p->pub;
 }
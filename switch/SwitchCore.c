@@ -69,10 +69,14 @@ struct ErrorPacket8 {
 };
 Assert_compileTime(sizeof(struct ErrorPacket8) == SwitchHeader_SIZE + 4 + sizeof(struct Control));
 
-static inline Iface_DEFUN sendError(struct SwitchInterface* iface,
-                                    struct Message* cause,
-                                    uint32_t code,
-                                    struct Log* logger)
+/**
+ * Turn the cause into an error packet addressed back to where it came from.
+ * @return the interface to send the error packet to or NULL if it should be dropped.
+ */
+static inline struct SwitchInterface* sendError(struct SwitchInterface* iface,
+                                                struct Message* cause,
+                                                uint32_t code,
+                                                struct Log* logger)
 {
     if (cause->length < SwitchHeader_SIZE + 4) {
         Log_debug(logger, "runt");
@@ -111,16 +115,21 @@ static inline Iface_DEFUN sendError(struct SwitchInterface* iface,
     err->ctrl.header.checksum_be =
         Checksum_engine((uint8_t*) &err->ctrl, cause->length - SwitchHeader_SIZE - 4);
 
-    return Iface_next(&iface->iface, cause);
+    return iface;
 }
 
 #define DEBUG_SRC_DST(logger, message) \
     Log_debug(logger, message " ([%u] to [%u])", sourceIndex, destIndex)
 
-/** This never returns an error, it sends an error packet instead. */
-static Iface_DEFUN receiveMessage(struct Message* message, struct Iface* iface)
+/**
+ * Switch a message, rewriting the label in place, or turn it into an error packet.
+ * This never returns an error, it replaces the message with an error packet instead.
+ *
+ * @return the interface to send the message to (sourceIf if it became an error packet)
+ *         or NULL if the message should be dropped.
+ */
+static struct SwitchInterface* route(struct Message* message, struct SwitchInterface* sourceIf)
 {
-    struct SwitchInterface* sourceIf = Identity_check((struct SwitchInterface*) iface);
     struct SwitchCore_pvt* core = Identity_check(sourceIf->core);
 
     if (message->length < SwitchHeader_SIZE) {
@@ -212,11 +221,8 @@ static Iface_DEFUN receiveMessage(struct Message* message, struct Iface* iface)
     uint64_t sourceLabel = Bits_bitReverse64(NumberCompress_getCompressed(sourceIndex, bits));
     uint64_t targetLabel = (label >> bits) | sourceLabel;
 
-    int cloneLength = (message->length < Control_Error_MAX_SIZE) ?
-        message->length : Control_Error_MAX_SIZE;
-    uint8_t messageClone[Control_Error_MAX_SIZE];
-    Bits_memcpy(messageClone, message->bytes, cloneLength);
-
+    // Every error above is sent before the header is touched so the message itself is the
+    // cause, don't add a sendError() below this point without undoing the label change first.
     // Update the header
     header->label_be = Endian_hostToBigEndian64(targetLabel);
     uint32_t labelShift = SwitchHeader_getLabelShift(header) + bits;
@@ -231,7 +237,46 @@ static Iface_DEFUN receiveMessage(struct Message* message, struct Iface* iface)
         Penalty_apply(sourceIf->penalty, header, message->length);
     }
 
-    return Iface_next(&core->interfaces[destIndex].iface, message);
+    return &core->interfaces[destIndex];
+}
+
+static Iface_DEFUN receiveMessage(struct Message* message, struct Iface* iface)
+{
+    struct SwitchInterface* sourceIf = Identity_check((struct SwitchInterface*) iface);
+    struct SwitchInterface* dest = route(message, sourceIf);
+    return (dest) ? Iface_next(&dest->iface, message) : NULL;
+}
+
+#define BATCH_MAX 64
+
+/**
+ * Switch a burst of messages, those which are headed for the same interface are passed on
+ * together with one Iface_sendBatch() in the order in which they arrived.
+ */
+static void receiveBatch(struct Message** msgs, int count, struct Iface* iface)
+{
+    struct SwitchInterface* sourceIf = Identity_check((struct SwitchInterface*) iface);
+    for (int base = 0; base < count; base += BATCH_MAX) {
+        int n = (count - base < BATCH_MAX) ? count - base : BATCH_MAX;
+        struct SwitchInterface* dests[BATCH_MAX];
+        for (int i = 0; i < n; i++) {
+            dests[i] = route(msgs[base + i], sourceIf);
+        }
+        struct Message* group[BATCH_MAX];
+        for (int i = 0; i < n; i++) {
+            struct SwitchInterface* dest = dests[i];
+            if (!dest) { continue; }
+            int groupLen = 0;
+            for (int j = i; j < n; j++) {
+                if (dests[j] != dest) { continue; }
+                group[groupLen++] = msgs[base + j];
+                dests[j] = NULL;
+            }
+            // A send might have caused the interface to be removed.
+            if (!dest->alloc) { continue; }
+            Iface_sendBatch(&dest->iface, group, groupLen);
+        }
+    }
 }
 
 static int removeInterface(struct Allocator_OnFreeJob* job)
@@ -287,6 +332,7 @@ int SwitchCore_addInterface(struct SwitchCore* switchCore,
     struct SwitchInterface* newIf = &core->interfaces[ifIndex];
     Identity_set(newIf);
     newIf->iface.send = receiveMessage;
+    newIf->iface.sendBatch = receiveBatch;
     newIf->core = core;
     newIf->alloc = alloc;
     newIf->penalty = Penalty_new(alloc, core->eventBase, core->logger);
@@ -313,6 +359,7 @@ struct SwitchCore* SwitchCore_new(struct Log* logger,
     struct SwitchInterface* routerIf = &core->interfaces[1];
     Identity_set(routerIf);
     routerIf->iface.send = receiveMessage;
+    routerIf->iface.sendBatch = receiveBatch;
     routerIf->core = core;
     routerIf->alloc = allocator;
     routerIf->state = SwitchCore_setInterfaceState_ifaceState_UP;
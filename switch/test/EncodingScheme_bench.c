@@ -0,0 +1,67 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "switch/EncodingScheme.h"
+#include "switch/NumberCompress.h"
+#include "test/Bench.h"
+#include "util/Assert.h"
+
+#define LABELS 1024
+
+struct Context
+{
+    struct EncodingScheme* scheme;
+    uint64_t labels[LABELS];
+};
+
+static void toCannonical(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    uint64_t invalid = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t label = EncodingScheme_convertLabel(ctx->scheme, ctx->labels[i % LABELS],
+            EncodingScheme_convertLabel_convertTo_CANNONICAL);
+        invalid += (label == EncodingScheme_convertLabel_INVALID);
+    }
+    Assert_true(!invalid);
+}
+
+static void toWidest(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    uint64_t invalid = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t label = EncodingScheme_convertLabel(ctx->scheme, ctx->labels[i % LABELS],
+            ctx->scheme->count - 1);
+        invalid += (label == EncodingScheme_convertLabel_INVALID);
+    }
+    Assert_true(!invalid);
+}
+
+int main(struct Bench* bench)
+{
+    struct Context* ctx = Allocator_calloc(bench->alloc, sizeof(struct Context), 1);
+    ctx->scheme = NumberCompress_v3x5x8_defineScheme(bench->alloc);
+    for (int i = 0; i < LABELS; i++) {
+        // A director for a random interface followed by the rest of a path.
+        // 1 is the self route which has only one form.
+        uint32_t iface = Random_uint16(bench->rand) % (NumberCompress_v3x5x8_INTERFACES - 2) + 2;
+        uint32_t bits = NumberCompress_v3x5x8_bitsUsedForNumber(iface);
+        uint64_t rest = (Random_uint32(bench->rand) | (1ull << 32));
+        ctx->labels[i] = (rest << bits) | NumberCompress_v3x5x8_getCompressed(iface, bits);
+    }
+    Bench_run(bench, "toCannonical", toCannonical, ctx);
+    Bench_run(bench, "toWidest", toWidest, ctx);
+    return 0;
+}
@@ -0,0 +1,50 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "switch/Penalty.h"
+#include "test/Bench.h"
+#include "util/Bits.h"
+
+#define HEADERS 1024
+
+struct Context
+{
+    struct Penalty* penalty;
+    uint16_t penalties[HEADERS];
+    uint16_t lengths[HEADERS];
+};
+
+static void apply(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        struct SwitchHeader header = { .label_be = 0 };
+        SwitchHeader_setPenalty(&header, ctx->penalties[i % HEADERS]);
+        Penalty_apply(ctx->penalty, &header, ctx->lengths[i % HEADERS]);
+    }
+}
+
+int main(struct Bench* bench)
+{
+    struct Context* ctx = Allocator_calloc(bench->alloc, sizeof(struct Context), 1);
+    ctx->penalty = Penalty_new(bench->alloc, bench->base, NULL);
+    for (int i = 0; i < HEADERS; i++) {
+        // Mostly low penalties with an occasional large one, like Penalty_test.
+        ctx->penalties[i] = Random_uint16(bench->rand);
+        if (Random_uint8(bench->rand) & 7) { ctx->penalties[i] &= 0x0fff; }
+        ctx->lengths[i] = Random_uint16(bench->rand) % 4096;
+    }
+    Bench_run(bench, "apply", apply, ctx);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "switch/Penalty.h"
+#include "switch/PenaltyFloat.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/Assert.h"
+
+#define ENTRY_COUNT 1024
+#define CYCLES 20000
+
+/** The original linear scan which Penalty is expected to agree with. */
+struct Reference
+{
+    int lastReplaced;
+    uint32_t entries[ENTRY_COUNT];
+};
+
+static uint16_t referenceApply(struct Reference* ref, uint32_t now, uint16_t penalty, int len)
+{
+    uint64_t unpackedPenalty = PenaltyFloat_unpack(penalty);
+    uint32_t newPenaltyEntry =
+        (PenaltyFloat_pack(unpackedPenalty) << 16) |
+        (((len / 128) & ((1<<5)-1)) << 11) |
+        (now & ((1<<11)-1));
+    uint32_t currentPackedPenalty = newPenaltyEntry >> 16;
+    for (int i = 0; i < ENTRY_COUNT; i++) {
+        uint32_t e = ref->entries[i];
+        unpackedPenalty += ( ((((e - newPenaltyEntry - 1) >> 31) << 31) - 1) & (e << 16 >> 11) );
+    }
+    ref->lastReplaced = (ref->lastReplaced + 1) % ENTRY_COUNT;
+    ref->entries[ref->lastReplaced] = newPenaltyEntry;
+    uint16_t newPackedPenalty = PenaltyFloat_pack(unpackedPenalty);
+    return (newPackedPenalty > currentPackedPenalty) ? newPackedPenalty : currentPackedPenalty;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Penalty* penalty = Penalty_new(alloc, base, NULL);
+
+    // The event loop is never run so the time stays the same for the whole test.
+    uint32_t now = Time_currentTimeMilliseconds(base);
+    struct Reference ref = { .lastReplaced = 0 };
+    for (int i = 0; i < ENTRY_COUNT; i++) {
+        ref.entries[i] = (PenaltyFloat_MAX << 16) | now;
+    }
+
+    for (int i = 0; i < CYCLES; i++) {
+        // Mostly low penalties with an occasional large one so that all buckets get used.
+        uint16_t currentPenalty = Random_uint16(rand);
+        if (Random_uint8(rand) & 7) { currentPenalty &= 0x0fff; }
+        int len = Random_uint16(rand) % 4096;
+
+        struct SwitchHeader header = { .versionAndLabelShift = 0 };
+        SwitchHeader_setPenalty(&header, currentPenalty);
+        Penalty_apply(penalty, &header, len);
+
+        uint16_t expected = referenceApply(&ref, now, currentPenalty, len);
+        Assert_true(SwitchHeader_getPenalty(&header) == expected);
+    }
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "switch/SwitchCore.h"
+#include "util/events/EventBase.h"
+#include "util/Assert.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+#include "wire/SwitchHeader.h"
+
+#define MESSAGE_COUNT 9
+
+struct Context
+{
+    /** Has a sendBatch function so it should get all of its messages in one call. */
+    struct Iface batchIf;
+
+    /** Has no sendBatch function so it should get its messages one at a time. */
+    struct Iface singleIf;
+
+    /** Removed before sending, the message addressed to it comes back as an error. */
+    struct Iface goneIf;
+
+    struct Iface routerIf;
+
+    uint32_t batchCalls;
+    uint32_t batchReceived;
+    uint32_t singleReceived;
+    uint32_t errorsReceived;
+
+    Identity
+};
+
+static uint32_t popNum(struct Message* msg)
+{
+    Message_shift(msg, -SwitchHeader_SIZE, NULL);
+    uint32_t num;
+    Message_pop(msg, &num, 4, NULL);
+    return num;
+}
+
+static void batchRecv(struct Message** msgs, int count, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, batchIf);
+    ctx->batchCalls++;
+    for (int i = 0; i < count; i++) {
+        // Messages 0, 2, 4 and 6 go to this interface and must not be reordered.
+        Assert_true(popNum(msgs[i]) == ctx->batchReceived * 2);
+        ctx->batchReceived++;
+    }
+}
+
+static Iface_DEFUN batchIfRecvOne(struct Message* msg, struct Iface* iface)
+{
+    Assert_failure("batch interface got a message without sendBatch");
+    return NULL;
+}
+
+static Iface_DEFUN singleRecv(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, singleIf);
+    // Messages 1, 3, 5 and 7.
+    Assert_true(popNum(msg) == ctx->singleReceived * 2 + 1);
+    ctx->singleReceived++;
+    return NULL;
+}
+
+static Iface_DEFUN routerRecv(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, routerIf);
+    ctx->errorsReceived++;
+    return NULL;
+}
+
+static Iface_DEFUN unexpected(struct Message* msg, struct Iface* iface)
+{
+    Assert_failure("Message sent to the wrong interface");
+    return NULL;
+}
+
+static struct Message* newMessage(uint64_t label, uint32_t num, struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(0, 512, alloc);
+    Message_push(msg, &num, 4, NULL);
+    Message_shift(msg, SwitchHeader_SIZE, NULL);
+    struct SwitchHeader* hdr = (struct SwitchHeader*) msg->bytes;
+    Bits_memset(hdr, 0, SwitchHeader_SIZE);
+    hdr->label_be = Endian_hostToBigEndian64(label);
+    SwitchHeader_setVersion(hdr, SwitchHeader_CURRENT_VERSION);
+    return msg;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct SwitchCore* core = SwitchCore_new(NULL, alloc, base);
+
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->batchIf.send = batchIfRecvOne;
+    ctx->batchIf.sendBatch = batchRecv;
+    ctx->singleIf.send = singleRecv;
+    ctx->goneIf.send = unexpected;
+    ctx->routerIf.send = routerRecv;
+    Iface_plumb(&ctx->routerIf, core->routerIf);
+
+    uint64_t batchLabel;
+    uint64_t singleLabel;
+    uint64_t goneLabel;
+    struct Allocator* goneAlloc = Allocator_child(alloc);
+    Assert_true(!SwitchCore_addInterface(core, &ctx->batchIf, alloc, &batchLabel));
+    Assert_true(!SwitchCore_addInterface(core, &ctx->singleIf, alloc, &singleLabel));
+    Assert_true(!SwitchCore_addInterface(core, &ctx->goneIf, goneAlloc, &goneLabel));
+    Allocator_free(goneAlloc);
+
+    struct Allocator* msgAlloc = Allocator_child(alloc);
+    struct Message* msgs[MESSAGE_COUNT];
+    for (int i = 0; i < MESSAGE_COUNT - 1; i++) {
+        msgs[i] = newMessage((i & 1) ? singleLabel : batchLabel, i, msgAlloc);
+    }
+    msgs[MESSAGE_COUNT - 1] = newMessage(goneLabel, MESSAGE_COUNT - 1, msgAlloc);
+
+    Iface_sendBatch(&ctx->routerIf, msgs, MESSAGE_COUNT);
+
+    Assert_true(ctx->batchCalls == 1);
+    Assert_true(ctx->batchReceived == 4);
+    Assert_true(ctx->singleReceived == 4);
+    Assert_true(ctx->errorsReceived == 1);
+
+    Allocator_free(alloc);
+    return 0;
+}
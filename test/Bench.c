@@ -0,0 +1,215 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "test/Bench.h"
+#include "crypto/random/test/DeterminentRandomSeed.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/Identity.h"
+#include "util/events/Time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/** How long each measurement should run for unless --millis is given. */
+#define DEFAULT_MILLIS 200
+
+#define MAX_NAME 128
+
+struct Baseline
+{
+    char name[MAX_NAME];
+    double nsPerOp;
+};
+
+struct Session
+{
+    uint64_t minNanos;
+    int resultCount;
+    struct Baseline* baseline;
+    int baselineCount;
+};
+
+struct Bench_pvt
+{
+    struct Bench pub;
+    char* fileName;
+    struct Session* session;
+    Identity
+};
+
+static struct Baseline* baselineFor(char* name, struct Session* s)
+{
+    for (int i = 0; i < s->baselineCount; i++) {
+        if (!CString_strcmp(s->baseline[i].name, name)) { return &s->baseline[i]; }
+    }
+    return NULL;
+}
+
+static void report(struct Bench_pvt* bench,
+                   char* name,
+                   uint64_t count,
+                   uint64_t nanos,
+                   uint64_t allocations)
+{
+    char fullName[MAX_NAME];
+    snprintf(fullName, MAX_NAME, "%s/%s", bench->fileName, name);
+    double nsPerOp = (double) nanos / count;
+    double opsPerSec = 1e9 * count / nanos;
+    double allocsPerOp = (double) allocations / count;
+
+    printf("%s\n  { \"name\": \"%s\", \"count\": %llu, \"nsPerOp\": %.3f, "
+           "\"opsPerSec\": %.0f, \"allocsPerOp\": %.3f }",
+           (bench->session->resultCount++) ? "," : "",
+           fullName, (unsigned long long) count, nsPerOp, opsPerSec, allocsPerOp);
+    fflush(stdout);
+
+    fprintf(stderr, "%-50s %12.1f ns/op %14.0f ops/s %8.2f allocs/op",
+            fullName, nsPerOp, opsPerSec, allocsPerOp);
+    struct Baseline* base = baselineFor(fullName, bench->session);
+    if (base) {
+        fprintf(stderr, "  %+6.1f%% vs %.1f ns/op",
+                100 * (nsPerOp - base->nsPerOp) / base->nsPerOp, base->nsPerOp);
+    }
+    fprintf(stderr, "\n");
+}
+
+static uint64_t allocationCount(struct Allocator* alloc)
+{
+    struct Allocator_Stats stats;
+    Allocator_getStats(alloc, &stats);
+    return stats.mallocs + stats.pooled;
+}
+
+void Bench_run(struct Bench* b, char* name, Bench_Func func, void* context)
+{
+    struct Bench_pvt* bench = Identity_check((struct Bench_pvt*) b);
+    uint64_t minNanos = bench->session->minNanos;
+    for (uint64_t count = 1;;) {
+        uint64_t allocations = allocationCount(b->alloc);
+        uint64_t start = Time_hrtime();
+        func(context, count);
+        uint64_t nanos = Time_hrtime() - start;
+        allocations = allocationCount(b->alloc) - allocations;
+        if (nanos >= minNanos) {
+            report(bench, name, count, (nanos) ? nanos : 1, allocations);
+            return;
+        }
+        // Aim a little past the target, growing by between 2x and 100x each round.
+        uint64_t next = (nanos) ? (count * (minNanos + minNanos / 5) / nanos) : (count * 100);
+        if (next < count * 2) { next = count * 2; }
+        if (next > count * 100) { next = count * 100; }
+        count = next;
+    }
+}
+
+/** Read results from a previous run, only the name and nsPerOp are needed. */
+static void readBaseline(char* fileName, struct Session* s, struct Allocator* alloc)
+{
+    FILE* f = fopen(fileName, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open baseline [%s]\n", fileName);
+        exit(100);
+    }
+    uint32_t length = 0;
+    uint32_t capacity = 4096;
+    char* content = Allocator_malloc(alloc, capacity + 1);
+    for (size_t r; (r = fread(&content[length], 1, capacity - length, f)) > 0;) {
+        length += r;
+        if (length == capacity) {
+            capacity *= 2;
+            content = Allocator_realloc(alloc, content, capacity + 1);
+        }
+    }
+    fclose(f);
+    content[length] = '\0';
+
+    char* nameTag = "\"name\": \"";
+    char* nsTag = "\"nsPerOp\": ";
+    for (char* p = CString_strstr(content, nameTag); p; p = CString_strstr(p, nameTag)) {
+        p += CString_strlen(nameTag);
+        char* end = CString_strchr(p, '"');
+        char* ns = (end) ? CString_strstr(end, nsTag) : NULL;
+        if (!ns || end - p >= MAX_NAME) { break; }
+        s->baseline = Allocator_realloc(alloc, s->baseline,
+                                        sizeof(struct Baseline) * (s->baselineCount + 1));
+        struct Baseline* base = &s->baseline[s->baselineCount++];
+        Bits_memcpy(base->name, p, end - p);
+        base->name[end - p] = '\0';
+        base->nsPerOp = strtod(&ns[CString_strlen(nsTag)], NULL);
+        p = end;
+    }
+}
+
+static void runBench(struct Bench_Entry* entry, struct Session* s)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<28);
+    struct Bench_pvt* bench = Allocator_calloc(alloc, sizeof(struct Bench_pvt), 1);
+    Identity_set(bench);
+    bench->fileName = entry->name;
+    bench->session = s;
+    bench->pub.alloc = alloc;
+    bench->pub.base = EventBase_new(alloc);
+    bench->pub.rand =
+        Random_newWithSeed(alloc, NULL, DeterminentRandomSeed_new(alloc, NULL), NULL);
+    Assert_true(!entry->func(&bench->pub));
+    Allocator_free(alloc);
+}
+
+static int usage(struct Bench_Entry* benches, int count)
+{
+    fprintf(stderr, "bench [name] [--millis <per measurement>] [--baseline <saved output>]\n\n"
+                    "Available Benchmarks:\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%s\n", benches[i].name);
+    }
+    return 100;
+}
+
+int Bench_main(struct Bench_Entry* benches, int count, int argc, char** argv)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Session s = { .minNanos = DEFAULT_MILLIS * 1000000ull };
+    char* only = NULL;
+    for (int i = 0; i < argc; i++) {
+        if (!CString_strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            readBaseline(argv[++i], &s, alloc);
+        } else if (!CString_strcmp(argv[i], "--millis") && i + 1 < argc) {
+            s.minNanos = strtoull(argv[++i], NULL, 10) * 1000000ull;
+        } else if (argv[i][0] != '-' && !only) {
+            only = argv[i];
+        } else {
+            Allocator_free(alloc);
+            return usage(benches, count);
+        }
+    }
+    int found = !only;
+    for (int i = 0; i < count && !found; i++) {
+        found = !CString_strcmp(only, benches[i].name);
+    }
+    if (!found) {
+        Allocator_free(alloc);
+        return usage(benches, count);
+    }
+    printf("[");
+    for (int i = 0; i < count; i++) {
+        if (only && CString_strcmp(only, benches[i].name)) { continue; }
+        runBench(&benches[i], &s);
+    }
+    printf("\n]\n");
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef Bench_H
+#define Bench_H
+
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("test/Bench.c");
+
+#include <stdint.h>
+
+/**
+ * Microbenchmarks are files named *_bench.c which are found and linked into testcjdroute
+ * the same way as tests, they are run with: testcjdroute bench [name] [--baseline file]
+ * Each file is written as int main(struct Bench* bench) which sets up whatever it needs
+ * and calls Bench_run() for each thing to be measured.
+ */
+struct Bench
+{
+    /**
+     * Allocator for the benchmark, allocations made anywhere in this tree while a Bench_Func
+     * is running are counted.
+     */
+    struct Allocator* alloc;
+
+    struct EventBase* base;
+
+    /** Seeded with a constant so every run does the same work. */
+    struct Random* rand;
+};
+
+/** Do the thing being measured count times. */
+typedef void (* Bench_Func)(void* context, uint64_t count);
+
+/**
+ * Run func repeatedly with larger counts until it has run for long enough to be measured
+ * then report the time and number of allocations per operation.
+ *
+ * @param bench the argument which was passed to main().
+ * @param name the name of this measurement, it is reported as <file>/<name>.
+ * @param func the function to measure.
+ * @param context passed to func.
+ */
+void Bench_run(struct Bench* bench, char* name, Bench_Func func, void* context);
+
+typedef int (* Bench_Main)(struct Bench* bench);
+
+struct Bench_Entry
+{
+    Bench_Main func;
+    char* name;
+};
+
+/**
+ * Run benchmarks from the command line, the results are printed to stdout as JSON, a
+ * saved copy of that output may be given with --baseline to compare against it.
+ *
+ * @param benches every benchmark which is linked in.
+ * @param count the number of benchmarks.
+ * @param argc number of arguments after "bench".
+ * @param argv the arguments after "bench".
+ * @return the exit code for the process.
+ */
+int Bench_main(struct Bench_Entry* benches, int count, int argc, char** argv);
+
+// In a *_bench.c file main is defined to a unique name by testcjdroute.js
+#ifdef main
+int main(struct Bench* bench);
+#endif
+
+#endif
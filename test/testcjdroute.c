@@ -12,6 +12,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include "test/Bench.h"
 #include "util/Assert.h"
 #include "util/events/Time.h"
 #include "util/events/EventBase.h"
@@ -40,6 +41,10 @@ static struct {
     <?js return file.testcjdroute_tests ?>
 };
 
+static struct Bench_Entry BENCHES[] = {
+    <?js return file.testcjdroute_benches ?>
+};
+
 static uint64_t runTest(Test test,
                         char* name,
                         uint64_t startTime,
@@ -63,7 +68,8 @@ static uint64_t runTest(Test test,
 static void usage(char* appName)
 {
     printf("%s <test>     run one test\n", appName);
-    printf("%s all        run every test\n\n", appName);
+    printf("%s all        run every test\n", appName);
+    printf("%s bench      run microbenchmarks, see test/Bench.h\n\n", appName);
     printf("Available Tests:\n");
     for (int i = 0; i < (int)(sizeof(TESTS)/sizeof(*TESTS)); i++) {
         printf("%s\n", TESTS[i].name);
@@ -81,6 +87,9 @@ int main(int argc, char** argv)
         usage(argv[0]);
         return 100;
     }
+    if (!CString_strcmp("bench", argv[1])) {
+        return Bench_main(BENCHES, sizeof(BENCHES)/sizeof(*BENCHES), argc - 2, argv + 2);
+    }
     if (CString_strcmp("all", argv[1])) {
         for (int i = 0; i < (int)(sizeof(TESTS)/sizeof(*TESTS)); i++) {
             if (!CString_strcmp(TESTS[i].name, argv[1])) {
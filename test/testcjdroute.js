@@ -28,7 +28,7 @@ var Fs_stat = function (file, callback) {
     });
 };
 
-var getTests = function (file, tests, isSubnode, callback) {
+var getTests = function (file, tests, benches, isSubnode, callback) {
     if (/\/(.git|build_.*|node_build|contrib)\//.test(file)) { callback(); return; }
     if (isSubnode && /\/dht\//.test(file)) { callback(); return; }
     Fs_stat(file, function (err, stat) {
@@ -38,7 +38,7 @@ var getTests = function (file, tests, isSubnode, callback) {
                 Fs.readdir(file, waitFor(function (err, list) {
                     if (err) { throw err; }
                     list.forEach(function (subFile) {
-                        getTests(file + '/' + subFile, tests, isSubnode, waitFor());
+                        getTests(file + '/' + subFile, tests, benches, isSubnode, waitFor());
                     });
                 }));
             }).nThen(function (waitFor) {
@@ -47,6 +47,8 @@ var getTests = function (file, tests, isSubnode, callback) {
             return;
         } else if (/_test\.c$/.test(file) && tests.indexOf(file) === -1) {
             tests.push(file);
+        } else if (/_bench\.c$/.test(file) && benches.indexOf(file) === -1) {
+            benches.push(file);
         }
         callback();
     });
@@ -55,7 +57,8 @@ var getTests = function (file, tests, isSubnode, callback) {
 var generate = module.exports.generate = function (file, builder, isSubnode, callback)
 {
     var tests = [];
-    getTests('.', tests, isSubnode, function () {
+    var benches = [];
+    getTests('.', tests, benches, isSubnode, function () {
         var prototypes = [];
         var listContent = [];
         tests.forEach(function (test) {
@@ -69,6 +72,18 @@ var generate = module.exports.generate = function (file, builder, isSubnode, cal
             prototypes.push('int '+main+'(int argc, char** argv);');
         });
         file.testcjdroute_tests = listContent.join('\n');
+
+        // Benchmarks are written as int main(struct Bench* bench), see test/Bench.h
+        var benchContent = [];
+        benches.forEach(function (bench) {
+            var main = /^.*\/([^\/]+)\.c$/.exec(bench)[1] + '_main';
+            (builder.config['cflags'+bench] =
+                builder.config['cflags'+bench] || []).push('-D', 'main='+main);
+            file.links.push(bench);
+            benchContent.push('{ .func = '+main+', .name = "'+bench.replace(/^.*\/|.c$/g, '')+'" },');
+            prototypes.push('int '+main+'(struct Bench* bench);');
+        });
+        file.testcjdroute_benches = benchContent.join('\n');
         file.testcjdroute_prototypes = prototypes.join('\n');
         callback();
     });
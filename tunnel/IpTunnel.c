@@ -31,6 +31,7 @@
 #include "util/AddrTools.h"
 #include "util/events/EventBase.h"
 #include "util/Identity.h"
+#include "util/PrefixTrie.h"
 #include "util/events/Timeout.h"
 #include "util/Defined.h"
 #include "util/Escape.h"
@@ -41,6 +42,22 @@
 
 #include <stddef.h>
 
+#define Map_NAME OfIndexesByNumber
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
+struct PublicKey
+{
+    uint8_t bytes[32];
+};
+#define Map_NAME OfNumbersByKey
+#define Map_KEY_TYPE struct PublicKey
+#define Map_VALUE_TYPE uint32_t
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
 struct IpTunnel_pvt
 {
     struct IpTunnel pub;
@@ -52,6 +69,21 @@ struct IpTunnel_pvt
 
     uint32_t connectionCapacity;
 
+    /** Position of each connection in connectionList, updated whenever the list is shifted. */
+    struct Map_OfIndexesByNumber* indexByNumber;
+
+    /** The number of the first connection with each key, for packets coming from nodes. */
+    struct Map_OfNumbersByKey* numberByKey;
+
+    /**
+     * Connection numbers by allocated block, for packets coming from the TUN.
+     * Outgoing connections are matched by source address and incoming ones by destination.
+     */
+    struct PrefixTrie* outgoing4;
+    struct PrefixTrie* outgoing6;
+    struct PrefixTrie* incoming4;
+    struct PrefixTrie* incoming6;
+
     /** An always incrementing number which represents the connections. */
     uint32_t nextConnectionNumber;
 
@@ -69,6 +101,107 @@ struct IpTunnel_pvt
     Identity
 };
 
+/** Refresh indexByNumber for every connection at or after first in the list. */
+static void reindexFrom(uint32_t first, struct IpTunnel_pvt* context)
+{
+    for (uint32_t i = first; i < context->pub.connectionList.count; i++) {
+        uint32_t number = context->pub.connectionList.connections[i].number;
+        Assert_true(Map_OfIndexesByNumber_put(&number, &i, context->indexByNumber) > -1);
+    }
+}
+
+static struct IpTunnel_Connection* connectionForNumber(uint32_t number,
+                                                       struct IpTunnel_pvt* context)
+{
+    int index = Map_OfIndexesByNumber_indexForKey(&number, context->indexByNumber);
+    if (index < 0) { return NULL; }
+    return &context->pub.connectionList.connections[context->indexByNumber->values[index]];
+}
+
+static struct PrefixTrie* trieFor(struct IpTunnel_Connection* conn,
+                                  bool ip6,
+                                  struct IpTunnel_pvt* context)
+{
+    if (conn->isOutgoing) {
+        return (ip6) ? context->outgoing6 : context->outgoing4;
+    }
+    return (ip6) ? context->incoming6 : context->incoming4;
+}
+
+/** Index whichever address blocks the connection has, a block already taken is left alone. */
+static void indexAddresses(struct IpTunnel_Connection* conn, struct IpTunnel_pvt* context)
+{
+    uint32_t existing;
+    if (conn->connectionIp4Alloc) {
+        struct PrefixTrie* trie = trieFor(conn, false, context);
+        uint8_t* addr = conn->connectionIp4;
+        if (!PrefixTrie_get(trie, addr, conn->connectionIp4Alloc, &existing)) {
+            PrefixTrie_put(trie, addr, conn->connectionIp4Alloc, conn->number);
+        }
+    }
+    if (conn->connectionIp6Alloc) {
+        struct PrefixTrie* trie = trieFor(conn, true, context);
+        uint8_t* addr = conn->connectionIp6;
+        if (!PrefixTrie_get(trie, addr, conn->connectionIp6Alloc, &existing)) {
+            PrefixTrie_put(trie, addr, conn->connectionIp6Alloc, conn->number);
+        }
+    }
+}
+
+/**
+ * Remove the connection's address blocks from the index, if another connection of the same
+ * direction has the same block then it takes over.
+ */
+static void unindexAddresses(struct IpTunnel_Connection* conn, struct IpTunnel_pvt* context)
+{
+    uint32_t existing;
+    for (int ip6 = 0; ip6 < 2; ip6++) {
+        uint8_t* addr = (ip6) ? conn->connectionIp6 : conn->connectionIp4;
+        uint8_t alloc = (ip6) ? conn->connectionIp6Alloc : conn->connectionIp4Alloc;
+        struct PrefixTrie* trie = trieFor(conn, ip6, context);
+        if (!alloc || !PrefixTrie_get(trie, addr, alloc, &existing)) { continue; }
+        if (existing != (uint32_t)conn->number) { continue; }
+        PrefixTrie_remove(trie, addr, alloc);
+        for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
+            struct IpTunnel_Connection* other = &context->pub.connectionList.connections[i];
+            if (other == conn || other->isOutgoing != conn->isOutgoing) { continue; }
+            if ((ip6) ? (other->connectionIp6Alloc == alloc
+                            && !Bits_memcmp(other->connectionIp6, addr, 16))
+                      : (other->connectionIp4Alloc == alloc
+                            && !Bits_memcmp(other->connectionIp4, addr, 4)))
+            {
+                PrefixTrie_put(trie, addr, alloc, other->number);
+                break;
+            }
+        }
+    }
+}
+
+static void indexKey(struct IpTunnel_Connection* conn, struct IpTunnel_pvt* context)
+{
+    struct PublicKey* key = (struct PublicKey*) conn->routeHeader.publicKey;
+    if (Map_OfNumbersByKey_indexForKey(key, context->numberByKey) < 0) {
+        uint32_t number = conn->number;
+        Assert_true(Map_OfNumbersByKey_put(key, &number, context->numberByKey) > -1);
+    }
+}
+
+/** Like unindexAddresses(), the next connection to the same node takes over the key. */
+static void unindexKey(struct IpTunnel_Connection* conn, struct IpTunnel_pvt* context)
+{
+    struct PublicKey* key = (struct PublicKey*) conn->routeHeader.publicKey;
+    int index = Map_OfNumbersByKey_indexForKey(key, context->numberByKey);
+    if (index < 0 || context->numberByKey->values[index] != (uint32_t)conn->number) { return; }
+    Map_OfNumbersByKey_remove(index, context->numberByKey);
+    for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
+        struct IpTunnel_Connection* other = &context->pub.connectionList.connections[i];
+        if (other != conn && !Bits_memcmp(other->routeHeader.publicKey, key, 32)) {
+            indexKey(other, context);
+            return;
+        }
+    }
+}
+
 static struct IpTunnel_Connection* newConnection(bool isOutgoing, struct IpTunnel_pvt* context)
 {
     if (context->pub.connectionList.count == context->connectionCapacity) {
@@ -103,6 +236,7 @@ static struct IpTunnel_Connection* newConnection(bool isOutgoing, struct IpTunne
     // if there are 2 billion calls, die.
     Assert_true(context->nextConnectionNumber < (UINT32_MAX >> 1));
 
+    reindexFrom(conn - context->pub.connectionList.connections, context);
     return conn;
 }
 
@@ -116,6 +250,13 @@ static void deleteConnection(struct IpTunnel_Connection* conn, struct IpTunnel_p
     // Sanity check
     Assert_true(i >= 0 && i < (signed int)context->pub.connectionList.count);
 
+    unindexAddresses(conn, context);
+    unindexKey(conn, context);
+    uint32_t number = conn->number;
+    int index = Map_OfIndexesByNumber_indexForKey(&number, context->indexByNumber);
+    Map_OfIndexesByNumber_remove(index, context->indexByNumber);
+    uint32_t first = i;
+
     for (; (unsigned int)i < context->pub.connectionList.count-1; ++i) {
         Bits_memcpy(&context->pub.connectionList.connections[i],
                     &context->pub.connectionList.connections[i + 1],
@@ -129,18 +270,15 @@ static void deleteConnection(struct IpTunnel_Connection* conn, struct IpTunnel_p
     }
 
     context->pub.connectionList.count--;
+    reindexFrom(first, context);
 }
 
 static struct IpTunnel_Connection* connectionByPubKey(uint8_t pubKey[32],
                                                       struct IpTunnel_pvt* context)
 {
-    for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
-        struct IpTunnel_Connection* conn = &context->pub.connectionList.connections[i];
-        if (!Bits_memcmp(pubKey, conn->routeHeader.publicKey, 32)) {
-            return conn;
-        }
-    }
-    return NULL;
+    int index = Map_OfNumbersByKey_indexForKey((struct PublicKey*) pubKey, context->numberByKey);
+    if (index < 0) { return NULL; }
+    return connectionForNumber(context->numberByKey->values[index], context);
 }
 
 /**
@@ -193,6 +331,8 @@ int IpTunnel_allowConnection(uint8_t publicKeyOfAuthorizedNode[32],
         Assert_true(ip6Alloc);
     }
 
+    indexKey(conn, context);
+    indexAddresses(conn, context);
     return conn->number;
 }
 
@@ -281,6 +421,7 @@ int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel*
     struct IpTunnel_Connection* conn = newConnection(true, context);
     Bits_memcpy(conn->routeHeader.publicKey, publicKeyOfNodeToConnectTo, 32);
     AddressCalc_addressForPublicKey(conn->routeHeader.ip6, publicKeyOfNodeToConnectTo);
+    indexKey(conn, context);
 
     if (Defined(Log_DEBUG)) {
         uint8_t addr[40];
@@ -303,16 +444,12 @@ int IpTunnel_removeConnection(int connectionNumber, struct IpTunnel* tunnel)
 {
     struct IpTunnel_pvt* context = Identity_check((struct IpTunnel_pvt*)tunnel);
 
-    for (int i = 0; i < (int)tunnel->connectionList.count; ++i)
-    {
-        if (tunnel->connectionList.connections[i].number==connectionNumber)
-        {
-            deleteConnection(&tunnel->connectionList.connections[i], context);
-            return 0;
-        }
+    struct IpTunnel_Connection* conn = connectionForNumber(connectionNumber, context);
+    if (!conn) {
+        return IpTunnel_removeConnection_NOT_FOUND;
     }
-
-    return IpTunnel_removeConnection_NOT_FOUND;
+    deleteConnection(conn, context);
+    return 0;
 }
 
 static bool isControlMessageInvalid(struct Message* message, struct IpTunnel_pvt* context)
@@ -470,21 +607,19 @@ static Iface_DEFUN incomingAddresses(Dict* d,
     }
 
     if (number != conn->number) {
-        for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
-            if (context->pub.connectionList.connections[i].number == number) {
-                if (Bits_memcmp(conn->routeHeader.publicKey,
-                                context->pub.connectionList.connections[i].routeHeader.publicKey,
-                                32))
-                {
-                    Log_info(context->logger, "txid doesn't match origin");
-                    return 0;
-                } else {
-                    conn = &context->pub.connectionList.connections[i];
-                }
+        struct IpTunnel_Connection* numbered = connectionForNumber(number, context);
+        if (numbered) {
+            if (Bits_memcmp(conn->routeHeader.publicKey, numbered->routeHeader.publicKey, 32)) {
+                Log_info(context->logger, "txid doesn't match origin");
+                return 0;
             }
+            conn = numbered;
         }
     }
 
+    // The blocks may change below.
+    unindexAddresses(conn, context);
+
     Dict* addresses = Dict_getDictC(d, "addresses");
 
     String* ip4 = Dict_getStringC(addresses, "ip4");
@@ -548,6 +683,8 @@ static Iface_DEFUN incomingAddresses(Dict* d,
 
         addAddress(printedAddr, conn->connectionIp6Prefix, conn->connectionIp6Alloc, context);
     }
+    indexAddresses(conn, context);
+
     if (context->rg->hasUncommittedChanges) {
         if (!context->ifName) {
             Log_error(context->logger, "Failed to set routes because TUN interface is not setup");
@@ -647,43 +784,58 @@ static bool prefixMatches4(uint8_t* addressA, uint8_t* refAddr, uint32_t prefixL
     return !((a ^ b) >> (32 - prefixLen));
 }
 
-static bool isValidAddress4(uint8_t sourceAndDestIp4[8],
+static bool isValidAddress4(struct Headers_IP4Header* header,
                             bool isFromTun,
                             struct IpTunnel_Connection* conn)
 {
     uint8_t* compareAddr = (isFromTun)
-        ? ((conn->isOutgoing) ? sourceAndDestIp4 : &sourceAndDestIp4[4])
-        : ((conn->isOutgoing) ? &sourceAndDestIp4[4] : sourceAndDestIp4);
+        ? ((conn->isOutgoing) ? header->sourceAddr : header->destAddr)
+        : ((conn->isOutgoing) ? header->destAddr : header->sourceAddr);
     return prefixMatches4(compareAddr, conn->connectionIp4, conn->connectionIp4Alloc);
 }
 
-static bool isValidAddress6(uint8_t sourceAndDestIp6[32],
+static bool isValidAddress6(struct Headers_IP6Header* header,
                             bool isFromTun,
                             struct IpTunnel_Connection* conn)
 {
-    if (AddressCalc_validAddress(sourceAndDestIp6)
-        || AddressCalc_validAddress(&sourceAndDestIp6[16])) {
+    if (AddressCalc_validAddress(header->sourceAddr)
+        || AddressCalc_validAddress(header->destinationAddr)) {
         return false;
     }
     uint8_t* compareAddr = (isFromTun)
-        ? ((conn->isOutgoing) ? sourceAndDestIp6 : &sourceAndDestIp6[16])
-        : ((conn->isOutgoing) ? &sourceAndDestIp6[16] : sourceAndDestIp6);
+        ? ((conn->isOutgoing) ? header->sourceAddr : header->destinationAddr)
+        : ((conn->isOutgoing) ? header->destinationAddr : header->sourceAddr);
     return prefixMatches6(compareAddr, conn->connectionIp6, conn->connectionIp6Alloc);
 }
 
-static struct IpTunnel_Connection* findConnection(uint8_t sourceAndDestIp6[32],
-                                                  uint8_t sourceAndDestIp4[8],
-                                                  bool isFromTun,
-                                                  struct IpTunnel_pvt* context)
+/**
+ * Find the connection for a packet from the TUN, the longest matching block wins.
+ * Blocks we were given by outgoing connections are checked before blocks we gave out.
+ */
+static struct IpTunnel_Connection* findConnection6(struct Headers_IP6Header* header,
+                                                   struct IpTunnel_pvt* context)
 {
-    for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
-        struct IpTunnel_Connection* conn = &context->pub.connectionList.connections[i];
-        if (sourceAndDestIp6 && isValidAddress6(sourceAndDestIp6, isFromTun, conn)) {
-            return conn;
-        }
-        if (sourceAndDestIp4 && isValidAddress4(sourceAndDestIp4, isFromTun, conn)) {
-            return conn;
-        }
+    if (AddressCalc_validAddress(header->sourceAddr)
+        || AddressCalc_validAddress(header->destinationAddr)) {
+        return NULL;
+    }
+    uint32_t number;
+    if (PrefixTrie_lookup(context->outgoing6, header->sourceAddr, &number)
+        || PrefixTrie_lookup(context->incoming6, header->destinationAddr, &number))
+    {
+        return connectionForNumber(number, context);
+    }
+    return NULL;
+}
+
+static struct IpTunnel_Connection* findConnection4(struct Headers_IP4Header* header,
+                                                   struct IpTunnel_pvt* context)
+{
+    uint32_t number;
+    if (PrefixTrie_lookup(context->outgoing4, header->sourceAddr, &number)
+        || PrefixTrie_lookup(context->incoming4, header->destAddr, &number))
+    {
+        return connectionForNumber(number, context);
     }
     return NULL;
 }
@@ -701,10 +853,10 @@ static Iface_DEFUN incomingFromTun(struct Message* message, struct Iface* tunIf)
         // No connections authorized, fall through to "unrecognized address"
     } else if (message->length > 40 && Headers_getIpVersion(message->bytes) == 6) {
         struct Headers_IP6Header* header = (struct Headers_IP6Header*) message->bytes;
-        conn = findConnection(header->sourceAddr, NULL, true, context);
+        conn = findConnection6(header, context);
     } else if (message->length > 20 && Headers_getIpVersion(message->bytes) == 4) {
         struct Headers_IP4Header* header = (struct Headers_IP4Header*) message->bytes;
-        conn = findConnection(NULL, header->sourceAddr, true, context);
+        conn = findConnection4(header, context);
     } else {
         Log_info(context->logger, "Message of unknown type from TUN");
         return 0;
@@ -730,7 +882,7 @@ static Iface_DEFUN ip6FromNode(struct Message* message,
         Log_debug(context->logger, "Got message with zero address");
         return 0;
     }
-    if (!isValidAddress6(header->sourceAddr, false, conn)) {
+    if (!isValidAddress6(header, false, conn)) {
         uint8_t addr[40];
         AddrTools_printIp(addr, header->sourceAddr);
         Log_debug(context->logger, "Got message with wrong address for connection [%s]", addr);
@@ -749,7 +901,7 @@ static Iface_DEFUN ip4FromNode(struct Message* message,
     if (Bits_isZero(header->sourceAddr, 4) || Bits_isZero(header->destAddr, 4)) {
         Log_debug(context->logger, "Got message with zero address");
         return 0;
-    } else if (!isValidAddress4(header->sourceAddr, false, conn)) {
+    } else if (!isValidAddress4(header, false, conn)) {
         Log_debug(context->logger, "Got message with wrong address [%d.%d.%d.%d] for connection "
                                    "[%d.%d.%d.%d/%d:%d]",
                   header->sourceAddr[0], header->sourceAddr[1],
@@ -850,7 +1002,13 @@ struct IpTunnel* IpTunnel_new(struct Log* logger,
         .allocator = alloc,
         .logger = logger,
         .rand = rand,
-        .rg = rg
+        .rg = rg,
+        .indexByNumber = Map_OfIndexesByNumber_new(alloc),
+        .numberByKey = Map_OfNumbersByKey_new(alloc),
+        .outgoing4 = PrefixTrie_new(32, alloc),
+        .outgoing6 = PrefixTrie_new(128, alloc),
+        .incoming4 = PrefixTrie_new(32, alloc),
+        .incoming6 = PrefixTrie_new(128, alloc)
     }));
     context->timeout = Timeout_setInterval(timeout, context, 10000, eventBase, alloc);
     Identity_set(context);
@@ -21,6 +21,7 @@
 #include "util/log/Log.h"
 #include "util/Identity.h"
 #include "util/Bits.h"
+#include "util/PrefixTrie.h"
 #include "util/platform/netdev/NetDev.h"
 
 struct Prefix6
@@ -293,37 +294,6 @@ bool RouteGen_removeException(struct RouteGen* rg, struct Sockaddr* toRemove)
     return removeSomething(rp, toRemove, rp->exceptions6, rp->exceptions4);
 }
 
-static struct ArrayList_OfPrefix4* invertPrefix4(struct Prefix4* toInvert, struct Allocator* alloc)
-{
-    struct ArrayList_OfPrefix4* result = ArrayList_OfPrefix4_new(alloc);
-    for (int i = 32 - toInvert->prefix; i < 32; i++) {
-        struct Prefix4* pfx = Allocator_calloc(alloc, sizeof(struct Prefix4), 1);
-        pfx->bits = ( toInvert->bits & ((uint32_t)~0 << i) ) ^ (1 << i);
-        pfx->prefix = 32 - i;
-        ArrayList_OfPrefix4_add(result, pfx);
-    }
-    return result;
-}
-
-static struct ArrayList_OfPrefix6* invertPrefix6(struct Prefix6* toInvert, struct Allocator* alloc)
-{
-    struct ArrayList_OfPrefix6* result = ArrayList_OfPrefix6_new(alloc);
-    for (int i = 128 - toInvert->prefix; i < 128; i++) {
-        struct Prefix6* pfx = Allocator_calloc(alloc, sizeof(struct Prefix6), 1);
-        if (i >= 64) {
-            pfx->highBits = ( toInvert->highBits & (~((uint64_t)0) << (i-64)) ) ^
-                (((uint64_t)1) << (i-64));
-            pfx->lowBits = 0;
-        } else {
-            pfx->highBits = toInvert->highBits;
-            pfx->lowBits = ( toInvert->lowBits & (~((uint64_t)0) << i) ) ^ (((uint64_t)1) << i);
-        }
-        pfx->prefix = 128 - i;
-        ArrayList_OfPrefix6_add(result, pfx);
-    }
-    return result;
-}
-
 static bool isSubsetOf4(struct Prefix4* isSubset, struct Prefix4* isSuperset)
 {
     if (isSuperset->prefix > isSubset->prefix) { return false; }
@@ -350,102 +320,68 @@ static bool isSubsetOf6(struct Prefix6* isSubset, struct Prefix6* isSuperset)
     }
 }
 
-static void mergePrefixSets4(struct ArrayList_OfPrefix4* mergeInto,
-                             struct ArrayList_OfPrefix4* prefixes)
+/**
+ * Local prefixes which hold one of the prefixes to route are ignored, the others make any
+ * exception inside of them pointless so those are dropped.
+ */
+static bool isEffectiveException4(struct Prefix4* exception,
+                                  struct ArrayList_OfPrefix4* prefixes,
+                                  struct ArrayList_OfPrefix4* localPrefixes)
 {
-    struct Prefix4* highestPrefix = NULL;
-    for (int j = 0; j < prefixes->length; j++) {
-        struct Prefix4* result = ArrayList_OfPrefix4_get(prefixes, j);
-        Assert_true(result);
-        if (!highestPrefix || highestPrefix->prefix < result->prefix) {
-            highestPrefix = result;
-        }
-    }
-
-    struct Prefix4 target;
-    Bits_memcpy(&target, highestPrefix, sizeof(struct Prefix4));
-    target.bits ^= (target.prefix) ? (1 << (32 - target.prefix)) : 0;
-    for (int i = mergeInto->length - 1; i >= 0; i--) {
-        struct Prefix4* result = ArrayList_OfPrefix4_get(mergeInto, i);
-        Assert_true(result);
-        if (isSubsetOf4(&target, result)) {
-            ArrayList_OfPrefix4_remove(mergeInto, i);
-        }
-    }
-
-    for (int i = 0; i < prefixes->length; i++) {
-        bool include = true;
-        struct Prefix4* toInclude = ArrayList_OfPrefix4_get(prefixes, i);
-        for (int j = 0; j < mergeInto->length; j++) {
-            struct Prefix4* test = ArrayList_OfPrefix4_get(mergeInto, j);
-            if (isSubsetOf4(test, toInclude)) {
-                include = false;
+    for (int i = 0; i < localPrefixes->length; i++) {
+        struct Prefix4* localPfx = ArrayList_OfPrefix4_get(localPrefixes, i);
+        if (!isSubsetOf4(exception, localPfx)) { continue; }
+        bool effective = true;
+        for (int j = 0; j < prefixes->length; j++) {
+            if (isSubsetOf4(ArrayList_OfPrefix4_get(prefixes, j), localPfx)) {
+                effective = false;
                 break;
             }
         }
-        if (include) {
-            ArrayList_OfPrefix4_add(mergeInto, toInclude);
-        }
+        if (effective) { return false; }
     }
+    return true;
 }
 
-static void mergePrefixSets6(struct ArrayList_OfPrefix6* mergeInto,
-                             struct ArrayList_OfPrefix6* prefixes, struct Allocator* alloc)
+static bool isEffectiveException6(struct Prefix6* exception,
+                                  struct ArrayList_OfPrefix6* prefixes,
+                                  struct ArrayList_OfPrefix6* localPrefixes)
 {
-    struct Prefix6* highestPrefix = NULL;
-    for (int j = 0; j < prefixes->length; j++) {
-        struct Prefix6* result = ArrayList_OfPrefix6_get(prefixes, j);
-        Assert_true(result);
-        if (!highestPrefix || highestPrefix->prefix < result->prefix) {
-            highestPrefix = result;
-        }
-    }
-
-    struct Prefix6 target;
-    Bits_memcpy(&target, highestPrefix, sizeof(struct Prefix6));
-    if (target.prefix > 64) {
-        target.lowBits ^= (((uint64_t)1) << (128 - target.prefix));
-    } else if (target.prefix) {
-        target.highBits ^= (((uint64_t)1) << (64 - target.prefix));
-        target.lowBits = 0;
-    }
-
-    for (int i = mergeInto->length - 1; i >= 0; i--) {
-        struct Prefix6* result = ArrayList_OfPrefix6_get(mergeInto, i);
-        Assert_true(result);
-        if (isSubsetOf6(&target, result)) {
-            ArrayList_OfPrefix6_remove(mergeInto, i);
-        }
-    }
-
-    for (int i = 0; i < prefixes->length; i++) {
-        bool include = true;
-        struct Prefix6* toInclude = ArrayList_OfPrefix6_get(prefixes, i);
-        for (int j = 0; j < mergeInto->length; j++) {
-            struct Prefix6* test = ArrayList_OfPrefix6_get(mergeInto, j);
-            if (isSubsetOf6(test, toInclude)) {
-                include = false;
+    for (int i = 0; i < localPrefixes->length; i++) {
+        struct Prefix6* localPfx = ArrayList_OfPrefix6_get(localPrefixes, i);
+        if (!isSubsetOf6(exception, localPfx)) { continue; }
+        bool effective = true;
+        for (int j = 0; j < prefixes->length; j++) {
+            if (isSubsetOf6(ArrayList_OfPrefix6_get(prefixes, j), localPfx)) {
+                effective = false;
                 break;
             }
         }
-        if (include) {
-            ArrayList_OfPrefix6_add(mergeInto, toInclude);
-        }
+        if (effective) { return false; }
     }
+    return true;
 }
 
-static struct Prefix4* clonePrefix4(struct Prefix4* original, struct Allocator* alloc)
+/** Values in the trie, the longest prefix which holds an address decides if it is routed. */
+#define MARK_EXCEPTION 0
+#define MARK_PREFIX 1
+
+struct GenContext4
 {
-    struct Prefix4* clone = Allocator_clone(alloc, original);
-    clone->alloc = alloc;
-    return clone;
-}
+    struct ArrayList_OfPrefix4* out;
+    struct Allocator* alloc;
+};
 
-static struct Prefix6* clonePrefix6(struct Prefix6* original, struct Allocator* alloc)
+static void addGenerated4(uint8_t* addr, uint32_t prefixLen, void* vctx)
 {
-    struct Prefix6* clone = Allocator_clone(alloc, original);
-    clone->alloc = alloc;
-    return clone;
+    struct GenContext4* ctx = vctx;
+    uint32_t bits_be;
+    Bits_memcpy(&bits_be, addr, 4);
+    struct Prefix4* pfx = Allocator_calloc(ctx->alloc, sizeof(struct Prefix4), 1);
+    pfx->bits = Endian_bigEndianToHost32(bits_be);
+    pfx->prefix = prefixLen;
+    pfx->alloc = ctx->alloc;
+    ArrayList_OfPrefix4_add(ctx->out, pfx);
 }
 
 static struct ArrayList_OfPrefix4* genPrefixes4(struct ArrayList_OfPrefix4* prefixes,
@@ -454,162 +390,79 @@ static struct ArrayList_OfPrefix4* genPrefixes4(struct ArrayList_OfPrefix4* pref
                                                 struct Allocator* alloc)
 {
     struct Allocator* tempAlloc = Allocator_child(alloc);
-
-    struct ArrayList_OfPrefix4* effectiveLocalPrefixes = ArrayList_OfPrefix4_new(tempAlloc);
-    for (int i = 0; i < localPrefixes->length; i++) {
-        bool add = true;
-        struct Prefix4* localPfx = ArrayList_OfPrefix4_get(localPrefixes, i);
-        for (int j = 0; j < prefixes->length; j++) {
-            struct Prefix4* pfx = ArrayList_OfPrefix4_get(prefixes, j);
-            if (isSubsetOf4(pfx, localPfx)) {
-                add = false;
-                break;
-            }
-        }
-        if (add) {
-            ArrayList_OfPrefix4_add(effectiveLocalPrefixes, localPfx);
-        }
-    }
-
-    struct ArrayList_OfPrefix4* allPrefixes = ArrayList_OfPrefix4_new(tempAlloc);
+    struct PrefixTrie* trie = PrefixTrie_new(32, tempAlloc);
     for (int i = 0; i < exceptions->length; i++) {
-        struct Prefix4* pfxToInvert = ArrayList_OfPrefix4_get(exceptions, i);
-        bool add = true;
-        for (int j = 0; j < effectiveLocalPrefixes->length; j++) {
-            struct Prefix4* localPfx = ArrayList_OfPrefix4_get(effectiveLocalPrefixes, j);
-            if (isSubsetOf4(pfxToInvert, localPfx)) {
-                add = false;
-                break;
-            }
-        }
-        if (add) {
-            struct ArrayList_OfPrefix4* prefixes4 = invertPrefix4(pfxToInvert, tempAlloc);
-            mergePrefixSets4(allPrefixes, prefixes4);
+        struct Prefix4* pfx = ArrayList_OfPrefix4_get(exceptions, i);
+        if (isEffectiveException4(pfx, prefixes, localPrefixes)) {
+            uint32_t bits_be = Endian_hostToBigEndian32(pfx->bits);
+            PrefixTrie_put(trie, (uint8_t*) &bits_be, pfx->prefix, MARK_EXCEPTION);
         }
     }
-
-    for (int i = allPrefixes->length - 2; i >= 0; i--) {
-        struct Prefix4* pfx = ArrayList_OfPrefix4_get(allPrefixes, i);
-        struct Prefix4* pfx2 = ArrayList_OfPrefix4_get(allPrefixes, i+1);
-        if (isSubsetOf4(pfx2, pfx)) {
-            ArrayList_OfPrefix4_remove(allPrefixes, i+1);
-            if (i < (allPrefixes->length - 2)) { i++; }
-        }
-    }
-
+    // After the exceptions so that a prefix wins over an identical exception.
     for (int i = 0; i < prefixes->length; i++) {
         struct Prefix4* pfx = ArrayList_OfPrefix4_get(prefixes, i);
-        int addPrefix = true;
-        for (int j = allPrefixes->length - 1; j >= 0; j--) {
-            struct Prefix4* pfx2 = ArrayList_OfPrefix4_get(allPrefixes, j);
-            if (isSubsetOf4(pfx2, pfx)) {
-                addPrefix = false;
-            }
-        }
-        if (addPrefix) {
-            ArrayList_OfPrefix4_add(allPrefixes, pfx);
-        }
+        uint32_t bits_be = Endian_hostToBigEndian32(pfx->bits);
+        PrefixTrie_put(trie, (uint8_t*) &bits_be, pfx->prefix, MARK_PREFIX);
     }
 
-    ArrayList_OfPrefix4_sort(allPrefixes);
-
-    struct ArrayList_OfPrefix4* out = ArrayList_OfPrefix4_new(alloc);
-    for (int i = 0; i < allPrefixes->length; i++) {
-        struct Prefix4* pfx = ArrayList_OfPrefix4_get(allPrefixes, i);
-        for (int j = 0; j < prefixes->length; j++) {
-            struct Prefix4* pfx2 = ArrayList_OfPrefix4_get(prefixes, j);
-            if (isSubsetOf4(pfx, pfx2)) {
-                ArrayList_OfPrefix4_add(out, clonePrefix4(pfx, alloc));
-                break;
-            }
-        }
-    }
+    struct GenContext4 ctx = { .out = ArrayList_OfPrefix4_new(alloc), .alloc = alloc };
+    PrefixTrie_cover(trie, addGenerated4, &ctx);
+    ArrayList_OfPrefix4_sort(ctx.out);
     Allocator_free(tempAlloc);
-    return out;
+    return ctx.out;
 }
 
-// Annoyingly, this function is *exactly* the same content as genPrefixes4()
-// but with evert 4 converted to a 6...
+struct GenContext6
+{
+    struct ArrayList_OfPrefix6* out;
+    struct Allocator* alloc;
+};
+
+static void addGenerated6(uint8_t* addr, uint32_t prefixLen, void* vctx)
+{
+    struct GenContext6* ctx = vctx;
+    uint64_t longs_be[2];
+    Bits_memcpy(longs_be, addr, 16);
+    struct Prefix6* pfx = Allocator_calloc(ctx->alloc, sizeof(struct Prefix6), 1);
+    pfx->highBits = Endian_bigEndianToHost64(longs_be[0]);
+    pfx->lowBits = Endian_bigEndianToHost64(longs_be[1]);
+    pfx->prefix = prefixLen;
+    pfx->alloc = ctx->alloc;
+    ArrayList_OfPrefix6_add(ctx->out, pfx);
+}
+
+static void putPrefix6(struct PrefixTrie* trie, struct Prefix6* pfx, uint32_t mark)
+{
+    uint64_t longs_be[2] = {
+        Endian_hostToBigEndian64(pfx->highBits),
+        Endian_hostToBigEndian64(pfx->lowBits)
+    };
+    PrefixTrie_put(trie, (uint8_t*) longs_be, pfx->prefix, mark);
+}
+
+// Same as genPrefixes4(), the minimal set of routes is found by PrefixTrie_cover().
 static struct ArrayList_OfPrefix6* genPrefixes6(struct ArrayList_OfPrefix6* prefixes,
                                                 struct ArrayList_OfPrefix6* exceptions,
                                                 struct ArrayList_OfPrefix6* localPrefixes,
                                                 struct Allocator* alloc)
 {
     struct Allocator* tempAlloc = Allocator_child(alloc);
-
-    struct ArrayList_OfPrefix6* effectiveLocalPrefixes = ArrayList_OfPrefix6_new(tempAlloc);
-    for (int i = 0; i < localPrefixes->length; i++) {
-        bool add = true;
-        struct Prefix6* localPfx = ArrayList_OfPrefix6_get(localPrefixes, i);
-        for (int j = 0; j < prefixes->length; j++) {
-            struct Prefix6* pfx = ArrayList_OfPrefix6_get(prefixes, j);
-            if (isSubsetOf6(pfx, localPfx)) {
-                add = false;
-                break;
-            }
-        }
-        if (add) {
-            ArrayList_OfPrefix6_add(effectiveLocalPrefixes, localPfx);
-        }
-    }
-
-    struct ArrayList_OfPrefix6* allPrefixes = ArrayList_OfPrefix6_new(tempAlloc);
+    struct PrefixTrie* trie = PrefixTrie_new(128, tempAlloc);
     for (int i = 0; i < exceptions->length; i++) {
-        struct Prefix6* pfxToInvert = ArrayList_OfPrefix6_get(exceptions, i);
-        bool add = true;
-        for (int j = 0; j < effectiveLocalPrefixes->length; j++) {
-            struct Prefix6* localPfx = ArrayList_OfPrefix6_get(effectiveLocalPrefixes, j);
-            if (isSubsetOf6(pfxToInvert, localPfx)) {
-                add = false;
-                break;
-            }
-        }
-        if (add) {
-            struct ArrayList_OfPrefix6* prefixes6 = invertPrefix6(pfxToInvert, tempAlloc);
-            mergePrefixSets6(allPrefixes, prefixes6, alloc);
+        struct Prefix6* pfx = ArrayList_OfPrefix6_get(exceptions, i);
+        if (isEffectiveException6(pfx, prefixes, localPrefixes)) {
+            putPrefix6(trie, pfx, MARK_EXCEPTION);
         }
     }
-
-    ArrayList_OfPrefix6_sort(allPrefixes);
-
-    for (int i = allPrefixes->length - 2; i >= 0; i--) {
-        struct Prefix6* pfx = ArrayList_OfPrefix6_get(allPrefixes, i);
-        struct Prefix6* pfx2 = ArrayList_OfPrefix6_get(allPrefixes, i+1);
-        if (isSubsetOf6(pfx2, pfx)) {
-            ArrayList_OfPrefix6_remove(allPrefixes, i+1);
-            if (i < (allPrefixes->length - 2)) { i++; }
-        }
-    }
-
     for (int i = 0; i < prefixes->length; i++) {
-        struct Prefix6* pfx = ArrayList_OfPrefix6_get(prefixes, i);
-        int addPrefix = true;
-        for (int j = allPrefixes->length - 1; j >= 0; j--) {
-            struct Prefix6* pfx2 = ArrayList_OfPrefix6_get(allPrefixes, j);
-            if (isSubsetOf6(pfx2, pfx)) {
-                addPrefix = false;
-            }
-        }
-        if (addPrefix) {
-            ArrayList_OfPrefix6_add(allPrefixes, pfx);
-        }
+        putPrefix6(trie, ArrayList_OfPrefix6_get(prefixes, i), MARK_PREFIX);
     }
 
-    ArrayList_OfPrefix6_sort(allPrefixes);
-
-    struct ArrayList_OfPrefix6* out = ArrayList_OfPrefix6_new(alloc);
-    for (int i = 0; i < allPrefixes->length; i++) {
-        struct Prefix6* pfx = ArrayList_OfPrefix6_get(allPrefixes, i);
-        for (int j = 0; j < prefixes->length; j++) {
-            struct Prefix6* pfx2 = ArrayList_OfPrefix6_get(prefixes, j);
-            if (isSubsetOf6(pfx, pfx2)) {
-                ArrayList_OfPrefix6_add(out, clonePrefix6(pfx, alloc));
-                break;
-            }
-        }
-    }
+    struct GenContext6 ctx = { .out = ArrayList_OfPrefix6_new(alloc), .alloc = alloc };
+    PrefixTrie_cover(trie, addGenerated6, &ctx);
+    ArrayList_OfPrefix6_sort(ctx.out);
     Allocator_free(tempAlloc);
-    return out;
+    return ctx.out;
 }
 
 static struct Prefix46* getGeneratedRoutes(struct RouteGen_pvt* rp, struct Allocator* alloc)
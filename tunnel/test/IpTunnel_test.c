@@ -363,6 +363,100 @@ static void testAddr(struct Context* ctx,
     Allocator_free(alloc);
 }
 
+#define MANY_CONNECTIONS 200
+
+struct ManyContext
+{
+    struct Iface nodeIf;
+    struct Iface tunIf;
+    uint8_t lastKey[32];
+    int received;
+};
+
+static Iface_DEFUN manyToNode(struct Message* msg, struct Iface* iface)
+{
+    struct ManyContext* mc = (struct ManyContext*) iface;
+    struct RouteHeader* rh = (struct RouteHeader*) msg->bytes;
+    Bits_memcpy(mc->lastKey, rh->publicKey, 32);
+    mc->received++;
+    return NULL;
+}
+
+static void keyFor(uint8_t key[32], int i)
+{
+    Bits_memset(key, 0, 32);
+    Bits_memcpy(key, &i, sizeof(int));
+    key[31] = 1;
+}
+
+/** Send a packet from the TUN to 10.a.b.c and get the key of the node it went to, or NULL. */
+static uint8_t* sendFromTun(struct ManyContext* mc, uint8_t a, uint8_t b, uint8_t c,
+                            struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(0, 512, alloc);
+    Message_push(msg, "hello world", 12, NULL);
+    Message_push(msg, NULL, Headers_IP4Header_SIZE, NULL);
+    struct Headers_IP4Header* iph = (struct Headers_IP4Header*) msg->bytes;
+    Headers_setIpVersion(iph);
+    Bits_memcpy(iph->sourceAddr, ((uint8_t[]){ 192, 168, 0, 1 }), 4);
+    Bits_memcpy(iph->destAddr, ((uint8_t[]){ 10, a, b, c }), 4);
+    int received = mc->received;
+    Iface_send(&mc->tunIf, msg);
+    return (mc->received == received) ? NULL : mc->lastKey;
+}
+
+/**
+ * Many clients each with their own /24 plus one with the /16 which covers them all,
+ * packets from the TUN must go to the longest match and fall back to the /16 on removal.
+ */
+static void testManyConnections(struct Context* ctx)
+{
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct IpTunnel* ipTun = IpTunnel_new(ctx->log, ctx->base, alloc, ctx->rand, NULL);
+    struct ManyContext* mc = Allocator_calloc(alloc, sizeof(struct ManyContext), 1);
+    mc->nodeIf.send = manyToNode;
+    Iface_plumb(&mc->nodeIf, &ipTun->nodeInterface);
+    Iface_plumb(&mc->tunIf, &ipTun->tunInterface);
+
+    uint8_t key[32];
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("10.0.0.0", &ss));
+    keyFor(key, MANY_CONNECTIONS);
+    IpTunnel_allowConnection(key, NULL, 0, 0, &ss.addr, 16, 16, ipTun);
+
+    int numbers[MANY_CONNECTIONS];
+    for (int i = 0; i < MANY_CONNECTIONS; i++) {
+        uint8_t* addr = NULL;
+        Assert_true(Sockaddr_getAddress(&ss.addr, &addr) == 4);
+        addr[2] = i;
+        keyFor(key, i);
+        numbers[i] = IpTunnel_allowConnection(key, NULL, 0, 0, &ss.addr, 24, 24, ipTun);
+    }
+
+    for (int i = 0; i < MANY_CONNECTIONS; i++) {
+        keyFor(key, i);
+        uint8_t* to = sendFromTun(mc, 0, i, 7, alloc);
+        Assert_true(to && !Bits_memcmp(to, key, 32));
+    }
+    keyFor(key, MANY_CONNECTIONS);
+    uint8_t* to = sendFromTun(mc, 0, MANY_CONNECTIONS, 1, alloc);
+    Assert_true(to && !Bits_memcmp(to, key, 32));
+    Assert_true(!sendFromTun(mc, 1, 0, 1, alloc));
+
+    for (int i = 0; i < MANY_CONNECTIONS; i += 2) {
+        Assert_true(!IpTunnel_removeConnection(numbers[i], ipTun));
+    }
+    Assert_true(IpTunnel_removeConnection(numbers[0], ipTun)
+        == IpTunnel_removeConnection_NOT_FOUND);
+    for (int i = 0; i < MANY_CONNECTIONS; i++) {
+        keyFor(key, (i % 2) ? i : MANY_CONNECTIONS);
+        to = sendFromTun(mc, 0, i, 7, alloc);
+        Assert_true(to && !Bits_memcmp(to, key, 32));
+    }
+
+    Allocator_free(alloc);
+}
+
 int main()
 {
     struct Allocator* alloc = MallocAllocator_new(1<<20);
@@ -386,6 +480,8 @@ int main()
     testAddr(ctx, "192.168.1.1", 16, 24, "fd00::1", 8, 64);
     testAddr(ctx, "192.168.1.1", 16, 24, "fd00::1", 64, 128);
 
+    testManyConnections(ctx);
+
     //Allocator_free(alloc); //TODO(cjd): This is caused by an allocator bug.
     /* To repeat the bug, create a test like this:
     struct Allocator* allocx = Allocator_child(alloc);
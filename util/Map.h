@@ -31,6 +31,9 @@
 #ifndef Map_NAME
     #error must give this map type a name by defining Map_NAME
 #endif
+#if defined(Map_USE_HASHTABLE) && !defined(Map_ENABLE_KEYS)
+    #error Map_USE_HASHTABLE requires Map_KEY_TYPE
+#endif
 
 #define Map_CONTEXT Map_GLUE(Map_, Map_NAME)
 #define Map_FUNCTION(name) Map_GLUE(Map_GLUE(Map_GLUE(Map_, Map_NAME),_), name)
@@ -74,6 +77,16 @@ struct Map_CONTEXT
 
     Map_VALUE_TYPE* values;
 
+    #ifdef Map_USE_HASHTABLE
+        /**
+         * Open addressed (linear probing) index over the entries, each slot contains
+         * the index of the entry plus one or zero if the slot is empty.
+         * The table is always at least twice the capacity so it never fills up.
+         */
+        uint32_t* table;
+        uint32_t tableMask;
+    #endif
+
     uint32_t count;
     uint32_t capacity;
 
@@ -87,6 +100,74 @@ static inline struct Map_CONTEXT* Map_FUNCTION(new)(struct Allocator* allocator)
     }));
 }
 
+#ifdef Map_USE_HASHTABLE
+/** Spread the bits of the hashcode because the table is indexed using only the low bits. */
+static inline uint32_t Map_FUNCTION(slotForHash)(uint32_t hashCode, struct Map_CONTEXT* map)
+{
+    hashCode ^= hashCode >> 16;
+    hashCode *= 0x85ebca6b;
+    hashCode ^= hashCode >> 13;
+    return hashCode & map->tableMask;
+}
+
+static inline void Map_FUNCTION(tableInsert)(uint32_t index, struct Map_CONTEXT* map)
+{
+    uint32_t slot = Map_FUNCTION(slotForHash)(map->hashCodes[index], map);
+    while (map->table[slot]) {
+        slot = (slot + 1) & map->tableMask;
+    }
+    map->table[slot] = index + 1;
+}
+
+static inline uint32_t Map_FUNCTION(tableSlotForIndex)(uint32_t index, struct Map_CONTEXT* map)
+{
+    uint32_t slot = Map_FUNCTION(slotForHash)(map->hashCodes[index], map);
+    while (map->table[slot] != index + 1) {
+        Assert_true(map->table[slot]);
+        slot = (slot + 1) & map->tableMask;
+    }
+    return slot;
+}
+
+/** Remove an entry from the table, shifting back any entries which probed past it. */
+static inline void Map_FUNCTION(tableRemove)(uint32_t index, struct Map_CONTEXT* map)
+{
+    uint32_t hole = Map_FUNCTION(tableSlotForIndex)(index, map);
+    for (uint32_t slot = (hole + 1) & map->tableMask;
+         map->table[slot];
+         slot = (slot + 1) & map->tableMask)
+    {
+        uint32_t home = Map_FUNCTION(slotForHash)(map->hashCodes[map->table[slot] - 1], map);
+        // Distance from the home slot must not be less than the distance to the hole
+        // otherwise moving the entry into the hole would make it unreachable.
+        if (((slot - home) & map->tableMask) >= ((slot - hole) & map->tableMask)) {
+            map->table[hole] = map->table[slot];
+            hole = slot;
+        }
+    }
+    map->table[hole] = 0;
+}
+
+/**
+ * Entries index + 1 to the end are about to be moved down by one to close the gap left by
+ * a removed entry, point their slots at the new indexes. Only the moved entries are probed.
+ */
+static inline void Map_FUNCTION(tableShiftDown)(uint32_t index, struct Map_CONTEXT* map)
+{
+    for (uint32_t i = index + 1; i < map->count; i++) {
+        map->table[Map_FUNCTION(tableSlotForIndex)(i, map)] = i;
+    }
+}
+
+static inline void Map_FUNCTION(tableRebuild)(struct Map_CONTEXT* map)
+{
+    Bits_memset(map->table, 0, sizeof(uint32_t) * (map->tableMask + 1));
+    for (uint32_t i = 0; i < map->count; i++) {
+        Map_FUNCTION(tableInsert)(i, map);
+    }
+}
+#endif
+
 /**
  * This is a very hot loop,
  * a large amount of code relies on this being fast so it is a good target for optimization.
@@ -95,13 +176,28 @@ static inline struct Map_CONTEXT* Map_FUNCTION(new)(struct Allocator* allocator)
 static inline int Map_FUNCTION(indexForKey)(Map_KEY_TYPE* key, struct Map_CONTEXT* map)
 {
     uint32_t hashCode = (Map_FUNCTION(hash)(key));
-    for (uint32_t i = 0; i < map->count; i++) {
-        if (map->hashCodes[i] == hashCode
-            && Map_FUNCTION(compare)(key, &map->keys[i]) == 0)
+    #ifdef Map_USE_HASHTABLE
+        if (!map->table) { return -1; }
+        for (uint32_t slot = Map_FUNCTION(slotForHash)(hashCode, map);
+             map->table[slot];
+             slot = (slot + 1) & map->tableMask)
         {
-            return i;
+            uint32_t i = map->table[slot] - 1;
+            if (map->hashCodes[i] == hashCode
+                && Map_FUNCTION(compare)(key, &map->keys[i]) == 0)
+            {
+                return i;
+            }
         }
-    }
+    #else
+        for (uint32_t i = 0; i < map->count; i++) {
+            if (map->hashCodes[i] == hashCode
+                && Map_FUNCTION(compare)(key, &map->keys[i]) == 0)
+            {
+                return i;
+            }
+        }
+    #endif
     return -1;
 }
 #endif
@@ -125,6 +221,10 @@ static inline int Map_FUNCTION(indexForHandle)(uint32_t handle, struct Map_CONTE
 #endif
 
 /**
+ * Without handles the last entry is moved into the gap so this is O(1). With handles the
+ * entries are kept sorted so every entry after the removed one is moved down, and with
+ * Map_USE_HASHTABLE each of those is found again in the table.
+ *
  * @param key the key of the entry to remove.
  * @param map the map to remove from.
  * @return 0 if the entry is removed, -1 if it could not be found.
@@ -133,6 +233,11 @@ static inline int Map_FUNCTION(remove)(int index, struct Map_CONTEXT* map)
 {
     if (index >= 0 && index < (int) map->count - 1) {
         #ifdef Map_ENABLE_HANDLES
+            // Done while the hashcodes are still at their old indexes.
+            #ifdef Map_USE_HASHTABLE
+                Map_FUNCTION(tableRemove)(index, map);
+                Map_FUNCTION(tableShiftDown)(index, map);
+            #endif
             // If we use handels then we need to keep the map sorted.
             #ifdef Map_ENABLE_KEYS
                 Bits_memmove(&map->hashCodes[index],
@@ -154,13 +259,20 @@ static inline int Map_FUNCTION(remove)(int index, struct Map_CONTEXT* map)
             map->count--;
         #else
             // No handles, we can just fold the top entry down on one to remove.
+            #ifdef Map_USE_HASHTABLE
+                Map_FUNCTION(tableRemove)(index, map);
+                map->table[Map_FUNCTION(tableSlotForIndex)(map->count - 1, map)] = index + 1;
+            #endif
             map->count--;
             map->hashCodes[index] = map->hashCodes[map->count];
             Bits_memcpy(&map->keys[index], &map->keys[map->count], sizeof(Map_KEY_TYPE));
             Bits_memcpy(&map->values[index], &map->values[map->count], sizeof(Map_VALUE_TYPE));
         #endif
         return 0;
-    } else if (index == (int) map->count - 1) {
+    } else if (index >= 0 && index == (int) map->count - 1) {
+        #ifdef Map_USE_HASHTABLE
+            Map_FUNCTION(tableRemove)(index, map);
+        #endif
         map->count--;
         return 0;
     }
@@ -177,26 +289,41 @@ static inline int Map_FUNCTION(put)(Map_VALUE_TYPE* value,
 #endif
 {
     if (map->count == map->capacity) {
+        #ifdef Map_USE_HASHTABLE
+            // Grow geometrically so that insertion is amortized O(1).
+            uint32_t newCapacity = (map->capacity) ? map->capacity * 2 : 8;
+        #else
+            uint32_t newCapacity = map->capacity + 10;
+        #endif
+
         #ifdef Map_ENABLE_KEYS
             map->hashCodes = Allocator_realloc(map->allocator,
                                                map->hashCodes,
-                                               sizeof(uint32_t) * (map->count + 10));
+                                               sizeof(uint32_t) * newCapacity);
             map->keys = Allocator_realloc(map->allocator,
                                           map->keys,
-                                          sizeof(Map_KEY_TYPE) * (map->count + 10));
+                                          sizeof(Map_KEY_TYPE) * newCapacity);
         #endif
 
         #ifdef Map_ENABLE_HANDLES
             map->handles = Allocator_realloc(map->allocator,
                                              map->handles,
-                                             sizeof(uint32_t) * (map->count + 10));
+                                             sizeof(uint32_t) * newCapacity);
         #endif
 
         map->values = Allocator_realloc(map->allocator,
                                         map->values,
-                                        sizeof(Map_VALUE_TYPE) * (map->count + 10));
+                                        sizeof(Map_VALUE_TYPE) * newCapacity);
 
-        map->capacity += 10;
+        #ifdef Map_USE_HASHTABLE
+            map->table = Allocator_realloc(map->allocator,
+                                           map->table,
+                                           sizeof(uint32_t) * newCapacity * 2);
+            map->tableMask = newCapacity * 2 - 1;
+            Map_FUNCTION(tableRebuild)(map);
+        #endif
+
+        map->capacity = newCapacity;
     }
 
     int i = -1;
@@ -215,6 +342,9 @@ static inline int Map_FUNCTION(put)(Map_VALUE_TYPE* value,
             map->hashCodes[i] = (Map_FUNCTION(hash)(key));
             Bits_memcpy(&map->keys[i], key, sizeof(Map_KEY_TYPE));
         #endif
+        #ifdef Map_USE_HASHTABLE
+            Map_FUNCTION(tableInsert)(i, map);
+        #endif
     }
 
     Bits_memcpy(&map->values[i], value, sizeof(Map_VALUE_TYPE));
@@ -232,3 +362,4 @@ static inline int Map_FUNCTION(put)(Map_VALUE_TYPE* value,
 #undef Map_KEY_TYPE
 #undef Map_ENABLE_KEYS
 #undef Map_USE_COMPARATOR
+#undef Map_USE_HASHTABLE
@@ -0,0 +1,54 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef MruCache_H
+#define MruCache_H
+
+#include "util/Bits.h"
+
+#include <stdint.h>
+
+/**
+ * Helpers for a small set associative cache keyed by public keys. Each set is an array of
+ * entries in most recently used first order so the last one is the one to evict on a miss.
+ * Looking up an entry and counting hits and misses is left to the user.
+ */
+
+/** Public keys are uniformly random so the first two bytes are enough to pick the set. */
+static inline uint32_t MruCache_setIndex(const uint8_t key[32], uint32_t setCount)
+{
+    return ((key[0] << 8) | key[1]) % setCount;
+}
+
+/**
+ * Put an entry at the front of its set, moving the ones which were in front of it down.
+ *
+ * @param set the first entry of the set.
+ * @param found the index of the entry which was found, or ways on a miss which evicts the last.
+ * @param ways the number of entries in the set.
+ * @param entry the new first entry, a copy of the one found or a new one, not inside the set.
+ * @param entrySize the size of one entry.
+ */
+static inline void MruCache_moveToFront(void* set,
+                                        int found,
+                                        int ways,
+                                        const void* entry,
+                                        uint32_t entrySize)
+{
+    if (found >= ways) { found = ways - 1; }
+    Bits_memmove(((uint8_t*) set) + entrySize, set, found * entrySize);
+    Bits_memcpy(set, entry, entrySize);
+}
+
+#endif
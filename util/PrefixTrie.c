@@ -0,0 +1,308 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/PrefixTrie.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+
+/** An address or prefix as two host order words, the first bit is the top of hi. */
+struct Key
+{
+    uint64_t hi;
+    uint64_t lo;
+};
+
+struct Node
+{
+    /** Bits past prefixLen are always zero. */
+    struct Key key;
+    uint32_t prefixLen;
+
+    /** False if the node only joins two children. */
+    bool hasValue;
+    uint32_t value;
+
+    /** Indexed by the bit after prefixLen, both are longer prefixes of this one. */
+    struct Node* child[2];
+};
+
+struct PrefixTrie
+{
+    struct Node* root;
+
+    /** Removed nodes, linked through child[0]. */
+    struct Node* free;
+
+    uint32_t addrBits;
+    struct Allocator* alloc;
+    Identity
+};
+
+static struct Key keyFor(struct PrefixTrie* trie, uint8_t* addr, uint32_t prefixLen)
+{
+    struct Key k = { 0, 0 };
+    if (trie->addrBits == 32) {
+        uint32_t x;
+        Bits_memcpy(&x, addr, 4);
+        k.hi = ((uint64_t) Endian_bigEndianToHost32(x)) << 32;
+    } else {
+        Bits_memcpy(&k.hi, addr, 8);
+        Bits_memcpy(&k.lo, &addr[8], 8);
+        k.hi = Endian_bigEndianToHost64(k.hi);
+        k.lo = Endian_bigEndianToHost64(k.lo);
+    }
+    if (prefixLen == 0) {
+        k.hi = 0;
+        k.lo = 0;
+    } else if (prefixLen <= 64) {
+        k.hi &= ~0ull << (64 - prefixLen);
+        k.lo = 0;
+    } else if (prefixLen < 128) {
+        k.lo &= ~0ull << (128 - prefixLen);
+    }
+    return k;
+}
+
+static inline int bitAt(struct Key* k, uint32_t i)
+{
+    return (i < 64) ? (k->hi >> (63 - i)) & 1 : (k->lo >> (127 - i)) & 1;
+}
+
+/** The number of leading bits which are the same in a and b, at most max. */
+static inline uint32_t commonLen(struct Key* a, struct Key* b, uint32_t max)
+{
+    uint32_t n;
+    if (a->hi != b->hi) {
+        n = __builtin_clzll(a->hi ^ b->hi);
+    } else if (a->lo != b->lo) {
+        n = 64 + __builtin_clzll(a->lo ^ b->lo);
+    } else {
+        n = 128;
+    }
+    return (n < max) ? n : max;
+}
+
+static struct Node* newNode(struct PrefixTrie* trie, struct Key* key, uint32_t prefixLen)
+{
+    struct Node* n = trie->free;
+    if (n) {
+        trie->free = n->child[0];
+    } else {
+        n = Allocator_malloc(trie->alloc, sizeof(struct Node));
+    }
+    Bits_memset(n, 0, sizeof(struct Node));
+    n->key = *key;
+    n->prefixLen = prefixLen;
+    return n;
+}
+
+static void freeNode(struct PrefixTrie* trie, struct Node* n)
+{
+    n->child[0] = trie->free;
+    trie->free = n;
+}
+
+void PrefixTrie_put(struct PrefixTrie* trie, uint8_t* addr, uint32_t prefixLen, uint32_t value)
+{
+    Identity_check(trie);
+    Assert_true(prefixLen <= trie->addrBits);
+    struct Key key = keyFor(trie, addr, prefixLen);
+    struct Node** slot = &trie->root;
+    struct Node* n;
+    for (;;) {
+        n = *slot;
+        if (!n) {
+            n = *slot = newNode(trie, &key, prefixLen);
+            break;
+        }
+        uint32_t max = (prefixLen < n->prefixLen) ? prefixLen : n->prefixLen;
+        uint32_t common = commonLen(&key, &n->key, max);
+        if (common < n->prefixLen) {
+            // n is not a prefix of key, put a node where they part and hang n under it.
+            struct Key parentKey = keyFor(trie, addr, common);
+            struct Node* parent = *slot = newNode(trie, &parentKey, common);
+            parent->child[bitAt(&n->key, common)] = n;
+            if (common == prefixLen) {
+                n = parent;
+            } else {
+                n = parent->child[bitAt(&key, common)] = newNode(trie, &key, prefixLen);
+            }
+            break;
+        }
+        if (n->prefixLen == prefixLen) { break; }
+        slot = &n->child[bitAt(&key, n->prefixLen)];
+    }
+    n->hasValue = true;
+    n->value = value;
+}
+
+/** Find the slot which points to exactly this prefix, NULL if it is not in the trie. */
+static struct Node** findSlot(struct PrefixTrie* trie,
+                              struct Key* key,
+                              uint32_t prefixLen,
+                              struct Node*** parentSlotOut)
+{
+    struct Node** parentSlot = NULL;
+    struct Node** slot = &trie->root;
+    while (*slot && (*slot)->prefixLen < prefixLen) {
+        parentSlot = slot;
+        slot = &(*slot)->child[bitAt(key, (*slot)->prefixLen)];
+    }
+    if (!*slot || (*slot)->prefixLen != prefixLen || !(*slot)->hasValue
+        || (*slot)->key.hi != key->hi || (*slot)->key.lo != key->lo)
+    {
+        return NULL;
+    }
+    if (parentSlotOut) { *parentSlotOut = parentSlot; }
+    return slot;
+}
+
+bool PrefixTrie_get(struct PrefixTrie* trie,
+                    uint8_t* addr,
+                    uint32_t prefixLen,
+                    uint32_t* valueOut)
+{
+    Identity_check(trie);
+    Assert_true(prefixLen <= trie->addrBits);
+    struct Key key = keyFor(trie, addr, prefixLen);
+    struct Node** slot = findSlot(trie, &key, prefixLen, NULL);
+    if (!slot) { return false; }
+    *valueOut = (*slot)->value;
+    return true;
+}
+
+/** If the node at slot has no value and fewer than two children, take it out. */
+static void prune(struct PrefixTrie* trie, struct Node** slot)
+{
+    struct Node* n = *slot;
+    if (n->hasValue || (n->child[0] && n->child[1])) { return; }
+    *slot = (n->child[0]) ? n->child[0] : n->child[1];
+    freeNode(trie, n);
+}
+
+bool PrefixTrie_remove(struct PrefixTrie* trie, uint8_t* addr, uint32_t prefixLen)
+{
+    Identity_check(trie);
+    Assert_true(prefixLen <= trie->addrBits);
+    struct Key key = keyFor(trie, addr, prefixLen);
+    struct Node** parentSlot;
+    struct Node** slot = findSlot(trie, &key, prefixLen, &parentSlot);
+    if (!slot) { return false; }
+    (*slot)->hasValue = false;
+    bool wasLeaf = !(*slot)->child[0] && !(*slot)->child[1];
+    prune(trie, slot);
+    // A joining node above a removed leaf is left with only one child.
+    if (wasLeaf && parentSlot) {
+        prune(trie, parentSlot);
+    }
+    return true;
+}
+
+bool PrefixTrie_lookup(struct PrefixTrie* trie, uint8_t* addr, uint32_t* valueOut)
+{
+    Identity_check(trie);
+    struct Key key = keyFor(trie, addr, trie->addrBits);
+    struct Node* best = NULL;
+    for (struct Node* n = trie->root; n; ) {
+        if (commonLen(&key, &n->key, n->prefixLen) < n->prefixLen) { break; }
+        if (n->hasValue) { best = n; }
+        if (n->prefixLen == trie->addrBits) { break; }
+        n = n->child[bitAt(&key, n->prefixLen)];
+    }
+    if (!best) { return false; }
+    *valueOut = best->value;
+    return true;
+}
+
+static void emit(struct PrefixTrie* trie,
+                 struct Key* key,
+                 uint32_t prefixLen,
+                 PrefixTrie_Callback callback,
+                 void* context)
+{
+    uint8_t addr[16];
+    if (trie->addrBits == 32) {
+        uint32_t x = Endian_hostToBigEndian32(key->hi >> 32);
+        Bits_memcpy(addr, &x, 4);
+    } else {
+        uint64_t hi = Endian_hostToBigEndian64(key->hi);
+        uint64_t lo = Endian_hostToBigEndian64(key->lo);
+        Bits_memcpy(addr, &hi, 8);
+        Bits_memcpy(&addr[8], &lo, 8);
+    }
+    callback(addr, prefixLen, context);
+}
+
+/**
+ * Cover the region key/prefixLen, n is the only subtree of the trie which is inside of it.
+ *
+ * @param included whether the addresses in the region are included by a shorter prefix.
+ * @return true if the whole region is included, it is left to the caller to report it so
+ *         that it can be merged with its neighbor.
+ */
+static bool cover(struct PrefixTrie* trie,
+                  struct Key* key,
+                  uint32_t prefixLen,
+                  bool included,
+                  struct Node* n,
+                  PrefixTrie_Callback callback,
+                  void* context)
+{
+    if (!n) { return included; }
+    struct Node* halves[2] = { NULL, NULL };
+    if (n->prefixLen == prefixLen) {
+        if (n->hasValue) { included = (n->value != 0); }
+        if (!n->child[0] && !n->child[1]) { return included; }
+        halves[0] = n->child[0];
+        halves[1] = n->child[1];
+    } else {
+        halves[bitAt(&n->key, prefixLen)] = n;
+    }
+    struct Key halfKeys[2] = { *key, *key };
+    if (prefixLen < 64) {
+        halfKeys[1].hi |= 1ull << (63 - prefixLen);
+    } else {
+        halfKeys[1].lo |= 1ull << (127 - prefixLen);
+    }
+    bool full[2];
+    for (int i = 0; i < 2; i++) {
+        full[i] = cover(trie, &halfKeys[i], prefixLen + 1, included, halves[i], callback, context);
+    }
+    if (full[0] && full[1]) { return true; }
+    for (int i = 0; i < 2; i++) {
+        if (full[i]) { emit(trie, &halfKeys[i], prefixLen + 1, callback, context); }
+    }
+    return false;
+}
+
+void PrefixTrie_cover(struct PrefixTrie* trie, PrefixTrie_Callback callback, void* context)
+{
+    Identity_check(trie);
+    struct Key all = { 0, 0 };
+    if (cover(trie, &all, 0, false, trie->root, callback, context)) {
+        emit(trie, &all, 0, callback, context);
+    }
+}
+
+struct PrefixTrie* PrefixTrie_new(uint32_t addrBits, struct Allocator* alloc)
+{
+    Assert_true(addrBits == 32 || addrBits == 128);
+    struct PrefixTrie* trie = Allocator_calloc(alloc, sizeof(struct PrefixTrie), 1);
+    trie->addrBits = addrBits;
+    trie->alloc = alloc;
+    Identity_set(trie);
+    return trie;
+}
@@ -0,0 +1,79 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PrefixTrie_H
+#define PrefixTrie_H
+
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("util/PrefixTrie.c");
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A path compressed binary trie of IPv4 or IPv6 prefixes with a number stored for each one,
+ * it finds the longest stored prefix which contains an address in at most one step per bit.
+ * Addresses are big endian bytes as they appear on the wire, 4 for IPv4 and 16 for IPv6.
+ * Removed nodes are kept for reuse so memory only grows to the largest number of prefixes.
+ */
+struct PrefixTrie;
+
+/**
+ * @param addrBits 32 for IPv4 or 128 for IPv6.
+ * @param alloc the memory for the trie, all nodes are freed with it.
+ */
+struct PrefixTrie* PrefixTrie_new(uint32_t addrBits, struct Allocator* alloc);
+
+/**
+ * Store a prefix, replacing the value if the prefix is already stored.
+ * Bits of the address past prefixLen are ignored.
+ */
+void PrefixTrie_put(struct PrefixTrie* trie, uint8_t* addr, uint32_t prefixLen, uint32_t value);
+
+/**
+ * Get the value of exactly this prefix.
+ *
+ * @return true if the prefix is stored.
+ */
+bool PrefixTrie_get(struct PrefixTrie* trie,
+                    uint8_t* addr,
+                    uint32_t prefixLen,
+                    uint32_t* valueOut);
+
+/** @return true if the prefix was stored and has been removed. */
+bool PrefixTrie_remove(struct PrefixTrie* trie, uint8_t* addr, uint32_t prefixLen);
+
+/**
+ * Find the longest stored prefix which contains addr.
+ *
+ * @return true if one was found, its value is put in valueOut.
+ */
+bool PrefixTrie_lookup(struct PrefixTrie* trie, uint8_t* addr, uint32_t* valueOut);
+
+/**
+ * Called by PrefixTrie_cover() with each prefix of the cover.
+ *
+ * @param addr the address of the prefix with all bits past prefixLen zero.
+ */
+typedef void (* PrefixTrie_Callback)(uint8_t* addr, uint32_t prefixLen, void* context);
+
+/**
+ * Find the fewest prefixes which together hold exactly the addresses whose longest stored
+ * prefix has a non-zero value, so a prefix stored with zero cuts a hole in any shorter one.
+ * Takes at most a few steps per bit of each stored prefix.
+ */
+void PrefixTrie_cover(struct PrefixTrie* trie, PrefixTrie_Callback callback, void* context);
+
+#endif
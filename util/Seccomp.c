@@ -13,13 +13,15 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-// sigaction() siginfo_t SIG_UNBLOCK
-#define _POSIX_C_SOURCE 199309L
+// sigaction() siginfo_t SIG_UNBLOCK syscall()
+#define _GNU_SOURCE
 
 #include "util/Seccomp.h"
 #include "util/Bits.h"
 #include "util/ArchInfo.h"
 #include "util/Defined.h"
+#include "util/events/ThreadIface.h"
+#include "util/events/Work.h"
 
 // getpriority()
 #include <sys/resource.h>
@@ -36,6 +38,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 /**
  * A unique number which is returned as errno by getpriority(), a syscall we never use
@@ -219,6 +222,10 @@ static struct sock_fprog* mkFilter(struct Allocator* alloc, struct Except* eh)
         #ifdef __NR_recvmsg
             IFEQ(__NR_recvmsg, success),
         #endif
+        // UDPAddrIface_setBatchSize(), sendmmsg is below with ETHInterface
+        #ifdef __NR_recvmmsg
+            IFEQ(__NR_recvmmsg, success),
+        #endif
 
         // ETHInterface
         #ifdef __NR_sendto
@@ -227,6 +234,12 @@ static struct sock_fprog* mkFilter(struct Allocator* alloc, struct Except* eh)
         #ifdef __NR_recvfrom
             IFEQ(__NR_recvfrom, success),
         #endif
+        // ETHInterface ring mode and UDPAddrIface_setBatchSize()
+        #ifdef __NR_sendmmsg
+            IFEQ(__NR_sendmmsg, success),
+        #endif
+        // ETHInterface ring mode, munmap() of the ring when it is closed
+        IFEQ(__NR_munmap, success),
 
         #ifdef __NR_socketcall
             // 32-bit: recvmsg is a socketcall
@@ -286,6 +299,10 @@ static struct sock_fprog* mkFilter(struct Allocator* alloc, struct Except* eh)
         // exit()
         IFEQ(__NR_exit_group, success),
 
+        // Work thread pool, the threads are started before the filter is installed.
+        IFEQ(__NR_futex, success),
+        IFEQ(__NR_exit, success),
+
         // Seccomp_isWorking()
         IFEQ(__NR_getpriority, isworking),
 
@@ -400,6 +417,26 @@ static void installFilter(struct sock_fprog* filter, struct Log* logger, struct
         // don't worry about it.
         Log_warn(logger, "prctl(PR_SET_NO_NEW_PRIVS) -> [%s]\n", strerror(errno));
     }
+    #if defined(__NR_seccomp) && defined(SECCOMP_FILTER_FLAG_TSYNC)
+        // Cover threads which were started before the sandbox, see ThreadIface.h.
+        long ret =
+            syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_TSYNC, filter);
+        if (ret > 0) {
+            Except_throw(eh, "seccomp(SECCOMP_FILTER_FLAG_TSYNC) failed for thread [%ld]\n", ret);
+        } else if (!ret) {
+            return;
+        }
+        // Older kernels, fall back to filtering only this thread.
+        Log_debug(logger, "seccomp(SECCOMP_SET_MODE_FILTER) -> [%s]\n", strerror(errno));
+    #endif
+    // Threads which are already running would be left outside of the sandbox.
+    int running = ThreadIface_running() + Work_threadCount();
+    if (running) {
+        Except_throw(eh, "Unable to sandbox [%d] threads which are already running, the kernel "
+                         "does not support SECCOMP_FILTER_FLAG_TSYNC. Turn off "
+                         "router.pathfinderThread, router.cryptoWorkers and UDPInterface shards",
+                         running);
+    }
     if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, filter) == -1) {
         Except_throw(eh, "prctl(PR_SET_SECCOMP) -> [%s]\n", strerror(errno));
     }
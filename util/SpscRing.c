@@ -0,0 +1,118 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/SpscRing.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+
+/** Tag of the record which fills the end of the ring when the next record does not fit. */
+#define TAG_WRAP UINT32_MAX
+
+#define HEADER_SIZE 8
+#define RECORD_SIZE(length) (HEADER_SIZE + (((length) + 7) & ~7u))
+
+struct Header
+{
+    uint32_t length;
+    uint32_t tag;
+};
+
+struct SpscRing
+{
+    uint8_t* buffer;
+    uint32_t mask;
+
+    /** Read position, written only by the consumer. Positions count up and wrap at 2^32. */
+    uint32_t head;
+
+    /** Keep the two sides in different cache lines. */
+    uint8_t pad[64];
+
+    /** Write position, written only by the producer. */
+    uint32_t tail;
+
+    /** Position of the reserved record and its length, producer only. */
+    uint32_t reserved;
+    uint32_t reservedLength;
+
+    Identity
+};
+
+struct SpscRing* SpscRing_new(uint32_t size, struct Allocator* alloc)
+{
+    Assert_true(size >= 64 && !(size & (size - 1)));
+    struct SpscRing* ring = Allocator_calloc(alloc, sizeof(struct SpscRing), 1);
+    ring->buffer = Allocator_malloc(alloc, size);
+    ring->mask = size - 1;
+    Identity_set(ring);
+    return ring;
+}
+
+uint8_t* SpscRing_reserve(struct SpscRing* ring, uint32_t length)
+{
+    Identity_check(ring);
+    uint32_t size = ring->mask + 1;
+    uint32_t need = RECORD_SIZE(length);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+    uint32_t offset = tail & ring->mask;
+    uint32_t skip = (offset + need > size) ? size - offset : 0;
+    if (need > size / 2 || size - (tail - head) < skip + need) { return NULL; }
+    if (skip) {
+        // Not published until the commit moves tail past it.
+        struct Header wrap = { .length = skip - HEADER_SIZE, .tag = TAG_WRAP };
+        Bits_memcpy(&ring->buffer[offset], &wrap, HEADER_SIZE);
+    }
+    ring->reserved = tail + skip;
+    ring->reservedLength = length;
+    return &ring->buffer[(ring->reserved & ring->mask) + HEADER_SIZE];
+}
+
+void SpscRing_commit(struct SpscRing* ring, uint32_t tag)
+{
+    Identity_check(ring);
+    struct Header h = { .length = ring->reservedLength, .tag = tag };
+    Bits_memcpy(&ring->buffer[ring->reserved & ring->mask], &h, HEADER_SIZE);
+    uint32_t tail = ring->reserved + RECORD_SIZE(ring->reservedLength);
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+uint8_t* SpscRing_peek(struct SpscRing* ring, uint32_t* lengthOut, uint32_t* tagOut)
+{
+    Identity_check(ring);
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t head = ring->head;
+        if (head == tail) { return NULL; }
+        struct Header h;
+        Bits_memcpy(&h, &ring->buffer[head & ring->mask], HEADER_SIZE);
+        if (h.tag == TAG_WRAP) {
+            __atomic_store_n(&ring->head, head + HEADER_SIZE + h.length, __ATOMIC_RELEASE);
+            continue;
+        }
+        *lengthOut = h.length;
+        *tagOut = h.tag;
+        return &ring->buffer[(head & ring->mask) + HEADER_SIZE];
+    }
+}
+
+void SpscRing_pop(struct SpscRing* ring)
+{
+    Identity_check(ring);
+    struct Header h;
+    uint32_t head = ring->head;
+    Bits_memcpy(&h, &ring->buffer[head & ring->mask], HEADER_SIZE);
+    __atomic_store_n(&ring->head, head + RECORD_SIZE(h.length), __ATOMIC_RELEASE);
+}
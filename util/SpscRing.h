@@ -0,0 +1,63 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SpscRing_H
+#define SpscRing_H
+
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("util/SpscRing.c");
+
+#include <stdint.h>
+
+/**
+ * A lock free ring of variable length records for passing data from exactly one producer
+ * thread to exactly one consumer thread. The producer uses SpscRing_reserve() and
+ * SpscRing_commit(), the consumer uses SpscRing_peek() and SpscRing_pop(), neither side ever
+ * blocks. Records are contiguous in memory and 8 byte aligned.
+ */
+struct SpscRing;
+
+/**
+ * @param size the number of bytes in the ring, must be a power of 2.
+ *             A record takes its length rounded up to 8 plus 8 bytes of header.
+ * @param alloc the memory for the ring, must not be freed while either thread can use it.
+ */
+struct SpscRing* SpscRing_new(uint32_t size, struct Allocator* alloc);
+
+/**
+ * Get space for a record, the record is not visible to the consumer until it is committed.
+ *
+ * @return a pointer to length bytes of space or NULL if the ring is too full.
+ */
+uint8_t* SpscRing_reserve(struct SpscRing* ring, uint32_t length);
+
+/**
+ * Make the last reserved record visible to the consumer.
+ *
+ * @param tag a number which is given back by SpscRing_peek().
+ */
+void SpscRing_commit(struct SpscRing* ring, uint32_t tag);
+
+/**
+ * Get the oldest record, it stays in the ring until SpscRing_pop() is called.
+ *
+ * @return a pointer to the record or NULL if the ring is empty.
+ */
+uint8_t* SpscRing_peek(struct SpscRing* ring, uint32_t* lengthOut, uint32_t* tagOut);
+
+/** Discard the record which was returned by SpscRing_peek(). */
+void SpscRing_pop(struct SpscRing* ring);
+
+#endif
@@ -0,0 +1,52 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef Defer_H
+#define Defer_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/Defer.c");
+
+/**
+ * A callback which runs on the next turn of the event loop, after the loop has checked for I/O.
+ * Unlike a zero length Timeout, a Defer which is scheduled again from its own callback waits
+ * for the next turn so two of them sending to each other can not keep I/O from being handled.
+ */
+struct Defer
+{
+    int unused;
+};
+
+/**
+ * Create a Defer, it does nothing until it is scheduled.
+ *
+ * @param callback the function to call.
+ * @param callbackContext a pointer to be passed to the callback.
+ * @param base the event base.
+ * @param alloc freeing this allocator makes the Defer be removed safely.
+ */
+struct Defer* Defer_new(void (* const callback)(void* callbackContext),
+                        void* const callbackContext,
+                        struct EventBase* base,
+                        struct Allocator* alloc);
+
+/**
+ * Call the callback once on the next turn of the event loop.
+ * Scheduling it again before then has no effect.
+ */
+void Defer_schedule(struct Defer* defer);
+
+#endif
@@ -0,0 +1,84 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ThreadIface_H
+#define ThreadIface_H
+
+#include "crypto/random/Random.h"
+#include "interface/Iface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/ThreadIface.c");
+
+#include <stdint.h>
+
+/** Bytes of padding before each message which comes out of a ThreadIface. */
+#define ThreadIface_PADDING_AMOUNT 512
+
+/** Size of each of the two rings, messages which do not fit when the ring is full are dropped. */
+#define ThreadIface_RING_SIZE (1<<17)
+
+struct ThreadIface
+{
+    /** Messages sent here come out of the iface which is given to the start function. */
+    struct Iface iface;
+};
+
+/**
+ * Called on the new thread to set up whatever runs there.
+ * Everything which is passed in belongs to the thread and must only be used from it.
+ *
+ * @param iface messages sent here come out of ThreadIface.iface on the calling thread.
+ * @param alloc the thread's root allocator, it is freed when the ThreadIface is freed.
+ * @param base the thread's event loop, it begins as soon as this function returns.
+ * @param log lines are passed back and printed to the log given to ThreadIface_new().
+ * @param rand a random generator which was seeded on the thread.
+ * @param userData the pointer given to ThreadIface_new(), the calling thread waits until this
+ *                 function returns so it may be used to pass results back, but not after.
+ */
+typedef void (* ThreadIface_Start)(struct Iface* iface,
+                                   struct Allocator* alloc,
+                                   struct EventBase* base,
+                                   struct Log* log,
+                                   struct Random* rand,
+                                   void* userData);
+
+/**
+ * Start a thread with its own event loop and connect it to this one with a pair of lock free
+ * rings. This returns after start has returned so it can be used before the process is
+ * sandboxed. When alloc is freed the thread's loop is stopped and the thread is joined.
+ *
+ * @param start the function to call on the new thread.
+ * @param userData passed to start.
+ * @param memoryLimit the maximum number of bytes the thread's allocator may hold.
+ * @param base the event loop which messages and log lines are delivered on.
+ * @param log the log to print the thread's log lines to.
+ * @param alloc the memory for the ThreadIface.
+ */
+struct ThreadIface* ThreadIface_new(ThreadIface_Start start,
+                                    void* userData,
+                                    uint64_t memoryLimit,
+                                    struct EventBase* base,
+                                    struct Log* log,
+                                    struct Allocator* alloc);
+
+/**
+ * The number of threads started by ThreadIface_new() which have not yet been joined.
+ * Seccomp uses this to refuse a sandbox which would only cover the calling thread.
+ */
+int ThreadIface_running(void);
+
+#endif
@@ -49,5 +49,29 @@ struct UDPAddrIface* UDPAddrIface_new(struct EventBase* base,
                                       struct Except* exHandler,
                                       struct Log* logger);
 
+/**
+ * Like UDPAddrIface_new() but the socket is bound with SO_REUSEPORT so that several of them
+ * can share one address, the kernel spreads the remote addresses among them. Linux only.
+ * The address must have a port unless this is the first of the sockets, see UDPShards.h.
+ */
+struct UDPAddrIface* UDPAddrIface_newShared(struct EventBase* base,
+                                            struct Sockaddr* bindAddr,
+                                            struct Allocator* allocator,
+                                            struct Except* exHandler,
+                                            struct Log* logger);
+
 int UDPAddrIface_setDSCP(struct UDPAddrIface* iface, uint8_t dscp);
+
+/** Largest batch which the kernel accepts in one recvmmsg() or sendmmsg(), UIO_MAXIOV. */
+#define UDPAddrIface_MAX_BATCH_SIZE 1024
+
+/**
+ * Receive and send up to batchSize datagrams per system call using recvmmsg() and sendmmsg().
+ * Sends are held until the end of the event loop turn so a burst leaves in one call.
+ * Must be called before anything is sent, cannot be undone.
+ * A batchSize over UDPAddrIface_MAX_BATCH_SIZE is reduced to it.
+ *
+ * @return 0 on success, -1 if batching is not supported on this platform or already enabled.
+ */
+int UDPAddrIface_setBatchSize(struct UDPAddrIface* iface, uint32_t batchSize);
 #endif
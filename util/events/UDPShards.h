@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef UDPShards_H
+#define UDPShards_H
+
+#include "exception/Except.h"
+#include "interface/addressable/AddrIface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/UDPShards.c");
+
+#include <stdint.h>
+
+/** Most shards which can be started for one address. */
+#define UDPShards_MAX 64
+
+/** The memory which each shard's thread may use for its socket and buffers. */
+#define UDPShards_THREAD_MEMORY (1<<22)
+
+/**
+ * A UDP socket which is spread across several threads, each with its own event loop and its
+ * own SO_REUSEPORT socket bound to the same address. The kernel keeps each remote address
+ * on one of the sockets. The system calls, batching and copying happen on the shard threads
+ * while messages come out of and go into the AddrIface on the caller's loop, the same as with
+ * a UDPAddrIface. Sends to a given address always leave from the same shard so they are not
+ * reordered.
+ */
+struct UDPShards
+{
+    struct AddrIface generic;
+
+    /** Number of shard threads. */
+    uint32_t count;
+};
+
+/**
+ * Start the shards, this must be done before the process is sandboxed. Linux only.
+ *
+ * @param base the event loop which messages come out on.
+ * @param bindAddr the address to bind to, if the port is 0 then the first shard picks it.
+ * @param count the number of shards, at most UDPShards_MAX.
+ * @param batchSize passed to UDPAddrIface_setBatchSize() on each shard, 0 to not batch.
+ * @param dscp passed to UDPAddrIface_setDSCP() on each shard, 0 to leave it.
+ * @param alloc freeing this stops and joins the shards.
+ * @param eh thrown to if a socket can not be bound.
+ * @param logger the shards log here.
+ */
+struct UDPShards* UDPShards_new(struct EventBase* base,
+                                struct Sockaddr* bindAddr,
+                                uint32_t count,
+                                uint32_t batchSize,
+                                uint8_t dscp,
+                                struct Allocator* alloc,
+                                struct Except* eh,
+                                struct Log* logger);
+
+#endif
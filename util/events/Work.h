@@ -0,0 +1,66 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef Work_H
+#define Work_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/Work.c");
+
+#include <stdint.h>
+
+/** Number of threads which the pool is started with if Work_startThreads() is never called. */
+#define Work_DEFAULT_THREADS 4
+
+/**
+ * Run a function on a thread from the thread pool then run a completion function back on
+ * the event loop.
+ * The work function runs concurrently with the event loop so it must not allocate, log or read
+ * anything which the event loop might change while it is running.
+ *
+ * @param work the function to call on a worker thread.
+ * @param complete the function to call on the event loop once work has returned.
+ * @param userData a pointer which will be passed to both functions.
+ * @param eventBase the event loop which complete will be called from.
+ * @param alloc if this is freed before the work is complete, complete will not be called
+ *              but the free will not finish until work has returned.
+ */
+void Work_queue(void (* work)(void* userData),
+                void (* complete)(void* userData),
+                void* userData,
+                struct EventBase* eventBase,
+                struct Allocator* alloc);
+
+/**
+ * Start the thread pool.
+ * The pool is process wide and threads cannot be created once the process is sandboxed so
+ * this must be called during setup. If it is not called, the first Work_queue() will start
+ * the pool with Work_DEFAULT_THREADS threads, so nothing may be queued after the sandbox
+ * unless the pool was started before it. Once started the pool keeps its size.
+ *
+ * @param count the number of threads.
+ * @param eventBase the event loop.
+ * @return 0 on success, -1 if the pool is already running with a different number of threads.
+ */
+int Work_startThreads(uint32_t count, struct EventBase* eventBase);
+
+/**
+ * @return the number of threads which the pool was started with, 0 if it is not started.
+ *         The threads are never stopped, Seccomp uses this to know that they exist.
+ */
+uint32_t Work_threadCount(void);
+
+#endif
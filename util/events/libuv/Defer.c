@@ -0,0 +1,93 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/Defer.h"
+#include "util/Identity.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Defer_pvt
+{
+    struct Defer pub;
+    void (* const callback)(void* callbackContext);
+    void* const callbackContext;
+
+    /**
+     * Runs every turn while it is active, which also keeps the loop from sleeping in poll.
+     * libuv runs idle handles before polling for I/O so anything scheduled from the callback
+     * waits until the I/O of this turn has been handled.
+     */
+    uv_idle_t idle;
+
+    /** Set by Defer_schedule(), cleared before the callback is called. */
+    bool scheduled;
+
+    Identity
+};
+
+static void onIdle(uv_idle_t* handle, int status)
+{
+    struct Defer_pvt* d =
+        Identity_check((struct Defer_pvt*) (((char*)handle) - offsetof(struct Defer_pvt, idle)));
+    d->scheduled = false;
+    d->callback(d->callbackContext);
+
+    // It is only stopped here, stopping and starting it again from the callback would put it
+    // back in the list which libuv is walking and it might be called again in the same turn.
+    if (!d->scheduled && !uv_is_closing((uv_handle_t*) handle)) {
+        uv_idle_stop(handle);
+    }
+}
+
+void Defer_schedule(struct Defer* defer)
+{
+    struct Defer_pvt* d = Identity_check((struct Defer_pvt*) defer);
+    if (uv_is_closing((uv_handle_t*) &d->idle)) { return; }
+    d->scheduled = true;
+    uv_idle_start(&d->idle, onIdle);
+}
+
+static void freeDefer2(uv_handle_t* handle)
+{
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*)handle->data);
+}
+
+static int freeDefer(struct Allocator_OnFreeJob* job)
+{
+    struct Defer_pvt* d = Identity_check((struct Defer_pvt*) job->userData);
+    d->idle.data = job;
+    uv_close((uv_handle_t*) &d->idle, freeDefer2);
+    return Allocator_ONFREE_ASYNC;
+}
+
+struct Defer* Defer_new(void (* const callback)(void* callbackContext),
+                        void* const callbackContext,
+                        struct EventBase* eventBase,
+                        struct Allocator* allocator)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+    struct Allocator* alloc = Allocator_child(allocator);
+    struct Defer_pvt* out = Allocator_clone(alloc, (&(struct Defer_pvt) {
+        .callback = callback,
+        .callbackContext = callbackContext
+    }));
+    Identity_set(out);
+    uv_idle_init(base->loop, &out->idle);
+    Allocator_onFree(alloc, freeDefer, out);
+    return &out->pub;
+}
@@ -25,6 +25,15 @@
     #include <sys/time.h>
 #endif
 
+static void deleteLoop(struct EventBase_pvt* ctx)
+{
+    if (ctx->wheel) {
+        // Timeouts which are freed after this point will not touch the loop.
+        uv_close((uv_handle_t*) ctx->wheel, NULL);
+    }
+    uv_loop_delete(ctx->loop);
+}
+
 static int onFree(struct Allocator_OnFreeJob* job)
 {
     struct EventBase_pvt* ctx = Identity_check((struct EventBase_pvt*) job->userData);
@@ -34,7 +43,7 @@ static int onFree(struct Allocator_OnFreeJob* job)
         EventBase_endLoop((struct EventBase*) ctx);
         return Allocator_ONFREE_ASYNC;
     } else {
-        uv_loop_delete(ctx->loop);
+        deleteLoop(ctx);
         return 0;
     }
 }
@@ -85,7 +94,7 @@ void EventBase_beginLoop(struct EventBase* eventBase)
     ctx->running = 0;
 
     if (ctx->onFree) {
-        uv_loop_delete(ctx->loop);
+        deleteLoop(ctx);
         Allocator_onFreeComplete(ctx->onFree);
         return;
     }
@@ -97,20 +106,30 @@ void EventBase_endLoop(struct EventBase* eventBase)
     uv_stop(ctx->loop);
 }
 
-static void countCallback(uv_handle_t* event, void* vEventCount)
+struct Count
+{
+    uv_handle_t* wheel;
+    int eventCount;
+};
+
+static void countCallback(uv_handle_t* event, void* vCount)
 {
-    int* eventCount = (int*) vEventCount;
-    if (!uv_is_closing(event)) {
-        *eventCount = *eventCount + 1;
+    struct Count* count = (struct Count*) vCount;
+    if (!uv_is_closing(event) && event != count->wheel) {
+        count->eventCount++;
     }
 }
 
 int EventBase_eventCount(struct EventBase* eventBase)
 {
-    int eventCount = 0;
     struct EventBase_pvt* ctx = Identity_check((struct EventBase_pvt*) eventBase);
-    uv_walk(ctx->loop, countCallback, &eventCount);
-    return eventCount;
+    // Timeouts share one handle, count them as if each had its own.
+    struct Count count = {
+        .wheel = (uv_handle_t*) ctx->wheel,
+        .eventCount = ctx->timeoutCount
+    };
+    uv_walk(ctx->loop, countCallback, &count);
+    return count.eventCount;
 }
 
 struct EventBase_pvt* EventBase_privatize(struct EventBase* base)
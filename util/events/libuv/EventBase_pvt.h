@@ -41,6 +41,15 @@ struct EventBase_pvt
     /** Number of milliseconds since epoch when the clock was calibrated. */
     uint64_t baseTime;
 
+    /**
+     * The timer wheel which every Timeout is kept in, see Timeout.c.
+     * It begins with the one uv_timer_t which drives it, NULL until the first Timeout.
+     */
+    struct EventBase_Wheel* wheel;
+
+    /** Number of Timeouts which have not been freed, each counts as an event. */
+    int timeoutCount;
+
     Identity
 };
 
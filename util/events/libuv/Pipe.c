@@ -14,6 +14,7 @@
  */
 #include "util/events/libuv/UvWrapper.h"
 #include "memory/Allocator.h"
+#include "memory/MessagePool.h"
 #include "util/events/Pipe.h"
 #include "util/events/libuv/EventBase_pvt.h"
 #include "util/log/Log.h"
@@ -59,6 +60,9 @@ struct Pipe_pvt
 
     struct Allocator* alloc;
 
+    /** Read buffers are drawn from here. */
+    struct MessagePool* pool;
+
     Identity
 };
 
@@ -214,7 +218,7 @@ static void allocate(uv_handle_t* handle, size_t size, uv_buf_t* buf)
     size = Pipe_BUFFER_CAP;
     size_t fullSize = size + Pipe_PADDING_AMOUNT;
 
-    struct Allocator* child = Allocator_child(pipe->alloc);
+    struct Allocator* child = MessagePool_child(pipe->pool, pipe->alloc);
     char* buff = Allocator_malloc(child, fullSize);
     buff += Pipe_PADDING_AMOUNT;
 
@@ -360,7 +364,8 @@ static struct Pipe_pvt* newPipe(struct EventBase* eb,
             .name = &cname[pos],
             .base = eb
         },
-        .alloc = alloc
+        .alloc = alloc,
+        .pool = MessagePool_new(alloc, Pipe_BUFFER_CAP + Pipe_PADDING_AMOUNT)
     }));
 
     int ret;
@@ -0,0 +1,311 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/ThreadIface.h"
+#include "util/log/Log_impl.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "util/SpscRing.h"
+#include "wire/Message.h"
+
+#include <stdio.h>
+
+#define TAG_MESSAGE 0
+#define TAG_LOG 1
+
+/** Records handled per wakeup, the rest wait for the next turn so the loop is not held. */
+#define DRAIN_MAX 64
+
+/** A log line is passed as this followed by the nul terminated text. */
+struct LogRecord
+{
+    const char* file;
+    uint32_t level;
+    uint32_t line;
+};
+
+/** The part which lives on the new thread and is allocated from its allocator. */
+struct Thread
+{
+    struct Iface iface;
+    struct Log log;
+    struct ThreadIface_pvt* ti;
+    struct Allocator* alloc;
+    uv_async_t wake;
+    Identity
+};
+
+struct ThreadIface_pvt
+{
+    struct ThreadIface pub;
+    struct Allocator* alloc;
+    struct Log* log;
+
+    struct SpscRing* toThread;
+    struct SpscRing* toMain;
+
+    /** Woken by the thread when it has put something in toMain. */
+    uv_async_t wake;
+
+    /** Set once the thread has started, only read from the thread or after it is started. */
+    struct Thread* thread;
+
+    uv_thread_t id;
+    uv_sem_t started;
+    ThreadIface_Start start;
+    void* userData;
+    uint64_t memoryLimit;
+
+    /** Set when the ThreadIface is freed, the thread frees everything and exits. */
+    int stopping;
+
+    /** Records which the thread could not send because toMain was full, written atomically. */
+    uint32_t threadDrops;
+    uint32_t threadDropsReported;
+
+    Identity
+};
+
+/**
+ * libuv skips the wakeup if the handle is still marked pending and clears the mark just
+ * before calling back without a barrier. The fences here and at the top of the callbacks make
+ * sure that either the sender sees the mark cleared or the woken side sees the new record.
+ */
+static void wake(uv_async_t* handle)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uv_async_send(handle);
+}
+
+static int push(struct SpscRing* ring, uint32_t tag, uint8_t* data, uint32_t length)
+{
+    uint8_t* rec = SpscRing_reserve(ring, length);
+    if (!rec) { return -1; }
+    Bits_memcpy(rec, data, length);
+    SpscRing_commit(ring, tag);
+    return 0;
+}
+
+static void deliver(struct Iface* iface, struct Allocator* alloc, uint8_t* data, uint32_t length)
+{
+    struct Allocator* msgAlloc = Allocator_child(alloc);
+    struct Message* msg = Message_new(length, ThreadIface_PADDING_AMOUNT, msgAlloc);
+    Bits_memcpy(msg->bytes, data, length);
+    Iface_send(iface, msg);
+    Allocator_free(msgAlloc);
+}
+
+// ---------------------------- On the thread ---------------------------- //
+
+static void threadLog(struct Log* log,
+                      enum Log_Level level,
+                      const char* file,
+                      int line,
+                      const char* format,
+                      va_list args)
+{
+    struct Thread* th = Identity_containerOf(log, struct Thread, log);
+    struct ThreadIface_pvt* ti = th->ti;
+    char text[1024];
+    int len = vsnprintf(text, sizeof text, format, args);
+    if (len < 0) { return; }
+    if (len >= (int) sizeof text) { len = sizeof text - 1; }
+    uint8_t* rec = SpscRing_reserve(ti->toMain, sizeof(struct LogRecord) + len + 1);
+    if (!rec) {
+        __atomic_add_fetch(&ti->threadDrops, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    struct LogRecord lr = { .file = file, .level = level, .line = line };
+    Bits_memcpy(rec, &lr, sizeof(struct LogRecord));
+    Bits_memcpy(&rec[sizeof(struct LogRecord)], text, len + 1);
+    SpscRing_commit(ti->toMain, TAG_LOG);
+    wake(&ti->wake);
+}
+
+static Iface_DEFUN fromThread(struct Message* msg, struct Iface* iface)
+{
+    struct Thread* th = Identity_containerOf(iface, struct Thread, iface);
+    struct ThreadIface_pvt* ti = th->ti;
+    if (push(ti->toMain, TAG_MESSAGE, msg->bytes, msg->length)) {
+        __atomic_add_fetch(&ti->threadDrops, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    wake(&ti->wake);
+    return NULL;
+}
+
+static void threadWake(uv_async_t* handle, int status)
+{
+    struct Thread* th = Identity_containerOf(handle, struct Thread, wake);
+    struct ThreadIface_pvt* ti = th->ti;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ti->stopping, __ATOMIC_ACQUIRE)) {
+        // Ends the loop once everything is closed, then threadMain() returns.
+        Allocator_free(th->alloc);
+        return;
+    }
+    uint32_t length;
+    uint32_t tag;
+    uint8_t* rec;
+    for (int i = 0; (rec = SpscRing_peek(ti->toThread, &length, &tag)); i++) {
+        if (i == DRAIN_MAX) {
+            uv_async_send(&th->wake);
+            return;
+        }
+        deliver(&th->iface, th->alloc, rec, length);
+        SpscRing_pop(ti->toThread);
+    }
+}
+
+static void threadWakeClosed(uv_handle_t* handle)
+{
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) handle->data);
+}
+
+static int closeThreadWake(struct Allocator_OnFreeJob* job)
+{
+    struct Thread* th = Identity_check((struct Thread*) job->userData);
+    th->wake.data = job;
+    uv_close((uv_handle_t*) &th->wake, threadWakeClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+static void threadMain(void* vThreadIface)
+{
+    struct ThreadIface_pvt* ti = Identity_check((struct ThreadIface_pvt*) vThreadIface);
+    struct Allocator* alloc = MallocAllocator_new(ti->memoryLimit);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Thread* th = Allocator_calloc(alloc, sizeof(struct Thread), 1);
+    Identity_set(th);
+    th->ti = ti;
+    th->alloc = alloc;
+    th->log.print = threadLog;
+    th->iface.send = fromThread;
+    uv_async_init(EventBase_privatize(base)->loop, &th->wake, threadWake);
+    Allocator_onFree(alloc, closeThreadWake, th);
+
+    struct Random* rand = Random_new(alloc, &th->log, NULL);
+    ti->start(&th->iface, alloc, base, &th->log, rand, ti->userData);
+
+    ti->thread = th;
+    uv_sem_post(&ti->started);
+    EventBase_beginLoop(base);
+}
+
+// ---------------------------- On the caller's loop ---------------------------- //
+
+static Iface_DEFUN fromMain(struct Message* msg, struct Iface* iface)
+{
+    struct ThreadIface_pvt* ti = Identity_containerOf(iface, struct ThreadIface_pvt, pub.iface);
+    // Sent by an onFree job, the thread is already gone.
+    if (ti->alloc->isFreeing) { return NULL; }
+    if (push(ti->toThread, TAG_MESSAGE, msg->bytes, msg->length)) {
+        Log_warn(ti->log, "Dropped message of [%d] bytes, thread is not keeping up",
+                 msg->length);
+        return NULL;
+    }
+    wake(&ti->thread->wake);
+    return NULL;
+}
+
+static void mainWake(uv_async_t* handle, int status)
+{
+    struct ThreadIface_pvt* ti = Identity_containerOf(handle, struct ThreadIface_pvt, wake);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t drops = __atomic_load_n(&ti->threadDrops, __ATOMIC_RELAXED);
+    if (drops != ti->threadDropsReported) {
+        Log_warn(ti->log, "Thread dropped [%u] messages and log lines, ring was full",
+                 drops - ti->threadDropsReported);
+        ti->threadDropsReported = drops;
+    }
+    uint32_t length;
+    uint32_t tag;
+    uint8_t* rec;
+    for (int i = 0; (rec = SpscRing_peek(ti->toMain, &length, &tag)); i++) {
+        if (i == DRAIN_MAX) {
+            uv_async_send(&ti->wake);
+            return;
+        }
+        if (tag == TAG_LOG) {
+            struct LogRecord lr;
+            Bits_memcpy(&lr, rec, sizeof(struct LogRecord));
+            Log_print(ti->log, lr.level, lr.file, lr.line, "%s", &rec[sizeof(struct LogRecord)]);
+        } else {
+            deliver(&ti->pub.iface, ti->alloc, rec, length);
+        }
+        SpscRing_pop(ti->toMain);
+    }
+}
+
+/** Threads which are started and not yet joined, written atomically. */
+static int gRunning = 0;
+
+int ThreadIface_running(void)
+{
+    return __atomic_load_n(&gRunning, __ATOMIC_ACQUIRE);
+}
+
+static void mainWakeClosed(uv_handle_t* handle)
+{
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) handle->data);
+}
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct ThreadIface_pvt* ti = Identity_check((struct ThreadIface_pvt*) job->userData);
+    __atomic_store_n(&ti->stopping, 1, __ATOMIC_RELEASE);
+    wake(&ti->thread->wake);
+    uv_thread_join(&ti->id);
+    __atomic_sub_fetch(&gRunning, 1, __ATOMIC_RELEASE);
+    uv_sem_destroy(&ti->started);
+    ti->wake.data = job;
+    uv_close((uv_handle_t*) &ti->wake, mainWakeClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+struct ThreadIface* ThreadIface_new(ThreadIface_Start start,
+                                    void* userData,
+                                    uint64_t memoryLimit,
+                                    struct EventBase* base,
+                                    struct Log* log,
+                                    struct Allocator* allocator)
+{
+    struct Allocator* alloc = Allocator_child(allocator);
+    struct ThreadIface_pvt* ti = Allocator_calloc(alloc, sizeof(struct ThreadIface_pvt), 1);
+    Identity_set(ti);
+    ti->alloc = alloc;
+    ti->log = log;
+    ti->start = start;
+    ti->userData = userData;
+    ti->memoryLimit = memoryLimit;
+    ti->pub.iface.send = fromMain;
+    ti->toThread = SpscRing_new(ThreadIface_RING_SIZE, alloc);
+    ti->toMain = SpscRing_new(ThreadIface_RING_SIZE, alloc);
+
+    uv_async_init(EventBase_privatize(base)->loop, &ti->wake, mainWake);
+    // An idle thread does not keep this loop running, whatever waits on it keeps it alive.
+    uv_unref((uv_handle_t*) &ti->wake);
+
+    uv_sem_init(&ti->started, 0);
+    __atomic_add_fetch(&gRunning, 1, __ATOMIC_RELEASE);
+    uv_thread_create(&ti->id, threadMain, ti);
+    uv_sem_wait(&ti->started);
+    Allocator_onFree(alloc, onFree, ti);
+    return &ti->pub;
+}
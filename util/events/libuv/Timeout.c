@@ -16,11 +16,41 @@
 #include "memory/Allocator.h"
 #include "util/events/libuv/EventBase_pvt.h"
 #include "util/events/Timeout.h"
+#include "util/Assert.h"
 #include "util/Identity.h"
 
+#include <stdbool.h>
+
+/**
+ * All timeouts of an EventBase live in a hierarchical timing wheel driven by a single libuv
+ * timer, so creating, resetting and clearing a timeout are constant time list operations
+ * rather than libuv heap operations and there is no libuv handle per timeout.
+ *
+ * The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots with a resolution of 1 millisecond.
+ * A timeout which expires within WHEEL_SLOTS ms is put in the level 0 slot for the millisecond
+ * when it expires, one which expires later goes in a higher level and is moved down
+ * (cascaded) when the wheel comes around to its slot. Timeouts beyond the top level are put
+ * in the farthest slot and cascaded until they are near enough.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+
+/** A circular doubly linked list, an entry which is not in any list has next == NULL. */
+struct Link
+{
+    struct Link* next;
+    struct Link* prev;
+};
+
 struct Timeout
 {
-    uv_timer_t timer;
+    /** Must be first, a Link in a slot is a Timeout. */
+    struct Link link;
+
+    /** The uv_now() time at which it should fire. */
+    uint64_t expires;
 
     void (* callback)(void* callbackContext);
 
@@ -30,34 +60,241 @@ struct Timeout
 
     int isInterval;
 
-    struct Allocator* alloc;
+    struct EventBase_Wheel* wheel;
 
     Identity
 };
 
-/**
- * The callback to be called by libuv.
- */
-static void handleEvent(uv_timer_t* handle, int status)
+struct EventBase_Wheel
+{
+    /** Must be first, EventBase counts every handle except this one. */
+    uv_timer_t timer;
+
+    struct EventBase_pvt* base;
+
+    /** Every millisecond up to and including this one has been processed. */
+    uint64_t now;
+
+    /** Timeouts which expire at or before now, fired on the next pass. */
+    struct Link due;
+
+    struct Link slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+    /** Number of timeouts which are waiting to fire. */
+    uint32_t pending;
+
+    /** When the libuv timer is set to go off if it is active. */
+    uint64_t armedFor;
+
+    Identity
+};
+
+static void linkInit(struct Link* l)
+{
+    l->next = l->prev = l;
+}
+
+static bool linkEmpty(struct Link* l)
+{
+    return l->next == l;
+}
+
+static void linkAppend(struct Link* list, struct Link* l)
+{
+    l->prev = list->prev;
+    l->next = list;
+    list->prev->next = l;
+    list->prev = l;
+}
+
+static void linkRemove(struct Link* l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->next = l->prev = NULL;
+}
+
+/** Move everything from one list to an empty list. */
+static void linkTake(struct Link* to, struct Link* from)
+{
+    if (linkEmpty(from)) {
+        linkInit(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    linkInit(from);
+}
+
+static struct Link* slotFor(struct EventBase_Wheel* w, uint64_t expires)
 {
-    struct Timeout* timeout = Identity_check((struct Timeout*) handle);
-    if (!timeout->isInterval) {
-        Timeout_clearTimeout(timeout);
+    if (expires <= w->now) { return &w->due; }
+    uint64_t delta = expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1)))) {
+        level++;
     }
-    timeout->callback(timeout->callbackContext);
+    if (delta >= (1ull << (WHEEL_BITS * WHEEL_LEVELS))) {
+        // Too far to say, park it in the last slot and look again when it is cascaded.
+        expires = w->now + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    return &w->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+}
+
+/** @return the uv_now() time when the wheel next needs to run, UINT64_MAX if never. */
+static uint64_t nextWake(struct EventBase_Wheel* w)
+{
+    if (!linkEmpty(&w->due)) { return w->now; }
+
+    // Everything in level 0 fires on the millisecond of its slot so the first one found wins.
+    for (uint64_t t = w->now + 1; t <= w->now + WHEEL_SLOTS; t++) {
+        if (!linkEmpty(&w->slots[0][t & WHEEL_MASK])) { return t; }
+    }
+
+    // Otherwise wake up for the first cascade which will bring anything down.
+    uint64_t wake = UINT64_MAX;
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        for (uint64_t i = 1; i <= WHEEL_SLOTS; i++) {
+            uint64_t index = (w->now >> shift) + i;
+            if (!linkEmpty(&w->slots[level][index & WHEEL_MASK])) {
+                if ((index << shift) < wake) { wake = index << shift; }
+                break;
+            }
+        }
+    }
+    return wake;
+}
+
+static void onTimer(uv_timer_t* handle, int status);
+
+static void arm(struct EventBase_Wheel* w, uint64_t when)
+{
+    // The EventBase is being freed.
+    if (uv_is_closing((uv_handle_t*) &w->timer)) { return; }
+    uint64_t now = uv_now(w->base->loop);
+    w->armedFor = when;
+    uv_timer_start(&w->timer, onTimer, (when > now) ? when - now : 0, 0);
+}
+
+static void schedule(struct EventBase_Wheel* w)
+{
+    if (!w->pending) {
+        if (!uv_is_closing((uv_handle_t*) &w->timer)) {
+            uv_timer_stop(&w->timer);
+        }
+        return;
+    }
+    arm(w, nextWake(w));
+}
+
+static void insert(struct Timeout* t, uint64_t milliseconds)
+{
+    struct EventBase_Wheel* w = t->wheel;
+    uint64_t now = uv_now(w->base->loop);
+    if (!w->pending && w->now < now) {
+        // Nothing is waiting so there is nothing to process on the way.
+        w->now = now;
+    }
+    t->expires = now + milliseconds;
+    linkAppend(slotFor(w, t->expires), &t->link);
+    w->pending++;
+    if (!uv_is_active((uv_handle_t*) &w->timer) || t->expires < w->armedFor) {
+        arm(w, t->expires);
+    }
+}
+
+static void detach(struct Timeout* t)
+{
+    if (!t->link.next) { return; }
+    linkRemove(&t->link);
+    t->wheel->pending--;
+}
+
+static void fire(struct EventBase_Wheel* w, struct Link* slot)
+{
+    struct Link list;
+    linkTake(&list, slot);
+    // Callbacks may clear or free any timeout in the list so take them one at a time.
+    while (!linkEmpty(&list)) {
+        struct Timeout* t = Identity_check((struct Timeout*) list.next);
+        detach(t);
+        if (t->expires > w->now) {
+            linkAppend(slotFor(w, t->expires), &t->link);
+            w->pending++;
+            continue;
+        }
+        if (t->isInterval) {
+            insert(t, t->milliseconds);
+        }
+        t->callback(t->callbackContext);
+    }
+}
+
+static void cascade(struct EventBase_Wheel* w, uint64_t tick)
+{
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        int shift = WHEEL_BITS * level;
+        if (tick & ((1ull << shift) - 1)) { continue; }
+        struct Link list;
+        linkTake(&list, &w->slots[level][(tick >> shift) & WHEEL_MASK]);
+        while (!linkEmpty(&list)) {
+            struct Link* l = list.next;
+            linkRemove(l);
+            linkAppend(slotFor(w, ((struct Timeout*) l)->expires), l);
+        }
+    }
+}
+
+static void onTimer(uv_timer_t* handle, int status)
+{
+    struct EventBase_Wheel* w = Identity_check((struct EventBase_Wheel*) handle);
+    uint64_t now = uv_now(w->base->loop);
+    fire(w, &w->due);
+    while (w->now < now) {
+        if (!w->pending) {
+            w->now = now;
+            break;
+        }
+        uint64_t tick = w->now + 1;
+        // Move on before cascading, slotFor() measures from w->now and anything which was one
+        // tick short of the next slot would be put back in the slot which is being emptied.
+        w->now = tick;
+        cascade(w, tick);
+        // Cascading puts anything which expires on this tick in the due list.
+        fire(w, &w->due);
+        fire(w, &w->slots[0][tick & WHEEL_MASK]);
+    }
+    schedule(w);
 }
 
-static void onFree2(uv_handle_t* timer)
+static struct EventBase_Wheel* getWheel(struct EventBase_pvt* base)
 {
-    Allocator_onFreeComplete(timer->data);
+    if (base->wheel) { return base->wheel; }
+    struct EventBase_Wheel* w =
+        Allocator_calloc(base->alloc, sizeof(struct EventBase_Wheel), 1);
+    Identity_set(w);
+    w->base = base;
+    w->now = uv_now(base->loop);
+    linkInit(&w->due);
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            linkInit(&w->slots[level][i]);
+        }
+    }
+    uv_timer_init(base->loop, &w->timer);
+    base->wheel = w;
+    return w;
 }
 
 static int onFree(struct Allocator_OnFreeJob* job)
 {
     struct Timeout* t = Identity_check((struct Timeout*) job->userData);
-    t->timer.data = job;
-    uv_close((uv_handle_t*) &t->timer, onFree2);
-    return Allocator_ONFREE_ASYNC;
+    Timeout_clearTimeout(t);
+    t->wheel->base->timeoutCount--;
+    return 0;
 }
 
 /**
@@ -83,23 +320,19 @@ static struct Timeout* setTimeout(void (* const callback)(void* callbackContext)
                                   int line)
 {
     struct EventBase_pvt* base = EventBase_privatize(eventBase);
-    struct Allocator* alloc = Allocator__child(allocator, file, line);
-    struct Timeout* timeout = Allocator_calloc(alloc, sizeof(struct Timeout), 1);
+    struct Timeout* timeout = Allocator__calloc(allocator, sizeof(struct Timeout), 1, file, line);
 
     timeout->callback = callback;
     timeout->callbackContext = callbackContext;
     timeout->milliseconds = milliseconds;
-    timeout->alloc = alloc;
     timeout->isInterval = interval;
+    timeout->wheel = getWheel(base);
     Identity_set(timeout);
 
-    uv_timer_init(base->loop, &timeout->timer);
-    uv_timer_start(&timeout->timer, handleEvent, milliseconds, (interval) ? milliseconds : 0);
-
-    timeout->timer.data = timeout;
-
-    Allocator_onFree(alloc, onFree, timeout);
+    base->timeoutCount++;
+    Allocator__onFree(allocator, onFree, timeout, file, line);
 
+    insert(timeout, milliseconds);
     return timeout;
 }
 
@@ -132,13 +365,16 @@ void Timeout_resetTimeout(struct Timeout* timeout,
                           const uint64_t milliseconds)
 {
     Timeout_clearTimeout(timeout);
-    uv_timer_start(&timeout->timer, handleEvent, milliseconds, 0);
+    timeout->milliseconds = milliseconds;
+    insert(timeout, milliseconds);
 }
 
 /** See: Timeout.h */
 void Timeout_clearTimeout(struct Timeout* timeout)
 {
-    if (!uv_is_closing((uv_handle_t*) &timeout->timer)) {
-        uv_timer_stop(&timeout->timer);
+    Identity_check(timeout);
+    detach(timeout);
+    if (!timeout->wheel->pending) {
+        schedule(timeout->wheel);
     }
 }
@@ -12,11 +12,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#ifdef linux
+    #define _GNU_SOURCE
+#endif
 #include "util/events/libuv/UvWrapper.h"
 #include "exception/Except.h"
 #include "interface/Iface.h"
 #include "util/events/UDPAddrIface.h"
 #include "memory/Allocator.h"
+#include "memory/MessagePool.h"
 #include "util/events/libuv/EventBase_pvt.h"
 #include "util/platform/Sockaddr.h"
 #include "util/Assert.h"
@@ -24,6 +28,49 @@
 #include "wire/Message.h"
 #include "wire/Error.h"
 #include "util/Hex.h"
+#include "util/events/Timeout.h"
+
+#ifdef linux
+    #include <sys/socket.h>
+    #include <errno.h>
+    #include <string.h>
+    #include <unistd.h>
+
+/**
+ * Buffers for recvmmsg() and sendmmsg(), each array has batchSize entries.
+ * Receive slots each have their own allocator which is handed off with the message
+ * so that a message can be held on to after the callback, a slot is refilled at the
+ * beginning of the next read.
+ */
+struct UDPAddrIface_Batch
+{
+    uint32_t batchSize;
+
+    struct mmsghdr* rxMsgs;
+    struct iovec* rxIov;
+    struct Sockaddr_storage* rxAddrs;
+    struct Allocator** rxAllocs;
+
+    /** The received messages, passed up together with one Iface_sendBatch(). */
+    struct Message** rxOut;
+
+    struct mmsghdr* txMsgs;
+    struct iovec* txIov;
+    struct Sockaddr_storage* txAddrs;
+    uint8_t* txBuffers;
+
+    /** Entries between txStart and txCount are waiting to be sent. */
+    uint32_t txStart;
+    uint32_t txCount;
+
+    /** Set when there is a flush scheduled for the end of the event loop turn. */
+    int txFlushPending;
+    struct Timeout* txFlush;
+
+    uv_poll_t uvPoll;
+    int pollEvents;
+};
+#endif
 
 struct UDPAddrIface_pvt
 {
@@ -31,8 +78,13 @@ struct UDPAddrIface_pvt
 
     struct Allocator* allocator;
 
+    /** Receive buffers come from here so that incoming packets don't cost a malloc(). */
+    struct MessagePool* pool;
+
     struct Log* logger;
 
+    struct EventBase* eventBase;
+
     /** Job to close the handle when the allocator is freed */
     struct Allocator_OnFreeJob* closeHandleOnFree;
 
@@ -45,6 +97,11 @@ struct UDPAddrIface_pvt
     /** true if we are inside of the callback, used by blockFreeInsideCallback */
     int inCallback;
 
+    #ifdef linux
+        /** Non-null if UDPAddrIface_setBatchSize() was used. */
+        struct UDPAddrIface_Batch* batch;
+    #endif
+
     Identity
 };
 
@@ -78,6 +135,11 @@ static void sendComplete(uv_udp_send_t* uvReq, int error)
 }
 
 
+#ifdef linux
+static void queueSend(struct UDPAddrIface_pvt* context, struct Message* m);
+static void flushTx(void* vcontext);
+#endif
+
 static Iface_DEFUN incomingFromIface(struct Message* m, struct Iface* iface)
 {
     struct UDPAddrIface_pvt* context = Identity_check((struct UDPAddrIface_pvt*) iface);
@@ -89,6 +151,13 @@ static Iface_DEFUN incomingFromIface(struct Message* m, struct Iface* iface)
         return NULL;
     }
 
+    #ifdef linux
+        if (context->batch) {
+            queueSend(context, m);
+            return NULL;
+        }
+    #endif
+
     if (context->queueLen > UDPAddrIface_MAX_QUEUE) {
         Log_warn(context->logger, "DROP Maximum queue length reached");
         return NULL;
@@ -134,11 +203,60 @@ static Iface_DEFUN incomingFromIface(struct Message* m, struct Iface* iface)
     return NULL;
 }
 
+static void incomingBatchFromIface(struct Message** msgs, int count, struct Iface* iface)
+{
+    struct UDPAddrIface_pvt* context = Identity_check((struct UDPAddrIface_pvt*) iface);
+    for (int i = 0; i < count; i++) {
+        Iface_CALL(incomingFromIface, msgs[i], iface);
+    }
+    #ifdef linux
+        if (context->batch && context->batch->txFlushPending) {
+            Timeout_clearTimeout(context->batch->txFlush);
+            flushTx(context);
+        }
+    #endif
+}
+
 #if UDPAddrIface_PADDING_AMOUNT < 8
     #error
 #endif
 #define ALLOC(buff) (((struct Allocator**) &(buff[-(8 + (((uintptr_t)buff) % 8))]))[0])
 
+static struct Message* newMessage(struct UDPAddrIface_pvt* context,
+                                  struct Allocator* alloc,
+                                  uint8_t* buff,
+                                  ssize_t nread,
+                                  const struct sockaddr* addr)
+{
+    struct Message* m = Allocator_calloc(alloc, sizeof(struct Message), 1);
+    m->length = nread;
+    m->padding = UDPAddrIface_PADDING_AMOUNT + context->pub.generic.addr->addrLen;
+    m->capacity = UDPAddrIface_BUFFER_CAP;
+    m->bytes = buff;
+    m->alloc = alloc;
+    Message_push(m, addr, context->pub.generic.addr->addrLen - Sockaddr_OVERHEAD, NULL);
+
+    // make sure the sockaddr doesn't have crap in it which will
+    // prevent it from being used as a lookup key
+    Sockaddr_normalizeNative((struct sockaddr*) m->bytes);
+
+    Message_push(m, context->pub.generic.addr, Sockaddr_OVERHEAD, NULL);
+
+    /*uint8_t buff[256] = {0};
+    Assert_true(Hex_encode(buff, 255, m->bytes, context->pub.generic.addr->addrLen));
+    Log_debug(context->logger, "Message from [%s]", buff);*/
+
+    return m;
+}
+
+static void endCallback(struct UDPAddrIface_pvt* context)
+{
+    context->inCallback = 0;
+    if (context->blockFreeInsideCallback) {
+        Allocator_onFreeComplete((struct Allocator_OnFreeJob*) context->blockFreeInsideCallback);
+    }
+}
+
 static void incoming(uv_udp_t* handle,
                      ssize_t nread,
                      const uv_buf_t* buf,
@@ -158,24 +276,7 @@ static void incoming(uv_udp_t* handle,
         //Log_debug(context->logger, "0 length read");
 
     } else {
-        struct Message* m = Allocator_calloc(alloc, sizeof(struct Message), 1);
-        m->length = nread;
-        m->padding = UDPAddrIface_PADDING_AMOUNT + context->pub.generic.addr->addrLen;
-        m->capacity = buf->len;
-        m->bytes = (uint8_t*)buf->base;
-        m->alloc = alloc;
-        Message_push(m, addr, context->pub.generic.addr->addrLen - Sockaddr_OVERHEAD, NULL);
-
-        // make sure the sockaddr doesn't have crap in it which will
-        // prevent it from being used as a lookup key
-        Sockaddr_normalizeNative((struct sockaddr*) m->bytes);
-
-        Message_push(m, context->pub.generic.addr, Sockaddr_OVERHEAD, NULL);
-
-        /*uint8_t buff[256] = {0};
-        Assert_true(Hex_encode(buff, 255, m->bytes, context->pub.generic.addr->addrLen));
-        Log_debug(context->logger, "Message from [%s]", buff);*/
-
+        struct Message* m = newMessage(context, alloc, (uint8_t*)buf->base, nread, addr);
         Iface_send(&context->pub.generic.iface, m);
     }
 
@@ -183,29 +284,154 @@ static void incoming(uv_udp_t* handle,
         Allocator_free(alloc);
     }
 
-    context->inCallback = 0;
-    if (context->blockFreeInsideCallback) {
-        Allocator_onFreeComplete((struct Allocator_OnFreeJob*) context->blockFreeInsideCallback);
-    }
+    endCallback(context);
+}
+
+static char* newBuffer(struct UDPAddrIface_pvt* context, struct Allocator* child)
+{
+    size_t fullSize = UDPAddrIface_BUFFER_CAP + UDPAddrIface_PADDING_AMOUNT
+        + context->pub.generic.addr->addrLen;
+    char* buff = Allocator_malloc(child, fullSize);
+    return buff + UDPAddrIface_PADDING_AMOUNT + context->pub.generic.addr->addrLen;
 }
 
 static void allocate(uv_handle_t* handle, size_t size, uv_buf_t* buf)
 {
     struct UDPAddrIface_pvt* context = ifaceForHandle((uv_udp_t*)handle);
 
-    size = UDPAddrIface_BUFFER_CAP;
-    size_t fullSize = size + UDPAddrIface_PADDING_AMOUNT + context->pub.generic.addr->addrLen;
-
-    struct Allocator* child = Allocator_child(context->allocator);
-    char* buff = Allocator_malloc(child, fullSize);
-    buff += UDPAddrIface_PADDING_AMOUNT + context->pub.generic.addr->addrLen;
+    struct Allocator* child = MessagePool_child(context->pool, context->allocator);
+    char* buff = newBuffer(context, child);
 
     ALLOC(buff) = child;
 
     buf->base = buff;
-    buf->len = size;
+    buf->len = UDPAddrIface_BUFFER_CAP;
 }
 
+#ifdef linux
+static void updatePoll(struct UDPAddrIface_pvt* context, int events);
+
+static void flushTx(void* vcontext)
+{
+    struct UDPAddrIface_pvt* context = Identity_check((struct UDPAddrIface_pvt*) vcontext);
+    struct UDPAddrIface_Batch* b = context->batch;
+    b->txFlushPending = 0;
+    while (b->txStart < b->txCount) {
+        int rc = sendmmsg(context->uvHandle.io_watcher.fd,
+                          &b->txMsgs[b->txStart],
+                          b->txCount - b->txStart,
+                          0);
+        if (rc > 0) {
+            b->txStart += rc;
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Try again when the socket becomes writable.
+            updatePoll(context, UV_READABLE | UV_WRITABLE);
+            return;
+        }
+        // Drop the datagram which failed and carry on with the rest.
+        Log_debug(context->logger, "DROP Failed writing to UDPAddrIface [%s]", strerror(errno));
+        b->txStart++;
+    }
+    b->txStart = b->txCount = 0;
+    updatePoll(context, UV_READABLE);
+}
+
+/**
+ * Copy the datagram into the send batch, the batch is sent with one sendmmsg() at the end of
+ * the event loop turn or as soon as it fills up.
+ */
+static void queueSend(struct UDPAddrIface_pvt* context, struct Message* m)
+{
+    struct UDPAddrIface_Batch* b = context->batch;
+    if (b->txCount == b->batchSize) {
+        Log_warn(context->logger, "DROP Maximum queue length reached");
+        return;
+    }
+
+    struct Sockaddr_storage ss;
+    Message_pop(m, &ss, context->pub.generic.addr->addrLen, NULL);
+    Assert_true(ss.addr.addrLen == context->pub.generic.addr->addrLen);
+    if (m->length > UDPAddrIface_BUFFER_CAP) {
+        Log_debug(context->logger, "DROP oversize datagram [%d]", m->length);
+        return;
+    }
+
+    uint32_t i = b->txCount++;
+    Bits_memcpy(&b->txBuffers[i * UDPAddrIface_BUFFER_CAP], m->bytes, m->length);
+    Bits_memcpy(b->txAddrs[i].nativeAddr, ss.nativeAddr, ss.addr.addrLen - Sockaddr_OVERHEAD);
+    b->txMsgs[i].msg_hdr.msg_namelen = ss.addr.addrLen - Sockaddr_OVERHEAD;
+    b->txIov[i].iov_len = m->length;
+
+    if (b->txCount == b->batchSize) {
+        flushTx(context);
+    } else if (!b->txFlushPending && !(b->pollEvents & UV_WRITABLE)) {
+        b->txFlushPending = 1;
+        Timeout_resetTimeout(b->txFlush, 0);
+    }
+}
+
+static void receiveBatch(struct UDPAddrIface_pvt* context)
+{
+    struct UDPAddrIface_Batch* b = context->batch;
+    for (uint32_t i = 0; i < b->batchSize; i++) {
+        if (!b->rxAllocs[i]) {
+            b->rxAllocs[i] = MessagePool_child(context->pool, context->allocator);
+            b->rxIov[i].iov_base = newBuffer(context, b->rxAllocs[i]);
+        }
+        b->rxMsgs[i].msg_hdr.msg_namelen = sizeof(b->rxAddrs[i].nativeAddr);
+    }
+
+    int count = recvmmsg(context->uvHandle.io_watcher.fd, b->rxMsgs, b->batchSize, 0, NULL);
+    if (count < 0) {
+        // The buffers are kept for the next try, as libuv does for recvmsg().
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            Log_info(context->logger, "Failed reading from UDPAddrIface [%s]", strerror(errno));
+        }
+        return;
+    }
+
+    context->inCallback = 1;
+    int outCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (!b->rxMsgs[i].msg_len) { continue; }
+        b->rxOut[outCount++] = newMessage(context,
+                                          b->rxAllocs[i],
+                                          (uint8_t*) b->rxIov[i].iov_base,
+                                          b->rxMsgs[i].msg_len,
+                                          (struct sockaddr*) b->rxAddrs[i].nativeAddr);
+    }
+    if (outCount) {
+        Iface_sendBatch(&context->pub.generic.iface, b->rxOut, outCount);
+    }
+    for (int i = 0; i < count; i++) {
+        Allocator_free(b->rxAllocs[i]);
+        b->rxAllocs[i] = NULL;
+    }
+    endCallback(context);
+}
+
+static void onPoll(uv_poll_t* handle, int status, int events)
+{
+    struct UDPAddrIface_pvt* context = Identity_check((struct UDPAddrIface_pvt*) handle->data);
+    if (status) { return; }
+    if (events & UV_WRITABLE) {
+        flushTx(context);
+    }
+    if (events & UV_READABLE) {
+        receiveBatch(context);
+    }
+}
+
+static void updatePoll(struct UDPAddrIface_pvt* context, int events)
+{
+    if (context->batch->pollEvents == events) { return; }
+    context->batch->pollEvents = events;
+    uv_poll_start(&context->batch->uvPoll, events, onPoll);
+}
+#endif
+
 static void onClosed(uv_handle_t* wasClosed)
 {
     struct UDPAddrIface_pvt* context =
@@ -213,11 +439,27 @@ static void onClosed(uv_handle_t* wasClosed)
     Allocator_onFreeComplete((struct Allocator_OnFreeJob*) context->closeHandleOnFree);
 }
 
+#ifdef linux
+static void onPollClosed(uv_handle_t* wasClosed)
+{
+    struct UDPAddrIface_pvt* context =
+        Identity_check((struct UDPAddrIface_pvt*) wasClosed->data);
+    uv_close((uv_handle_t*)&context->uvHandle, onClosed);
+}
+#endif
+
 static int closeHandleOnFree(struct Allocator_OnFreeJob* job)
 {
     struct UDPAddrIface_pvt* context =
         Identity_check((struct UDPAddrIface_pvt*) job->userData);
     context->closeHandleOnFree = job;
+    #ifdef linux
+        // The poll handle shares the fd with uvHandle so it must be stopped first.
+        if (context->batch) {
+            uv_close((uv_handle_t*)&context->batch->uvPoll, onPollClosed);
+            return Allocator_ONFREE_ASYNC;
+        }
+    #endif
     uv_close((uv_handle_t*)&context->uvHandle, onClosed);
     return Allocator_ONFREE_ASYNC;
 }
@@ -252,21 +494,99 @@ int UDPAddrIface_setDSCP(struct UDPAddrIface* iface, uint8_t dscp)
     return res;
 }
 
-struct UDPAddrIface* UDPAddrIface_new(struct EventBase* eventBase,
-                                      struct Sockaddr* addr,
-                                      struct Allocator* alloc,
-                                      struct Except* exHandler,
-                                      struct Log* logger)
+int UDPAddrIface_setBatchSize(struct UDPAddrIface* iface, uint32_t batchSize)
+{
+    #ifdef linux
+        struct UDPAddrIface_pvt* context = Identity_check((struct UDPAddrIface_pvt*) iface);
+        if (context->batch || context->queueLen || !batchSize) {
+            return -1;
+        }
+        if (batchSize > UDPAddrIface_MAX_BATCH_SIZE) {
+            batchSize = UDPAddrIface_MAX_BATCH_SIZE;
+        }
+        struct Allocator* alloc = context->allocator;
+        struct UDPAddrIface_Batch* b =
+            Allocator_calloc(alloc, sizeof(struct UDPAddrIface_Batch), 1);
+        b->batchSize = batchSize;
+        b->rxMsgs = Allocator_calloc(alloc, sizeof(struct mmsghdr), batchSize);
+        b->rxIov = Allocator_calloc(alloc, sizeof(struct iovec), batchSize);
+        b->rxAddrs = Allocator_calloc(alloc, sizeof(struct Sockaddr_storage), batchSize);
+        b->rxAllocs = Allocator_calloc(alloc, sizeof(struct Allocator*), batchSize);
+        b->rxOut = Allocator_calloc(alloc, sizeof(struct Message*), batchSize);
+        b->txMsgs = Allocator_calloc(alloc, sizeof(struct mmsghdr), batchSize);
+        b->txIov = Allocator_calloc(alloc, sizeof(struct iovec), batchSize);
+        b->txAddrs = Allocator_calloc(alloc, sizeof(struct Sockaddr_storage), batchSize);
+        b->txBuffers = Allocator_malloc(alloc, UDPAddrIface_BUFFER_CAP * batchSize);
+        for (uint32_t i = 0; i < batchSize; i++) {
+            b->rxIov[i].iov_len = UDPAddrIface_BUFFER_CAP;
+            b->rxMsgs[i].msg_hdr.msg_name = b->rxAddrs[i].nativeAddr;
+            b->rxMsgs[i].msg_hdr.msg_iov = &b->rxIov[i];
+            b->rxMsgs[i].msg_hdr.msg_iovlen = 1;
+            b->txIov[i].iov_base = &b->txBuffers[i * UDPAddrIface_BUFFER_CAP];
+            b->txMsgs[i].msg_hdr.msg_name = b->txAddrs[i].nativeAddr;
+            b->txMsgs[i].msg_hdr.msg_iov = &b->txIov[i];
+            b->txMsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Take the socket away from libuv's udp handle, from now on it is only polled.
+        uv_udp_recv_stop(&context->uvHandle);
+        uv_poll_init(context->uvHandle.loop, &b->uvPoll, context->uvHandle.io_watcher.fd);
+        b->uvPoll.data = context;
+        context->batch = b;
+        updatePoll(context, UV_READABLE);
+
+        b->txFlush = Timeout_setTimeout(flushTx, context, 0, context->eventBase, alloc);
+        Timeout_clearTimeout(b->txFlush);
+        return 0;
+    #else
+        return -1;
+    #endif
+}
+
+#ifdef linux
+static int bindReusePort(uv_udp_t* handle, struct Sockaddr* addr)
+{
+    #ifdef SO_REUSEPORT
+        struct sockaddr* native = Sockaddr_asNative(addr);
+        // uv_udp_open() does not make the socket non-blocking.
+        int fd = socket(native->sa_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        // libuv errors are negative errno on unix.
+        if (fd < 0) { return -errno; }
+        int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one)
+            || bind(fd, native, addr->addrLen - Sockaddr_OVERHEAD))
+        {
+            int err = errno;
+            close(fd);
+            return -err;
+        }
+        return uv_udp_open(handle, fd);
+    #else
+        return UV_ENOTSUP;
+    #endif
+}
+#endif
+
+static struct UDPAddrIface* newIface(struct EventBase* eventBase,
+                                     struct Sockaddr* addr,
+                                     bool reusePort,
+                                     struct Allocator* alloc,
+                                     struct Except* exHandler,
+                                     struct Log* logger)
 {
     struct EventBase_pvt* base = EventBase_privatize(eventBase);
 
     struct UDPAddrIface_pvt* context =
         Allocator_clone(alloc, (&(struct UDPAddrIface_pvt) {
             .logger = logger,
-            .allocator = alloc
+            .eventBase = eventBase,
+            .allocator = alloc,
+            .pool = MessagePool_new(alloc, UDPAddrIface_BUFFER_CAP + UDPAddrIface_PADDING_AMOUNT
+                + sizeof(struct Sockaddr_storage))
         }));
     context->pub.generic.alloc = alloc;
     context->pub.generic.iface.send = incomingFromIface;
+    context->pub.generic.iface.sendBatch = incomingBatchFromIface;
     Identity_set(context);
 
     if (addr) {
@@ -284,7 +604,15 @@ struct UDPAddrIface* UDPAddrIface_new(struct EventBase* eventBase,
 
     int ret;
     void* native = Sockaddr_asNative(addr);
-    ret = uv_udp_bind(&context->uvHandle, (const struct sockaddr*)native, 0);
+    if (reusePort) {
+        #ifdef linux
+            ret = bindReusePort(&context->uvHandle, addr);
+        #else
+            ret = UV_ENOTSUP;
+        #endif
+    } else {
+        ret = uv_udp_bind(&context->uvHandle, (const struct sockaddr*)native, 0);
+    }
 
     if (ret) {
         Except_throw(exHandler, "call to uv_udp_bind() failed [%s]",
@@ -316,3 +644,21 @@ struct UDPAddrIface* UDPAddrIface_new(struct EventBase* eventBase,
 
     return &context->pub;
 }
+
+struct UDPAddrIface* UDPAddrIface_new(struct EventBase* eventBase,
+                                      struct Sockaddr* addr,
+                                      struct Allocator* alloc,
+                                      struct Except* exHandler,
+                                      struct Log* logger)
+{
+    return newIface(eventBase, addr, false, alloc, exHandler, logger);
+}
+
+struct UDPAddrIface* UDPAddrIface_newShared(struct EventBase* eventBase,
+                                            struct Sockaddr* addr,
+                                            struct Allocator* alloc,
+                                            struct Except* exHandler,
+                                            struct Log* logger)
+{
+    return newIface(eventBase, addr, true, alloc, exHandler, logger);
+}
@@ -0,0 +1,138 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "exception/Jmp.h"
+#include "interface/Iface.h"
+#include "memory/Allocator.h"
+#include "util/events/ThreadIface.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/events/UDPShards.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+/** Given to a shard's thread, the results are written before ThreadIface_new() returns. */
+struct ShardSetup
+{
+    struct Sockaddr* bindAddr;
+    uint32_t batchSize;
+    uint8_t dscp;
+
+    /** The address which the shard was bound to, addrLen is zero if it failed. */
+    struct Sockaddr_storage bound;
+    char error[128];
+};
+
+struct Shard
+{
+    /** Plumbed to the shard's ThreadIface. */
+    struct Iface iface;
+    struct UDPShards_pvt* shards;
+    Identity
+};
+
+struct UDPShards_pvt
+{
+    struct UDPShards pub;
+    struct Shard* shards;
+    Identity
+};
+
+static void startShard(struct Iface* iface,
+                       struct Allocator* alloc,
+                       struct EventBase* base,
+                       struct Log* log,
+                       struct Random* rand,
+                       void* vSetup)
+{
+    struct ShardSetup* setup = vSetup;
+    struct Jmp jmp;
+    Jmp_try(jmp) {
+        struct UDPAddrIface* udp =
+            UDPAddrIface_newShared(base, setup->bindAddr, alloc, &jmp.handler, log);
+        if (setup->batchSize && UDPAddrIface_setBatchSize(udp, setup->batchSize)) {
+            Log_warn(log, "Set batchSize failed");
+        }
+        if (setup->dscp && UDPAddrIface_setDSCP(udp, setup->dscp)) {
+            Log_warn(log, "Set DSCP failed");
+        }
+        Iface_plumb(iface, &udp->generic.iface);
+        Bits_memcpy(&setup->bound, udp->generic.addr, udp->generic.addr->addrLen);
+    } Jmp_catch {
+        CString_strncpy(setup->error, jmp.message, sizeof(setup->error) - 1);
+    }
+}
+
+static Iface_DEFUN fromShard(struct Message* msg, struct Iface* iface)
+{
+    struct Shard* shard = Identity_check((struct Shard*) iface);
+    return Iface_next(&shard->shards->pub.generic.iface, msg);
+}
+
+static Iface_DEFUN toShard(struct Message* msg, struct Iface* iface)
+{
+    struct UDPShards_pvt* ctx =
+        Identity_containerOf(iface, struct UDPShards_pvt, pub.generic.iface);
+    Assert_true(msg->length >= ctx->pub.generic.addr->addrLen);
+    uint32_t i = Sockaddr_hash((struct Sockaddr*) msg->bytes) % ctx->pub.count;
+    return Iface_next(&ctx->shards[i].iface, msg);
+}
+
+struct UDPShards* UDPShards_new(struct EventBase* base,
+                                struct Sockaddr* bindAddr,
+                                uint32_t count,
+                                uint32_t batchSize,
+                                uint8_t dscp,
+                                struct Allocator* allocator,
+                                struct Except* eh,
+                                struct Log* logger)
+{
+    if (!count || count > UDPShards_MAX) {
+        Except_throw(eh, "shards must be between 1 and [%d]", UDPShards_MAX);
+    }
+    struct Allocator* alloc = Allocator_child(allocator);
+    struct UDPShards_pvt* ctx = Allocator_calloc(alloc, sizeof(struct UDPShards_pvt), 1);
+    Identity_set(ctx);
+    ctx->pub.count = count;
+    ctx->pub.generic.alloc = alloc;
+    ctx->pub.generic.iface.send = toShard;
+    ctx->shards = Allocator_calloc(alloc, sizeof(struct Shard), count);
+
+    struct ShardSetup setup = { .bindAddr = bindAddr, .batchSize = batchSize, .dscp = dscp };
+    for (uint32_t i = 0; i < count; i++) {
+        struct ThreadIface* ti =
+            ThreadIface_new(startShard, &setup, UDPShards_THREAD_MEMORY, base, logger, alloc);
+        if (!setup.bound.addr.addrLen) {
+            Allocator_free(alloc);
+            Except_throw(eh, "shard [%u] failed [%s]", i, setup.error);
+        }
+        // The rest share whichever port the first one got.
+        if (!i) {
+            ctx->pub.generic.addr = Sockaddr_clone(&setup.bound.addr, alloc);
+            setup.bindAddr = ctx->pub.generic.addr;
+        }
+        setup.bound.addr.addrLen = 0;
+
+        struct Shard* shard = &ctx->shards[i];
+        Identity_set(shard);
+        shard->shards = ctx;
+        shard->iface.send = fromShard;
+        Iface_plumb(&shard->iface, &ti->iface);
+    }
+    Log_info(logger, "Bound [%u] shards to [%s]", count,
+             Sockaddr_print(ctx->pub.generic.addr, alloc));
+    return &ctx->pub;
+}
@@ -0,0 +1,115 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/Work.h"
+#include "util/Identity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Work
+{
+    uv_work_t req;
+
+    void (* work)(void* userData);
+    void (* complete)(void* userData);
+    void* userData;
+
+    /** True once the work function has returned. */
+    int done;
+
+    /** If the allocator is freed while the work is running, the free is held here. */
+    struct Allocator_OnFreeJob* onFree;
+
+    Identity
+};
+
+/** Number of threads in the pool, zero until it is started. */
+static uint32_t threadCount = 0;
+
+static void doWork(uv_work_t* req)
+{
+    struct Work* w = (struct Work*) req->data;
+    w->work(w->userData);
+}
+
+static void afterWork(uv_work_t* req, int status)
+{
+    struct Work* w = Identity_check((struct Work*) req->data);
+    w->done = 1;
+    if (w->onFree) {
+        Allocator_onFreeComplete(w->onFree);
+        return;
+    }
+    w->complete(w->userData);
+}
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct Work* w = Identity_check((struct Work*) job->userData);
+    if (w->done) {
+        return 0;
+    }
+    w->onFree = job;
+    return Allocator_ONFREE_ASYNC;
+}
+
+static void noWork(uv_work_t* req)
+{
+}
+
+int Work_startThreads(uint32_t count, struct EventBase* eventBase)
+{
+    if (threadCount) {
+        return (count == threadCount) ? 0 : -1;
+    }
+    threadCount = count;
+
+    // libuv sizes the pool from the environment when the first work is queued.
+    static char env[32];
+    snprintf(env, sizeof env, "UV_THREADPOOL_SIZE=%u", count);
+    putenv(env);
+
+    // Queue an empty job so that the threads are created now, not when the first work comes.
+    static uv_work_t warmup;
+    uv_queue_work(EventBase_privatize(eventBase)->loop, &warmup, noWork, NULL);
+    return 0;
+}
+
+uint32_t Work_threadCount(void)
+{
+    return threadCount;
+}
+
+void Work_queue(void (* work)(void* userData),
+                void (* complete)(void* userData),
+                void* userData,
+                struct EventBase* eventBase,
+                struct Allocator* alloc)
+{
+    if (!threadCount) {
+        Work_startThreads(Work_DEFAULT_THREADS, eventBase);
+    }
+    struct Work* w = Allocator_calloc(alloc, sizeof(struct Work), 1);
+    w->work = work;
+    w->complete = complete;
+    w->userData = userData;
+    w->req.data = w;
+    Identity_set(w);
+    Allocator_onFree(alloc, onFree, w);
+    uv_queue_work(EventBase_privatize(eventBase)->loop, &w->req, doWork, afterWork);
+}
@@ -19,6 +19,7 @@
 #include "wire/Message.h"
 #include "util/AddrTools.h"
 #include "util/Assert.h"
+#include "util/Bits.h"
 
 #include <stdbool.h>
 #include <string.h>
@@ -359,6 +360,18 @@ static void bitShave(uint8_t* address, int prefix, int af)
     }
 }
 
+static void sendBatch(int sock, uint8_t* batch, int batchLen, struct Except* eh)
+{
+    ssize_t sz = send(sock, batch, batchLen, 0);
+    if (sz < 0) {
+        Except_throw(eh, "send() -> %s", strerror(errno));
+    }
+}
+
+/**
+ * The requests are packed back to back and sent up to BUFF_SZ bytes at a time,
+ * the kernel handles each one in turn even if an earlier one fails.
+ */
 static void addDeleteRoutes(int sock,
                             bool delete,
                             struct RouteInfo* ri,
@@ -366,6 +379,8 @@ static void addDeleteRoutes(int sock,
                             struct Except* eh)
 {
     struct Message* msg = Message_new(0, 512, tempAlloc);
+    uint8_t* batch = Allocator_malloc(tempAlloc, BUFF_SZ);
+    int batchLen = 0;
     for (;ri;ri = ri->next) {
         struct IfIndexAttr ifa = {
             .rta = {
@@ -395,12 +410,17 @@ static void addDeleteRoutes(int sock,
             .nlmsg_flags = NLM_F_REQUEST | ((delete) ? 0 : NLM_F_CREATE) // | NLM_F_ACK,
         };
         Message_push(msg, &hdr, sizeof(struct nlmsghdr), NULL);
-        ssize_t sz = send(sock, msg->bytes, msg->length, 0);
-        if (sz < 0) {
-            Except_throw(eh, "send() -> %s", strerror(errno));
+        if (batchLen + msg->length > BUFF_SZ) {
+            sendBatch(sock, batch, batchLen, eh);
+            batchLen = 0;
         }
+        Bits_memcpy(&batch[batchLen], msg->bytes, msg->length);
+        batchLen += msg->length;
         Message_reset(msg);
     }
+    if (batchLen) {
+        sendBatch(sock, batch, batchLen, eh);
+    }
 }
 
 static int closeSocket(struct Allocator_OnFreeJob* job)
@@ -442,6 +462,70 @@ static struct RouteInfo* riForSockaddrs(struct Sockaddr** prefixSet,
     return out;
 }
 
+struct RouteKey {
+    uint8_t dstAddr[16];
+    uint32_t af;
+    uint32_t prefix;
+};
+#define Map_NAME OfRoutesByKey
+#define Map_KEY_TYPE struct RouteKey
+#define Map_VALUE_TYPE struct RouteInfo*
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
+static void keyForRoute(struct RouteKey* key, struct RouteInfo* ri)
+{
+    Bits_memset(key, 0, sizeof(struct RouteKey));
+    Bits_memcpy(key->dstAddr, ri->dstAddr, (ri->af == AF_INET6) ? 16 : 4);
+    bitShave(key->dstAddr, ri->prefix, ri->af);
+    key->af = ri->af;
+    key->prefix = ri->prefix;
+}
+
+/**
+ * Reduce oldRi to the routes which are not in newRi and newRi to the routes which are not
+ * in oldRi, routes which are in both are left in place rather than deleted and re-added.
+ */
+static void routeDelta(struct RouteInfo** oldRi,
+                       struct RouteInfo** newRi,
+                       struct Allocator* tempAlloc)
+{
+    struct Map_OfRoutesByKey* old = Map_OfRoutesByKey_new(tempAlloc);
+    struct RouteInfo* toDelete = NULL;
+    struct RouteKey key;
+    for (struct RouteInfo* ri = *oldRi; ri;) {
+        struct RouteInfo* next = ri->next;
+        keyForRoute(&key, ri);
+        if (Map_OfRoutesByKey_indexForKey(&key, old) > -1) {
+            // duplicate, only one of them will be kept.
+            ri->next = toDelete;
+            toDelete = ri;
+        } else {
+            Map_OfRoutesByKey_put(&key, &ri, old);
+        }
+        ri = next;
+    }
+    struct RouteInfo* toAdd = NULL;
+    for (struct RouteInfo* ri = *newRi; ri;) {
+        struct RouteInfo* next = ri->next;
+        keyForRoute(&key, ri);
+        int index = Map_OfRoutesByKey_indexForKey(&key, old);
+        if (index > -1) {
+            Map_OfRoutesByKey_remove(index, old);
+        } else {
+            ri->next = toAdd;
+            toAdd = ri;
+        }
+        ri = next;
+    }
+    for (int i = 0; i < (int)old->count; i++) {
+        old->values[i]->next = toDelete;
+        toDelete = old->values[i];
+    }
+    *oldRi = toDelete;
+    *newRi = toAdd;
+}
+
 static void logRis(struct RouteInfo* ri, struct Log* logger, char* msg)
 {
     for (; ri; ri = ri->next) {
@@ -467,6 +551,7 @@ void NetPlatform_setRoutes(const char* ifName,
     struct RouteInfo* newRi = riForSockaddrs(prefixSet, prefixCount, ifIndex, tempAlloc);
     int sock = mkSocket(tempAlloc, eh);
     struct RouteInfo* oldRi = getRoutes(sock, ifIndex, tempAlloc, eh);
+    routeDelta(&oldRi, &newRi, tempAlloc);
     logRis(oldRi, logger, "DELETE ROUTE");
     addDeleteRoutes(sock, true, oldRi, tempAlloc, eh);
     logRis(newRi, logger, "ADD ROUTE");
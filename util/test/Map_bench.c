@@ -0,0 +1,87 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "test/Bench.h"
+#include "util/Assert.h"
+
+#define Map_NAME OfNumbers
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#include "util/Map.h"
+
+#define Map_NAME OfNumbersHashed
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
+#define ENTRIES 1024
+
+struct Context
+{
+    struct Map_OfNumbers* map;
+    struct Map_OfNumbersHashed* hashed;
+    uint32_t keys[ENTRIES];
+};
+
+static void lookup(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        found += (Map_OfNumbers_indexForKey(&ctx->keys[i % ENTRIES], ctx->map) > -1);
+    }
+    Assert_true(found == count);
+}
+
+static void lookupHashed(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        found += (Map_OfNumbersHashed_indexForKey(&ctx->keys[i % ENTRIES], ctx->hashed) > -1);
+    }
+    Assert_true(found == count);
+}
+
+static void putRemoveHashed(void* vcontext, uint64_t count)
+{
+    struct Context* ctx = vcontext;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t* key = &ctx->keys[i % ENTRIES];
+        int index = Map_OfNumbersHashed_indexForKey(key, ctx->hashed);
+        Map_OfNumbersHashed_remove(index, ctx->hashed);
+        Assert_true(Map_OfNumbersHashed_put(key, key, ctx->hashed) > -1);
+    }
+}
+
+int main(struct Bench* bench)
+{
+    struct Context* ctx = Allocator_calloc(bench->alloc, sizeof(struct Context), 1);
+    ctx->map = Map_OfNumbers_new(bench->alloc);
+    ctx->hashed = Map_OfNumbersHashed_new(bench->alloc);
+    for (int i = 0; i < ENTRIES; i++) {
+        // Skip duplicates so that every key is found.
+        do {
+            ctx->keys[i] = Random_uint32(bench->rand);
+        } while (Map_OfNumbers_indexForKey(&ctx->keys[i], ctx->map) > -1);
+        Map_OfNumbers_put(&ctx->keys[i], &ctx->keys[i], ctx->map);
+        Map_OfNumbersHashed_put(&ctx->keys[i], &ctx->keys[i], ctx->hashed);
+    }
+
+    Bench_run(bench, "lookup", lookup, ctx);
+    Bench_run(bench, "lookupHashed", lookupHashed, ctx);
+    Bench_run(bench, "putRemoveHashed", putRemoveHashed, ctx);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+
+#define Map_NAME OfLongsByInteger
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint64_t
+#define Map_ENABLE_HANDLES
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
+#define Map_NAME UnorderedLongsByInteger
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint64_t
+#define Map_USE_HASHTABLE
+#include "util/Map.h"
+
+#include <stdbool.h>
+
+#define KEYSPACE 512
+#define OPERATIONS 20000
+
+/**
+ * Apply random puts and removes to both flavors of hashed map and check every key against
+ * a flat array which holds the expected state.
+ */
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+
+    struct Map_OfLongsByInteger* ordered = Map_OfLongsByInteger_new(alloc);
+    struct Map_UnorderedLongsByInteger* unordered = Map_UnorderedLongsByInteger_new(alloc);
+    uint64_t* expected = Allocator_calloc(alloc, sizeof(uint64_t), KEYSPACE);
+
+    for (int i = 0; i < OPERATIONS; i++) {
+        uint32_t key = Random_uint32(rand) % KEYSPACE;
+        if (Random_uint8(rand) & 1) {
+            uint64_t val = Random_uint64(rand) | 1;
+            Assert_true(Map_OfLongsByInteger_put(&key, &val, ordered) > -1);
+            Assert_true(Map_UnorderedLongsByInteger_put(&key, &val, unordered) > -1);
+            expected[key] = val;
+        } else {
+            int index = Map_OfLongsByInteger_indexForKey(&key, ordered);
+            Assert_true((index > -1) == (expected[key] != 0));
+            Map_OfLongsByInteger_remove(index, ordered);
+            index = Map_UnorderedLongsByInteger_indexForKey(&key, unordered);
+            Assert_true((index > -1) == (expected[key] != 0));
+            Map_UnorderedLongsByInteger_remove(index, unordered);
+            expected[key] = 0;
+        }
+
+        if (i % 100) { continue; }
+        uint32_t count = 0;
+        for (uint32_t k = 0; k < KEYSPACE; k++) {
+            int index = Map_OfLongsByInteger_indexForKey(&k, ordered);
+            int uIndex = Map_UnorderedLongsByInteger_indexForKey(&k, unordered);
+            if (!expected[k]) {
+                Assert_true(index == -1 && uIndex == -1);
+                continue;
+            }
+            count++;
+            Assert_true(index > -1 && ordered->values[index] == expected[k]);
+            Assert_true(uIndex > -1 && unordered->values[uIndex] == expected[k]);
+            Assert_true(Map_OfLongsByInteger_indexForHandle(ordered->handles[index], ordered)
+                == index);
+        }
+        Assert_true(count == ordered->count && count == unordered->count);
+
+        // Handles must stay sorted because iteration order depends on it.
+        for (uint32_t j = 1; j < ordered->count; j++) {
+            Assert_true(ordered->handles[j - 1] < ordered->handles[j]);
+        }
+    }
+
+    Allocator_free(alloc);
+    return 0;
+}
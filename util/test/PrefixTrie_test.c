@@ -0,0 +1,192 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/PrefixTrie.h"
+
+#define SLOTS 256
+#define OPERATIONS 20000
+#define MAX_COVER 16384
+
+struct Entry
+{
+    uint8_t addr[16];
+    uint32_t prefixLen;
+    uint32_t value;
+    bool present;
+};
+
+static bool matches(uint8_t* addr, uint8_t* prefix, uint32_t prefixLen)
+{
+    for (uint32_t i = 0; i < prefixLen; i++) {
+        if ((addr[i / 8] ^ prefix[i / 8]) & (0x80 >> (i % 8))) { return false; }
+    }
+    return true;
+}
+
+/** Addresses near a few bases so that prefixes nest and share long runs of bits. */
+static void randomAddr(uint8_t* out, uint32_t bytes, struct Random* rand)
+{
+    Bits_memset(out, 0, 16);
+    out[0] = 0x10 * (Random_uint8(rand) % 4);
+    uint32_t noise = Random_uint8(rand) % (bytes * 8);
+    for (uint32_t i = 0; i < noise; i++) {
+        uint32_t bit = Random_uint8(rand) % (bytes * 8);
+        if (Random_uint8(rand) % 4) { bit = bytes * 8 - 1 - bit / 8; }
+        out[bit / 8] ^= 0x80 >> (bit % 8);
+    }
+}
+
+/** Every value is unique, a third of them are the holes in the cover. */
+static uint32_t coverValue(uint32_t value)
+{
+    return (value % 3) ? value : 0;
+}
+
+/** The longest present entry which contains addr, found by a linear scan. */
+static struct Entry* longest(struct Entry* entries, uint8_t* addr)
+{
+    struct Entry* best = NULL;
+    for (int j = 0; j < SLOTS; j++) {
+        struct Entry* x = &entries[j];
+        if (x->present && matches(addr, x->addr, x->prefixLen)
+            && (!best || x->prefixLen > best->prefixLen))
+        {
+            best = x;
+        }
+    }
+    return best;
+}
+
+struct Cover
+{
+    struct Entry prefixes[MAX_COVER];
+    int count;
+};
+
+static void addToCover(uint8_t* addr, uint32_t prefixLen, void* vCover)
+{
+    struct Cover* c = vCover;
+    Assert_true(c->count < MAX_COVER);
+    Bits_memcpy(c->prefixes[c->count].addr, addr, 16);
+    c->prefixes[c->count++].prefixLen = prefixLen;
+}
+
+/**
+ * The cover must hold exactly the addresses whose longest entry is not a hole
+ * and no two of its prefixes may overlap or be mergeable.
+ * coverTrie holds the same prefixes as the entries with the values from coverValue().
+ */
+static void checkCover(struct PrefixTrie* coverTrie,
+                       struct Entry* entries,
+                       uint32_t bytes,
+                       struct Random* rand,
+                       struct Allocator* alloc)
+{
+    struct Allocator* coverAlloc = Allocator_child(alloc);
+    struct Cover* c = Allocator_calloc(coverAlloc, sizeof(struct Cover), 1);
+    PrefixTrie_cover(coverTrie, addToCover, c);
+    for (int i = 0; i < c->count; i++) {
+        struct Entry* a = &c->prefixes[i];
+        for (int j = i + 1; j < c->count; j++) {
+            struct Entry* b = &c->prefixes[j];
+            uint32_t shorter = (a->prefixLen < b->prefixLen) ? a->prefixLen : b->prefixLen;
+            Assert_true(!matches(a->addr, b->addr, shorter));
+            Assert_true(a->prefixLen != b->prefixLen || !a->prefixLen
+                || !matches(a->addr, b->addr, a->prefixLen - 1));
+        }
+    }
+    for (int i = 0; i < 200; i++) {
+        uint8_t addr[16];
+        randomAddr(addr, bytes, rand);
+        struct Entry* best = longest(entries, addr);
+        bool included = best && coverValue(best->value);
+        bool covered = false;
+        for (int j = 0; j < c->count; j++) {
+            covered |= matches(addr, c->prefixes[j].addr, c->prefixes[j].prefixLen);
+        }
+        Assert_true(included == covered);
+    }
+    Allocator_free(coverAlloc);
+}
+
+/**
+ * Apply random puts and removes and check exact gets and longest prefix lookups against
+ * a linear scan of the expected entries.
+ */
+static void testTrie(uint32_t addrBits, struct Random* rand, struct Allocator* alloc)
+{
+    struct PrefixTrie* trie = PrefixTrie_new(addrBits, alloc);
+    struct PrefixTrie* coverTrie = PrefixTrie_new(addrBits, alloc);
+    struct Entry* entries = Allocator_calloc(alloc, sizeof(struct Entry), SLOTS);
+    uint32_t bytes = addrBits / 8;
+
+    for (uint32_t i = 0; i < OPERATIONS; i++) {
+        struct Entry* e = &entries[Random_uint32(rand) % SLOTS];
+        if (e->present && Random_uint8(rand) & 1) {
+            Assert_true(PrefixTrie_remove(trie, e->addr, e->prefixLen));
+            Assert_true(!PrefixTrie_remove(trie, e->addr, e->prefixLen));
+            Assert_true(PrefixTrie_remove(coverTrie, e->addr, e->prefixLen));
+            e->present = false;
+        } else if (!e->present) {
+            uint8_t addr[16];
+            randomAddr(addr, bytes, rand);
+            uint32_t prefixLen = Random_uint32(rand) % (addrBits + 1);
+            // Another entry may have the same prefix, that one is replaced.
+            for (int j = 0; j < SLOTS; j++) {
+                if (entries[j].present && entries[j].prefixLen == prefixLen
+                    && matches(addr, entries[j].addr, prefixLen))
+                {
+                    entries[j].present = false;
+                }
+            }
+            Bits_memcpy(e->addr, addr, 16);
+            e->prefixLen = prefixLen;
+            e->value = i;
+            e->present = true;
+            PrefixTrie_put(trie, addr, prefixLen, i);
+            PrefixTrie_put(coverTrie, addr, prefixLen, coverValue(i));
+        }
+
+        uint8_t addr[16];
+        randomAddr(addr, bytes, rand);
+        struct Entry* best = longest(entries, addr);
+        uint32_t value = UINT32_MAX;
+        Assert_true(PrefixTrie_lookup(trie, addr, &value) == (best != NULL));
+        Assert_true(!best || value == best->value);
+        Assert_true(PrefixTrie_lookup(coverTrie, addr, &value) == (best != NULL));
+        Assert_true(!best || value == coverValue(best->value));
+
+        if (i % 100) { continue; }
+        if (!(i % 1000)) { checkCover(coverTrie, entries, bytes, rand, alloc); }
+        for (int j = 0; j < SLOTS; j++) {
+            if (!entries[j].present) { continue; }
+            Assert_true(PrefixTrie_get(trie, entries[j].addr, entries[j].prefixLen, &value));
+            Assert_true(value == entries[j].value);
+        }
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    testTrie(32, rand, alloc);
+    testTrie(128, rand, alloc);
+    Allocator_free(alloc);
+    return 0;
+}
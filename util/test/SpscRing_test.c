@@ -0,0 +1,68 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/SpscRing.h"
+#include "util/Assert.h"
+
+#include <sched.h>
+
+#define RECORDS 100000
+
+static uint32_t lengthOf(uint32_t i)
+{
+    // Odd sizes so records land at every offset and wrap around the end.
+    return 4 + (i * 7) % 61;
+}
+
+static void producer(void* vring)
+{
+    struct SpscRing* ring = (struct SpscRing*) vring;
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        uint32_t length = lengthOf(i);
+        uint8_t* rec;
+        while (!(rec = SpscRing_reserve(ring, length))) { sched_yield(); }
+        for (uint32_t j = 0; j < length; j++) { rec[j] = (uint8_t) (i + j); }
+        SpscRing_commit(ring, i);
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct SpscRing* ring = SpscRing_new(1024, alloc);
+
+    Assert_true(!SpscRing_peek(ring, &(uint32_t){0}, &(uint32_t){0}));
+    Assert_true(!SpscRing_reserve(ring, 1024));
+
+    uv_thread_t thread;
+    Assert_true(!uv_thread_create(&thread, producer, ring));
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        uint32_t length;
+        uint32_t tag;
+        uint8_t* rec;
+        while (!(rec = SpscRing_peek(ring, &length, &tag))) { sched_yield(); }
+        Assert_true(tag == i);
+        Assert_true(length == lengthOf(i));
+        for (uint32_t j = 0; j < length; j++) { Assert_true(rec[j] == (uint8_t) (i + j)); }
+        SpscRing_pop(ring);
+    }
+    uv_thread_join(&thread);
+    Assert_true(!SpscRing_peek(ring, &(uint32_t){0}, &(uint32_t){0}));
+
+    Allocator_free(alloc);
+    return 0;
+}
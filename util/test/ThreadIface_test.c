@@ -0,0 +1,139 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "interface/Iface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/ThreadIface.h"
+#include "util/events/Timeout.h"
+#include "util/log/Log_impl.h"
+#include "util/Assert.h"
+#include "util/CString.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+#define MESSAGES 1000
+
+/** Lives on the thread, sends each message back with one more byte on the front. */
+struct Echo
+{
+    struct Iface iface;
+    struct Log* log;
+    Identity
+};
+
+static Iface_DEFUN echo(struct Message* msg, struct Iface* iface)
+{
+    struct Echo* e = Identity_check((struct Echo*) iface);
+    uint32_t num = Message_pop32(msg, NULL);
+    if (num == MESSAGES - 1) {
+        Log_print(e->log, Log_Level_INFO, "file.c", 42, "last message [%u]", num);
+    }
+    Message_push32(msg, num, NULL);
+    Message_push8(msg, 0xee, NULL);
+    return Iface_next(&e->iface, msg);
+}
+
+static void start(struct Iface* iface,
+                  struct Allocator* alloc,
+                  struct EventBase* base,
+                  struct Log* log,
+                  struct Random* rand,
+                  void* userData)
+{
+    Assert_true(!CString_strcmp(userData, "hello"));
+    struct Echo* e = Allocator_calloc(alloc, sizeof(struct Echo), 1);
+    Identity_set(e);
+    e->log = log;
+    e->iface.send = echo;
+    Iface_plumb(iface, &e->iface);
+}
+
+struct Context
+{
+    struct Iface iface;
+    struct Log log;
+    struct Allocator* threadAlloc;
+    struct Timeout* failsafe;
+    uint32_t received;
+    int logLines;
+    Identity
+};
+
+static void printLog(struct Log* log,
+                     enum Log_Level level,
+                     const char* file,
+                     int line,
+                     const char* format,
+                     va_list args)
+{
+    struct Context* ctx = Identity_containerOf(log, struct Context, log);
+    // Setting up the thread may log too.
+    if (CString_strcmp(file, "file.c")) { return; }
+    Assert_true(level == Log_Level_INFO && line == 42);
+    Assert_true(!CString_strcmp(va_arg(args, char*), "last message [999]"));
+    ctx->logLines++;
+}
+
+static Iface_DEFUN receive(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_check((struct Context*) iface);
+    Assert_true(Message_pop8(msg, NULL) == 0xee);
+    Assert_true(Message_pop32(msg, NULL) == ctx->received);
+    Assert_true(msg->length == 0);
+    if (++ctx->received == MESSAGES) {
+        Timeout_clearTimeout(ctx->failsafe);
+        // Joins the thread, the loop then ends because nothing is left.
+        Allocator_free(ctx->threadAlloc);
+    }
+    return NULL;
+}
+
+static void failsafe(void* vctx)
+{
+    Assert_failure("replies did not come back");
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->log.print = printLog;
+    ctx->iface.send = receive;
+    ctx->threadAlloc = Allocator_child(alloc);
+
+    struct ThreadIface* ti =
+        ThreadIface_new(start, "hello", 1<<20, base, &ctx->log, ctx->threadAlloc);
+    Iface_plumb(&ctx->iface, &ti->iface);
+    Assert_true(ThreadIface_running() == 1);
+
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        struct Allocator* msgAlloc = Allocator_child(alloc);
+        struct Message* msg = Message_new(0, 512, msgAlloc);
+        Message_push32(msg, i, NULL);
+        Iface_send(&ctx->iface, msg);
+        Allocator_free(msgAlloc);
+    }
+    ctx->failsafe = Timeout_setTimeout(failsafe, ctx, 10000, base, alloc);
+    EventBase_beginLoop(base);
+
+    Assert_true(ctx->received == MESSAGES);
+    Assert_true(ctx->logLines == 1);
+    Assert_true(!ThreadIface_running());
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+
+struct Context
+{
+    struct Timeout* interval;
+    struct Timeout* far;
+    int intervalCount;
+    char order[16];
+    int count;
+    Identity
+};
+
+#define RECORDER(name, letter) \
+    static void name(void* vctx)                                        \
+    {                                                                   \
+        struct Context* ctx = Identity_check((struct Context*) vctx);  \
+        Assert_true(ctx->count < 15);                                   \
+        ctx->order[ctx->count++] = (letter);                            \
+    }
+RECORDER(recordA, 'a')
+RECORDER(recordB, 'b')
+RECORDER(recordC, 'c')
+RECORDER(recordE, 'e')
+
+static void recordD(void* vctx)
+{
+    struct Context* ctx = Identity_check((struct Context*) vctx);
+    ctx->order[ctx->count++] = 'd';
+    // The last one pending, clearing it lets the loop end.
+    Timeout_clearTimeout(ctx->far);
+}
+
+static void onInterval(void* vctx)
+{
+    struct Context* ctx = Identity_check((struct Context*) vctx);
+    ctx->order[ctx->count++] = 'i';
+    if (++ctx->intervalCount == 3) {
+        Timeout_clearTimeout(ctx->interval);
+    }
+}
+
+static void neverCalled(void* vctx)
+{
+    Assert_failure("cleared timeout fired");
+}
+
+/** Enough to absorb a slow machine, far less than the 4096ms of a level 1 rotation. */
+#define MAX_LATE_MS 250
+
+struct Late
+{
+    uint64_t dueMs;
+    int* remaining;
+    struct EventBase* base;
+    Identity
+};
+
+static uint64_t nowMs(void)
+{
+    return Time_hrtime() / 1000000;
+}
+
+static void onLate(void* vlate)
+{
+    struct Late* late = Identity_check((struct Late*) vlate);
+    uint64_t now = nowMs();
+    Assert_true(now <= late->dueMs + MAX_LATE_MS);
+    if (!--(*late->remaining)) {
+        EventBase_endLoop(late->base);
+    }
+}
+
+/**
+ * Every offset within a level 1 slot, including the last millisecond before the next one,
+ * which must be cascaded down rather than put back in the slot which is being emptied.
+ */
+static void lateness(struct Allocator* alloc)
+{
+    struct EventBase* base = EventBase_new(alloc);
+    int remaining = 0;
+    uint64_t start = nowMs();
+    for (uint64_t ms = 60; ms <= 400; ms++) {
+        struct Late* late = Allocator_calloc(alloc, sizeof(struct Late), 1);
+        Identity_set(late);
+        late->dueMs = start + ms;
+        late->remaining = &remaining;
+        late->base = base;
+        Timeout_setTimeout(onLate, late, ms, base, alloc);
+        remaining++;
+    }
+    EventBase_beginLoop(base);
+    Assert_true(!remaining);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Allocator* tAlloc = Allocator_child(alloc);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+
+    Timeout_setTimeout(recordA, ctx, 0, base, tAlloc);
+    Timeout_setTimeout(recordB, ctx, 3, base, tAlloc);
+    Timeout_setTimeout(recordC, ctx, 10, base, tAlloc);
+    struct Timeout* e = Timeout_setTimeout(recordE, ctx, 100000, base, tAlloc);
+    Timeout_resetTimeout(e, 100);
+    // Past the end of the first level so it has to be cascaded down.
+    Timeout_setTimeout(recordD, ctx, 300, base, tAlloc);
+    ctx->interval = Timeout_setInterval(onInterval, ctx, 7, base, tAlloc);
+    ctx->far = Timeout_setTimeout(neverCalled, ctx, 70000, base, tAlloc);
+
+    Timeout_clearTimeout(Timeout_setTimeout(neverCalled, ctx, 5, base, tAlloc));
+    Timeout_clearTimeout(Timeout_setTimeout(neverCalled, ctx, 1ull << 40, base, tAlloc));
+    struct Allocator* freed = Allocator_child(alloc);
+    Timeout_setTimeout(neverCalled, ctx, 2, base, freed);
+    Allocator_free(freed);
+
+    Assert_true(EventBase_eventCount(base) == 9);
+    EventBase_beginLoop(base);
+
+    Assert_true(!Bits_memcmp(ctx->order, "abiciied", 9));
+    Allocator_free(tAlloc);
+    Assert_true(EventBase_eventCount(base) == 0);
+
+    lateness(Allocator_child(alloc));
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/log/FileWriterLog.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+#define MESSAGE_COUNT 100
+#define BATCH_SIZE 8
+
+struct Context
+{
+    struct Iface sender;
+    struct Iface receiver;
+    struct UDPAddrIface* a;
+    struct UDPAddrIface* b;
+    struct Allocator* alloc;
+    uint32_t received;
+    Identity
+};
+
+static Iface_DEFUN receiveMessage(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, receiver);
+    struct Sockaddr_storage ss;
+    Message_pop(msg, &ss, ctx->b->generic.addr->addrLen, NULL);
+    Assert_true(Sockaddr_getPort(&ss.addr) == Sockaddr_getPort(ctx->a->generic.addr));
+
+    uint32_t num;
+    Message_pop(msg, &num, 4, NULL);
+    Assert_true(!msg->length);
+
+    // Loopback does not reorder so they should arrive in the order sent.
+    Assert_true(num == ctx->received);
+    if (++ctx->received == MESSAGE_COUNT) {
+        Allocator_free(ctx->alloc);
+    }
+    return NULL;
+}
+
+static Iface_DEFUN unexpected(struct Message* msg, struct Iface* iface)
+{
+    Assert_failure("Message sent to the wrong interface");
+    return NULL;
+}
+
+static void fail(void* vNULL)
+{
+    Assert_failure("timed out.");
+}
+
+static struct UDPAddrIface* newIface(struct Context* ctx, struct EventBase* base, struct Log* log)
+{
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    return UDPAddrIface_new(base, &ss.addr, ctx->alloc, NULL, log);
+}
+
+int main()
+{
+    struct Allocator* mainAlloc = MallocAllocator_new(1<<23);
+    struct EventBase* base = EventBase_new(mainAlloc);
+    struct Log* log = FileWriterLog_new(stdout, mainAlloc);
+
+    struct Context* ctx = Allocator_calloc(mainAlloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->alloc = Allocator_child(mainAlloc);
+    ctx->a = newIface(ctx, base, log);
+    ctx->b = newIface(ctx, base, log);
+
+    if (UDPAddrIface_setBatchSize(ctx->a, BATCH_SIZE)) {
+        // Batching is not supported on this platform.
+        Allocator_free(mainAlloc);
+        return 0;
+    }
+    Assert_true(!UDPAddrIface_setBatchSize(ctx->b, BATCH_SIZE));
+    Assert_true(UDPAddrIface_setBatchSize(ctx->b, BATCH_SIZE));
+
+    // Zero is refused and an oversize batch is cut down rather than overflowing its buffers.
+    struct UDPAddrIface* c = newIface(ctx, base, log);
+    Assert_true(UDPAddrIface_setBatchSize(c, 0));
+    Assert_true(!UDPAddrIface_setBatchSize(c, UINT32_MAX));
+
+    ctx->sender.send = unexpected;
+    ctx->receiver.send = receiveMessage;
+    Iface_plumb(&ctx->sender, &ctx->a->generic.iface);
+    Iface_plumb(&ctx->receiver, &ctx->b->generic.iface);
+
+    // More than one batch worth so that both the full batch and end of turn flush are used.
+    for (uint32_t i = 0; i < MESSAGE_COUNT; i++) {
+        struct Allocator* msgAlloc = Allocator_child(mainAlloc);
+        struct Message* msg = Message_new(0, 512, msgAlloc);
+        Message_push(msg, &i, 4, NULL);
+        Message_push(msg, ctx->b->generic.addr, ctx->b->generic.addr->addrLen, NULL);
+        Iface_send(&ctx->sender, msg);
+        Allocator_free(msgAlloc);
+    }
+
+    Timeout_setTimeout(fail, NULL, 2000, base, ctx->alloc);
+    EventBase_beginLoop(base);
+
+    Assert_true(ctx->received == MESSAGE_COUNT);
+    Allocator_free(mainAlloc);
+    return 0;
+}
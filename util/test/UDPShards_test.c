@@ -0,0 +1,145 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "exception/Jmp.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/events/UDPAddrIface.h"
+#include "util/events/UDPShards.h"
+#include "util/log/FileWriterLog.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+#define CLIENTS 4
+#define MESSAGE_COUNT 25
+#define SHARDS 3
+#define BATCH_SIZE 8
+
+struct Client
+{
+    struct Iface iface;
+    struct UDPAddrIface* udp;
+    struct Context* ctx;
+    uint32_t received;
+    Identity
+};
+
+struct Context
+{
+    struct Iface shardsIf;
+    struct UDPShards* shards;
+    struct Client clients[CLIENTS];
+    struct Allocator* alloc;
+    uint32_t echoed;
+    uint32_t received;
+    Identity
+};
+
+/** Everything which comes out of the shards is sent back where it came from. */
+static Iface_DEFUN echo(struct Message* msg, struct Iface* iface)
+{
+    struct Context* ctx = Identity_containerOf(iface, struct Context, shardsIf);
+    Assert_true(msg->length == ctx->shards->generic.addr->addrLen + 4);
+    ctx->echoed++;
+    return Iface_next(&ctx->shardsIf, msg);
+}
+
+static Iface_DEFUN clientReceive(struct Message* msg, struct Iface* iface)
+{
+    struct Client* cl = Identity_check((struct Client*) iface);
+    struct Context* ctx = cl->ctx;
+    struct Sockaddr_storage ss;
+    Message_pop(msg, &ss, cl->udp->generic.addr->addrLen, NULL);
+    Assert_true(Sockaddr_getPort(&ss.addr) == Sockaddr_getPort(ctx->shards->generic.addr));
+
+    uint32_t num;
+    Message_pop(msg, &num, 4, NULL);
+    Assert_true(!msg->length);
+
+    // Each client is handled by one shard in each direction so order is kept.
+    Assert_true(num == cl->received);
+    cl->received++;
+    if (++ctx->received == CLIENTS * MESSAGE_COUNT) {
+        // Stops and joins the shard threads.
+        Allocator_free(ctx->alloc);
+    }
+    return NULL;
+}
+
+static void fail(void* vctx)
+{
+    struct Context* ctx = vctx;
+    Assert_failure("timed out. echoed %u received %u", ctx->echoed, ctx->received);
+}
+
+int main()
+{
+    struct Allocator* mainAlloc = MallocAllocator_new(1<<23);
+    struct EventBase* base = EventBase_new(mainAlloc);
+    struct Log* log = FileWriterLog_new(stdout, mainAlloc);
+
+    struct Context* ctx = Allocator_calloc(mainAlloc, sizeof(struct Context), 1);
+    Identity_set(ctx);
+    ctx->alloc = Allocator_child(mainAlloc);
+
+    struct Sockaddr_storage ss;
+    Assert_true(!Sockaddr_parse("127.0.0.1", &ss));
+    struct Jmp jmp;
+    Jmp_try(jmp) {
+        ctx->shards =
+            UDPShards_new(base, &ss.addr, SHARDS, BATCH_SIZE, 0, ctx->alloc, &jmp.handler, log);
+    } Jmp_catch {
+        // SO_REUSEPORT is Linux only.
+        #ifdef linux
+            Assert_failure("UDPShards_new() failed [%s]", jmp.message);
+        #endif
+        Allocator_free(mainAlloc);
+        return 0;
+    }
+    Assert_true(ctx->shards->count == SHARDS);
+    Assert_true(Sockaddr_getPort(ctx->shards->generic.addr));
+    ctx->shardsIf.send = echo;
+    Iface_plumb(&ctx->shardsIf, &ctx->shards->generic.iface);
+
+    for (int c = 0; c < CLIENTS; c++) {
+        struct Client* cl = &ctx->clients[c];
+        Identity_set(cl);
+        cl->ctx = ctx;
+        cl->udp = UDPAddrIface_new(base, &ss.addr, ctx->alloc, NULL, log);
+        cl->iface.send = clientReceive;
+        Iface_plumb(&cl->iface, &cl->udp->generic.iface);
+    }
+
+    for (uint32_t i = 0; i < MESSAGE_COUNT; i++) {
+        for (int c = 0; c < CLIENTS; c++) {
+            struct Allocator* msgAlloc = Allocator_child(mainAlloc);
+            struct Message* msg = Message_new(0, 512, msgAlloc);
+            Message_push(msg, &i, 4, NULL);
+            Message_push(msg, ctx->shards->generic.addr, ctx->shards->generic.addr->addrLen, NULL);
+            Iface_send(&ctx->clients[c].iface, msg);
+            Allocator_free(msgAlloc);
+        }
+    }
+
+    Timeout_setTimeout(fail, ctx, 5000, base, ctx->alloc);
+    EventBase_beginLoop(base);
+
+    Assert_true(ctx->echoed == CLIENTS * MESSAGE_COUNT);
+    Allocator_free(mainAlloc);
+    return 0;
+}
@@ -109,6 +109,31 @@ struct Headers_UDPHeader {
 #define Headers_UDPHeader_SIZE 8
 Assert_compileTime(sizeof(struct Headers_UDPHeader) == Headers_UDPHeader_SIZE);
 
+struct Headers_TCPHeader {
+    uint16_t srcPort_be;
+    uint16_t destPort_be;
+    uint32_t seq_be;
+    uint32_t ack_be;
+
+    /** Length of the header including options in 32 bit words, in the high 4 bits. */
+    uint8_t dataOffset;
+
+    uint8_t flags;
+    uint16_t window_be;
+    uint16_t checksum_be;
+    uint16_t urgentPointer_be;
+};
+#define Headers_TCPHeader_SIZE 20
+Assert_compileTime(sizeof(struct Headers_TCPHeader) == Headers_TCPHeader_SIZE);
+#define Headers_TCPHeader_FIN 0x01
+#define Headers_TCPHeader_SYN 0x02
+#define Headers_TCPHeader_RST 0x04
+#define Headers_TCPHeader_PSH 0x08
+#define Headers_TCPHeader_ACK 0x10
+#define Headers_TCPHeader_URG 0x20
+#define Headers_TCPHeader_ECE 0x40
+#define Headers_TCPHeader_CWR 0x80
+
 struct Headers_ICMP6Header {
     uint8_t type;
     uint8_t code;
@@ -55,6 +55,11 @@ struct Message
         .capacity = messageLength                              \
     }
 
+/**
+ * Allocate a new message.
+ * On a hot path, use an allocator from MessagePool_child() so the memory is recycled
+ * instead of malloc()'d, see memory/MessagePool.h.
+ */
 static inline struct Message* Message_new(uint32_t messageLength,
                                           uint32_t amountOfPadding,
                                           struct Allocator* alloc)